@@ -201,6 +201,7 @@ static void setup_page_tables()
 }
 
 static u64 working_saved_base;
+static u64 stage2_start_tsc;
 
 closure_function(0, 4, u64, kernel_elf_map,
                  u64, vaddr, u64, paddr, u64, size, pageflags, flags)
@@ -240,6 +241,9 @@ closure_function(0, 1, status, kernel_read_complete,
 
     /* reset initial pages length */
     initial_pages_region->length = INITIAL_PAGES_SIZE;
+
+    /* stage2 start and duration, for the boot timeline */
+    create_region(stage2_start_tsc, stage2_rdtsc() - stage2_start_tsc, REGION_BOOT_TSC);
     stage2_debug("%s: run64, start address 0xffffffff%08lx\n", __func__, u64_from_pointer(k));
     run64(u64_from_pointer(k));
     halt("failed to start long mode\n");
@@ -322,6 +326,7 @@ static u64 stage2_allocator(heap h, bytes b)
 
 void centry()
 {
+    stage2_start_tsc = stage2_rdtsc();
     working_heap.alloc = stage2_allocator;
     working_heap.dealloc = leak;
     working_p = u64_from_pointer(early_working);
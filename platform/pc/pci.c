@@ -168,7 +168,7 @@ u64 pci_platform_allocate_msi(pci_dev dev, thunk h, const char *name, u32 *addre
     if (v == INVALID_PHYSICAL)
         return v;
     register_interrupt(v, h, name);
-    msi_format(address, data, v);
+    msi_format(address, data, v, 0);
     return v;
 }
 
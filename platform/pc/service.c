@@ -7,6 +7,7 @@
 #include <apic.h>
 #include <aws/aws.h>
 #include <drivers/acpi.h>
+#include <drivers/ahci.h>
 #include <drivers/ata-pci.h>
 #include <drivers/dmi.h>
 #include <drivers/nvme.h>
@@ -220,6 +221,14 @@ static void count_processors()
     present_processors = MIN(present_processors, MAX_CPUS);
 }
 
+/* APs are brought up in two steps, so that the 10ms delay between INIT and SIPI (and the time
+   taken by the APs to come online) overlaps with device probing rather than stalling the boot
+   once per AP. */
+#define AP_INIT_DELAY_MS        10
+#define AP_START_TIMEOUT_MS     200
+
+static timestamp ap_init_time;
+
 void start_secondary_cores(kernel_heaps kh)
 {
     memory_barrier();
@@ -229,7 +238,22 @@ void start_secondary_cores(kernel_heaps kh)
     init_debug("starting APs");
     allocate_apboot(heap_backed(kh), new_cpu);
     for (int i = 1; i < present_processors; i++)
-        start_cpu(i);
+        ap_send_init(i);
+    ap_init_time = now(CLOCK_ID_MONOTONIC_RAW);
+}
+
+void finish_secondary_cores(kernel_heaps kh)
+{
+    timestamp elapsed = now(CLOCK_ID_MONOTONIC_RAW) - ap_init_time;
+    if (elapsed < milliseconds(AP_INIT_DELAY_MS))
+        kernel_delay(milliseconds(AP_INIT_DELAY_MS) - elapsed);
+    for (int i = 1; i < present_processors; i++)
+        ap_send_startup(i);
+    kernel_delay(microseconds(200));
+    for (int i = 1; i < present_processors; i++)
+        ap_send_startup(i);
+    for (u64 to = 0; total_processors != present_processors && to < AP_START_TIMEOUT_MS; to++)
+        kernel_delay(milliseconds(1));
     deallocate_apboot(heap_backed(kh));
     init_flush(heap_locked(kh));
     init_debug("started %d total processors", total_processors);
@@ -238,6 +262,10 @@ void start_secondary_cores(kernel_heaps kh)
 void start_secondary_cores(kernel_heaps kh)
 {
 }
+
+void finish_secondary_cores(kernel_heaps kh)
+{
+}
 #endif
 
 u64 xsave_features();
@@ -252,9 +280,12 @@ static void __attribute__((noinline)) init_service_new_stack()
     for_regions(e) {
         if (e->type == REGION_SMBIOS) {
             smbios_entry_point = e->base;
-            break;
+        } else if (e->type == REGION_BOOT_TSC) {
+            boot_timeline_mark_at("stage2", e->base);
+            boot_timeline_mark_at("kernel_entry", e->base + e->length);
         }
     }
+    boot_timeline_mark("kernel_init");
 
     init_management(allocate_tagged_region(kh, tag_function_tuple), heap_general(kh));
     init_debug("init_hwrand");
@@ -533,6 +564,7 @@ void detect_devices(kernel_heaps kh, storage_attach sa)
         init_virtio_scsi(kh, sa);
         init_pvscsi(kh, sa);
         init_nvme(kh, sa);
+        init_ahci(kh, sa);
         init_ata_pci(kh, sa);
     }
 
@@ -185,6 +185,10 @@ void start_secondary_cores(kernel_heaps kh)
 {
 }
 
+void finish_secondary_cores(kernel_heaps kh)
+{
+}
+
 static void init_kernel_heaps(void)
 {
     static struct heap bootstrap;
@@ -216,6 +220,7 @@ static void init_kernel_heaps(void)
 static void __attribute__((noinline)) init_service_new_stack(void)
 {
     init_debug("in init_service_new_stack\n");
+    boot_timeline_mark("kernel_init");
     kernel_heaps kh = get_kernel_heaps();
     page_heap_init(heap_locked(kh), heap_physical(kh));
     init_tuples(allocate_tagged_region(kh, tag_table_tuple));
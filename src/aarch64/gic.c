@@ -138,7 +138,8 @@ void gic_eoi(int irq)
     gicc_write(EOIR1, irq);
 }
 
-void msi_format(u32 *address, u32 *data, int vector)
+/* GICv2m MSIs are SPIs, which are all routed to the boot cpu: the target cpu is ignored. */
+void msi_format(u32 *address, u32 *data, int vector, u32 target_cpu)
 {
     *address = DEV_BASE_GIC_V2M + GIC_V2M_MSI_SETSPI_NS;
     *data = vector;
@@ -283,6 +283,7 @@ void irq_handler(void)
 
         if (list_empty(&handlers[i]))
             halt("no handler for interrupt %d\n", i);
+        ci->irq_counts[i]++;
 
         list_foreach(&handlers[i], l) {
             inthandler h = struct_from_list(l, inthandler, l);
@@ -392,6 +393,7 @@ void init_interrupts(kernel_heaps kh)
     assert(handlers != INVALID_ADDRESS);
     for (int i = 0; i < GIC_MAX_INT; i++)
         list_init(&handlers[i]);
+    init_irq_affinity(int_general, GIC_MAX_INT);
 
     /* set exception vector table base */
     register u64 v = u64_from_pointer(&exception_vectors);
@@ -163,6 +163,14 @@ static inline __attribute__((always_inline)) void memory_barrier(void)
     asm volatile("dmb sy" ::: "memory");
 }
 
+/* zero memory with non-temporal stores, bypassing the cache; x and length are 16-byte aligned */
+static inline void zero_nontemporal(void *x, bytes length)
+{
+    for (u64 *p = x; p < (u64 *)(x + length); p += 2)
+        asm volatile("stnp xzr, xzr, [%0]" :: "r"(p) : "memory");
+    write_barrier();
+}
+
 /* XXX something b0rked with ldset here...ordering, or asm constraints? */
 static inline __attribute__((always_inline)) int atomic_test_and_set_bit(u64 *target, u64 bit)
 {
@@ -140,10 +140,10 @@ void register_other_syscalls(struct syscall *map)
     register_syscall(map, fchown, syscall_ignore);
     register_syscall(map, ptrace, 0);
     register_syscall(map, syslog, 0);
-    register_syscall(map, getgid, syscall_ignore);
-    register_syscall(map, getegid, syscall_ignore);
+    register_syscall_nolock(map, getgid, syscall_ignore);
+    register_syscall_nolock(map, getegid, syscall_ignore);
     register_syscall(map, setpgid, 0);
-    register_syscall(map, getppid, 0);
+    register_syscall_nolock(map, getppid, syscall_ignore);
     register_syscall(map, setsid, 0);
     register_syscall(map, setreuid, 0);
     register_syscall(map, setregid, 0);
@@ -232,7 +232,6 @@ void register_other_syscalls(struct syscall *map)
     register_syscall(map, unshare, 0);
     register_syscall(map, splice, 0);
     register_syscall(map, tee, 0);
-    register_syscall(map, sync_file_range, 0);
     register_syscall(map, vmsplice, 0);
     register_syscall(map, move_pages, 0);
     register_syscall(map, utimensat, 0);
@@ -240,7 +239,6 @@ void register_other_syscalls(struct syscall *map)
     register_syscall(map, preadv, 0);
     register_syscall(map, pwritev, 0);
     register_syscall(map, perf_event_open, 0);
-    register_syscall(map, recvmmsg, 0);
     register_syscall(map, fanotify_init, 0);
     register_syscall(map, fanotify_mark, 0);
     register_syscall(map, name_to_handle_at, 0);
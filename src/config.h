@@ -27,6 +27,9 @@
 /* length of thread scheduling queue */
 #define MAX_THREADS 8192
 
+/* length of each per-cpu bhqueue and runqueue */
+#define SCHED_QUEUE_SIZE 2048
+
 /* could probably find progammatically via cpuid... */
 #define DEFAULT_CACHELINE_SIZE 64
 
@@ -39,6 +42,14 @@
 /* Log compaction is not triggered if the ratio between total entries and
  * obsolete entries is above the constant below. */
 #define TFS_LOG_COMPACT_RATIO   2
+/* Upper bound for the size of a log extension; extensions larger than the
+ * default are used to hold a checkpoint (or any large batch of staged
+ * metadata) so that it can be read back with few I/O requests. */
+#define TFS_LOG_MAX_EXTENSION_SIZE (8*MB)
+/* A checkpoint is triggered when the log has grown to at least this number of
+ * extensions, and at least twice the number of extensions it had right after
+ * the previous checkpoint. */
+#define TFS_LOG_CHECKPOINT_EXTENSIONS   64
 
 /* Xen stuff */
 #define XENNET_INIT_RX_BUFFERS_FACTOR 4
@@ -49,6 +60,10 @@
 #define PAGECACHE_DRAIN_CUTOFF (64 * MB)
 #define PAGECACHE_SCAN_PERIOD_SECONDS 5
 
+/* per-cpu pool of pre-zeroed pages, refilled by idle cpus a batch at a time */
+#define ZERO_PAGE_POOL_SIZE     64
+#define ZERO_PAGE_POOL_BATCH    16
+
 /* don't go below this minimum amount of physical memory when inflating balloon */
 #define BALLOON_MEMORY_MINIMUM (16 * MB)
 
@@ -0,0 +1,742 @@
+#include <kernel.h>
+#include <pci.h>
+#include <storage.h>
+
+#include "ata.h"
+#include "ahci.h"
+
+#define AHCI_ABAR   5   /* AHCI base memory register */
+
+/* Generic host control registers */
+#define AHCI_CAP    0x00
+#define AHCI_CAP_NCS(cap)   ((((cap) >> 8) & 0x1F) + 1)  /* number of command slots */
+#define AHCI_CAP_SNCQ       U32_FROM_BIT(30)
+#define AHCI_CAP_S64A       U32_FROM_BIT(31)
+
+#define AHCI_GHC    0x04
+#define AHCI_GHC_HR     U32_FROM_BIT(0)
+#define AHCI_GHC_IE     U32_FROM_BIT(1)
+#define AHCI_GHC_AE     U32_FROM_BIT(31)
+
+#define AHCI_IS     0x08
+#define AHCI_PI     0x0C
+#define AHCI_VS     0x10
+
+/* Port registers */
+#define AHCI_PORT_REG(port, reg)    (0x100 + (port) * 0x80 + (reg))
+
+#define AHCI_PxCLB  0x00
+#define AHCI_PxCLBU 0x04
+#define AHCI_PxFB   0x08
+#define AHCI_PxFBU  0x0C
+#define AHCI_PxIS   0x10
+#define AHCI_PxIE   0x14
+
+#define AHCI_PxCMD  0x18
+#define AHCI_PxCMD_ST   U32_FROM_BIT(0)
+#define AHCI_PxCMD_SUD  U32_FROM_BIT(1)
+#define AHCI_PxCMD_POD  U32_FROM_BIT(2)
+#define AHCI_PxCMD_FRE  U32_FROM_BIT(4)
+#define AHCI_PxCMD_FR   U32_FROM_BIT(14)
+#define AHCI_PxCMD_CR   U32_FROM_BIT(15)
+
+#define AHCI_PxTFD  0x20
+#define AHCI_PxTFD_ERR  U32_FROM_BIT(0)
+#define AHCI_PxTFD_DRQ  U32_FROM_BIT(3)
+#define AHCI_PxTFD_BSY  U32_FROM_BIT(7)
+
+#define AHCI_PxSIG  0x24
+#define AHCI_SIG_ATA    0x00000101
+
+#define AHCI_PxSSTS 0x28
+#define AHCI_PxSSTS_DET(ssts)   ((ssts) & 0xF)
+#define AHCI_DET_PRESENT        3   /* device present, Phy communication established */
+
+#define AHCI_PxSCTL 0x2C
+#define AHCI_PxSCTL_DET_INIT    1
+
+#define AHCI_PxSERR 0x30
+#define AHCI_PxSACT 0x34
+#define AHCI_PxCI   0x38
+
+/* Port interrupt status and enable bits */
+#define AHCI_PxIS_DHRS  U32_FROM_BIT(0)     /* device to host register FIS */
+#define AHCI_PxIS_PSS   U32_FROM_BIT(1)     /* PIO setup FIS */
+#define AHCI_PxIS_DSS   U32_FROM_BIT(2)     /* DMA setup FIS */
+#define AHCI_PxIS_SDBS  U32_FROM_BIT(3)     /* set device bits FIS */
+#define AHCI_PxIS_IFS   U32_FROM_BIT(27)    /* interface fatal error */
+#define AHCI_PxIS_HBDS  U32_FROM_BIT(28)    /* host bus data error */
+#define AHCI_PxIS_HBFS  U32_FROM_BIT(29)    /* host bus fatal error */
+#define AHCI_PxIS_TFES  U32_FROM_BIT(30)    /* task file error */
+#define AHCI_PxIS_ERR   (AHCI_PxIS_IFS | AHCI_PxIS_HBDS | AHCI_PxIS_HBFS | AHCI_PxIS_TFES)
+
+#define AHCI_MAX_PORTS  32
+#define AHCI_MAX_SLOTS  32
+
+/* Each PRD entry covers at most one page unless consecutive pages are physically contiguous. */
+#define AHCI_PRDT_ENTRIES   64
+#define AHCI_PRD_MAX_BYTES  (4 * MB)
+
+/* Sector count fields are 16 bits wide. */
+#define AHCI_MAX_XFER_SECTORS   0xFFFF
+
+#define AHCI_CMD_LIST_SIZE  1024
+#define AHCI_RFIS_SIZE      256
+
+/* Command header flags */
+#define AHCI_CMD_CFL(fis_len)   ((fis_len) / sizeof(u32))
+#define AHCI_CMD_W              U32_FROM_BIT(6)
+
+#define AHCI_FIS_TYPE_H2D   0x27
+#define AHCI_FIS_H2D_C      0x80    /* command register update */
+
+#define ATA_DEV_LBA 0x40
+
+/* IDENTIFY DEVICE words */
+#define ATA_ID_LBA28_SECTORS    60
+#define ATA_ID_QUEUE_DEPTH      75
+#define ATA_ID_SATA_CAP         76
+#define ATA_ID_SATA_CAP_NCQ     U32_FROM_BIT(8)
+#define ATA_ID_CMD_SET2         83
+#define ATA_ID_CMD_SET2_LBA48   U32_FROM_BIT(10)
+#define ATA_ID_LBA48_SECTORS    100
+
+#define AHCI_RESET_TIMEOUT_MS   1000
+#define AHCI_LINK_TIMEOUT_MS    10
+#define AHCI_CMD_TIMEOUT_MS     500
+
+//#define AHCI_DEBUG
+#ifdef AHCI_DEBUG
+#define ahci_debug(x, ...) do {rprintf("AHCI: " x "\n", ##__VA_ARGS__);} while(0)
+#else
+#define ahci_debug(x, ...)
+#endif
+
+struct ahci_cmd_hdr {
+    u16 flags;
+    u16 prdtl;  /* PRDT length (entries) */
+    u32 prdbc;  /* PRD byte count transferred */
+    u64 ctba;   /* command table base address */
+    u32 reserved[4];
+} __attribute__((packed));
+
+struct ahci_prd {
+    u64 dba;    /* data base address */
+    u32 reserved;
+    u32 dbc;    /* data byte count minus one */
+} __attribute__((packed));
+
+struct ahci_fis_h2d {
+    u8 type;
+    u8 flags;
+    u8 command;
+    u8 featurel;
+    u8 lba0, lba1, lba2;
+    u8 device;
+    u8 lba3, lba4, lba5;
+    u8 featureh;
+    u8 countl, counth;
+    u8 icc;
+    u8 control;
+    u32 reserved;
+} __attribute__((packed));
+
+struct ahci_cmd_tbl {
+    u8 cfis[64];    /* command FIS */
+    u8 acmd[16];    /* ATAPI command */
+    u8 reserved[48];
+    struct ahci_prd prdt[AHCI_PRDT_ENTRIES];
+} __attribute__((packed));
+
+declare_closure_struct(1, 0, void, ahci_irq,
+                       struct ahci *, hba);
+declare_closure_struct(2, 3, void, ahci_io,
+                       struct ahci_port *, p, boolean, write,
+                       void *, buf, range, blocks, status_handler, sh);
+declare_closure_struct(1, 1, void, ahci_flush,
+                       struct ahci_port *, p,
+                       status_handler, sh);
+declare_closure_struct(1, 0, void, ahci_bh_service,
+                       struct ahci_port *, p);
+declare_closure_struct(1, 0, void, ahci_port_recover,
+                       struct ahci_port *, p);
+
+typedef struct ahci {
+    heap general, contiguous;
+    pci_dev d;
+    struct pci_bar bar;
+    u32 cap;
+    struct ahci_port *ports[AHCI_MAX_PORTS];
+    closure_struct(ahci_irq, irq);
+} *ahci;
+
+typedef struct ahci_port {
+    ahci hba;
+    int index;
+    struct ahci_cmd_hdr *cmd_list;
+    struct ahci_cmd_tbl *cmd_tables;
+    u64 capacity;
+    boolean ncq;
+    u32 slot_mask;  /* usable command slots (NCQ tags) */
+    u32 active;     /* issued command slots */
+    boolean flushing;   /* a (non-queued) FLUSH CACHE EXT is in progress */
+    boolean recovering; /* the command engine is being restarted after an error */
+    struct ahci_req *slot_reqs[AHCI_MAX_SLOTS];
+    struct list pending_reqs, done_reqs;
+    closure_struct(ahci_io, read);
+    closure_struct(ahci_io, write);
+    closure_struct(ahci_flush, flush);
+    closure_struct(ahci_bh_service, bh_service);
+    closure_struct(ahci_port_recover, recover);
+    struct spinlock lock;
+} *ahci_port;
+
+typedef struct ahci_req {
+    struct list l;
+    boolean write;
+    boolean flush;
+    void *buf;
+    range blocks;
+    u64 pending_cmds;
+    status_handler sh;
+    u32 err_is, tfd;
+} *ahci_req;
+
+static inline u32 ahci_read(ahci hba, u64 reg)
+{
+    return pci_bar_read_4(&hba->bar, reg);
+}
+
+static inline void ahci_write(ahci hba, u64 reg, u32 val)
+{
+    pci_bar_write_4(&hba->bar, reg, val);
+}
+
+static inline u32 ahci_port_read(ahci_port p, u64 reg)
+{
+    return ahci_read(p->hba, AHCI_PORT_REG(p->index, reg));
+}
+
+static inline void ahci_port_write(ahci_port p, u64 reg, u32 val)
+{
+    ahci_write(p->hba, AHCI_PORT_REG(p->index, reg), val);
+}
+
+static boolean ahci_wait(ahci hba, u64 reg, u32 mask, u32 val, int timeout_ms)
+{
+    for (int i = 0; ; i++) {
+        if ((ahci_read(hba, reg) & mask) == val)
+            return true;
+        if (i == timeout_ms)
+            return false;
+        kernel_delay(milliseconds(1));
+    }
+}
+
+static boolean ahci_port_wait(ahci_port p, u64 reg, u32 mask, u32 val, int timeout_ms)
+{
+    return ahci_wait(p->hba, AHCI_PORT_REG(p->index, reg), mask, val, timeout_ms);
+}
+
+static boolean ahci_port_stop(ahci_port p)
+{
+    ahci_port_write(p, AHCI_PxCMD, ahci_port_read(p, AHCI_PxCMD) & ~AHCI_PxCMD_ST);
+    return ahci_port_wait(p, AHCI_PxCMD, AHCI_PxCMD_CR, 0, AHCI_CMD_TIMEOUT_MS);
+}
+
+static boolean ahci_port_start(ahci_port p)
+{
+    u32 busy = AHCI_PxTFD_BSY | AHCI_PxTFD_DRQ;
+    if (!ahci_port_wait(p, AHCI_PxTFD, busy, 0, AHCI_CMD_TIMEOUT_MS)) {
+        /* the device is stuck: issue a COMRESET */
+        ahci_debug("port %d: COMRESET", p->index);
+        u32 sctl = ahci_port_read(p, AHCI_PxSCTL) & ~0xF;
+        ahci_port_write(p, AHCI_PxSCTL, sctl | AHCI_PxSCTL_DET_INIT);
+        kernel_delay(milliseconds(1));
+        ahci_port_write(p, AHCI_PxSCTL, sctl);
+        if (!ahci_port_wait(p, AHCI_PxSSTS, 0xF, AHCI_DET_PRESENT, AHCI_CMD_TIMEOUT_MS) ||
+            !ahci_port_wait(p, AHCI_PxTFD, busy, 0, AHCI_CMD_TIMEOUT_MS))
+            return false;
+        ahci_port_write(p, AHCI_PxSERR, -1u);
+    }
+    ahci_port_write(p, AHCI_PxCMD, ahci_port_read(p, AHCI_PxCMD) | AHCI_PxCMD_ST);
+    return true;
+}
+
+/* Fills the PRDT of a command slot with as much of the buffer as fits, and returns the number of
+ * bytes covered, which is a multiple of the sector size unless the buffer is shorter than that. */
+static u64 ahci_setup_prdt(ahci_port p, int slot, void *buf, u64 length)
+{
+    struct ahci_prd *prdt = p->cmd_tables[slot].prdt;
+    int nprd = 0;
+    u64 bytes = 0;
+    while (bytes < length) {
+        u64 phys = physical_from_virtual(buf + bytes);
+        u64 len = MIN(length - bytes, PAGESIZE - (phys & PAGEMASK));
+        struct ahci_prd *prd = (nprd > 0) ? &prdt[nprd - 1] : 0;
+        if (prd && (prd->dba + prd->dbc + 1 == phys) &&
+            (prd->dbc + 1 + len <= AHCI_PRD_MAX_BYTES)) {
+            prd->dbc += len;
+        } else {
+            if (nprd == AHCI_PRDT_ENTRIES)
+                break;
+            prd = &prdt[nprd++];
+            prd->dba = phys;
+            prd->reserved = 0;
+            prd->dbc = len - 1;
+        }
+        bytes += len;
+    }
+    if (bytes < length) {
+        /* trim the transfer to a whole number of sectors */
+        u64 trim = bytes & (SECTOR_SIZE - 1);
+        bytes -= trim;
+        while (trim > 0) {
+            struct ahci_prd *prd = &prdt[nprd - 1];
+            if (prd->dbc + 1 <= trim) {
+                trim -= prd->dbc + 1;
+                nprd--;
+            } else {
+                prd->dbc -= trim;
+                trim = 0;
+            }
+        }
+    }
+    p->cmd_list[slot].prdtl = nprd;
+    return bytes;
+}
+
+static void ahci_setup_fis(ahci_port p, int slot, u8 command, u64 lba, u16 features,
+                           u16 count, boolean write)
+{
+    struct ahci_fis_h2d *fis = (struct ahci_fis_h2d *)p->cmd_tables[slot].cfis;
+    zero(fis, sizeof(*fis));
+    fis->type = AHCI_FIS_TYPE_H2D;
+    fis->flags = AHCI_FIS_H2D_C;
+    fis->command = command;
+    fis->featurel = features;
+    fis->featureh = features >> 8;
+    fis->lba0 = lba;
+    fis->lba1 = lba >> 8;
+    fis->lba2 = lba >> 16;
+    fis->lba3 = lba >> 24;
+    fis->lba4 = lba >> 32;
+    fis->lba5 = lba >> 40;
+    fis->device = ATA_DEV_LBA;
+    fis->countl = count;
+    fis->counth = count >> 8;
+    struct ahci_cmd_hdr *hdr = &p->cmd_list[slot];
+    hdr->flags = AHCI_CMD_CFL(sizeof(*fis)) | (write ? AHCI_CMD_W : 0);
+    hdr->prdbc = 0;
+}
+
+/* Called with the lock held. */
+static void ahci_service_pending(ahci_port p)
+{
+    u32 issue = 0, sact = 0;
+    list l;
+    if (p->recovering)
+        return;
+    while (!p->flushing && (l = list_get_next(&p->pending_reqs))) {
+        u32 free_slots = p->slot_mask & ~(p->active | issue);
+        if (!free_slots)
+            break;
+        int slot = lsb(free_slots);
+        ahci_req req = struct_from_list(l, ahci_req, l);
+        if (req->flush) {
+            /* FLUSH CACHE EXT is not a queued command: it is issued once the commands ahead of
+             * it have completed, and nothing else is issued until it completes. */
+            if (p->active | issue)
+                break;
+            ahci_setup_fis(p, slot, ATA_FLUSHCACHE48, 0, 0, 0, false);
+            p->cmd_list[slot].prdtl = 0;
+            ahci_debug("port %d: flush, slot %d", p->index, slot);
+            p->slot_reqs[slot] = req;
+            req->pending_cmds++;
+            list_delete(l);
+            p->flushing = true;
+            issue |= U32_FROM_BIT(slot);
+            break;
+        }
+        u64 nlb = MIN(range_span(req->blocks), AHCI_MAX_XFER_SECTORS);
+        u64 bytes = ahci_setup_prdt(p, slot, req->buf, nlb * SECTOR_SIZE);
+        nlb = bytes / SECTOR_SIZE;
+        if (p->ncq)
+            ahci_setup_fis(p, slot,
+                           req->write ? ATA_WRITE_FPDMA_QUEUED : ATA_READ_FPDMA_QUEUED,
+                           req->blocks.start, nlb, slot << 3, req->write);
+        else
+            ahci_setup_fis(p, slot, req->write ? ATA_WRITE_DMA48 : ATA_READ_DMA48,
+                           req->blocks.start, 0, nlb, req->write);
+        ahci_debug("port %d: sectors [0x%lx, 0x%lx), slot %d", p->index, req->blocks.start,
+                   req->blocks.start + nlb, slot);
+        p->slot_reqs[slot] = req;
+        req->pending_cmds++;
+        req->blocks.start += nlb;
+        req->buf += bytes;
+        if (range_span(req->blocks) == 0)
+            list_delete(l);
+        issue |= U32_FROM_BIT(slot);
+        if (p->ncq)
+            sact |= U32_FROM_BIT(slot);
+    }
+    if (issue) {
+        p->active |= issue;
+        write_barrier();
+        if (sact)
+            ahci_port_write(p, AHCI_PxSACT, sact);
+        ahci_port_write(p, AHCI_PxCI, issue);
+    }
+}
+
+/* Called with the lock held. */
+static void ahci_complete_slots(ahci_port p, u32 slots, u32 err_is, u32 tfd)
+{
+    bitmap_word_foreach_set(slots, bit, slot, 0) {
+        ahci_req req = p->slot_reqs[slot];
+        p->slot_reqs[slot] = 0;
+        if (req->flush)
+            p->flushing = false;
+        if (err_is && !req->err_is) {
+            req->err_is = err_is;
+            req->tfd = tfd;
+            if (range_span(req->blocks) != 0) {
+                list_delete(&req->l);   /* remove from pending list */
+                req->blocks.start = req->blocks.end;
+            }
+        }
+        if (!(--req->pending_cmds) && (range_span(req->blocks) == 0))
+            list_push_back(&p->done_reqs, &req->l);
+    }
+    p->active &= ~slots;
+}
+
+static void ahci_port_irq(ahci_port p)
+{
+    spin_lock(&p->lock);
+    boolean done_empty = list_empty(&p->done_reqs);
+    u32 is = ahci_port_read(p, AHCI_PxIS);
+    ahci_port_write(p, AHCI_PxIS, is);
+    ahci_debug("port %d: IS 0x%x, active 0x%x", p->index, is, p->active);
+    if (p->recovering) {
+        /* nothing is outstanding while the command engine is restarted */
+    } else if (is & AHCI_PxIS_ERR) {
+        /* Without a READ LOG EXT to find the failed NCQ tag, all outstanding commands are
+         * failed; the command engine must be restarted before issuing new ones, which may
+         * take a while and is left to the bottom half. */
+        u32 tfd = ahci_port_read(p, AHCI_PxTFD);
+        msg_err("port %d error: IS 0x%x, TFD 0x%x, SERR 0x%x\n", p->index, is, tfd,
+                ahci_port_read(p, AHCI_PxSERR));
+        ahci_complete_slots(p, p->active, is, tfd);
+        p->recovering = true;
+        enqueue(bhqueue, &p->recover);
+    } else {
+        u32 busy = ahci_port_read(p, AHCI_PxCI);
+        if (p->ncq)
+            busy |= ahci_port_read(p, AHCI_PxSACT);
+        ahci_complete_slots(p, p->active & ~busy, 0, 0);
+    }
+    ahci_service_pending(p);
+    if (done_empty && !list_empty(&p->done_reqs))
+        enqueue(bhqueue, &p->bh_service);
+    spin_unlock(&p->lock);
+}
+
+define_closure_function(1, 0, void, ahci_irq,
+                        ahci, hba)
+{
+    ahci hba = bound(hba);
+    u32 is = ahci_read(hba, AHCI_IS);
+    bitmap_word_foreach_set(is, bit, port, 0) {
+        ahci_port p = hba->ports[port];
+        if (p)
+            ahci_port_irq(p);
+    }
+    ahci_write(hba, AHCI_IS, is);
+}
+
+static void ahci_submit(ahci_port p, boolean write, boolean flush, void *buf, range blocks,
+                        status_handler sh)
+{
+    ahci_req req = allocate(p->hba->general, sizeof(*req));
+    if (req == INVALID_ADDRESS) {
+        apply(sh, timm("result", "request allocation failed"));
+        return;
+    }
+    req->write = write;
+    req->flush = flush;
+    req->buf = buf;
+    req->blocks = blocks;
+    req->pending_cmds = 0;
+    req->sh = sh;
+    req->err_is = 0;
+    u64 irqflags = spin_lock_irq(&p->lock);
+    list_push_back(&p->pending_reqs, &req->l);
+    ahci_service_pending(p);
+    spin_unlock_irq(&p->lock, irqflags);
+}
+
+define_closure_function(2, 3, void, ahci_io,
+                        ahci_port, p, boolean, write,
+                        void *, buf, range, blocks, status_handler, sh)
+{
+    ahci_port p = bound(p);
+    ahci_debug("port %d: %s %R", p->index, bound(write) ? "write" : "read", blocks);
+    if (range_span(blocks) == 0) {
+        apply(sh, STATUS_OK);
+        return;
+    }
+    ahci_submit(p, bound(write), false, buf, blocks, sh);
+}
+
+/* Completes once the data of all writes completed before it is on stable storage. */
+define_closure_function(1, 1, void, ahci_flush,
+                        ahci_port, p,
+                        status_handler, sh)
+{
+    ahci_submit(bound(p), false, true, 0, irange(0, 0), sh);
+}
+
+define_closure_function(1, 0, void, ahci_bh_service,
+                        ahci_port, p)
+{
+    ahci_port p = bound(p);
+    list l;
+    u64 irqflags = spin_lock_irq(&p->lock);
+    while ((l = list_get_next(&p->done_reqs))) {
+        list_delete(l);
+        spin_unlock_irq(&p->lock, irqflags);
+        ahci_req req = struct_from_list(l, ahci_req, l);
+        apply(req->sh, req->err_is ? timm("result", "AHCI port %d error (IS 0x%x, TFD 0x%x)",
+                                          p->index, req->err_is, req->tfd) : STATUS_OK);
+        deallocate(p->hba->general, req, sizeof(*req));
+        irqflags = spin_lock_irq(&p->lock);
+    }
+    spin_unlock_irq(&p->lock, irqflags);
+}
+
+define_closure_function(1, 0, void, ahci_port_recover,
+                        ahci_port, p)
+{
+    ahci_port p = bound(p);
+    ahci_debug("port %d: restarting command engine", p->index);
+    ahci_port_stop(p);
+    ahci_port_write(p, AHCI_PxSERR, -1u);
+    ahci_port_write(p, AHCI_PxIS, -1u);
+    if (!ahci_port_start(p))
+        msg_err("port %d: failed to restart command engine\n", p->index);
+    u64 irqflags = spin_lock_irq(&p->lock);
+    p->recovering = false;
+    ahci_service_pending(p);
+    spin_unlock_irq(&p->lock, irqflags);
+}
+
+/* Issues IDENTIFY DEVICE on slot 0 and polls for its completion; interrupts are not enabled yet. */
+static boolean ahci_identify(ahci_port p, u16 *id)
+{
+    if (ahci_setup_prdt(p, 0, id, SECTOR_SIZE) != SECTOR_SIZE)
+        return false;
+    ahci_setup_fis(p, 0, ATA_ATA_IDENTIFY, 0, 0, 0, false);
+    write_barrier();
+    ahci_port_write(p, AHCI_PxCI, 1);
+    boolean done = ahci_port_wait(p, AHCI_PxCI, 1, 0, AHCI_CMD_TIMEOUT_MS);
+    u32 is = ahci_port_read(p, AHCI_PxIS);
+    ahci_port_write(p, AHCI_PxIS, is);
+    return done && !(is & AHCI_PxIS_ERR) && !(ahci_port_read(p, AHCI_PxTFD) & AHCI_PxTFD_ERR);
+}
+
+static ahci_port ahci_port_init(ahci hba, int index, u16 *id)
+{
+    ahci_port p = allocate(hba->general, sizeof(*p));
+    if (p == INVALID_ADDRESS)
+        return p;
+    p->hba = hba;
+    p->index = index;
+
+    /* spin up and power on the device, then wait for the link to come up */
+    ahci_port_write(p, AHCI_PxCMD,
+                    ahci_port_read(p, AHCI_PxCMD) | AHCI_PxCMD_SUD | AHCI_PxCMD_POD);
+    if (!ahci_port_wait(p, AHCI_PxSSTS, 0xF, AHCI_DET_PRESENT, AHCI_LINK_TIMEOUT_MS)) {
+        ahci_debug("port %d: no device", index);
+        goto free_port;
+    }
+    u32 sig = ahci_port_read(p, AHCI_PxSIG);
+    if (sig != AHCI_SIG_ATA) {
+        ahci_debug("port %d: unsupported device signature 0x%x", index, sig);
+        goto free_port;
+    }
+
+    /* make sure the port is idle before programming the command list and FIS areas */
+    if (!ahci_port_stop(p))
+        goto port_error;
+    ahci_port_write(p, AHCI_PxCMD, ahci_port_read(p, AHCI_PxCMD) & ~AHCI_PxCMD_FRE);
+    if (!ahci_port_wait(p, AHCI_PxCMD, AHCI_PxCMD_FR, 0, AHCI_CMD_TIMEOUT_MS))
+        goto port_error;
+
+    p->cmd_list = allocate(hba->contiguous, AHCI_CMD_LIST_SIZE + AHCI_RFIS_SIZE);
+    if (p->cmd_list == INVALID_ADDRESS)
+        goto free_port;
+    zero(p->cmd_list, AHCI_CMD_LIST_SIZE + AHCI_RFIS_SIZE);
+    p->cmd_tables = allocate(hba->contiguous, AHCI_MAX_SLOTS * sizeof(struct ahci_cmd_tbl));
+    if (p->cmd_tables == INVALID_ADDRESS)
+        goto free_cmd_list;
+    zero(p->cmd_tables, AHCI_MAX_SLOTS * sizeof(struct ahci_cmd_tbl));
+    for (int slot = 0; slot < AHCI_MAX_SLOTS; slot++)
+        p->cmd_list[slot].ctba = physical_from_virtual(&p->cmd_tables[slot]);
+    u64 clb = physical_from_virtual(p->cmd_list);
+    u64 fb = clb + AHCI_CMD_LIST_SIZE;
+    ahci_port_write(p, AHCI_PxCLB, clb);
+    ahci_port_write(p, AHCI_PxCLBU, clb >> 32);
+    ahci_port_write(p, AHCI_PxFB, fb);
+    ahci_port_write(p, AHCI_PxFBU, fb >> 32);
+    ahci_port_write(p, AHCI_PxSERR, -1u);
+    ahci_port_write(p, AHCI_PxIS, -1u);
+    ahci_port_write(p, AHCI_PxCMD, ahci_port_read(p, AHCI_PxCMD) | AHCI_PxCMD_FRE);
+    if (!ahci_port_start(p))
+        goto port_error_free;
+    if (!ahci_identify(p, id)) {
+        msg_err("port %d: IDENTIFY failed\n", index);
+        ahci_port_stop(p);
+        goto free_cmd_tables;
+    }
+    if (!(id[ATA_ID_CMD_SET2] & ATA_ID_CMD_SET2_LBA48)) {
+        msg_err("port %d: 48-bit LBA not supported\n", index);
+        ahci_port_stop(p);
+        goto free_cmd_tables;
+    }
+    runtime_memcpy(&p->capacity, &id[ATA_ID_LBA48_SECTORS], sizeof(p->capacity));
+    p->capacity *= SECTOR_SIZE;
+    p->ncq = (hba->cap & AHCI_CAP_SNCQ) && (id[ATA_ID_SATA_CAP] & ATA_ID_SATA_CAP_NCQ);
+    int depth = p->ncq ? MIN((id[ATA_ID_QUEUE_DEPTH] & 0x1F) + 1, AHCI_CAP_NCS(hba->cap)) : 1;
+    p->slot_mask = MASK32(depth);
+    p->active = 0;
+    p->flushing = p->recovering = false;
+    ahci_debug("port %d: capacity %ld bytes, NCQ %s, queue depth %d", index, p->capacity,
+               p->ncq ? "enabled" : "unsupported", depth);
+    list_init(&p->pending_reqs);
+    list_init(&p->done_reqs);
+    spin_lock_init(&p->lock);
+    init_closure(&p->read, ahci_io, p, false);
+    init_closure(&p->write, ahci_io, p, true);
+    init_closure(&p->flush, ahci_flush, p);
+    init_closure(&p->bh_service, ahci_bh_service, p);
+    init_closure(&p->recover, ahci_port_recover, p);
+    ahci_port_write(p, AHCI_PxIE, AHCI_PxIS_DHRS | AHCI_PxIS_PSS | AHCI_PxIS_DSS |
+                    AHCI_PxIS_SDBS | AHCI_PxIS_ERR);
+    return p;
+  port_error_free:
+    msg_err("port %d: failed to start command engine\n", index);
+  free_cmd_tables:
+    deallocate(hba->contiguous, p->cmd_tables, AHCI_MAX_SLOTS * sizeof(struct ahci_cmd_tbl));
+  free_cmd_list:
+    deallocate(hba->contiguous, p->cmd_list, AHCI_CMD_LIST_SIZE + AHCI_RFIS_SIZE);
+    goto free_port;
+  port_error:
+    msg_err("port %d: failed to stop command engine\n", index);
+  free_port:
+    deallocate(hba->general, p, sizeof(*p));
+    return INVALID_ADDRESS;
+}
+
+/* Stops a port brought up by ahci_port_init() that has not been attached. */
+static void ahci_port_free(ahci_port p)
+{
+    ahci hba = p->hba;
+    ahci_port_write(p, AHCI_PxIE, 0);
+    ahci_port_stop(p);
+    ahci_port_write(p, AHCI_PxCMD, ahci_port_read(p, AHCI_PxCMD) & ~AHCI_PxCMD_FRE);
+    ahci_port_wait(p, AHCI_PxCMD, AHCI_PxCMD_FR, 0, AHCI_CMD_TIMEOUT_MS);
+    deallocate(hba->contiguous, p->cmd_tables, AHCI_MAX_SLOTS * sizeof(struct ahci_cmd_tbl));
+    deallocate(hba->contiguous, p->cmd_list, AHCI_CMD_LIST_SIZE + AHCI_RFIS_SIZE);
+    hba->ports[p->index] = 0;
+    deallocate(hba->general, p, sizeof(*p));
+}
+
+closure_function(3, 1, boolean, ahci_probe,
+                 heap, general, storage_attach, a, heap, contiguous,
+                 pci_dev, d)
+{
+    if ((pci_get_class(d) != PCIC_STORAGE) || (pci_get_subclass(d) != PCIS_STORAGE_SATA) ||
+            (pci_get_prog_if(d) != PCIPI_STORAGE_AHCI))
+        return false;
+    heap general = bound(general);
+    ahci hba = allocate(general, sizeof(*hba));
+    if (hba == INVALID_ADDRESS)
+        return false;
+    zero(hba, sizeof(*hba));
+    hba->general = general;
+    hba->contiguous = bound(contiguous);
+    hba->d = d;
+    pci_bar_init(d, &hba->bar, AHCI_ABAR, 0, -1);
+    pci_set_bus_master(d);
+
+    /* reset controller */
+    ahci_write(hba, AHCI_GHC, AHCI_GHC_AE);
+    ahci_write(hba, AHCI_GHC, AHCI_GHC_AE | AHCI_GHC_HR);
+    if (!ahci_wait(hba, AHCI_GHC, AHCI_GHC_HR, 0, AHCI_RESET_TIMEOUT_MS)) {
+        msg_err("failed to reset controller\n");
+        goto free_hba;
+    }
+    ahci_write(hba, AHCI_GHC, AHCI_GHC_AE);
+    hba->cap = ahci_read(hba, AHCI_CAP);
+    u32 pi = ahci_read(hba, AHCI_PI);
+    ahci_debug("new controller (version 0x%x), CAP 0x%x, ports 0x%x",
+               ahci_read(hba, AHCI_VS), hba->cap, pi);
+    if (!(hba->cap & AHCI_CAP_S64A)) {
+        msg_err("64-bit addressing not supported\n");
+        goto free_hba;
+    }
+
+    u16 *id = allocate(hba->contiguous, SECTOR_SIZE);
+    if (id == INVALID_ADDRESS)
+        goto free_hba;
+    int nports = 0;
+    bitmap_word_foreach_set(pi, bit, port, 0) {
+        ahci_port p = ahci_port_init(hba, port, id);
+        if (p != INVALID_ADDRESS) {
+            hba->ports[port] = p;
+            nports++;
+        }
+    }
+    deallocate(hba->contiguous, id, SECTOR_SIZE);
+    if (nports == 0)
+        goto free_hba;
+
+    init_closure(&hba->irq, ahci_irq, hba);
+    if (pci_get_msix_count(d) > 0) {
+        pci_enable_msix(d);
+        if (pci_setup_msix(d, 0, (thunk)&hba->irq, "ahci") == INVALID_PHYSICAL) {
+            msg_err("failed to allocate MSI-X vector\n");
+            pci_disable_msix(d);
+            goto free_ports;
+        }
+    } else {
+        pci_setup_non_msi_irq(d, (thunk)&hba->irq, "ahci");
+    }
+    ahci_write(hba, AHCI_IS, -1u);
+    ahci_write(hba, AHCI_GHC, AHCI_GHC_AE | AHCI_GHC_IE);
+
+    // attach
+    for (int port = 0; port < AHCI_MAX_PORTS; port++) {
+        ahci_port p = hba->ports[port];
+        if (p)
+            apply(bound(a), (block_io)&p->read, (block_io)&p->write, (block_flush)&p->flush,
+                  p->capacity);
+    }
+    return true;
+  free_ports:
+    for (int port = 0; port < AHCI_MAX_PORTS; port++) {
+        if (hba->ports[port])
+            ahci_port_free(hba->ports[port]);
+    }
+  free_hba:
+    pci_bar_deinit(&hba->bar);
+    deallocate(general, hba, sizeof(*hba));
+    return false;
+}
+
+void init_ahci(kernel_heaps kh, storage_attach a)
+{
+    heap h = heap_locked(kh);
+    register_pci_driver(closure(h, ahci_probe, h, a, heap_backed(kh)));
+}
@@ -0,0 +1 @@
+void init_ahci(kernel_heaps kh, storage_attach a);
@@ -123,7 +123,7 @@ vmbus_chan_ins_list(vmbus_dev sc, struct vmbus_channel *chan)
 
 void
 vmbus_chan_open(struct vmbus_channel *chan, int txbr_size, int rxbr_size,
-                const void *udata, int udlen, vmbus_chan_callback_t cb, void *cbarg, queue sched_queue)
+                const void *udata, int udlen, vmbus_chan_callback_t cb, void *cbarg, sched_queue_kind sched_queue)
 {
     struct vmbus_chan_br cbr;
 
@@ -154,7 +154,7 @@ closure_function(1, 0, void, vmbus_chan_closure,
 
 int
 vmbus_chan_open_br(struct vmbus_channel *chan, const struct vmbus_chan_br *cbr,
-                   const void *udata, int udlen, vmbus_chan_callback_t cb, void *cbarg, queue sched_queue)
+                   const void *udata, int udlen, vmbus_chan_callback_t cb, void *cbarg, sched_queue_kind sched_queue)
 {
     vmbus_dev vmbus = chan->ch_vmbus;
 
@@ -714,7 +714,7 @@ vmbus_event_flags_proc(vmbus_dev sc, volatile u64 *event_flags,
             if (chan->ch_flags & VMBUS_CHAN_FLAG_BATCHREAD)
                 vmbus_rxbr_intr_mask(&chan->ch_rxbr);
             if (!sc->poll_mode) {
-                enqueue_irqsafe(chan->sched_queue, chan->ch_tq);
+                enqueue_irqsafe(sched_queue_local(chan->sched_queue), chan->ch_tq);
             } else {
                 apply(chan->ch_tq);
             }
@@ -0,0 +1,95 @@
+#include <kernel.h>
+
+/* Boot timeline
+
+   Boot phases are stamped with the cycle counter as they begin, from stage2 (when booting
+   through the bootloader) to the first user instruction. The counter is calibrated against the
+   monotonic clock once the latter is available, so that early stamps can be converted as well.
+   When boot completes, the timeline is published under "boot_timeline" in the root tuple and,
+   if "print_boot_timeline" is set, printed on the console. */
+
+#define BOOT_TIMELINE_MAX_ENTRIES   64
+
+static struct boot_timeline_entry {
+    const char *phase;
+    u64 tsc;
+} boot_timeline[BOOT_TIMELINE_MAX_ENTRIES];
+static word boot_timeline_count;
+
+static u64 calib_tsc;
+static timestamp calib_time;
+static boolean boot_complete;
+
+void boot_timeline_mark_at(const char *phase, u64 tsc)
+{
+    if (boot_complete)
+        return;
+    word i = fetch_and_add(&boot_timeline_count, 1);
+    if (i >= BOOT_TIMELINE_MAX_ENTRIES)
+        return;
+    boot_timeline[i].tsc = tsc;
+    boot_timeline[i].phase = phase;
+}
+
+void boot_timeline_mark(const char *phase)
+{
+    boot_timeline_mark_at(phase, rdtsc());
+}
+
+void boot_timeline_clock_ready(void)
+{
+    calib_tsc = rdtsc();
+    calib_time = now(CLOCK_ID_MONOTONIC_RAW);
+}
+
+/* cycle counter ticks per microsecond */
+static u64 boot_timeline_rate(void)
+{
+    u64 usec = usec_from_timestamp(now(CLOCK_ID_MONOTONIC_RAW) - calib_time);
+    if (!calib_tsc || !usec)
+        return 0;
+    return MAX((rdtsc() - calib_tsc) / usec, 1);
+}
+
+static u64 boot_timeline_usec(u64 rate, u64 from, u64 to)
+{
+    return (to > from) ? (to - from) / rate : 0;
+}
+
+void boot_timeline_complete(tuple root)
+{
+    if (boot_complete)
+        return;
+    boot_timeline_mark("user");
+    boot_complete = true;
+    u64 rate = boot_timeline_rate();
+    word n = MIN(boot_timeline_count, BOOT_TIMELINE_MAX_ENTRIES);
+    if (!rate)
+        return;
+    heap h = heap_general(get_kernel_heaps());
+    tuple t = allocate_tuple();
+    assert(t != INVALID_ADDRESS);
+    u64 first = boot_timeline[0].tsc;
+    for (word i = 0; i < n; i++) {
+        u64 usec = boot_timeline_usec(rate, first, boot_timeline[i].tsc);
+        set(t, sym_this(boot_timeline[i].phase), value_from_u64(h, usec));
+    }
+    set(t, sym(no_encode), null_value);
+    set(root, sym(boot_timeline), t);
+
+    if (!get(root, sym(print_boot_timeline)))
+        return;
+    buffer b = allocate_buffer(h, 64 * (n + 1));
+    assert(b != INVALID_ADDRESS);
+    bprintf(b, "boot timeline (start, duration):\n");
+    for (word i = 0; i < n; i++) {
+        u64 start = boot_timeline_usec(rate, first, boot_timeline[i].tsc);
+        u64 end = (i + 1 < n) ?
+            boot_timeline_usec(rate, first, boot_timeline[i + 1].tsc) : start;
+        u64 d = end > start ? end - start : 0;
+        bprintf(b, "  %6ld.%03ld ms  %6ld.%03ld ms  %s\n", start / 1000, start % 1000,
+                d / 1000, d % 1000, boot_timeline[i].phase);
+    }
+    buffer_print(b);
+    deallocate_buffer(b);
+}
@@ -61,6 +61,7 @@ closure_function(3, 2, void, fsstarted,
                  filesystem, fs, status, s)
 {
     init_debug("%s\n", __func__);
+    boot_timeline_mark("rootfs_mounted");
     heap h = heap_locked(init_heaps);
     if (!is_ok(s)) {
         buffer b = allocate_buffer(h, 128);
@@ -81,6 +82,12 @@ closure_function(3, 2, void, fsstarted,
     assert(wrapped_root != INVALID_ADDRESS);
     // XXX use wrapped_root after root fs is separate
     tuple root = filesystem_getroot(root_fs);
+    if (get(root, sym(fs_mount_stats))) {
+        tfs_mount_stats ms = filesystem_get_mount_stats(fs);
+        rprintf("root fs log: %ld extensions, %ld bytes, %ld entries; read %T, total %T\n",
+                ms->log_extensions, ms->log_bytes, ms->log_entries, ms->read_time,
+                ms->total_time);
+    }
     tuple mounts = get_tuple(root, sym(mounts));
     if (mounts)
         storage_set_mountpoints(mounts);
@@ -266,6 +273,7 @@ void kernel_runtime_init(kernel_heaps kh)
 
     /* runtime and console init */
     init_debug("kernel_runtime_init");
+    boot_timeline_mark("runtime_init");
     init_runtime(misc, locked);
     init_sg(locked);
     init_pagecache(locked, backed, (heap)heap_physical(kh), PAGESIZE);
@@ -278,14 +286,17 @@ void kernel_runtime_init(kernel_heaps kh)
     reclaim_regions();          /* for pc: no accessing regions after this point */
     shutdown_completions = allocate_vector(misc, SHUTDOWN_COMPLETIONS_SIZE);
     init_debug("pci_discover (for VGA)");
+    boot_timeline_mark("pci_discover");
     pci_discover(); // early PCI discover to configure VGA console
     init_debug("clock");
     init_clock();
+    boot_timeline_clock_ready();
     init_debug("init_kernel_contexts");
     init_kernel_contexts(backed);
 
     /* interrupts */
     init_debug("init_interrupts");
+    boot_timeline_mark("interrupts");
     init_interrupts(kh);
 
     init_debug("init_scheduler");
@@ -293,6 +304,7 @@ void kernel_runtime_init(kernel_heaps kh)
 
     /* platform detection and early init */
     init_debug("probing for hypervisor platform");
+    boot_timeline_mark("hypervisor");
     detect_hypervisor(kh);
 
     /* RNG, stack canaries */
@@ -302,6 +314,7 @@ void kernel_runtime_init(kernel_heaps kh)
 
     /* networking */
     init_debug("LWIP init");
+    boot_timeline_mark("net");
     init_net(kh);
 
     init_debug("probe fs, register storage drivers");
@@ -309,17 +322,25 @@ void kernel_runtime_init(kernel_heaps kh)
 
     storage_attach sa = closure(misc, attach_storage);
 
+    /* APs are started in the background of device probing */
+    init_debug("start_secondary_cores");
+    boot_timeline_mark("secondary_cores_init");
+    start_secondary_cores(kh);
+
     init_debug("detect_devices");
+    boot_timeline_mark("devices");
     detect_devices(kh, sa);
 
     init_debug("pci_discover (for other devices)");
     pci_discover();
     init_debug("discover done");
 
-    init_debug("start_secondary_cores");
-    start_secondary_cores(kh);
+    init_debug("finish_secondary_cores");
+    boot_timeline_mark("secondary_cores_start");
+    finish_secondary_cores(kh);
 
     init_debug("starting runloop");
+    boot_timeline_mark("runloop");
     runloop();
 }
 
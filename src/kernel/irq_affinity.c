@@ -0,0 +1,240 @@
+#include <kernel.h>
+
+/* Interrupt affinity
+
+   Interrupt sources that can be directed at a given cpu, such as MSI-X table entries, register
+   their vector here with a closure that reprograms the destination. Unless the driver asks for a
+   cpu, vectors are spread over the present cpus round-robin, so that the queues of a multi-queue
+   device complete in parallel. Devices are probed before the secondary cpus are started, so a
+   vector is delivered to the boot cpu until its cpu is running; irq_affinity_start() then
+   programs every vector, spreading the unpinned ones again over the cpus that did start.
+
+   Vectors can be pinned by interrupt name from the root tuple, e.g.
+   irq_affinity:("virtio net rx":1), and each vector can be moved at run time by setting "cpu"
+   under /interrupts/<vector> in the management tree, which also reports per-cpu counts. */
+
+//#define IRQ_AFFINITY_DEBUG
+#ifdef IRQ_AFFINITY_DEBUG
+#define irq_debug(x, ...) do {log_printf("IRQ", x, ##__VA_ARGS__);} while(0)
+#else
+#define irq_debug(x, ...)
+#endif
+
+typedef struct irq_affinity {
+    struct list l;
+    u64 vector;
+    const char *name;
+    u32 cpu;                    /* requested */
+    u32 target;                 /* programmed */
+    boolean spread;             /* cpu chosen round-robin */
+    irq_retarget retarget;
+    tuple mgmt;
+} *irq_affinity;
+
+static heap irq_heap;
+static struct list irq_vectors;
+static struct spinlock irq_lock;
+static word irq_next_cpu;
+static tuple irq_mgmt;
+static u32 irq_count_vectors;
+
+static boolean irq_cpu_ready(u32 cpu)
+{
+    return (cpu < total_processors) && (cpuinfo_from_id(cpu)->state != cpu_not_present);
+}
+
+/* must be called with irq_lock held */
+static irq_affinity irq_affinity_find(u64 vector)
+{
+    list_foreach(&irq_vectors, l) {
+        irq_affinity ia = struct_from_list(l, irq_affinity, l);
+        if (ia->vector == vector)
+            return ia;
+    }
+    return 0;
+}
+
+static void irq_affinity_program(irq_affinity ia)
+{
+    u32 target = irq_cpu_ready(ia->cpu) ? ia->cpu : 0;
+    if (target == ia->target)
+        return;
+    irq_debug("vector %ld (%s): cpu %d -> %d\n", ia->vector, ia->name, ia->target, target);
+    apply(ia->retarget, target);
+    ia->target = target;
+}
+
+static u32 irq_default_cpu(void)
+{
+    return fetch_and_add(&irq_next_cpu, 1) % present_processors;
+}
+
+static u64 irq_vector_count(irq_affinity ia, int cpu)
+{
+    return cpuinfo_from_id(cpu)->irq_counts[ia->vector];
+}
+
+closure_function(2, 0, value, irq_get_count,
+                 irq_affinity, ia, value, v)
+{
+    u64 count = 0;
+    for (int i = 0; i < total_processors; i++)
+        count += irq_vector_count(bound(ia), i);
+    return value_rewrite_u64(bound(v), count);
+}
+
+closure_function(3, 0, value, irq_get_cpu_count,
+                 irq_affinity, ia, int, cpu, value, v)
+{
+    return value_rewrite_u64(bound(v), irq_vector_count(bound(ia), bound(cpu)));
+}
+
+/* the notifier stores the new value in the management tuple, so it is not updated here */
+static boolean irq_set_affinity_internal(u64 vector, u32 cpu, boolean update_mgmt)
+{
+    if (cpu >= present_processors)
+        return false;
+    spin_lock(&irq_lock);
+    irq_affinity ia = irq_affinity_find(vector);
+    if (ia) {
+        ia->cpu = cpu;
+        ia->spread = false;
+        irq_affinity_program(ia);
+        if (update_mgmt)
+            value_rewrite_u64(get(ia->mgmt, sym(cpu)), cpu);
+    }
+    spin_unlock(&irq_lock);
+    return ia != 0;
+}
+
+closure_function(1, 1, boolean, irq_set_cpu,
+                 irq_affinity, ia,
+                 value, v)
+{
+    u64 cpu;
+    if (!u64_from_value(v, &cpu) || (cpu > U32_MAX) ||
+        !irq_set_affinity_internal(bound(ia)->vector, cpu, false)) {
+        msg_err("invalid cpu for interrupt %s\n", bound(ia)->name);
+        return false;
+    }
+    return true;
+}
+
+static void irq_affinity_management(irq_affinity ia)
+{
+    tuple t = timm("name", "%s", ia->name);
+    assert(t != INVALID_ADDRESS);
+    tuple_notifier n = tuple_notifier_wrap(t);
+    assert(n != INVALID_ADDRESS);
+    tuple_notifier_register_set_notify(n, sym(cpu), closure(irq_heap, irq_set_cpu, ia));
+    set(t, sym(cpu), value_from_u64(irq_heap, ia->cpu));
+    value v = value_from_u64(irq_heap, 0);
+    set(t, sym(count), v);
+    tuple_notifier_register_get_notify(n, sym(count), closure(irq_heap, irq_get_count, ia, v));
+    tuple cpus = allocate_tuple();
+    assert(cpus != INVALID_ADDRESS);
+    tuple_notifier cn = tuple_notifier_wrap(cpus);
+    assert(cn != INVALID_ADDRESS);
+    for (int i = 0; i < present_processors; i++) {
+        symbol s = intern_u64(i);
+        v = value_from_u64(irq_heap, 0);
+        set(cpus, s, v);
+        tuple_notifier_register_get_notify(cn, s, closure(irq_heap, irq_get_cpu_count, ia, i, v));
+    }
+    set(t, sym(cpus), cn);
+    ia->mgmt = t;
+    set(irq_mgmt, intern_u64(ia->vector), n);
+}
+
+/* Returns the cpu that the interrupt source should be programmed to deliver to. A cpu of
+   IRQ_CPU_ANY selects one round-robin. */
+u32 irq_register_affinity(u64 vector, const char *name, u32 cpu, irq_retarget retarget)
+{
+    assert(vector < irq_count_vectors);
+    irq_affinity ia = allocate(irq_heap, sizeof(struct irq_affinity));
+    assert(ia != INVALID_ADDRESS);
+    ia->vector = vector;
+    ia->name = name;
+    ia->spread = (cpu == IRQ_CPU_ANY);
+    if (ia->spread)
+        cpu = irq_default_cpu();
+    ia->cpu = (cpu < present_processors) ? cpu : 0;
+    ia->target = irq_cpu_ready(ia->cpu) ? ia->cpu : 0;
+    ia->retarget = retarget;
+    irq_debug("registering vector %ld (%s), cpu %d, target %d\n", vector, name, ia->cpu,
+              ia->target);
+    spin_lock(&irq_lock);
+    list_push_back(&irq_vectors, &ia->l);
+    irq_affinity_management(ia);
+    spin_unlock(&irq_lock);
+    return ia->target;
+}
+
+void irq_unregister_affinity(u64 vector)
+{
+    spin_lock(&irq_lock);
+    irq_affinity ia = irq_affinity_find(vector);
+    if (ia) {
+        list_delete(&ia->l);
+        set(irq_mgmt, intern_u64(vector), 0);
+    }
+    spin_unlock(&irq_lock);
+    if (!ia)
+        return;
+    /* management closures stay allocated, as management clients may still reference them */
+    deallocate_closure(ia->retarget);
+    deallocate(irq_heap, ia, sizeof(struct irq_affinity));
+}
+
+boolean irq_set_affinity(u64 vector, u32 cpu)
+{
+    return irq_set_affinity_internal(vector, cpu, true);
+}
+
+/* Called once the secondary cpus have been started: applies the pins from the root tuple,
+   spreads the other round-robin vectors over the cpus that are running, moves every vector to
+   its cpu and publishes the management tree. */
+void irq_affinity_start(tuple root)
+{
+    tuple pins = get_tuple(root, sym(irq_affinity));
+    u32 next_cpu = 0;
+    spin_lock(&irq_lock);
+    list_foreach(&irq_vectors, l) {
+        irq_affinity ia = struct_from_list(l, irq_affinity, l);
+        value v;
+        u64 cpu;
+        if (pins && (v = get(pins, sym_this(ia->name)))) {
+            if (u64_from_value(v, &cpu) && (cpu < present_processors)) {
+                ia->cpu = cpu;
+                ia->spread = false;
+            } else {
+                msg_err("invalid cpu for interrupt %s in irq_affinity\n", ia->name);
+            }
+        }
+        if (ia->spread) {
+            ia->cpu = next_cpu;
+            next_cpu = (next_cpu + 1) % total_processors;
+        }
+        value_rewrite_u64(get(ia->mgmt, sym(cpu)), ia->cpu);
+        irq_affinity_program(ia);
+    }
+    spin_unlock(&irq_lock);
+    set(root, sym(interrupts), irq_mgmt);
+}
+
+void init_irq_affinity(heap h, u32 nvectors)
+{
+    irq_heap = h;
+    list_init(&irq_vectors);
+    spin_lock_init(&irq_lock);
+    irq_next_cpu = 0;
+    irq_count_vectors = nvectors;
+    for (int i = 0; i < MAX_CPUS; i++) {
+        cpuinfo ci = cpuinfo_from_id(i);
+        ci->irq_counts = allocate_zero(h, nvectors * sizeof(u64));
+        assert(ci->irq_counts != INVALID_ADDRESS);
+    }
+    irq_mgmt = allocate_tuple();
+    assert(irq_mgmt != INVALID_ADDRESS);
+    set(irq_mgmt, sym(no_encode), null_value);
+}
@@ -93,8 +93,12 @@ static void init_cpuinfos(heap backed)
         ci->state = cpu_not_present;
         ci->have_kernel_lock = false;
         ci->thread_queue = allocate_queue(backed, MAX_THREADS);
+        ci->bh_queue = allocate_queue(backed, SCHED_QUEUE_SIZE);
+        ci->run_queue = allocate_queue(backed, SCHED_QUEUE_SIZE);
         ci->last_timer_update = 0;
         ci->frcount = 0;
+        ci->zero_page_count = 0;
+        ci->zero_window = 0;
 
         init_cpuinfo_machine(ci, backed);
 
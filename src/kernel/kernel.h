@@ -23,10 +23,18 @@ typedef struct cpuinfo {
     int state;
     boolean have_kernel_lock;
     queue thread_queue;
+    queue bh_queue;     /* bottom halves queued on this cpu, see bhqueue */
+    queue run_queue;    /* kernel lock work queued on this cpu, see runqueue */
+    u64 *irq_counts;    /* interrupts taken on this cpu, by vector */
     timestamp last_timer_update;
     u64 frcount;
     u64 inval_gen; /* Generation number for invalidates */
 
+    /* pre-zeroed physical pages, see zero_page_pool.c */
+    u64 zero_pages[ZERO_PAGE_POOL_SIZE];
+    int zero_page_count;
+    u64 zero_window;
+
 #ifdef CONFIG_FTRACE
     int graph_idx;
     struct ftrace_graph_entry * graph_stack;
@@ -39,6 +47,8 @@ extern struct cpuinfo cpuinfos[];
 struct mm_stats {
     word minor_faults;
     word major_faults;
+    word zero_pool_hits;    /* pages */
+    word zero_pool_misses;
 };
 
 extern struct mm_stats mm_stats;
@@ -186,8 +196,24 @@ _IRQSAFE_1(void *, queue_peek, queue);
 #endif
 
 typedef struct queue *queue;
-extern queue bhqueue;
-extern queue runqueue;
+
+/* Scheduling queues are per-cpu: work is queued on the cpu that generates it (e.g. a device
+   completion runs on the cpu that took the interrupt) and is stolen by other cpus only when
+   the owner is not about to drain it. */
+#define bhqueue     (current_cpu()->bh_queue)
+#define runqueue    (current_cpu()->run_queue)
+
+/* Drivers record the kind of queue that an interrupt service is to run from, which resolves to
+   the queue of the cpu that took the interrupt. */
+typedef enum {
+    SCHED_QUEUE_BH,             /* bhqueue */
+    SCHED_QUEUE_RUN,            /* runqueue, i.e. under the kernel lock */
+} sched_queue_kind;
+
+static inline queue sched_queue_local(sched_queue_kind kind)
+{
+    return (kind == SCHED_QUEUE_BH) ? bhqueue : runqueue;
+}
 extern timerheap runloop_timers;
 
 backed_heap mem_debug_backed(heap m, backed_heap bh, u64 padsize);
@@ -226,7 +252,16 @@ void init_clock(void);
 void process_bhqueue();
 void install_fallback_fault_handler(fault_handler h);
 
-void msi_format(u32 *address, u32 *data, int vector);
+void msi_format(u32 *address, u32 *data, int vector, u32 target_cpu);
+
+/* interrupt affinity, see irq_affinity.c */
+typedef closure_type(irq_retarget, void, u32);
+void init_irq_affinity(heap h, u32 nvectors);
+#define IRQ_CPU_ANY     U32_MAX
+u32 irq_register_affinity(u64 vector, const char *name, u32 cpu, irq_retarget retarget);
+void irq_unregister_affinity(u64 vector);
+boolean irq_set_affinity(u64 vector, u32 cpu);
+void irq_affinity_start(tuple root);
 
 u64 allocate_ipi_interrupt(void);
 void deallocate_ipi_interrupt(u64 irq);
@@ -241,6 +276,14 @@ boolean kern_try_lock(void);
 void kern_unlock(void);
 void init_scheduler(heap);
 void mm_service(void);
+void zero_page_pool_refill(void);
+boolean map_zeroed_pages(u64 vaddr, u64 length, pageflags flags);
+value zero_page_pool_management(heap h);
+
+void boot_timeline_mark_at(const char *phase, u64 tsc);
+void boot_timeline_mark(const char *phase);
+void boot_timeline_clock_ready(void);
+void boot_timeline_complete(tuple root);
 
 typedef closure_type(balloon_deflater, u64, u64);
 void mm_register_balloon_deflater(balloon_deflater deflater);
@@ -269,6 +312,7 @@ extern void xsave(context f);
 
 void cpu_init(int cpu);
 void start_secondary_cores(kernel_heaps kh);
+void finish_secondary_cores(kernel_heaps kh);
 void detect_hypervisor(kernel_heaps kh);
 void detect_devices(kernel_heaps kh, storage_attach sa);
 
@@ -733,6 +733,40 @@ u64 pagecache_drain(u64 drain_bytes)
     return evicted << pc->page_order;
 }
 
+/* Drop the clean pages of a node in the given byte range, except those that are
+   mapped or otherwise in use. */
+void pagecache_node_evict_clean(pagecache_node pn, range r)
+{
+    pagecache pc = pn->pv->pc;
+    vector v = allocate_vector(pc->h, DRAIN_ITER_MAX);
+    if (v == INVALID_ADDRESS)
+        return;
+    struct pagecache_page k;
+    k.state_offset = r.start >> pc->page_order;
+    u64 end = (r.end + MASK(pc->page_order)) >> pc->page_order;
+    pagecache_lock_node(pn);
+    pagecache_page pp = (pagecache_page)rbtree_lookup_max_lte(&pn->pages, &k.rbnode);
+    if (pp == INVALID_ADDRESS)
+        pp = (pagecache_page)rbtree_find_first(&pn->pages);
+    else if (page_offset(pp) < k.state_offset)
+        pp = (pagecache_page)rbnode_get_next((rbnode)pp);
+    pagecache_lock_state(pc);
+    for (; pp != INVALID_ADDRESS && page_offset(pp) < end;
+         pp = (pagecache_page)rbnode_get_next((rbnode)pp)) {
+        int state = page_state(pp);
+        if (pp->evicted || (pp->refcount.c != 1) ||
+            ((state != PAGECACHE_PAGESTATE_NEW) && (state != PAGECACHE_PAGESTATE_ACTIVE)))
+            continue;
+        pp->evicted = true;
+        vector_push(v, pp);
+    }
+    pagecache_unlock_state(pc);
+    pagecache_unlock_node(pn);
+    while ((pp = vector_pop(v)))
+        refcount_release(&pp->refcount);
+    deallocate_vector(v);
+}
+
 /* TODO could encode completion to indicate completion on transition
    to new rather than writing - otherwise we're completing on storage
    request issuance, not completion - just for sync use */
@@ -1287,6 +1321,11 @@ void *pagecache_get_zero_page(void)
     return global_pagecache->zero_page;
 }
 
+heap pagecache_get_contiguous_heap(void)
+{
+    return global_pagecache->contiguous;
+}
+
 int pagecache_get_page_order(void)
 {
     return global_pagecache->page_order;
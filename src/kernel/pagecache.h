@@ -16,12 +16,16 @@ void pagecache_sync_volume(pagecache_volume pv, status_handler complete);
 
 void *pagecache_get_zero_page(void);
 
+heap pagecache_get_contiguous_heap(void);
+
 int pagecache_get_page_order(void);
 
 u64 pagecache_get_occupancy(void);
 
 u64 pagecache_drain(u64 drain_bytes);
 
+void pagecache_node_evict_clean(pagecache_node pn, range r /* bytes */);
+
 pagecache_node pagecache_allocate_node(pagecache_volume pv, sg_io fs_read, sg_io fs_write, pagecache_node_reserve fs_reserve);
 
 void pagecache_deallocate_node(pagecache_node pn);
@@ -12,6 +12,7 @@
 static vector devices;
 static vector drivers;
 static heap virtual_page;
+static heap pci_general;
 
 static u32 pci_bar_len(pci_dev dev, int bar)
 {
@@ -154,31 +155,62 @@ u64 pci_msix_table_slot_addr(pci_dev dev, int msi_slot)
     return pci_msix_table_addr(dev) + (msi_slot * sizeof(u32) * 4);
 }
 
-u64 pci_setup_msix(pci_dev dev, int msi_slot, thunk h, const char *name)
+static void pci_msix_write_entry(u64 slot_addr, u32 address, u32 data)
 {
-    pci_debug("%s: msi %d: %s\n", __func__, msi_slot, name);
+    mmio_write_32(slot_addr + (sizeof(u32) * 0), address);
+    mmio_write_32(slot_addr + (sizeof(u32) * 1), 0);
+    mmio_write_32(slot_addr + (sizeof(u32) * 2), data);
+    mmio_write_32(slot_addr + (sizeof(u32) * 3), 0);
+}
+
+/* the entry is masked while its address and data are rewritten */
+closure_function(3, 1, void, pci_msix_retarget,
+                 pci_dev, dev, int, msi_slot, u64, vector,
+                 u32, cpu)
+{
+    u32 address, data;
+    msi_format(&address, &data, bound(vector), cpu);
+    u64 slot_addr = pci_msix_table_slot_addr(bound(dev), bound(msi_slot));
+    pci_debug("%s: msi %d, vector %d, cpu %d\n", __func__, bound(msi_slot), bound(vector), cpu);
+    mmio_write_32(slot_addr + (sizeof(u32) * 3), 1);
+    pci_msix_write_entry(slot_addr, address, data);
+}
+
+u64 pci_setup_msix_cpu(pci_dev dev, int msi_slot, thunk h, const char *name, u32 cpu)
+{
+    pci_debug("%s: msi %d: %s, cpu %d\n", __func__, msi_slot, name, cpu);
 
     u32 address, data;
     u64 vector = pci_platform_allocate_msi(dev, h, name, &address, &data);
     if (vector == INVALID_PHYSICAL)
         return vector;
 
+    irq_retarget r = closure(pci_general, pci_msix_retarget, dev, msi_slot, vector);
+    assert(r != INVALID_ADDRESS);
+    u32 target = irq_register_affinity(vector, name, cpu, r);
+    if (target != 0)
+        msi_format(&address, &data, vector, target);
+
     u64 slot_addr = pci_msix_table_slot_addr(dev, msi_slot);
-    pci_debug("   vector %d, address 0x%x, data 0x%x, table slot addr 0x%lx\n",
-              vector, address, data, slot_addr);
-    mmio_write_32(slot_addr + (sizeof(u32) * 0), address);
-    mmio_write_32(slot_addr + (sizeof(u32) * 1), 0);
-    mmio_write_32(slot_addr + (sizeof(u32) * 2), data);
-    mmio_write_32(slot_addr + (sizeof(u32) * 3), 0);
+    pci_debug("   vector %d, cpu %d, address 0x%x, data 0x%x, table slot addr 0x%lx\n",
+              vector, target, address, data, slot_addr);
+    pci_msix_write_entry(slot_addr, address, data);
     return vector;
 }
 
+/* vectors set up without an explicit cpu are spread over cpus round-robin */
+u64 pci_setup_msix(pci_dev dev, int msi_slot, thunk h, const char *name)
+{
+    return pci_setup_msix_cpu(dev, msi_slot, h, name, IRQ_CPU_ANY);
+}
+
 void pci_teardown_msix(pci_dev dev, int msi_slot)
 {
     u64 slot_addr = pci_msix_table_slot_addr(dev, msi_slot);
     int v = mmio_read_32(slot_addr + sizeof(u32) * 2) & 0xff;
     pci_debug("%s: table slot addr 0x%lx, msi %d: int %d\n", __func__, slot_addr, msi_slot, v);
     mmio_write_32(slot_addr + (sizeof(u32) * 3), 1); /* set Masked bit to 1 */
+    irq_unregister_affinity(v);
     pci_platform_deallocate_msi(dev, v);
 }
 
@@ -309,6 +341,7 @@ void init_pci(kernel_heaps kh)
 {
     // should use the global node space
     virtual_page = (heap)heap_virtual_page(kh);
+    pci_general = heap_general(kh);
     devices = allocate_vector(heap_general(kh), 8);
     drivers = allocate_vector(heap_general(kh), 8);
 }
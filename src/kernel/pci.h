@@ -44,6 +44,8 @@
 /* PCI device class */
 #define PCIC_STORAGE 0x01
 #define PCIS_STORAGE_IDE 0x01
+#define PCIS_STORAGE_SATA 0x06
+#define PCIPI_STORAGE_AHCI  0x01
 #define PCIS_STORAGE_NVM 0x08
 #define PCIPI_STORAGE_NVME  0x02
 
@@ -139,6 +141,7 @@ static inline u8 pci_get_hdrtype(pci_dev dev)
  */
 
 void pci_bar_init(pci_dev dev, struct pci_bar *b, int bar, bytes offset, bytes length);
+void pci_bar_deinit(struct pci_bar *b);
 void pci_platform_init_bar(pci_dev dev, int bar);
 u64 pci_platform_allocate_msi(pci_dev dev, thunk h, const char *name, u32 *address, u32 *data);
 void pci_platform_deallocate_msi(pci_dev dev, u64 v);
@@ -168,6 +171,7 @@ int pci_get_msix_count(pci_dev dev);
 int pci_enable_msix(pci_dev dev);
 void pci_enable_io_and_memory(pci_dev dev);
 u64 pci_setup_msix(pci_dev dev, int msi_slot, thunk h, const char *name);
+u64 pci_setup_msix_cpu(pci_dev dev, int msi_slot, thunk h, const char *name, u32 cpu);
 void pci_teardown_msix(pci_dev dev, int msi_slot);
 void pci_disable_msix(pci_dev dev);
 void pci_setup_non_msi_irq(pci_dev dev, thunk h, const char *name);
@@ -23,8 +23,6 @@ static int wakeup_vector;
 int shutdown_vector;
 boolean shutting_down;
 
-queue runqueue;                 /* kernel space from ?*/
-queue bhqueue;                  /* kernel from interrupt */
 timerheap runloop_timers;
 u64 idle_cpu_mask;              /* xxx - limited to 64 aps. consider merging with bitmask */
 timestamp last_timer_update;
@@ -168,6 +166,30 @@ static void migrate_from_self(cpuinfo ci, u64 cpu_mask)
     }
 }
 
+/* A cpu that is in the kernel or handling an interrupt drains its own queues on its way
+   through the runloop (the runqueue if it gets the kernel lock), so that work stays on the cpu
+   that queued it. Work left on the queues of an idle cpu or one running user code, e.g. after
+   it failed to take the kernel lock, is run here instead of waking or interrupting the owner. */
+static void steal_work(cpuinfo ci, boolean run_queue)
+{
+    thunk t;
+    for (u64 cpu = ci->id + 1; ; cpu++) {
+        if (cpu == total_processors)
+            cpu = 0;
+        if (cpu == ci->id)
+            break;
+        cpuinfo cpui = cpuinfo_from_id(cpu);
+        if ((cpui->state != cpu_idle) && (cpui->state != cpu_user))
+            continue;
+        queue q = run_queue ? cpui->run_queue : cpui->bh_queue;
+        while ((t = dequeue(q)) != INVALID_ADDRESS) {
+            sched_debug("running %s work from CPU %d\n", run_queue ? "runqueue" : "bhqueue",
+                        cpu);
+            run_thunk(t);
+        }
+    }
+}
+
 // should we ever be in the user frame here? i .. guess so?
 NOTRACE void __attribute__((noreturn)) runloop_internal()
 {
@@ -178,7 +200,7 @@ NOTRACE void __attribute__((noreturn)) runloop_internal()
     sched_thread_pause();
     disable_interrupts();
     sched_debug("runloop from %s b:%d r:%d t:%d i:%x%s\n", state_strings[ci->state],
-                queue_length(bhqueue), queue_length(runqueue), queue_length(ci->thread_queue),
+                queue_length(ci->bh_queue), queue_length(ci->run_queue), queue_length(ci->thread_queue),
                 idle_cpu_mask, ci->have_kernel_lock ? " locked" : "");
     ci->state = cpu_kernel;
     /* Make sure TLB entries are appropriately flushed before doing any work */
@@ -186,16 +208,20 @@ NOTRACE void __attribute__((noreturn)) runloop_internal()
 
     /* bhqueue is for operations outside the realm of the kernel lock,
        e.g. storage I/O completions */
-    while ((t = dequeue(bhqueue)) != INVALID_ADDRESS)
+    while ((t = dequeue(ci->bh_queue)) != INVALID_ADDRESS)
         run_thunk(t);
+    if (total_processors > 1)
+        steal_work(ci, false);
 
     if (kern_try_lock()) {
         /* invoke expired timer callbacks */
         ci->state = cpu_kernel;
         timer_service(runloop_timers, now(CLOCK_ID_MONOTONIC_RAW));
 
-        while ((t = dequeue(runqueue)) != INVALID_ADDRESS)
+        while ((t = dequeue(ci->run_queue)) != INVALID_ADDRESS)
             run_thunk(t);
+        if (total_processors > 1)
+            steal_work(ci, true);
 
         /* should be a list of per-runloop checks - also low-pri background */
         mm_service();
@@ -251,6 +277,10 @@ NOTRACE void __attribute__((noreturn)) runloop_internal()
         }
     }
 
+    /* nothing to run: prepare zeroed pages for anonymous faults before going idle */
+    if (!shutting_down)
+        zero_page_pool_refill();
+
     sched_thread_pause();
     kernel_sleep();
 }    
@@ -271,9 +301,6 @@ void init_scheduler(heap h)
     shutdown_vector = allocate_ipi_interrupt();
     register_interrupt(shutdown_vector, closure(h, global_shutdown), "shutdown ipi");
     assert(wakeup_vector != INVALID_PHYSICAL);
-    /* scheduling queues init */
-    runqueue = allocate_queue(h, 2048);
-    bhqueue = allocate_queue(h, 2048);
     runloop_timers = allocate_timerheap(h, "runloop");
     assert(runloop_timers != INVALID_ADDRESS);
     shutting_down = false;
@@ -9,13 +9,14 @@
 #include <symtab.h>
 #include <virtio/virtio.h>
 
-closure_function(2, 1, void, program_start,
-                 buffer, elf, process, kp,
+closure_function(3, 1, void, program_start,
+                 buffer, elf, tuple, program, process, kp,
                  status, s)
 {
     if (!is_ok(s))
         halt("%s: aborting %v\n", __func__, s);
-    exec_elf(bound(elf), bound(kp));
+    boot_timeline_mark("exec");
+    exec_elf(bound(elf), bound(program), bound(kp));
     closure_finish();
 }
 
@@ -24,6 +25,7 @@ closure_function(5, 1, status, read_program_complete,
                  buffer, b)
 {
     tuple root = bound(root);
+    boot_timeline_mark("storage_ready_wait");
     if (get(root, sym(trace))) {
         rprintf("read program complete: %p ", root);
         rprintf("gitversion: %s ", gitversion);
@@ -108,6 +110,7 @@ static void init_kernel_heaps_management(tuple root)
     set(heaps, sym(physical), heap_management((heap)heap_physical(kh)));
     set(heaps, sym(general), heap_management((heap)heap_general(kh)));
     set(heaps, sym(locked), heap_management((heap)heap_locked(kh)));
+    set(heaps, sym(zero_page_pool), zero_page_pool_management(heap_general(kh)));
     set(heaps, sym(no_encode), null_value);
     set(root, sym(heaps), heaps);
 }
@@ -133,6 +136,7 @@ closure_function(6, 0, void, startup,
     /* register root tuple with management and kick off interfaces, if any */
     init_management_root(root);
     init_kernel_heaps_management(root);
+    irq_affinity_start(root);
 #if 0
     http_listener hl = allocate_http_listener(general, 9090);
     assert(hl != INVALID_ADDRESS);
@@ -150,15 +154,17 @@ closure_function(6, 0, void, startup,
     tuple pro = resolve_path(root, split(general, p, '/'));
     if (get(root, sym(exec_protection)))
         set(pro, sym(exec), null_value);  /* set executable flag */
+    closure_member(program_start, start, program) = pro;
     init_network_iface(root);
-    filesystem_read_entire(fs, pro, heap_backed(kh), pg, closure(general, read_program_fail));
+    snapshot_load(fs, root, apply_merge(bound(m)));
+    read_elf_headers(fs, pro, general, pg, closure(general, read_program_fail));
     closure_finish();
 }
 
 thunk create_init(kernel_heaps kh, tuple root, filesystem fs, merge *m)
 {
     heap h = heap_general(kh);
-    status_handler start = closure(h, program_start, 0, 0);
+    status_handler start = closure(h, program_start, 0, 0, 0);
     *m = allocate_merge(h, start);
     return closure(h, startup, kh, root, fs, *m, start, apply_merge(*m));
 }
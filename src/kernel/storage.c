@@ -99,6 +99,7 @@ closure_function(2, 2, void, volume_link,
         set(mount, sym(root), volume_root);
         set(mount, sym(no_encode), null_value); /* non-persistent entry */
         set(mount_dir, sym(mount), mount);
+        fs_invalidate_path_cache();
         v->fs = fs;
         v->mount_dir = mount_dir;
         storage_debug("volume mounted, mount directory %p, root %p", mount_dir,
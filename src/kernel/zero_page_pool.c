@@ -0,0 +1,131 @@
+#include <kernel.h>
+
+/* Per-cpu pools of pre-zeroed physical pages
+
+   Anonymous page faults and brk growth need zeroed memory. Rather than zeroing pages on the
+   faulting cpu, idle cpus fill a small pool of zeroed pages from the runloop, before going to
+   sleep. Pages are zeroed in batches through a per-cpu kernel window, using non-temporal stores
+   so as not to evict the cache contents of the workload. A pool is only accessed by its own cpu,
+   with interrupts disabled; when it is empty, callers fall back to zeroing synchronously. */
+
+//#define ZERO_PAGE_POOL_DEBUG
+#ifdef ZERO_PAGE_POOL_DEBUG
+#define zpp_debug(x, ...) do {log_printf("ZPP", "[%02d] " x, current_cpu()->id, ##__VA_ARGS__);} while(0)
+#else
+#define zpp_debug(x, ...)
+#endif
+
+static u64 zero_page_get(void)
+{
+    u64 flags = irq_disable_save();
+    cpuinfo ci = current_cpu();
+    u64 paddr = ci->zero_page_count > 0 ? ci->zero_pages[--ci->zero_page_count] :
+        INVALID_PHYSICAL;
+    irq_restore(flags);
+    return paddr;
+}
+
+void zero_page_pool_refill(void)
+{
+    cpuinfo ci = current_cpu();
+    int n = MIN(ZERO_PAGE_POOL_SIZE - ci->zero_page_count, ZERO_PAGE_POOL_BATCH);
+    if (n <= 0)
+        return;
+    kernel_heaps kh = get_kernel_heaps();
+    heap physical = (heap)heap_physical(kh);
+
+    /* don't hold on to memory that the page cache would need to give back */
+    if (heap_free(physical) < PAGECACHE_DRAIN_CUTOFF)
+        return;
+    if (!ci->zero_window) {
+        ci->zero_window = allocate_u64((heap)heap_virtual_page(kh),
+                                       ZERO_PAGE_POOL_BATCH * PAGESIZE);
+        if (ci->zero_window == INVALID_PHYSICAL) {
+            ci->zero_window = 0;
+            return;
+        }
+    }
+    u64 len = n * PAGESIZE;
+    u64 paddr = allocate_u64(physical, len);
+    if (paddr == INVALID_PHYSICAL)
+        return;
+    zpp_debug("zeroing %d pages at 0x%lx\n", n, paddr);
+    map(ci->zero_window, paddr, len, pageflags_writable(pageflags_noexec(pageflags_memory())));
+    zero_nontemporal(pointer_from_u64(ci->zero_window), len);
+    unmap(ci->zero_window, len);
+
+    u64 flags = irq_disable_save();
+    for (int i = 0; i < n; i++)
+        ci->zero_pages[ci->zero_page_count++] = paddr + i * PAGESIZE;
+    irq_restore(flags);
+}
+
+boolean map_zeroed_pages(u64 vaddr, u64 length, pageflags flags)
+{
+    assert((vaddr & PAGEMASK) == 0);
+    assert((length & PAGEMASK) == 0);
+    u64 mapped = 0;
+    while (mapped < length) {
+        u64 paddr = zero_page_get();
+        if (paddr == INVALID_PHYSICAL)
+            break;
+        map(vaddr + mapped, paddr, PAGESIZE, flags);
+        mapped += PAGESIZE;
+    }
+    if (mapped)
+        fetch_and_add(&mm_stats.zero_pool_hits, mapped >> PAGELOG);
+    if (mapped == length)
+        return true;
+
+    u64 len = length - mapped;
+    fetch_and_add(&mm_stats.zero_pool_misses, len >> PAGELOG);
+    u64 paddr = allocate_u64((heap)heap_physical(get_kernel_heaps()), len);
+    if (paddr == INVALID_PHYSICAL) {
+        if (mapped)
+            unmap_and_free_phys(vaddr, mapped);
+        return false;
+    }
+    map_and_zero(vaddr + mapped, paddr, len, flags);
+    return true;
+}
+
+closure_function(1, 0, value, zero_page_pool_get_hits,
+                 value, v)
+{
+    return value_rewrite_u64(bound(v), mm_stats.zero_pool_hits);
+}
+
+closure_function(1, 0, value, zero_page_pool_get_misses,
+                 value, v)
+{
+    return value_rewrite_u64(bound(v), mm_stats.zero_pool_misses);
+}
+
+closure_function(1, 0, value, zero_page_pool_get_pages,
+                 value, v)
+{
+    u64 pages = 0;
+    for (int i = 0; i < total_processors; i++)
+        pages += cpuinfo_from_id(i)->zero_page_count;
+    return value_rewrite_u64(bound(v), pages);
+}
+
+#define register_stat(h, n, t, name)                                    \
+    v = value_from_u64(h, 0);                                           \
+    s = sym(name);                                                      \
+    set(t, s, v);                                                       \
+    tuple_notifier_register_get_notify(n, s, closure(h, zero_page_pool_get_ ##name, v));
+
+value zero_page_pool_management(heap h)
+{
+    value v;
+    symbol s;
+    tuple t = timm("pool_size", "%d", ZERO_PAGE_POOL_SIZE);
+    assert(t != INVALID_ADDRESS);
+    tuple_notifier n = tuple_notifier_wrap(t);
+    assert(n != INVALID_ADDRESS);
+    register_stat(h, n, t, hits);
+    register_stat(h, n, t, misses);
+    register_stat(h, n, t, pages);
+    return n;
+}
@@ -52,14 +52,16 @@
 
 #define LWIP_WND_SCALE 1
 #define TCP_MSS 1460            /* Assuming ethernet; may want to derive this */
-#define TCP_WND 65535
+/* Maximum receive window; connections start with a smaller window which is auto-tuned in
+   netsyscall.c. */
+#define TCP_WND (8 * 1024 * 1024)
 #define TCP_SND_BUF 65535
 #define TCP_SND_QUEUELEN TCP_SNDQUEUELEN_OVERFLOW
 #define TCP_OVERSIZE TCP_MSS
 #define TCP_QUEUE_OOSEQ 1
 
-#define TCP_RCV_SCALE 0         /* XXX check */
-#define TCP_LISTEN_BACKLOG 1
+#define TCP_RCV_SCALE 8         /* TCP_WND >> TCP_RCV_SCALE must fit in 16 bits */
+#define TCP_LISTEN_BACKLOG 1     /* limits the SYN queue; the accept queue is in netsyscall.c */
 #define LWIP_DHCP 1
 // would prefer to set this dynamically...also,
 // seems better to allow some progress to be made
@@ -133,6 +135,14 @@ extern void lwip_debug(char * format, ...);
 extern u32_t lwip_rand(void);
 #define LWIP_RAND   lwip_rand
 
+/* admission control for listening sockets (accept queue limits, SYN cookies), see netsyscall.c */
+struct tcp_pcb;
+struct tcp_hdr;
+struct pbuf;
+extern s8_t lwip_tcp_inpacket(struct tcp_pcb *pcb, struct tcp_hdr *hdr, u16_t optlen,
+                              u16_t opt1len, u8_t *opt2, struct pbuf *p);
+#define LWIP_HOOK_TCP_INPACKET_PCB  lwip_tcp_inpacket
+
 extern void net_debug(char *format, ...);
 extern void *lwip_allocate(unsigned long long size);
 extern void lwip_deallocate(void *z);
@@ -1,6 +1,8 @@
 #include <kernel.h>
 #include <lwip.h>
 #include <lwip/priv/tcp_priv.h>
+#include <tcp_cc.h>
+#include <syncookie.h>
 
 /* Network interface flags */
 #define IFF_UP          (1 << 0)
@@ -341,6 +343,16 @@ void init_network_iface(tuple root) {
     } else {
         rprintf("NET: no network interface found\n");
     }
+
+    string cc = get_string(root, sym(tcp_congestion));
+    if (cc) {
+        if (tcp_cc_set_default(buffer_ref(cc, 0), buffer_length(cc))) {
+            if (trace)
+                rprintf("NET: TCP congestion control %b\n", cc);
+        } else {
+            rprintf("NET: unknown TCP congestion control %b; ignored\n", cc);
+        }
+    }
 }
 
 extern void lwip_init();
@@ -351,6 +363,7 @@ void init_net(kernel_heaps kh)
     heap backed = heap_backed(kh);
     lwip_heap = allocate_mcache(h, backed, 5, MAX_LWIP_ALLOC_ORDER, PAGESIZE_2M);
     lwip_init();
+    syncookie_init();
     NETIF_DECLARE_EXT_CALLBACK(netif_callback);
     netif_add_ext_callback(&netif_callback, lwip_ext_callback);
 }
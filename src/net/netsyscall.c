@@ -8,8 +8,11 @@
 #include <unix_internal.h>
 #include <lwip.h>
 #include <lwip/udp.h>
+#include <lwip/prot/tcp.h>
 #include <net_system_structs.h>
 #include <socket.h>
+#include <tcp_cc.h>
+#include <syncookie.h>
 
 //#define NETSYSCALL_DEBUG
 #ifdef NETSYSCALL_DEBUG
@@ -31,6 +34,12 @@
 
 #define MTU_MAX (32 * KB)
 
+#define UDP_MAX_SEGMENTS    64
+
+#define TCP_WND_INIT        (64 * KB)
+#define TCP_BUF_MIN         (2 * TCP_MSS)
+#define TCP_SND_BUF_MAX     TCP_WND
+
 #define resolve_socket(__p, __fd) ({fdesc f = resolve_fd(__p, __fd); \
     if (f->type != FDESC_TYPE_SOCKET) \
         return set_syscall_error(current, ENOTSOCK); \
@@ -99,14 +108,39 @@ typedef struct netsock {
     queue incoming;
     err_t lwip_error;           /* lwIP error code; ERR_OK if normal */
     u8 ipv6only:1;
+    u8 zerocopy:1;              /* SO_ZEROCOPY */
     union {
 	struct {
 	    struct tcp_pcb *lw;
 	    enum tcp_socket_state state; // half open?
+	    u64 bytes_acked;
+	    struct list zc_errqueue;    /* MSG_ZEROCOPY notifications for MSG_ERRQUEUE */
+	    u32 zc_next_id;
+	    u32 rcv_wnd;                /* receive window, see tcp_rcv_consumed() */
+	    u32 rcv_deficit;            /* window credit to withhold after shrinking rcv_wnd */
+	    u32 rcv_epoch_bytes;        /* bytes consumed in the current auto-tuning epoch */
+	    timestamp rcv_epoch_start;
+	    u64 rcv_rate;               /* drain rate (bytes/s) at the last window increase */
+	    boolean rcv_wnd_full;       /* the sender filled the window during this epoch */
+	    u32 snd_buf;                /* send buffer, see tcp_snd_autotune() */
+	    u32 snd_deficit;            /* send buffer space to withhold after shrinking snd_buf */
+	    u32 rcv_buf_req, snd_buf_req;   /* SO_RCVBUF and SO_SNDBUF, or 0 to auto-tune */
+	    tcp_cc_ops cc_ops;          /* TCP_CONGESTION */
+	    struct tcp_cc cc;
+	    u32 acc_limit;              /* accept queue limit, from the listen() backlog */
+	    u32 defer_accept;           /* TCP_DEFER_ACCEPT (seconds) */
+	    struct list deferred;       /* connections held back by TCP_DEFER_ACCEPT */
+	    u32 deferred_count;
+	    timestamp cookie_stamp;     /* last SYN cookie sent */
+	    struct netsock *listener;   /* held back by TCP_DEFER_ACCEPT on this listening socket */
+	    struct list deferred_l;
+	    timestamp deferred_stamp;
 	} tcp;
 	struct {
 	    struct udp_pcb *lw;
 	    enum udp_socket_state state;
+	    u16 gso_size;       /* UDP_SEGMENT: split sends into datagrams of this size */
+	    boolean gro;        /* UDP_GRO: coalesce received datagrams */
 	} udp;
     } info;
 } *netsock;
@@ -131,6 +165,10 @@ static sysreturn netsock_recvmsg(struct sock *sock, struct msghdr *msg,
 static thunk net_loop_poll;
 static boolean net_loop_poll_queued;
 
+/* memory committed to TCP receive windows and send buffers */
+static u64 tcp_mem_used;
+static u64 tcp_mem_limit;
+
 closure_function(0, 0, void, netsock_poll) {
     net_loop_poll_queued = false;
     netif_poll_all();
@@ -167,6 +205,7 @@ closure_function(1, 1, u32, socket_events,
             return in ? EPOLLIN : 0;
         } else if (s->info.tcp.state == TCP_SOCK_OPEN) {
             return (in ? EPOLLIN | EPOLLRDNORM : 0) |
+                (list_empty(&s->info.tcp.zc_errqueue) ? 0 : EPOLLERR) |
                 (s->info.tcp.lw->state == ESTABLISHED ?
                 (tcp_sndbuf(s->info.tcp.lw) ? EPOLLOUT | EPOLLWRNORM : 0) :
                 EPOLLIN | EPOLLHUP);
@@ -340,6 +379,147 @@ struct udp_entry {
     u16 rport;
 };
 
+/* TCP buffer auto-tuning
+
+   Windows are scaled, so lwIP can advertise up to TCP_WND, but a connection starts out with a
+   TCP_WND_INIT receive window: the window is shrunk by withholding credit from tcp_recved() and
+   grown by handing out extra credit. An auto-tuning epoch lasts until the application has
+   consumed a full window; the window is doubled at the end of an epoch if the sender filled it
+   and the drain rate went up since the last increase, i.e. the window rather than the reader
+   was limiting throughput. Likewise, a writer that finds the send buffer full grows it to twice
+   the data that the congestion and peer windows allow in flight. Sizes set with SO_RCVBUF and
+   SO_SNDBUF are not auto-tuned, and no buffer grows once tcp_mem_limit is reached. */
+
+static boolean tcp_mem_charge(u64 old, u64 new, boolean autotune)
+{
+    if (new > old) {
+        if (autotune && (tcp_mem_used + new - old > tcp_mem_limit))
+            return false;
+        fetch_and_add(&tcp_mem_used, new - old);
+    } else {
+        fetch_and_add(&tcp_mem_used, -(old - new));
+    }
+    return true;
+}
+
+static void tcp_set_rcv_wnd(netsock s, u32 wnd)
+{
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    u32 old = s->info.tcp.rcv_wnd;
+    if (wnd > old) {
+        u32 credit = wnd - old;
+        u32 n = MIN(credit, s->info.tcp.rcv_deficit);
+        s->info.tcp.rcv_deficit -= n;
+        for (credit -= n; credit > 0; credit -= n) {
+            n = MIN(credit, 0xffff);    /* tcp_recved() takes a 16-bit length */
+            tcp_recved(lw, n);
+        }
+    } else {
+        /* Credit that has not been announced yet can be taken back right away; the rest is
+           withheld as data is consumed, since the window must not shrink. */
+        u32 unannounced = (lw->rcv_wnd > lw->rcv_ann_wnd) ? lw->rcv_wnd - lw->rcv_ann_wnd : 0;
+        u32 n = MIN(old - wnd, unannounced);
+        lw->rcv_wnd -= n;
+        s->info.tcp.rcv_deficit += old - wnd - n;
+    }
+    s->info.tcp.rcv_wnd = wnd;
+}
+
+static void tcp_set_snd_buf(netsock s, u32 size)
+{
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    u32 old = s->info.tcp.snd_buf;
+    if (size > old) {
+        u32 n = MIN(size - old, s->info.tcp.snd_deficit);
+        s->info.tcp.snd_deficit -= n;
+        lw->snd_buf += size - old - n;
+    } else {
+        /* space taken by unacknowledged data is withheld as it is acknowledged */
+        u32 n = MIN(old - size, lw->snd_buf);
+        lw->snd_buf -= n;
+        s->info.tcp.snd_deficit += old - size - n;
+    }
+    s->info.tcp.snd_buf = size;
+}
+
+static void tcp_rcv_epoch_start(netsock s)
+{
+    s->info.tcp.rcv_epoch_bytes = 0;
+    s->info.tcp.rcv_epoch_start = now(CLOCK_ID_MONOTONIC_RAW);
+    s->info.tcp.rcv_wnd_full = false;
+}
+
+/* Called when a connection is established, before any data is exchanged. */
+static void tcp_sock_established(netsock s)
+{
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    u32 wnd = MIN(s->info.tcp.rcv_buf_req ? s->info.tcp.rcv_buf_req : TCP_WND_INIT,
+                  TCP_WND_MAX(lw));
+
+    /* The SYN or SYN-ACK has announced an unscaled window, which must not shrink: a smaller
+       window starts out at the announced size and is shrunk as data is consumed. */
+    s32 edge = lw->rcv_ann_right_edge - lw->rcv_nxt;
+    u32 ann = (edge > 0) ? edge : 0;
+    lw->rcv_wnd = lw->rcv_ann_wnd = MAX(wnd, ann);
+    s->info.tcp.rcv_wnd = MAX(wnd, ann);
+    s->info.tcp.rcv_deficit = 0;
+    if (wnd < ann)
+        tcp_set_rcv_wnd(s, wnd);
+    s->info.tcp.rcv_rate = 0;
+    tcp_rcv_epoch_start(s);
+    u32 snd_buf = s->info.tcp.snd_buf_req ? s->info.tcp.snd_buf_req : TCP_SND_BUF;
+    lw->snd_buf = snd_buf;
+    s->info.tcp.snd_buf = snd_buf;
+    s->info.tcp.snd_deficit = 0;
+    tcp_mem_charge(0, wnd + snd_buf, false);
+    tcp_cc_init(&s->info.tcp.cc, s->info.tcp.cc_ops, lw);
+}
+
+/* Hand window credit for data consumed by the application back to lwIP. */
+static void tcp_rcv_consumed(netsock s, u64 len)
+{
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    if (!lw)
+        return;
+    u32 n = MIN(len, s->info.tcp.rcv_deficit);
+    s->info.tcp.rcv_deficit -= n;
+    if (len > n)
+        tcp_recved(lw, len - n);
+    if (s->info.tcp.rcv_buf_req)
+        return;
+    s->info.tcp.rcv_epoch_bytes += len;
+    u32 wnd = s->info.tcp.rcv_wnd;
+    if (s->info.tcp.rcv_epoch_bytes < wnd)
+        return;
+    timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
+    u64 rate = s->info.tcp.rcv_epoch_bytes * MILLION /
+        MAX(usec_from_timestamp(here - s->info.tcp.rcv_epoch_start), 1);
+    if (s->info.tcp.rcv_wnd_full && (rate > s->info.tcp.rcv_rate + s->info.tcp.rcv_rate / 4)) {
+        u32 new_wnd = MIN(2 * wnd, TCP_WND_MAX(lw));
+        if ((new_wnd > wnd) && tcp_mem_charge(wnd, new_wnd, true)) {
+            net_debug("sock %d, receive window %d -> %d\n", s->sock.fd, wnd, new_wnd);
+            tcp_set_rcv_wnd(s, new_wnd);
+            s->info.tcp.rcv_rate = rate;
+        }
+    }
+    tcp_rcv_epoch_start(s);
+}
+
+/* Returns true if the send buffer has been grown. */
+static boolean tcp_snd_autotune(netsock s)
+{
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    if (s->info.tcp.snd_buf_req)
+        return false;
+    u32 size = MIN(2 * (u64)MIN(lw->cwnd, lw->snd_wnd), TCP_SND_BUF_MAX);
+    u32 old = s->info.tcp.snd_buf;
+    if ((size <= old) || !tcp_mem_charge(old, size, true))
+        return false;
+    net_debug("sock %d, send buffer %d -> %d\n", s->sock.fd, old, size);
+    tcp_set_snd_buf(s, size);
+    return true;
+}
+
 static sysreturn sock_read_bh_internal(netsock s, thread t, void * dest,
                                        u64 length, int flags, struct sockaddr *src_addr,
                                        socklen_t *addrlen, io_completion completion, u64 bqflags)
@@ -412,7 +592,7 @@ static sysreturn sock_read_bh_internal(netsock s, thread t, void * dest,
                 xfer_total += xfer;
                 dest = (char *) dest + xfer;
                 if ((s->sock.type == SOCK_STREAM) && !(flags & MSG_PEEK))
-                    tcp_recved(s->info.tcp.lw, xfer);
+                    tcp_rcv_consumed(s, xfer);
             }
             if ((cur_buf->len == 0) || (flags & MSG_PEEK))
                 cur_buf = cur_buf->next;
@@ -495,6 +675,141 @@ closure_function(6, 1, sysreturn, recvmsg_bh,
     return rv;
 }
 
+/* copy len bytes from the start of a pbuf chain to an iovec array, starting at byte iov_off of
+   the array */
+static u64 pbuf_to_iov(struct pbuf *p, u64 len, struct iovec *iov, u64 iovlen, u64 iov_off)
+{
+    u64 copied = 0;
+    for (u64 i = 0; (i < iovlen) && (copied < len); i++) {
+        if (iov_off >= iov[i].iov_len) {
+            iov_off -= iov[i].iov_len;
+            continue;
+        }
+        u64 n = MIN(iov[i].iov_len - iov_off, len - copied);
+        pbuf_copy_partial(p, iov[i].iov_base + iov_off, n, copied);
+        copied += n;
+        iov_off = 0;
+    }
+    return copied;
+}
+
+static void put_cmsg(struct msghdr *msg, int level, int type, void *data, u64 len)
+{
+    if (!msg->msg_control || (msg->msg_controllen < CMSG_LEN(len))) {
+        msg->msg_controllen = 0;
+        msg->msg_flags |= MSG_CTRUNC;
+        return;
+    }
+    struct cmsghdr *cmsg = msg->msg_control;
+    cmsg->cmsg_len = CMSG_LEN(len);
+    cmsg->cmsg_level = level;
+    cmsg->cmsg_type = type;
+    runtime_memcpy(CMSG_DATA(cmsg), data, len);
+    msg->msg_controllen = MIN(msg->msg_controllen, CMSG_SPACE(len));
+}
+
+/* Receive the datagram at the head of the incoming queue into msg. With UDP_GRO, a run of
+   datagrams from the same source and of the same size (the last one may be shorter) is
+   received as one, and the segment size is reported in a UDP_GRO control message.
+   Called with the rx blockq lock held and the queue not empty. */
+static u64 udp_recv_msg(netsock s, struct msghdr *msg, int flags)
+{
+    struct udp_entry *e = queue_peek(s->incoming);
+    u64 space = iov_total_len(msg->msg_iov, msg->msg_iovlen);
+    ip_addr_t raddr;
+    u16 rport = e->rport;
+    runtime_memcpy(&raddr, &e->raddr, sizeof(raddr));
+    if (msg->msg_name)
+        addrport_to_sockaddr(s->sock.domain, &raddr, rport, msg->msg_name, &msg->msg_namelen);
+    msg->msg_flags = 0;
+
+    u64 len = 0;
+    u16 gso_size = 0;
+    int segs = 0;
+    while (true) {
+        u16 dlen = e->pbuf->tot_len;
+        u64 xfer = pbuf_to_iov(e->pbuf, MIN(dlen, space - len), msg->msg_iov, msg->msg_iovlen,
+                               len);
+        if (xfer < dlen)
+            msg->msg_flags |= MSG_TRUNC;
+        len += xfer;
+        if (segs++ == 0)
+            gso_size = dlen;
+        if (flags & MSG_PEEK) {
+            e = queue_peek_at(s->incoming, segs);
+        } else {
+            assert(dequeue(s->incoming) == e);
+            pbuf_free(e->pbuf);
+            deallocate(s->sock.h, e, sizeof(struct udp_entry));
+            e = queue_peek(s->incoming);
+        }
+        if (!s->info.udp.gro || (e == INVALID_ADDRESS) || (segs == UDP_MAX_SEGMENTS) ||
+            (msg->msg_flags & MSG_TRUNC) || (dlen == 0) || (dlen < gso_size))
+            break;
+        u16 next_len = e->pbuf->tot_len;
+        if ((next_len == 0) || (next_len > gso_size) || (len + next_len > space) ||
+            (e->rport != rport) || !ip_addr_cmp(&e->raddr, &raddr))
+            break;
+    }
+    if (!(flags & MSG_PEEK) && (queue_peek(s->incoming) == INVALID_ADDRESS))
+        fdesc_notify_events(&s->sock.f); /* reset a triggered EPOLLIN condition */
+    if (segs > 1) {
+        int val = gso_size;
+        put_cmsg(msg, SOL_UDP, UDP_GRO, &val, sizeof(val));
+    } else {
+        msg->msg_controllen = 0;
+    }
+    return len;
+}
+
+/* Serves both recvmsg() (msgs is a struct msghdr, vlen is 1) and recvmmsg() (msgs is an array
+   of struct mmsghdr) on datagram sockets. Only blocks until the first datagram arrives if
+   MSG_WAITFORONE is set. */
+closure_function(7, 1, sysreturn, udp_recvmmsg_bh,
+                 netsock, s, thread, t, void *, msgs, unsigned int, vlen, int, flags, boolean, mmsg, unsigned int, count,
+                 u64, bqflags)
+{
+    netsock s = bound(s);
+    thread t = bound(t);
+    int flags = bound(flags);
+    err_t err = get_lwip_error(s);
+    sysreturn rv;
+    u64 len = 0;
+    net_debug("sock %d, thread %ld, vlen %d, count %d, flags 0x%x, bqflags 0x%lx, lwip err %d\n",
+              s->sock.fd, t->tid, bound(vlen), bound(count), flags, bqflags, err);
+
+    if ((err == ERR_OK) && !(bqflags & BLOCKQ_ACTION_NULLIFY)) {
+        while ((bound(count) < bound(vlen)) && (queue_peek(s->incoming) != INVALID_ADDRESS)) {
+            if (bound(mmsg)) {
+                struct mmsghdr *m = (struct mmsghdr *)bound(msgs) + bound(count);
+                m->msg_len = udp_recv_msg(s, &m->msg_hdr, flags);
+            } else {
+                len = udp_recv_msg(s, bound(msgs), flags);
+            }
+            bound(count)++;
+        }
+    }
+    if (bound(count) < bound(vlen)) {
+        if (err != ERR_OK)
+            rv = lwip_to_errno(err);
+        else if (bqflags & BLOCKQ_ACTION_NULLIFY)
+            rv = -ERESTARTSYS;
+        else if ((bqflags & BLOCKQ_ACTION_TIMEDOUT) || (s->sock.f.flags & SOCK_NONBLOCK) ||
+                 (flags & MSG_DONTWAIT) || (bound(count) && (flags & MSG_WAITFORONE)))
+            rv = -EAGAIN;
+        else
+            return BLOCKQ_BLOCK_REQUIRED;
+        if (bound(count) == 0)
+            goto out;
+    }
+    rv = bound(mmsg) ? bound(count) : len;
+  out:
+    net_debug("   rv %ld\n", rv);
+    blockq_handle_completion(s->sock.rxbq, bqflags, syscall_io_complete, t, rv);
+    closure_finish();
+    return rv;
+}
+
 closure_function(1, 6, sysreturn, socket_read,
                  netsock, s,
                  void *, dest, u64, length, u64, offset, thread, t, boolean, bh, io_completion, completion)
@@ -511,11 +826,69 @@ closure_function(1, 6, sysreturn, socket_read,
     return blockq_check(s->sock.rxbq, t, ba, bh);
 }
 
+/* MSG_ZEROCOPY notification. lwIP's tcp_write() builds its own pbufs around the data pointer,
+   so there is no way to attach a custom pbuf that would keep user pages referenced until lwIP
+   and the NIC drivers are done with them. The data is copied instead, and each send is
+   reported at once with SO_EE_CODE_ZEROCOPY_COPIED, as Linux does when it cannot use the user
+   pages; consecutive ids are merged. */
+typedef struct zc_send {
+    struct list l;
+    u32 lo, hi;                 /* notification id range */
+} *zc_send;
+
+static void zc_send_notify(netsock s, zc_send zc)
+{
+    u32 id = s->info.tcp.zc_next_id++;
+    list errq = &s->info.tcp.zc_errqueue;
+    if (!list_empty(errq)) {
+        zc_send last = struct_from_list(errq->prev, zc_send, l);
+        if (last->hi + 1 == id) {
+            last->hi = id;
+            deallocate(s->sock.h, zc, sizeof(*zc));
+            return;
+        }
+    }
+    zc->lo = zc->hi = id;
+    list_push_back(errq, &zc->l);
+    fdesc_notify_events(&s->sock.f);
+}
+
+static void zc_send_flush(netsock s)
+{
+    list_foreach(&s->info.tcp.zc_errqueue, l) {
+        list_delete(l);
+        deallocate(s->sock.h, struct_from_list(l, zc_send, l), sizeof(struct zc_send));
+    }
+}
+
+static sysreturn zc_recv_errqueue(netsock s, struct msghdr *msg)
+{
+    if ((s->sock.type != SOCK_STREAM) || list_empty(&s->info.tcp.zc_errqueue))
+        return -EAGAIN;
+    zc_send zc = struct_from_list(list_begin(&s->info.tcp.zc_errqueue), zc_send, l);
+    struct sock_extended_err ee;
+    runtime_memset((u8 *)&ee, 0, sizeof(ee));
+    ee.ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+    ee.ee_code = SO_EE_CODE_ZEROCOPY_COPIED;
+    ee.ee_info = zc->lo;
+    ee.ee_data = zc->hi;
+    msg->msg_flags = MSG_ERRQUEUE;
+    if (s->sock.domain == AF_INET6)
+        put_cmsg(msg, IPPROTO_IPV6, IPV6_RECVERR, &ee, sizeof(ee));
+    else
+        put_cmsg(msg, SOL_IP, IP_RECVERR, &ee, sizeof(ee));
+    list_delete(&zc->l);
+    deallocate(s->sock.h, zc, sizeof(*zc));
+    fdesc_notify_events(&s->sock.f);
+    return 0;
+}
+
 static sysreturn socket_write_tcp_bh_internal(netsock s, thread t, void * buf,
                                               u64 remain, int flags, io_completion completion,
                                               u64 bqflags)
 {
     sysreturn rv = 0;
+    zc_send zc = 0;
     err_t err = get_lwip_error(s);
     net_debug("fd %d, thread %ld, buf %p, remain %ld, flags 0x%x, bqflags 0x%lx, lwip err %d\n",
               s->sock.fd, t->tid, buf, remain, flags, bqflags, err);
@@ -541,6 +914,8 @@ static sysreturn socket_write_tcp_bh_internal(netsock s, thread t, void * buf,
        anyway), so even if we have a large transmit window due to
        LWIP_WND_SCALE, we still can't write more than 2^16. Sigh... */
     u64 avail = tcp_sndbuf(s->info.tcp.lw);
+    if ((avail == 0) && tcp_snd_autotune(s))
+        avail = tcp_sndbuf(s->info.tcp.lw);
     if (avail == 0) {
       full:
         if ((bqflags & BLOCKQ_ACTION_BLOCKED) == 0 &&
@@ -564,11 +939,26 @@ static sysreturn socket_write_tcp_bh_internal(netsock s, thread t, void * buf,
         n = remain;
     }
 
+    if ((flags & MSG_ZEROCOPY) && s->zerocopy) {
+        zc = allocate(s->sock.h, sizeof(*zc));
+        if (zc == INVALID_ADDRESS) {
+            zc = 0;
+            rv = -ENOBUFS;
+            goto out;
+        }
+    }
+
     /* XXX need to pore over lwIP error conditions here */
     err = tcp_write(s->info.tcp.lw, buf, n, apiflags);
     if (err == ERR_OK) {
+        if (zc) {
+            zc_send_notify(s, zc);
+            zc = 0;
+        }
         /* XXX prob add a flag to determine whether to continuously
            post data, e.g. if used by send/sendto... */
+        if (!s->info.tcp.lw->unacked)
+            tcp_cc_output(&s->info.tcp.cc, s->info.tcp.lw);   /* sent right away */
         err = tcp_output(s->info.tcp.lw);
         if (err == ERR_OK) {
             net_debug(" tcp_write and tcp_output successful for %ld bytes\n", n);
@@ -585,6 +975,10 @@ static sysreturn socket_write_tcp_bh_internal(netsock s, thread t, void * buf,
     } else if (err == ERR_MEM) {
         /* XXX some ambiguity in lwIP - investigate */
         net_debug(" tcp_write() returned ERR_MEM\n");
+        if (zc) {
+            deallocate(s->sock.h, zc, sizeof(*zc));
+            zc = 0;
+        }
         goto full;
     } else {
         net_debug(" tcp_write() lwip error: %d\n", err);
@@ -592,6 +986,8 @@ static sysreturn socket_write_tcp_bh_internal(netsock s, thread t, void * buf,
     }
   out:
     net_debug("   completion %p, rv %ld\n", completion, rv);
+    if (zc)
+        deallocate(s->sock.h, zc, sizeof(*zc));
     blockq_handle_completion(s->sock.txbq, bqflags, completion, t, rv);
     return rv;
 }
@@ -607,8 +1003,9 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
     return rv;
 }
 
+/* gso_size, if non-zero, splits the payload into datagrams of this size (UDP_SEGMENT) */
 static sysreturn socket_write_udp(netsock s, void *source, u64 length,
-                                  struct sockaddr *dest_addr, socklen_t addrlen)
+                                  struct sockaddr *dest_addr, socklen_t addrlen, u16 gso_size)
 {
     ip_addr_t ipaddr;
     u16 port;
@@ -628,27 +1025,61 @@ static sysreturn socket_write_udp(netsock s, void *source, u64 length,
         }
     }
     err_t err = ERR_OK;
+    u64 seg_len = (gso_size && (length > gso_size)) ? gso_size : length;
+    if (length > seg_len * UDP_MAX_SEGMENTS)
+        return -EINVAL;
 
     /* XXX check how much we can queue, maybe make udp bh */
     /* XXX check if remote endpoint set? let LWIP check? */
-    struct pbuf * pbuf = pbuf_alloc(PBUF_TRANSPORT, length, PBUF_RAM);
+    /* If a segment fails after others have been sent, the bytes sent so far are returned. */
+    sysreturn rv = 0;
+    u64 offset = 0;
+    do {
+        u64 n = MIN(seg_len, length - offset);
+        struct pbuf * pbuf = pbuf_alloc(PBUF_TRANSPORT, n, PBUF_RAM);
 
-    if (!pbuf) {
-        msg_err("failed to allocate pbuf for udp_send()\n");
-        return -ENOBUFS;
-    }
-    runtime_memcpy(pbuf->payload, source, length);
-    if (dest_addr)
-        err = udp_sendto(s->info.udp.lw, pbuf, &ipaddr, port);
-    else
-        err = udp_send(s->info.udp.lw, pbuf);
-    pbuf_free(pbuf);
-    if (err != ERR_OK) {
-        net_debug("lwip error %d\n", err);
-        return lwip_to_errno(err);
-    }
+        if (!pbuf) {
+            msg_err("failed to allocate pbuf for udp_send()\n");
+            rv = -ENOBUFS;
+            break;
+        }
+        runtime_memcpy(pbuf->payload, source + offset, n);
+        if (dest_addr)
+            err = udp_sendto(s->info.udp.lw, pbuf, &ipaddr, port);
+        else
+            err = udp_send(s->info.udp.lw, pbuf);
+        pbuf_free(pbuf);
+        if (err != ERR_OK) {
+            net_debug("lwip error %d\n", err);
+            rv = lwip_to_errno(err);
+            break;
+        }
+        offset += n;
+    } while (offset < length);
+    if (offset == 0)
+        return rv;
     netsock_check_loop();
-    return length;
+    return offset;
+}
+
+/* segment size for a datagram send: a UDP_SEGMENT control message overrides the socket option */
+static sysreturn udp_msg_gso_size(netsock s, const struct msghdr *msg)
+{
+    sysreturn gso_size = s->info.udp.gso_size;
+    u64 offset = 0;
+    while (msg->msg_control && (offset + sizeof(struct cmsghdr) <= msg->msg_controllen)) {
+        struct cmsghdr *cmsg = msg->msg_control + offset;
+        if ((cmsg->cmsg_len < sizeof(struct cmsghdr)) ||
+            (cmsg->cmsg_len > msg->msg_controllen - offset))
+            return -EINVAL;
+        if ((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_SEGMENT)) {
+            if (cmsg->cmsg_len != CMSG_LEN(sizeof(u16)))
+                return -EINVAL;
+            gso_size = *(u16 *)CMSG_DATA(cmsg);
+        }
+        offset += CMSG_ALIGN(cmsg->cmsg_len);
+    }
+    return gso_size;
 }
 
 static sysreturn socket_write_internal(struct sock *sock, void *source,
@@ -673,7 +1104,7 @@ static sysreturn socket_write_internal(struct sock *sock, void *source,
                                    source, length, flags, completion);
         return blockq_check(sock->txbq, t, ba, bh);
     } else if (sock->type == SOCK_DGRAM) {
-        rv = socket_write_udp(s, source, length, dest_addr, addrlen);
+        rv = socket_write_udp(s, source, length, dest_addr, addrlen, s->info.udp.gso_size);
     } else {
 	msg_err("socket type %d unsupported\n", sock->type);
 	rv = -EINVAL;
@@ -883,6 +1314,9 @@ closure_function(1, 2, sysreturn, netsock_ioctl,
 }
 
 #define SOCK_QUEUE_LEN 128
+#define SOMAXCONN 4096              /* maximum listen() backlog */
+#define TCP_SYN_BACKLOG_MAX 255     /* lwIP listen backlog (SYN queue) is 8 bits wide */
+#define TCP_DEFER_ACCEPT_POLL 2     /* in lwIP coarse timer ticks (500 ms) */
 
 closure_function(1, 2, sysreturn, socket_close,
                  netsock, s,
@@ -892,6 +1326,16 @@ closure_function(1, 2, sysreturn, socket_close,
     net_debug("sock %d, type %d\n", s->sock.fd, s->sock.type);
     switch (s->sock.type) {
     case SOCK_STREAM:
+        if (s->info.tcp.listener) {
+            list_delete(&s->info.tcp.deferred_l);
+            s->info.tcp.listener->info.tcp.deferred_count--;
+        }
+        list_foreach(&s->info.tcp.deferred, l) {
+            netsock child = struct_from_list(l, netsock, info.tcp.deferred_l);
+            child->info.tcp.listener = 0;
+            if (child->info.tcp.lw)
+                tcp_poll(child->info.tcp.lw, 0, 0);
+        }
         /* tcp_close() doesn't really stop everything synchronously; in order to
          * prevent any lwIP callback that might be called after tcp_close() from
          * using a stale reference to the socket structure, set the callback
@@ -901,6 +1345,8 @@ closure_function(1, 2, sysreturn, socket_close,
             tcp_arg(s->info.tcp.lw, 0);
             netsock_check_loop();
         }
+        zc_send_flush(s);
+        tcp_mem_charge(s->info.tcp.rcv_wnd + s->info.tcp.snd_buf, 0, false);
         break;
     case SOCK_DGRAM:
         udp_remove(s->info.udp.lw);
@@ -1037,6 +1483,7 @@ static int allocate_sock(process p, int af, int type, u32 flags, netsock *rs)
     s->sock.recvmsg = netsock_recvmsg;
     s->sock.shutdown = netsock_shutdown;
     s->ipv6only = 0;
+    s->zerocopy = 0;
     set_lwip_error(s, ERR_OK);
     *rs = s;
     return fd;
@@ -1049,13 +1496,27 @@ err_sock:
     return -ENOMEM;
 }
 
-static int allocate_tcp_sock(process p, int af, struct tcp_pcb *pcb, u32 flags)
+static int allocate_tcp_sock(process p, int af, struct tcp_pcb *pcb, u32 flags, netsock *rs)
 {
     netsock s;
     int fd = allocate_sock(p, af, SOCK_STREAM, flags, &s);
     if (fd >= 0) {
 	s->info.tcp.lw = pcb;
 	s->info.tcp.state = TCP_SOCK_CREATED;
+	s->info.tcp.bytes_acked = 0;
+	list_init(&s->info.tcp.zc_errqueue);
+	s->info.tcp.zc_next_id = 0;
+	s->info.tcp.rcv_wnd = s->info.tcp.snd_buf = 0;
+	s->info.tcp.rcv_buf_req = s->info.tcp.snd_buf_req = 0;
+	s->info.tcp.cc_ops = tcp_cc_get_default();
+	s->info.tcp.cc.ops = 0;
+	s->info.tcp.acc_limit = s->info.tcp.defer_accept = 0;
+	list_init(&s->info.tcp.deferred);
+	s->info.tcp.deferred_count = 0;
+	s->info.tcp.cookie_stamp = 0;
+	s->info.tcp.listener = 0;
+	if (rs)
+	    *rs = s;
     }
     return fd;
 }
@@ -1067,6 +1528,8 @@ static int allocate_udp_sock(process p, int af, struct udp_pcb *pcb, u32 flags)
     if (fd >= 0) {
 	s->info.udp.lw = pcb;
 	s->info.udp.state = UDP_SOCK_CREATED;
+	s->info.udp.gso_size = 0;
+	s->info.udp.gro = false;
 	udp_recv(pcb, udp_input_lower, s);
     }
     return fd;
@@ -1109,7 +1572,7 @@ sysreturn socket(int domain, int type, int protocol)
             return -ENOMEM;
 
         int fd = allocate_tcp_sock(current->p, domain, p,
-            nonblock ? SOCK_NONBLOCK : 0);
+            nonblock ? SOCK_NONBLOCK : 0, 0);
         net_debug("new tcp fd %d, pcb %p\n", fd, p);
         return fd;
     } else if (type == SOCK_DGRAM) {
@@ -1126,6 +1589,31 @@ sysreturn socket(int domain, int type, int protocol)
     return -EINVAL;
 }
 
+/* With TCP_DEFER_ACCEPT, an established connection is not reported to the application until data
+   arrives, the peer closes, or the listener's timeout expires. */
+static void tcp_defer_accept_done(netsock s)
+{
+    netsock l = s->info.tcp.listener;
+    net_debug("sock %d, listener %d\n", s->sock.fd, l->sock.fd);
+    s->info.tcp.listener = 0;
+    list_delete(&s->info.tcp.deferred_l);
+    l->info.tcp.deferred_count--;
+    if (s->info.tcp.lw)
+        tcp_poll(s->info.tcp.lw, 0, 0);
+    assert(enqueue(l->incoming, s));
+    wakeup_sock(l, WAKEUP_SOCK_RX);
+}
+
+static err_t tcp_defer_accept_poll(void *z, struct tcp_pcb *pcb)
+{
+    netsock s = z;
+    if (s && s->info.tcp.listener &&
+        (now(CLOCK_ID_MONOTONIC_RAW) - s->info.tcp.deferred_stamp >=
+         seconds(s->info.tcp.listener->info.tcp.defer_accept)))
+        tcp_defer_accept_done(s);
+    return ERR_OK;
+}
+
 static err_t tcp_input_lower(void *z, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
 {
     if (!z) {
@@ -1145,8 +1633,12 @@ static err_t tcp_input_lower(void *z, struct tcp_pcb *pcb, struct pbuf *p, err_t
 	    msg_err("incoming queue full\n");
             return ERR_BUF;     /* XXX verify */
         }
+        if (pcb->rcv_wnd <= s->info.tcp.rcv_deficit + s->info.tcp.rcv_wnd / 8)
+            s->info.tcp.rcv_wnd_full = true;
     }
     wakeup_sock(s, WAKEUP_SOCK_RX);
+    if (s->info.tcp.listener)
+        tcp_defer_accept_done(s);
 
     return ERR_OK;
 }
@@ -1209,6 +1701,8 @@ static void lwip_tcp_conn_err(void * z, err_t err) {
     s->info.tcp.lw = 0;
 
     wakeup_sock(s, WAKEUP_SOCK_EXCEPT);
+    if (s->info.tcp.listener)
+        tcp_defer_accept_done(s);
 }
 
 static err_t lwip_tcp_sent(void * arg, struct tcp_pcb * pcb, u16 len)
@@ -1218,6 +1712,13 @@ static err_t lwip_tcp_sent(void * arg, struct tcp_pcb * pcb, u16 len)
     }
     netsock s = (netsock)arg;
     net_debug("fd %d, pcb %p, len %d\n", s->sock.fd, pcb, len);
+    s->info.tcp.bytes_acked += len;
+    if (s->info.tcp.snd_deficit) {
+        u32 n = MIN(s->info.tcp.snd_deficit, pcb->snd_buf);
+        pcb->snd_buf -= n;
+        s->info.tcp.snd_deficit -= n;
+    }
+    tcp_cc_ack(&s->info.tcp.cc, pcb, len);
     wakeup_sock(s, WAKEUP_SOCK_TX);
     return ERR_OK;
 }
@@ -1270,6 +1771,8 @@ static err_t connect_tcp_complete(void* arg, struct tcp_pcb* tpcb, err_t err)
    assert(s->info.tcp.state == TCP_SOCK_IN_CONNECTION);
    s->info.tcp.state = TCP_SOCK_OPEN; /* XXX state handling needs fixing; this could indicate an error as well */
    set_lwip_error(s, err);
+   if (err == ERR_OK)
+       tcp_sock_established(s);
    wakeup_sock(s, WAKEUP_SOCK_TX);
    return ERR_OK;
 }
@@ -1458,9 +1961,25 @@ static sysreturn netsock_sendmsg(struct sock *s, const struct msghdr *msg,
     u64 len;
     sysreturn rv;
 
+    if ((flags & MSG_ZEROCOPY) && ((netsock)s)->zerocopy && (s->type == SOCK_STREAM) &&
+        (msg->msg_iovlen == 1)) {
+        rv = sendto_prepare(s, flags);
+        if (rv < 0)
+            return set_syscall_return(current, rv);
+        return socket_write_internal(s, msg->msg_iov[0].iov_base, msg->msg_iov[0].iov_len,
+                                     flags, 0, 0, current, false, syscall_io_complete);
+    }
     rv = sendmsg_prepare(s, msg, flags, &buf, &len);
     if (rv <= 0)
         return set_syscall_return(current, rv);
+    if (s->type == SOCK_DGRAM) {
+        netsock ns = (netsock)s;
+        rv = udp_msg_gso_size(ns, msg);
+        if (rv >= 0)
+            rv = socket_write_udp(ns, buf, len, msg->msg_name, msg->msg_namelen, rv);
+        sendmsg_complete_internal(s, buf, len, current, rv);
+        return rv;
+    }
     io_completion completion = closure(s->h, sendmsg_complete, s, buf, len);
     return socket_write_internal(s, buf, len, flags, msg->msg_name, msg->msg_namelen,
         current, false, completion);
@@ -1572,8 +2091,10 @@ sysreturn sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
             rv = blockq_check(sock->txbq, current, ba, false);
             break;
         case SOCK_DGRAM:
-            rv = socket_write_udp(s, buf, len, msg_hdr->msg_name,
-                msg_hdr->msg_namelen);
+            rv = udp_msg_gso_size(s, msg_hdr);
+            if (rv >= 0)
+                rv = socket_write_udp(s, buf, len, msg_hdr->msg_name,
+                    msg_hdr->msg_namelen, rv);
             break;
         }
         deallocate(sock->h, buf, len);
@@ -1627,9 +2148,16 @@ static sysreturn netsock_recvmsg(struct sock *sock, struct msghdr *msg,
     u8 *buf;
     netsock s = (netsock) sock;
 
+    if (flags & MSG_ERRQUEUE)
+        return set_syscall_return(current, zc_recv_errqueue(s, msg));
     if ((sock->type == SOCK_STREAM) && (s->info.tcp.state != TCP_SOCK_OPEN)) {
         return set_syscall_error(current, (s->info.tcp.state == TCP_SOCK_UNDEFINED) ? 0 : ENOTCONN);
     }
+    if (sock->type == SOCK_DGRAM) {
+        blockq_action ba = closure(sock->h, udp_recvmmsg_bh, s, current, msg, 1, flags, false,
+                                   0);
+        return blockq_check(sock->rxbq, current, ba, false);
+    }
     total_len = 0;
     for (int i = 0; i < msg->msg_iovlen; i++) {
         total_len += msg->msg_iov[i].iov_len;
@@ -1658,6 +2186,38 @@ sysreturn recvmsg(int sockfd, struct msghdr *msg, int flags)
     return s->recvmsg(s, msg, flags);
 }
 
+sysreturn recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+                   struct timespec *timeout)
+{
+    struct sock *sock = resolve_socket(current->p, sockfd);
+    netsock s = get_netsock(sock);
+    if (!s || (sock->type != SOCK_DGRAM))
+        return -EOPNOTSUPP;
+
+    net_debug("sock %d, type %d, thread %ld, vlen %d, flags 0x%x\n", sock->fd, sock->type,
+              current->tid, vlen, flags);
+    if (vlen == 0)
+        return 0;
+    if (!validate_user_memory(msgvec, vlen * sizeof(struct mmsghdr), true))
+        return -EFAULT;
+    for (int i = 0; i < vlen; i++) {
+        if (!validate_msghdr(&msgvec[i].msg_hdr, true))
+            return -EFAULT;
+    }
+    timestamp ts = 0;
+    if (timeout) {
+        if (!validate_user_memory(timeout, sizeof(struct timespec), false))
+            return -EFAULT;
+        ts = time_from_timespec(timeout);
+        /* a zero timeout polls, whereas no timeout to blockq_check_timeout() waits forever */
+        if (ts == 0)
+            flags |= MSG_DONTWAIT;
+    }
+    blockq_action ba = closure(sock->h, udp_recvmmsg_bh, s, current, msgvec, vlen, flags, true,
+                               0);
+    return blockq_check_timeout(sock->rxbq, current, ba, false, CLOCK_ID_MONOTONIC, ts, false);
+}
+
 static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
 {
     if (!z) {
@@ -1672,7 +2232,11 @@ static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
     }
 
     /* XXX such a thing as nonblock inherited from listen socket? */
-    int fd = allocate_tcp_sock(s->p, s->sock.domain, lw, 0);
+    /* The fd is already visible to other threads of the process, so the
+       files vector can't be read here without fd_lock; take the socket from
+       the allocation instead. */
+    netsock sn;
+    int fd = allocate_tcp_sock(s->p, s->sock.domain, lw, 0, &sn);
     if (fd < 0)
 	return ERR_MEM;
 
@@ -1680,33 +2244,126 @@ static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
     // refcnt
 
     net_debug("new fd %d, pcb %p\n", fd, lw);
-    netsock sn = vector_get(s->p->files, fd);
     sn->info.tcp.state = TCP_SOCK_OPEN;
     sn->sock.fd = fd;
+    sn->info.tcp.rcv_buf_req = s->info.tcp.rcv_buf_req;
+    sn->info.tcp.snd_buf_req = s->info.tcp.snd_buf_req;
+    sn->info.tcp.cc_ops = s->info.tcp.cc_ops;
+    tcp_sock_established(sn);
     set_lwip_error(s, ERR_OK);
     tcp_arg(lw, sn);
     tcp_recv(lw, tcp_input_lower);
     tcp_err(lw, lwip_tcp_conn_err);
     tcp_sent(lw, lwip_tcp_sent);
+    if (s->info.tcp.defer_accept) {
+        sn->info.tcp.listener = s;
+        sn->info.tcp.deferred_stamp = now(CLOCK_ID_MONOTONIC_RAW);
+        list_insert_before(&s->info.tcp.deferred, &sn->info.tcp.deferred_l);
+        s->info.tcp.deferred_count++;
+        tcp_poll(lw, tcp_defer_accept_poll, TCP_DEFER_ACCEPT_POLL);
+        return ERR_OK;
+    }
     if (!enqueue(s->incoming, sn)) {
-        msg_err("queue overrun; shouldn't happen with lwIP listen backlog\n");
+        msg_err("queue overrun; shouldn't happen with accept queue limit\n");
         return ERR_BUF;         /* lwIP will do tcp_abort */
     }
 
-    /* consume a slot in the lwIP listen backlog */
-    tcp_backlog_delayed(lw);
-
     wakeup_sock(s, WAKEUP_SOCK_RX);
     return ERR_OK;
 }
 
+/* Connections waiting in the accept queue, including those held back by TCP_DEFER_ACCEPT */
+static boolean tcp_accept_queue_full(netsock s)
+{
+    return queue_length(s->incoming) + s->info.tcp.deferred_count >= s->info.tcp.acc_limit;
+}
+
+/* Called by lwIP (LWIP_HOOK_TCP_INPACKET_PCB) before a segment is processed by the pcb it belongs
+   to; the segment is dropped unless ERR_OK is returned.
+   A handshake is not allowed to complete while the accept queue of the listener is full: the
+   segment is dropped as in Linux, and the peer retransmits until the application has accepted
+   enough connections, instead of lwIP resetting the connection. When the SYN queue (the lwIP
+   listen backlog) is full, SYNs are answered with SYN cookies. */
+err_t lwip_tcp_inpacket(struct tcp_pcb *pcb, struct tcp_hdr *hdr, u16 optlen, u16 opt1len,
+                        u8 *opt2, struct pbuf *p)
+{
+    u8 flags = TCPH_FLAGS(hdr);
+    if (flags & TCP_RST)
+        return ERR_OK;
+    switch (pcb->state) {
+    case LISTEN: {
+        struct tcp_pcb_listen *lpcb = (struct tcp_pcb_listen *)pcb;
+        netsock s = lpcb->callback_arg;
+        if (!s || (lpcb->accept != accept_tcp_from_lwip))
+            break;      /* not a socket, e.g. the gdb stub */
+        if ((flags & (TCP_SYN | TCP_ACK)) == TCP_SYN) {
+            if (tcp_accept_queue_full(s))
+                return ERR_ABRT;
+            if (lpcb->accepts_pending >= lpcb->backlog) {
+                if (syncookie_send(lpcb, hdr, optlen, opt1len, opt2))
+                    s->info.tcp.cookie_stamp = now(CLOCK_ID_MONOTONIC_RAW);
+                return ERR_ABRT;
+            }
+        } else if ((flags & (TCP_SYN | TCP_ACK)) == TCP_ACK) {
+            /* if no cookies have been sent lately, let lwIP reset the connection */
+            if (!s->info.tcp.cookie_stamp ||
+                (now(CLOCK_ID_MONOTONIC_RAW) - s->info.tcp.cookie_stamp > SYNCOOKIE_LIFETIME))
+                break;
+            if (tcp_accept_queue_full(s))
+                return ERR_ABRT;
+            struct tcp_pcb *npcb = syncookie_accept(lpcb, hdr);
+            if (!npcb)
+                break;
+            net_debug("sock %d, pcb %p from SYN cookie\n", s->sock.fd, npcb);
+            if (accept_tcp_from_lwip(s, npcb, ERR_OK) != ERR_OK)
+                tcp_abort(npcb);
+
+            /* any data in the segment is retransmitted by the peer */
+            return ERR_ABRT;
+        }
+        break;
+    }
+    case SYN_RCVD:
+        /* callback_arg is inherited from the listener; listener is cleared if it closes */
+        if ((flags & TCP_ACK) && pcb->listener && pcb->callback_arg &&
+            (pcb->listener->accept == accept_tcp_from_lwip) &&
+            tcp_accept_queue_full(pcb->callback_arg))
+            return ERR_ABRT;
+        break;
+    default:
+        break;
+    }
+    return ERR_OK;
+}
+
 static sysreturn netsock_listen(struct sock *sock, int backlog)
 {
     netsock s = (netsock) sock;
     if (s->sock.type != SOCK_STREAM)
 	return -EOPNOTSUPP;
-    backlog = MAX(backlog, SOCK_QUEUE_LEN);
-    struct tcp_pcb * lw = tcp_listen_with_backlog(s->info.tcp.lw, backlog);
+
+    /* as in Linux, the backlog is silently capped at SOMAXCONN */
+    u32 acc_limit = MIN(MAX(backlog, 1), SOMAXCONN);
+    if (acc_limit > _queue_size(s->incoming)) {
+        queue q = allocate_queue(s->sock.h, acc_limit);
+        if (q == INVALID_ADDRESS)
+            return -ENOMEM;
+        void *child;
+        while ((child = dequeue(s->incoming)) != INVALID_ADDRESS)
+            assert(enqueue(q, child));
+        deallocate_queue(s->incoming);
+        s->incoming = q;
+    }
+    s->info.tcp.acc_limit = acc_limit;
+    u8 syn_backlog = MIN(acc_limit, TCP_SYN_BACKLOG_MAX);
+    if (s->info.tcp.state == TCP_SOCK_LISTENING) {
+        tcp_backlog_set(s->info.tcp.lw, syn_backlog);
+        return 0;
+    }
+    err_t err;
+    struct tcp_pcb * lw = tcp_listen_with_backlog_and_err(s->info.tcp.lw, syn_backlog, &err);
+    if (!lw)
+        return lwip_to_errno(err);
     s->info.tcp.lw = lw;
     s->info.tcp.state = TCP_SOCK_LISTENING;
     set_lwip_error(s, ERR_OK);
@@ -1770,9 +2427,6 @@ closure_function(5, 1, sysreturn, accept_bh,
     if (queue_length(s->incoming) == 0)
         fdesc_notify_events(&s->sock.f);
 
-    /* release slot in lwIP listen backlog */
-    tcp_backlog_accepted(child->info.tcp.lw);
-
     rv = child->sock.fd;
   out:
     syscall_return(t, rv);
@@ -1877,6 +2531,43 @@ sysreturn setsockopt(int sockfd,
     if (!validate_user_memory(optval, optlen, false))
         return -EFAULT;
     switch (level) {
+    case SOL_SOCKET:
+        switch (optname) {
+        case SO_ZEROCOPY:
+            if (sock->type != SOCK_STREAM)
+                return -EOPNOTSUPP;
+            if (optlen != sizeof(int))
+                return -EINVAL;
+            s->zerocopy = *((int *)optval) != 0;
+            break;
+        case SO_SNDBUF:
+        case SO_RCVBUF: {
+            if (sock->type != SOCK_STREAM)
+                goto unimplemented;
+            if (optlen != sizeof(int))
+                return -EINVAL;
+            u32 size = MIN(MAX(*((int *)optval), TCP_BUF_MIN), TCP_WND);
+            boolean open = (s->info.tcp.state == TCP_SOCK_OPEN) && s->info.tcp.lw;
+            if (optname == SO_SNDBUF) {
+                s->info.tcp.snd_buf_req = size;
+                if (open) {
+                    tcp_mem_charge(s->info.tcp.snd_buf, size, false);
+                    tcp_set_snd_buf(s, size);
+                }
+            } else {
+                s->info.tcp.rcv_buf_req = size;
+                if (open) {
+                    size = MIN(size, TCP_WND_MAX(s->info.tcp.lw));
+                    tcp_mem_charge(s->info.tcp.rcv_wnd, size, false);
+                    tcp_set_rcv_wnd(s, size);
+                }
+            }
+            break;
+        }
+        default:
+            goto unimplemented;
+        }
+        break;
     case IPPROTO_IPV6:
         switch (optname) {
         case IPV6_V6ONLY:
@@ -1888,6 +2579,52 @@ sysreturn setsockopt(int sockfd,
             goto unimplemented;
         }
         break;
+    case IPPROTO_TCP:
+        if (sock->type != SOCK_STREAM)
+            return -ENOPROTOOPT;
+        switch (optname) {
+        case TCP_CONGESTION: {
+            const char *name = optval;
+            bytes len = 0;
+            while ((len < optlen) && name[len])
+                len++;
+            tcp_cc_ops ops = tcp_cc_find(name, len);
+            if (!ops)
+                return -ENOENT;
+            s->info.tcp.cc_ops = ops;
+            if (s->info.tcp.cc.ops && s->info.tcp.lw)
+                tcp_cc_set(&s->info.tcp.cc, ops, s->info.tcp.lw);
+            break;
+        }
+        case TCP_DEFER_ACCEPT:
+            if (optlen != sizeof(int))
+                return -EINVAL;
+            s->info.tcp.defer_accept = MAX(*((int *)optval), 0);
+            break;
+        default:
+            goto unimplemented;
+        }
+        break;
+    case SOL_UDP:
+        if (sock->type != SOCK_DGRAM)
+            return -ENOPROTOOPT;
+        if (optlen != sizeof(int))
+            return -EINVAL;
+        switch (optname) {
+        case UDP_SEGMENT: {
+            int val = *((int *)optval);
+            if ((val < 0) || (val > 0xffff))
+                return -EINVAL;
+            s->info.udp.gso_size = val;
+            break;
+        }
+        case UDP_GRO:
+            s->info.udp.gro = *((int *)optval) != 0;
+            break;
+        default:
+            goto unimplemented;
+        }
+        break;
     default:
         goto unimplemented;
     }
@@ -1903,7 +2640,8 @@ sysreturn getsockopt(int sockfd, int level, int optname, void *optval, socklen_t
     struct sock *sock = resolve_socket(current->p, sockfd);
     netsock s = get_netsock(sock);
     if (!s)
-        return -EOPNOTSUPP;
+        return sock->getsockopt ? sock->getsockopt(sock, level, optname, optval, optlen) :
+            -EOPNOTSUPP;
     net_debug("sock %d, type %d, thread %ld, level %d, optname %d\n, optlen %d\n",
         s->sock.fd, s->sock.type, current->tid, level, optname,
         optlen ? *optlen : -1);
@@ -1914,6 +2652,8 @@ sysreturn getsockopt(int sockfd, int level, int optname, void *optval, socklen_t
     union {
         int val;
         struct linger linger;
+        struct tcp_info info;
+        char name[TCP_CC_NAME_MAX];
     } ret_optval;
     int ret_optlen;
 
@@ -1930,7 +2670,17 @@ sysreturn getsockopt(int sockfd, int level, int optname, void *optval, socklen_t
             break;
         case SO_SNDBUF:
         case SO_RCVBUF:
-            ret_optval.val = 2048;  /* minimum value for this option in Linux */
+            if (s->sock.type != SOCK_STREAM) {
+                ret_optval.val = 2048;  /* minimum value for this option in Linux */
+            } else {
+                /* as in Linux, report twice the size to account for bookkeeping overhead */
+                boolean snd = (optname == SO_SNDBUF);
+                u32 size = snd ? s->info.tcp.snd_buf : s->info.tcp.rcv_wnd;
+                if (!size)
+                    size = snd ? (s->info.tcp.snd_buf_req ? s->info.tcp.snd_buf_req : TCP_SND_BUF) :
+                        (s->info.tcp.rcv_buf_req ? s->info.tcp.rcv_buf_req : TCP_WND_INIT);
+                ret_optval.val = 2 * size;
+            }
             ret_optlen = sizeof(ret_optval.val);
             break;
         case SO_PRIORITY:
@@ -1942,6 +2692,10 @@ sysreturn getsockopt(int sockfd, int level, int optname, void *optval, socklen_t
             ret_optval.linger.l_linger = 0;
             ret_optlen = sizeof(ret_optval.linger);
             break;
+        case SO_ZEROCOPY:
+            ret_optval.val = s->zerocopy;
+            ret_optlen = sizeof(ret_optval.val);
+            break;
         default:
             goto unimplemented;
         }
@@ -1956,6 +2710,52 @@ sysreturn getsockopt(int sockfd, int level, int optname, void *optval, socklen_t
             goto unimplemented;
         }
         break;
+    case IPPROTO_TCP:
+        if (s->sock.type != SOCK_STREAM)
+            return -ENOPROTOOPT;
+        switch (optname) {
+        case TCP_CONGESTION:
+            zero(ret_optval.name, sizeof(ret_optval.name));
+            runtime_memcpy(ret_optval.name, s->info.tcp.cc_ops->name,
+                           runtime_strlen(s->info.tcp.cc_ops->name));
+            ret_optlen = sizeof(ret_optval.name);
+            break;
+        case TCP_INFO:
+            if (!s->info.tcp.cc.ops || !s->info.tcp.lw) {
+                zero(&ret_optval.info, sizeof(ret_optval.info));
+            } else {
+                tcp_cc_info(&s->info.tcp.cc, s->info.tcp.lw, &ret_optval.info);
+                ret_optval.info.tcpi_rcv_space = s->info.tcp.rcv_wnd;
+                ret_optval.info.tcpi_bytes_acked = s->info.tcp.bytes_acked;
+                ret_optval.info.tcpi_notsent_bytes =
+                    s->info.tcp.lw->snd_lbb - s->info.tcp.lw->snd_nxt;
+            }
+            ret_optlen = sizeof(ret_optval.info);
+            break;
+        case TCP_DEFER_ACCEPT:
+            ret_optval.val = s->info.tcp.defer_accept;
+            ret_optlen = sizeof(ret_optval.val);
+            break;
+        default:
+            goto unimplemented;
+        }
+        break;
+    case SOL_UDP:
+        if (s->sock.type != SOCK_DGRAM)
+            return -ENOPROTOOPT;
+        switch (optname) {
+        case UDP_SEGMENT:
+            ret_optval.val = s->info.udp.gso_size;
+            ret_optlen = sizeof(ret_optval.val);
+            break;
+        case UDP_GRO:
+            ret_optval.val = s->info.udp.gro;
+            ret_optlen = sizeof(ret_optval.val);
+            break;
+        default:
+            goto unimplemented;
+        }
+        break;
     default:
         return -EOPNOTSUPP;
     }
@@ -1985,6 +2785,7 @@ void register_net_syscalls(struct syscall *map)
     register_syscall(map, sendmmsg, sendmmsg);
     register_syscall(map, recvfrom, recvfrom);
     register_syscall(map, recvmsg, recvmsg);
+    register_syscall(map, recvmmsg, recvmmsg);
     register_syscall(map, setsockopt, setsockopt);
     register_syscall(map, getsockname, getsockname);
     register_syscall(map, getpeername, getpeername);
@@ -2000,6 +2801,7 @@ boolean netsyscall_init(unix_heaps uh)
     if (socket_cache == INVALID_ADDRESS)
 	return false;
     uh->socket_cache = socket_cache;
+    tcp_mem_limit = heap_total((heap)heap_physical(kh)) / 8;
     net_loop_poll = closure(heap_general(kh), netsock_poll);
     netlink_init();
     return true;
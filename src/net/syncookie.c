@@ -0,0 +1,176 @@
+#include <kernel.h>
+#include <lwip.h>
+#include <lwip/inet_chksum.h>
+#include <lwip/priv/tcp_priv.h>
+#include <syncookie.h>
+
+/* A cookie is the initial sequence number of the SYN-ACK:
+   bits 31-27: time counter, incremented every SYNCOOKIE_PERIOD
+   bits 26-24: index in syncookie_mss[] of the MSS advertised by the peer
+   bits 23-0:  HMAC of the addresses and ports, the peer's ISN, the counter and the MSS index
+ */
+
+#define SYNCOOKIE_PERIOD    seconds(64)
+#define SYNCOOKIE_MAX_AGE   (SYNCOOKIE_LIFETIME / SYNCOOKIE_PERIOD - 1)
+#define SYNCOOKIE_HASH_MASK MASK(24)
+
+/* the hash is HMAC-SHA256 with a random key, truncated to SYNCOOKIE_HASH_MASK */
+#define SYNCOOKIE_KEY_BYTES     32
+#define SHA256_BLOCK_BYTES      64
+#define SHA256_BYTES            32
+#define SYNCOOKIE_MSG_MAX_BYTES (2 * 16 + 3 * sizeof(u32)) /* IPv6 addresses, ports, ISN, count */
+
+static const u16 syncookie_mss[] = {
+    536, 1220, 1300, 1360, 1400, 1440, 1452, 1460
+};
+
+/* the key padded to a block and xored with the HMAC inner and outer pads */
+static u8 syncookie_ipad[SHA256_BLOCK_BYTES];
+static u8 syncookie_opad[SHA256_BLOCK_BYTES];
+
+void syncookie_init(void)
+{
+    u64 key[SYNCOOKIE_KEY_BYTES / sizeof(u64)];
+    for (int i = 0; i < _countof(key); i++)
+        key[i] = random_u64();
+    for (int i = 0; i < SHA256_BLOCK_BYTES; i++) {
+        u8 k = (i < SYNCOOKIE_KEY_BYTES) ? ((u8 *)key)[i] : 0;
+        syncookie_ipad[i] = k ^ 0x36;
+        syncookie_opad[i] = k ^ 0x5c;
+    }
+    zero(key, sizeof(key));
+}
+
+static void syncookie_write_addr(buffer b, const ip_addr_t *a)
+{
+    if (IP_IS_V4(a))
+        buffer_write(b, &ip_2_ip4(a)->addr, sizeof(ip_2_ip4(a)->addr));
+    else
+        buffer_write(b, ip_2_ip6(a)->addr, sizeof(ip_2_ip6(a)->addr));
+}
+
+static u32 syncookie_hash(struct tcp_hdr *hdr, u32 isn, u32 count, u32 mss_idx)
+{
+    buffer inner = little_stack_buffer(SHA256_BLOCK_BYTES + SYNCOOKIE_MSG_MAX_BYTES);
+    buffer_write(inner, syncookie_ipad, SHA256_BLOCK_BYTES);
+    syncookie_write_addr(inner, ip_current_src_addr());
+    syncookie_write_addr(inner, ip_current_dest_addr());
+    buffer_write_le32(inner, ((u32)hdr->src << 16) | hdr->dest);
+    buffer_write_le32(inner, isn);
+    buffer_write_le32(inner, (count << 3) | mss_idx);
+    buffer outer = little_stack_buffer(SHA256_BLOCK_BYTES + SHA256_BYTES);
+    buffer_write(outer, syncookie_opad, SHA256_BLOCK_BYTES);
+    sha256(outer, inner);
+    buffer mac = little_stack_buffer(SHA256_BYTES);
+    sha256(mac, outer);
+    u8 *d = buffer_ref(mac, 0);
+    return ((d[0] << 16) | (d[1] << 8) | d[2]) & SYNCOOKIE_HASH_MASK;
+}
+
+static u32 syncookie_count(void)
+{
+    return now(CLOCK_ID_MONOTONIC_RAW) / SYNCOOKIE_PERIOD;
+}
+
+static u8 syncookie_opt_byte(struct tcp_hdr *hdr, u16 opt1len, u8 *opt2, u16 i)
+{
+    return (i < opt1len) ? ((u8 *)(hdr + 1))[i] : opt2[i - opt1len];
+}
+
+/* MSS option of a SYN, or the default MSS if there is none */
+static u16 syncookie_peer_mss(struct tcp_hdr *hdr, u16 optlen, u16 opt1len, u8 *opt2)
+{
+    u16 i = 0;
+    while (i < optlen) {
+        u8 kind = syncookie_opt_byte(hdr, opt1len, opt2, i);
+        if (kind == LWIP_TCP_OPT_EOL)
+            break;
+        if (kind == LWIP_TCP_OPT_NOP) {
+            i++;
+            continue;
+        }
+        if (i + 1 >= optlen)
+            break;
+        u8 len = syncookie_opt_byte(hdr, opt1len, opt2, i + 1);
+        if ((len < 2) || (i + len > optlen))
+            break;
+        if ((kind == LWIP_TCP_OPT_MSS) && (len == LWIP_TCP_OPT_LEN_MSS))
+            return (syncookie_opt_byte(hdr, opt1len, opt2, i + 2) << 8) |
+                syncookie_opt_byte(hdr, opt1len, opt2, i + 3);
+        i += len;
+    }
+    return syncookie_mss[0];
+}
+
+boolean syncookie_send(struct tcp_pcb_listen *lpcb, struct tcp_hdr *hdr, u16 optlen, u16 opt1len,
+                       u8 *opt2)
+{
+    u16 mss = syncookie_peer_mss(hdr, optlen, opt1len, opt2);
+    u32 mss_idx = _countof(syncookie_mss) - 1;
+    while ((mss_idx > 0) && (syncookie_mss[mss_idx] > mss))
+        mss_idx--;
+    u32 count = syncookie_count();
+    u32 cookie = ((count & 0x1f) << 27) | (mss_idx << 24) |
+        syncookie_hash(hdr, hdr->seqno, count, mss_idx);
+
+    struct pbuf *p = pbuf_alloc(PBUF_IP, TCP_HLEN + LWIP_TCP_OPT_LEN_MSS, PBUF_RAM);
+    if (!p)
+        return false;
+    struct tcp_hdr *synack = p->payload;
+    synack->src = lwip_htons(hdr->dest);
+    synack->dest = lwip_htons(hdr->src);
+    synack->seqno = lwip_htonl(cookie);
+    synack->ackno = lwip_htonl(hdr->seqno + 1);
+    TCPH_HDRLEN_FLAGS_SET(synack, (TCP_HLEN + LWIP_TCP_OPT_LEN_MSS) / 4, TCP_SYN | TCP_ACK);
+    synack->wnd = lwip_htons(TCPWND_MIN16(TCP_WND));
+    synack->chksum = 0;
+    synack->urgp = 0;
+    *(u32 *)(synack + 1) = lwip_htonl((LWIP_TCP_OPT_MSS << 24) | (LWIP_TCP_OPT_LEN_MSS << 16) |
+                                      TCP_MSS);
+    const ip_addr_t *src = ip_current_dest_addr();
+    const ip_addr_t *dest = ip_current_src_addr();
+    synack->chksum = ip_chksum_pseudo(p, IP_PROTO_TCP, p->tot_len, src, dest);
+    err_t err = ip_output(p, src, dest, lpcb->ttl, lpcb->tos, IP_PROTO_TCP);
+    pbuf_free(p);
+    return (err == ERR_OK);
+}
+
+/* Validates the cookie acknowledged by hdr and creates an established pcb for the connection, as
+   tcp_listen_input() and tcp_process() would have done if the SYN had been queued. */
+struct tcp_pcb *syncookie_accept(struct tcp_pcb_listen *lpcb, struct tcp_hdr *hdr)
+{
+    u32 cookie = hdr->ackno - 1;
+    u32 isn = hdr->seqno - 1;
+    u32 mss_idx = (cookie >> 24) & 0x7;
+    u32 count = syncookie_count();
+    u32 age;
+    for (age = 0; age <= SYNCOOKIE_MAX_AGE; age++) {
+        if (((count - age) & 0x1f) == (cookie >> 27) &&
+            (syncookie_hash(hdr, isn, count - age, mss_idx) == (cookie & SYNCOOKIE_HASH_MASK)))
+            break;
+    }
+    if (age > SYNCOOKIE_MAX_AGE)
+        return 0;
+
+    struct tcp_pcb *pcb = tcp_alloc(lpcb->prio);
+    if (!pcb)
+        return 0;
+    ip_addr_copy(pcb->local_ip, *ip_current_dest_addr());
+    ip_addr_copy(pcb->remote_ip, *ip_current_src_addr());
+    pcb->local_port = lpcb->local_port;
+    pcb->remote_port = hdr->src;
+    pcb->state = ESTABLISHED;
+    pcb->rcv_nxt = hdr->seqno;
+    pcb->rcv_ann_right_edge = pcb->rcv_nxt + TCPWND_MIN16(TCP_WND);   /* as in the SYN-ACK */
+    pcb->snd_nxt = pcb->lastack = pcb->snd_lbb = pcb->snd_wl2 = hdr->ackno;
+    pcb->snd_wl1 = hdr->seqno;
+    pcb->snd_wnd = pcb->snd_wnd_max = hdr->wnd;
+    pcb->callback_arg = lpcb->callback_arg;
+    pcb->listener = lpcb;
+    pcb->so_options = lpcb->so_options & SOF_INHERITED;
+    pcb->netif_idx = lpcb->netif_idx;
+    pcb->mss = tcp_eff_send_mss(syncookie_mss[mss_idx], &pcb->local_ip, &pcb->remote_ip);
+    pcb->cwnd = LWIP_TCP_CALC_INITIAL_CWND(pcb->mss);
+    TCP_REG_ACTIVE(pcb);
+    return pcb;
+}
@@ -0,0 +1,13 @@
+/* SYN cookies
+
+   When the SYN queue of a listening pcb is full, a SYN is answered with a SYN-ACK whose sequence
+   number encodes the connection parameters, and no state is kept; the connection is created when
+   the peer acknowledges the cookie. Window scaling is not negotiated for such connections. These
+   functions are called from the TCP input hook, with the header fields in host byte order. */
+
+#define SYNCOOKIE_LIFETIME  seconds(128)
+
+void syncookie_init(void);
+boolean syncookie_send(struct tcp_pcb_listen *lpcb, struct tcp_hdr *hdr, u16 optlen, u16 opt1len,
+                       u8 *opt2);
+struct tcp_pcb *syncookie_accept(struct tcp_pcb_listen *lpcb, struct tcp_hdr *hdr);
@@ -0,0 +1,370 @@
+#include <kernel.h>
+#include <lwip.h>
+#include <lwip/priv/tcp_priv.h>
+#include <tcp_cc.h>
+
+//#define TCP_CC_DEBUG
+#ifdef TCP_CC_DEBUG
+#define tcp_cc_debug(x, ...) do {log_printf("TCPCC", "%s: " x, __func__, ##__VA_ARGS__);} while(0)
+#else
+#define tcp_cc_debug(x, ...)
+#endif
+
+#define CWND_MAX            (1ull << 30)
+#define MIN_RTT_WINDOW      seconds(10)
+
+static u64 icbrt(u64 x)
+{
+    u64 r = 0;
+    for (int s = 63; s >= 0; s -= 3) {
+        r <<= 1;
+        u64 b = 3 * r * (r + 1) + 1;
+        if ((x >> s) >= b) {
+            x -= b << s;
+            r++;
+        }
+    }
+    return r;
+}
+
+/* CUBIC (RFC 8312)
+
+   After a reduction the window follows W(t) = C * (t - K)^3 + W_max, with C = 0.4 and t in
+   seconds, so that it approaches the window at which the loss occurred slowly and then probes
+   beyond it, independently of the round-trip time. It never grows slower than Reno would. */
+
+#define CUBIC_BETA          717         /* multiplicative decrease factor (0.7), scaled by 1024 */
+#define CUBIC_T_MAX         100000      /* clamp for t - K in ms, to keep the cube in range */
+
+static void cubic_init(tcp_cc cc, struct tcp_pcb *pcb)
+{
+    cc->cubic.w_max = 0;
+    cc->cubic.epoch_start = 0;
+
+    /* leave slow start on the first loss rather than at lwIP's initial threshold */
+    pcb->ssthresh = CWND_MAX;
+}
+
+static void cubic_ack(tcp_cc cc, struct tcp_pcb *pcb, u32 acked, boolean round_end)
+{
+    u64 cwnd = cc->cwnd;
+    u64 mss = pcb->mss;
+    if (cwnd < pcb->ssthresh) {
+        cwnd += acked;
+    } else {
+        timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
+        if (!cc->cubic.epoch_start) {
+            cc->cubic.epoch_start = here;
+            if (cwnd < cc->cubic.w_max) {
+                /* K^3 = (W_max - cwnd) / C, in ms and segments */
+                cc->cubic.k = icbrt((cc->cubic.w_max - cwnd) / mss * 2500 * MILLION);
+                cc->cubic.origin = cc->cubic.w_max;
+            } else {
+                cc->cubic.k = 0;
+                cc->cubic.origin = cwnd;
+            }
+            cc->cubic.w_est = cwnd;
+        }
+
+        /* target the window one round trip ahead */
+        u64 elapsed = usec_from_timestamp(here - cc->cubic.epoch_start) / THOUSAND;
+        s64 t = elapsed + cc->srtt / THOUSAND - cc->cubic.k;
+        t = MIN(MAX(t, -CUBIC_T_MAX), CUBIC_T_MAX);
+        s64 target = cc->cubic.origin + 4 * t * t * t / (s64)(10 * BILLION) * (s64)mss;
+
+        /* Reno-friendly region: Reno grows by 3 * (1 - beta) / (1 + beta) = 9/17 segments per
+           round trip on average */
+        if (cc->srtt) {
+            u64 w_est = cc->cubic.w_est + elapsed * THOUSAND * 9 / (17 * (u64)cc->srtt) * mss;
+            target = MAX(target, (s64)w_est);
+        }
+        if (target > (s64)cwnd)
+            cwnd += MIN((target - cwnd) * acked / cwnd, acked);
+    }
+    pcb->cwnd = MIN(MAX(cwnd, 2 * mss), CWND_MAX);
+}
+
+static void cubic_loss(tcp_cc cc, struct tcp_pcb *pcb, boolean timeout)
+{
+    u64 cwnd = cc->cwnd;
+
+    /* fast convergence: release bandwidth to new flows if the window keeps shrinking */
+    cc->cubic.w_max = (cwnd < cc->cubic.w_max) ? cwnd * (1024 + CUBIC_BETA) / 2048 : cwnd;
+    cc->cubic.epoch_start = 0;
+    u32 ssthresh = MAX(cwnd * CUBIC_BETA / 1024, 2 * pcb->mss);
+    tcp_cc_debug("pcb %p, cwnd %d, ssthresh %d, timeout %d\n", pcb, cwnd, ssthresh, timeout);
+    pcb->ssthresh = ssthresh;
+
+    /* lwIP sets cwnd to ssthresh at the end of fast recovery, which may have ended already;
+       after a timeout, slow start resumes from lwIP's one-segment window */
+    if (!timeout && !(pcb->flags & TF_INFR))
+        pcb->cwnd = ssthresh;
+}
+
+/* BBR
+
+   The window is derived from a model of the path: the bottleneck bandwidth is the maximum
+   delivery rate over the last BBR_BW_ROUNDS round trips and the propagation delay is the
+   minimum RTT over MIN_RTT_WINDOW. lwIP has no pacing, so the pacing gains of BBR are applied to
+   the window instead and transmission is clocked by acknowledgments. Loss is not treated as a
+   congestion signal. */
+
+enum bbr_mode {
+    BBR_STARTUP,        /* double the delivery rate each round until it stops growing */
+    BBR_DRAIN,          /* drain the queue built up during startup */
+    BBR_PROBE_BW,       /* cycle around the estimated bandwidth-delay product */
+    BBR_PROBE_RTT,      /* shrink the window to measure the propagation delay */
+};
+
+#define BBR_UNIT            256
+#define BBR_HIGH_GAIN       739         /* 2 / ln(2) */
+#define BBR_FULL_BW_THRESH  320         /* bandwidth growth expected in startup (1.25) */
+#define BBR_FULL_BW_ROUNDS  3
+#define BBR_MIN_CWND        4           /* segments */
+#define BBR_PROBE_RTT_TIME  milliseconds(200)
+
+static const u16 bbr_cycle_gain[] = {
+    BBR_UNIT * 5 / 4, BBR_UNIT * 3 / 4, BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT,
+};
+
+static void bbr_init(tcp_cc cc, struct tcp_pcb *pcb)
+{
+    zero(&cc->bbr, sizeof(cc->bbr));
+    cc->bbr.mode = BBR_STARTUP;
+    cc->bbr.probe_rtt_stamp = now(CLOCK_ID_MONOTONIC_RAW);
+}
+
+static void bbr_update_model(tcp_cc cc)
+{
+    cc->bbr.bw[cc->rounds % BBR_BW_ROUNDS] = cc->delivery_rate;
+    cc->bbr.btl_bw = 0;
+    for (int i = 0; i < BBR_BW_ROUNDS; i++)
+        cc->bbr.btl_bw = MAX(cc->bbr.btl_bw, cc->bbr.bw[i]);
+    if (cc->bbr.full_bw_reached)
+        return;
+    if (cc->bbr.btl_bw * BBR_UNIT >= cc->bbr.full_bw * BBR_FULL_BW_THRESH) {
+        cc->bbr.full_bw = cc->bbr.btl_bw;
+        cc->bbr.full_bw_rounds = 0;
+    } else if (++cc->bbr.full_bw_rounds >= BBR_FULL_BW_ROUNDS) {
+        cc->bbr.full_bw_reached = true;
+    }
+}
+
+static void bbr_ack(tcp_cc cc, struct tcp_pcb *pcb, u32 acked, boolean round_end)
+{
+    timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
+    u64 mss = pcb->mss;
+    if (round_end) {
+        bbr_update_model(cc);
+        if ((cc->bbr.mode == BBR_STARTUP) && cc->bbr.full_bw_reached)
+            cc->bbr.mode = BBR_DRAIN;
+        else if (cc->bbr.mode == BBR_PROBE_BW)
+            cc->bbr.cycle = (cc->bbr.cycle + 1) % _countof(bbr_cycle_gain);
+    }
+    u64 bdp = cc->bbr.btl_bw * cc->min_rtt / MILLION;
+    if ((cc->bbr.mode == BBR_DRAIN) && ((u32)(pcb->snd_nxt - pcb->lastack) <= bdp)) {
+        cc->bbr.mode = BBR_PROBE_BW;
+        cc->bbr.cycle = 0;
+    }
+    if ((cc->bbr.mode != BBR_PROBE_RTT) && (here - cc->bbr.probe_rtt_stamp > MIN_RTT_WINDOW)) {
+        tcp_cc_debug("pcb %p, probe RTT, min_rtt %d\n", pcb, cc->min_rtt);
+        cc->bbr.mode = BBR_PROBE_RTT;
+        cc->bbr.prior_cwnd = cc->cwnd;
+        cc->bbr.probe_rtt_stamp = here;
+        cc->bbr.probe_rtt_done = here + BBR_PROBE_RTT_TIME;
+
+        /* let the next samples at a low queue replace the minimum */
+        cc->min_rtt_stamp = here - MIN_RTT_WINDOW;
+    }
+
+    u64 cwnd = cc->cwnd;
+    if (cc->bbr.mode == BBR_PROBE_RTT) {
+        cwnd = BBR_MIN_CWND * mss;
+        if (here >= cc->bbr.probe_rtt_done) {
+            cc->bbr.mode = cc->bbr.full_bw_reached ? BBR_PROBE_BW : BBR_STARTUP;
+            cwnd = MAX(cwnd, cc->bbr.prior_cwnd);
+        }
+    } else if (!bdp) {
+        cwnd += acked;          /* no model yet: slow start */
+    } else {
+        u32 gain = (cc->bbr.mode == BBR_STARTUP) ? BBR_HIGH_GAIN :
+            (cc->bbr.mode == BBR_DRAIN) ? BBR_UNIT : bbr_cycle_gain[cc->bbr.cycle];
+        u64 target = bdp * gain / BBR_UNIT + 3 * mss;
+        if (cc->bbr.full_bw_reached)
+            cwnd = MIN(cwnd + acked, target);
+        else if (cwnd < target)
+            cwnd += acked;
+    }
+    pcb->cwnd = MIN(MAX(cwnd, BBR_MIN_CWND * mss), CWND_MAX);
+}
+
+static void bbr_loss(tcp_cc cc, struct tcp_pcb *pcb, boolean timeout)
+{
+    /* restore the window when lwIP's fast recovery ends */
+    u32 cwnd = MAX(cc->cwnd, BBR_MIN_CWND * pcb->mss);
+    tcp_cc_debug("pcb %p, cwnd %d, timeout %d\n", pcb, cwnd, timeout);
+    pcb->ssthresh = cwnd;
+    if (!timeout && !(pcb->flags & TF_INFR))
+        pcb->cwnd = cwnd;
+}
+
+static struct tcp_cc_ops tcp_cc_algorithms[] = {
+    { .name = "reno" },         /* implemented by lwIP */
+    { .name = "cubic", .init = cubic_init, .ack = cubic_ack, .loss = cubic_loss },
+    { .name = "bbr", .init = bbr_init, .ack = bbr_ack, .loss = bbr_loss },
+};
+
+static tcp_cc_ops tcp_cc_default = &tcp_cc_algorithms[0];
+
+tcp_cc_ops tcp_cc_find(const char *name, bytes len)
+{
+    for (int i = 0; i < _countof(tcp_cc_algorithms); i++) {
+        tcp_cc_ops ops = &tcp_cc_algorithms[i];
+        if ((runtime_strlen(ops->name) == len) && !runtime_memcmp(ops->name, name, len))
+            return ops;
+    }
+    return 0;
+}
+
+boolean tcp_cc_set_default(const char *name, bytes len)
+{
+    tcp_cc_ops ops = tcp_cc_find(name, len);
+    if (!ops)
+        return false;
+    tcp_cc_default = ops;
+    return true;
+}
+
+tcp_cc_ops tcp_cc_get_default(void)
+{
+    return tcp_cc_default;
+}
+
+/* Select the algorithm of an established connection; statistics are preserved. */
+void tcp_cc_set(tcp_cc cc, tcp_cc_ops ops, struct tcp_pcb *pcb)
+{
+    cc->ops = ops;
+    if (ops->init)
+        ops->init(cc, pcb);
+    cc->cwnd = pcb->cwnd;
+    cc->ssthresh = pcb->ssthresh;
+}
+
+void tcp_cc_init(tcp_cc cc, tcp_cc_ops ops, struct tcp_pcb *pcb)
+{
+    zero(cc, sizeof(*cc));
+    cc->round_seq = pcb->snd_nxt;
+    cc->round_start = now(CLOCK_ID_MONOTONIC_RAW);
+    tcp_cc_set(cc, ops, pcb);
+}
+
+/* Called before lwIP may transmit queued data: time the acknowledgment of the next byte sent. */
+void tcp_cc_output(tcp_cc cc, struct tcp_pcb *pcb)
+{
+    if (!cc->ops || cc->rtt_pending || !pcb->unsent)
+        return;
+    cc->rtt_seq = pcb->snd_nxt;
+    cc->rtt_start = now(CLOCK_ID_MONOTONIC_RAW);
+    cc->rtt_pending = true;
+}
+
+static void tcp_cc_rtt_sample(tcp_cc cc, u32 rtt, timestamp here)
+{
+    /* RFC 6298 */
+    if (!cc->srtt) {
+        cc->srtt = rtt;
+        cc->rttvar = rtt / 2;
+    } else {
+        u32 delta = (rtt > cc->srtt) ? rtt - cc->srtt : cc->srtt - rtt;
+        cc->rttvar = cc->rttvar - cc->rttvar / 4 + delta / 4;
+        cc->srtt = cc->srtt - cc->srtt / 8 + rtt / 8;
+    }
+    if (!cc->min_rtt || (rtt <= cc->min_rtt) || (here - cc->min_rtt_stamp > MIN_RTT_WINDOW)) {
+        cc->min_rtt = rtt;
+        cc->min_rtt_stamp = here;
+    }
+}
+
+/* Called when new data has been acknowledged. */
+void tcp_cc_ack(tcp_cc cc, struct tcp_pcb *pcb, u32 acked)
+{
+    if (!cc->ops)
+        return;
+    timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
+    if (pcb->ssthresh != cc->ssthresh) {
+        /* lwIP has reduced the window after a fast retransmit or a retransmission timeout */
+        boolean timeout = pcb->cwnd < pcb->ssthresh;
+        cc->loss_events++;
+        if (timeout)
+            cc->timeouts++;
+        cc->rtt_pending = false;    /* the timed segment may have been retransmitted */
+        if (cc->ops->loss)
+            cc->ops->loss(cc, pcb, timeout);
+        cc->cwnd = pcb->cwnd;
+    } else if (cc->rtt_pending && TCP_SEQ_GT(pcb->lastack, cc->rtt_seq)) {
+        cc->rtt_pending = false;
+        tcp_cc_rtt_sample(cc, MAX(usec_from_timestamp(here - cc->rtt_start), 1), here);
+    }
+
+    cc->round_delivered += acked;
+    boolean round_end = TCP_SEQ_GEQ(pcb->lastack, cc->round_seq);
+    if (round_end) {
+        u64 elapsed = usec_from_timestamp(here - cc->round_start);
+        if (elapsed)
+            cc->delivery_rate = cc->round_delivered * MILLION / elapsed;
+        cc->rounds++;
+        cc->round_delivered = 0;
+        cc->round_seq = pcb->snd_nxt;
+        cc->round_start = here;
+    }
+
+    if (pcb->flags & TF_INFR) {
+        cc->recovery = true;
+    } else {
+        if (cc->recovery) {
+            /* lwIP has deflated the window to ssthresh */
+            cc->recovery = false;
+            cc->cwnd = pcb->cwnd;
+        }
+        if (cc->ops->ack)
+            cc->ops->ack(cc, pcb, acked, round_end);
+    }
+    cc->cwnd = pcb->cwnd;
+    cc->ssthresh = pcb->ssthresh;
+    tcp_cc_output(cc, pcb);
+}
+
+/* Linux states, indexed by lwIP state */
+static const u8 tcp_info_states[] = {
+    [CLOSED] = 7, [LISTEN] = 10, [SYN_SENT] = 2, [SYN_RCVD] = 3, [ESTABLISHED] = 1,
+    [FIN_WAIT_1] = 4, [FIN_WAIT_2] = 5, [CLOSE_WAIT] = 8, [CLOSING] = 11, [LAST_ACK] = 9,
+    [TIME_WAIT] = 6,
+};
+
+void tcp_cc_info(tcp_cc cc, struct tcp_pcb *pcb, struct tcp_info *info)
+{
+    u32 mss = MAX(pcb->mss, 1);
+    zero(info, sizeof(*info));
+    info->tcpi_state = tcp_info_states[pcb->state];
+    info->tcpi_ca_state = (pcb->flags & TF_INFR) ? TCP_CA_RECOVERY :
+        (pcb->nrtx ? TCP_CA_LOSS : TCP_CA_OPEN);
+    info->tcpi_retransmits = pcb->nrtx;
+    if (pcb->flags & TF_WND_SCALE) {
+        info->tcpi_options = TCPI_OPT_WSCALE;
+        info->tcpi_snd_wscale = pcb->snd_scale;
+        info->tcpi_rcv_wscale = pcb->rcv_scale;
+    }
+    info->tcpi_rto = pcb->rto * TCP_SLOW_INTERVAL * THOUSAND;
+    info->tcpi_snd_mss = info->tcpi_rcv_mss = info->tcpi_advmss = pcb->mss;
+    info->tcpi_unacked = ((u32)(pcb->snd_nxt - pcb->lastack) + mss - 1) / mss;
+    info->tcpi_rtt = cc->srtt;
+    info->tcpi_rttvar = cc->rttvar;
+    info->tcpi_min_rtt = cc->min_rtt;
+    info->tcpi_snd_ssthresh = (pcb->ssthresh >= CWND_MAX) ? 0x7fffffff : pcb->ssthresh / mss;
+    info->tcpi_snd_cwnd = pcb->cwnd / mss;
+    info->tcpi_reordering = 3;  /* duplicate ACKs triggering fast retransmit */
+
+    /* lwIP does not count retransmitted segments, so report loss recovery episodes */
+    info->tcpi_total_retrans = cc->loss_events;
+    info->tcpi_delivery_rate = cc->delivery_rate;
+}
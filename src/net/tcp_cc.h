@@ -0,0 +1,121 @@
+/* Congestion control for TCP sockets
+
+   lwIP implements Reno; an algorithm plugged in here takes over the congestion window of a
+   connection after each acknowledgment, and after lwIP has reduced it in response to a loss.
+   While lwIP is in fast recovery the window is left to lwIP. */
+
+#define TCP_CC_NAME_MAX     16
+
+typedef struct tcp_cc *tcp_cc;
+
+typedef struct tcp_cc_ops {
+    const char *name;
+    void (*init)(tcp_cc cc, struct tcp_pcb *pcb);
+    void (*ack)(tcp_cc cc, struct tcp_pcb *pcb, u32 acked, boolean round_end);
+    void (*loss)(tcp_cc cc, struct tcp_pcb *pcb, boolean timeout);
+} *tcp_cc_ops;
+
+#define BBR_BW_ROUNDS   10
+
+struct tcp_cc {
+    tcp_cc_ops ops;
+    u32 cwnd;                   /* congestion window after the last acknowledgment */
+    u32 ssthresh;               /* lwIP changes ssthresh only on loss */
+    boolean recovery;           /* lwIP is in fast recovery */
+    u32 srtt, rttvar;           /* microseconds */
+    u32 min_rtt;
+    timestamp min_rtt_stamp;
+    u32 rtt_seq;                /* RTT sample: ack of rtt_seq sent at rtt_start */
+    timestamp rtt_start;
+    boolean rtt_pending;
+    u32 round_seq;              /* a round trip ends when round_seq is acknowledged */
+    timestamp round_start;
+    u64 round_delivered;
+    u64 delivery_rate;          /* bytes/s delivered over the last round trip */
+    u64 rounds;
+    u32 loss_events;
+    u32 timeouts;
+    union {
+        struct {
+            u32 w_max;          /* window before the last reduction */
+            u32 origin;         /* window the cubic function plateaus at */
+            u32 k;              /* ms from epoch_start to the plateau */
+            u32 w_est;          /* Reno-friendly window estimate */
+            timestamp epoch_start;
+        } cubic;
+        struct {
+            u8 mode;
+            u8 cycle;
+            u8 full_bw_rounds;
+            boolean full_bw_reached;
+            u64 bw[BBR_BW_ROUNDS];  /* delivery rate of recent rounds */
+            u64 btl_bw;
+            u64 full_bw;
+            timestamp probe_rtt_stamp;  /* start of the last PROBE_RTT */
+            timestamp probe_rtt_done;
+            u32 prior_cwnd;
+        } bbr;
+    };
+};
+
+/* TCP_INFO; the layout matches the beginning of the Linux structure */
+struct tcp_info {
+    u8 tcpi_state;
+    u8 tcpi_ca_state;
+    u8 tcpi_retransmits;
+    u8 tcpi_probes;
+    u8 tcpi_backoff;
+    u8 tcpi_options;
+    u8 tcpi_snd_wscale:4, tcpi_rcv_wscale:4;
+    u8 tcpi_delivery_rate_app_limited:1, tcpi_fastopen_client_fail:2;
+    u32 tcpi_rto;               /* microseconds */
+    u32 tcpi_ato;
+    u32 tcpi_snd_mss;
+    u32 tcpi_rcv_mss;
+    u32 tcpi_unacked;           /* segments */
+    u32 tcpi_sacked;
+    u32 tcpi_lost;
+    u32 tcpi_retrans;
+    u32 tcpi_fackets;
+    u32 tcpi_last_data_sent;
+    u32 tcpi_last_ack_sent;
+    u32 tcpi_last_data_recv;
+    u32 tcpi_last_ack_recv;
+    u32 tcpi_pmtu;
+    u32 tcpi_rcv_ssthresh;
+    u32 tcpi_rtt;               /* microseconds */
+    u32 tcpi_rttvar;
+    u32 tcpi_snd_ssthresh;      /* segments */
+    u32 tcpi_snd_cwnd;
+    u32 tcpi_advmss;
+    u32 tcpi_reordering;
+    u32 tcpi_rcv_rtt;
+    u32 tcpi_rcv_space;
+    u32 tcpi_total_retrans;
+    u64 tcpi_pacing_rate;
+    u64 tcpi_max_pacing_rate;
+    u64 tcpi_bytes_acked;
+    u64 tcpi_bytes_received;
+    u32 tcpi_segs_out;
+    u32 tcpi_segs_in;
+    u32 tcpi_notsent_bytes;
+    u32 tcpi_min_rtt;
+    u32 tcpi_data_segs_in;
+    u32 tcpi_data_segs_out;
+    u64 tcpi_delivery_rate;     /* bytes/s */
+};
+
+#define TCPI_OPT_WSCALE     4
+
+#define TCP_CA_OPEN         0
+#define TCP_CA_RECOVERY     3
+#define TCP_CA_LOSS         4
+
+tcp_cc_ops tcp_cc_find(const char *name, bytes len);
+boolean tcp_cc_set_default(const char *name, bytes len);
+tcp_cc_ops tcp_cc_get_default(void);
+void tcp_cc_init(tcp_cc cc, tcp_cc_ops ops, struct tcp_pcb *pcb);
+void tcp_cc_set(tcp_cc cc, tcp_cc_ops ops, struct tcp_pcb *pcb);
+void tcp_cc_output(tcp_cc cc, struct tcp_pcb *pcb);
+void tcp_cc_ack(tcp_cc cc, struct tcp_pcb *pcb, u32 acked);
+void tcp_cc_info(tcp_cc cc, struct tcp_pcb *pcb, struct tcp_info *info);
@@ -0,0 +1,161 @@
+#include <runtime.h>
+
+/* LZ4 block format
+
+   A block is a series of sequences, each made of a token byte, a run of literals and a match:
+   the high nibble of the token is the literal length and the low nibble is the match length
+   minus LZ4_MINMATCH, with 15 meaning that more length bytes (each adding up to 255) follow.
+   The match is a 2-byte little-endian offset back into the decompressed data. The last
+   sequence only has literals, the last LZ4_LASTLITERALS bytes of a block are always literals,
+   and no match starts within the last LZ4_MFLIMIT bytes. The compressor is a single-pass
+   greedy matcher over a hash table of 4-byte sequences. */
+
+#define LZ4_MINMATCH        4
+#define LZ4_LASTLITERALS    5
+#define LZ4_MFLIMIT         12
+#define LZ4_MAX_OFFSET      65535
+#define LZ4_RUN_MASK        15
+
+static inline u32 lz4_read32(const u8 *p)
+{
+    u32 v;
+    runtime_memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline u32 lz4_hash(u32 v)
+{
+    return (v * 2654435761u) >> (32 - LZ4_HASH_ORDER);
+}
+
+/* worst case size of a sequence with the given literal and match lengths */
+static inline bytes lz4_sequence_max(bytes literals, bytes match)
+{
+    return 1 + literals + literals / 255 + 1 + 2 + match / 255 + 1;
+}
+
+static u8 *lz4_write_length(u8 *op, bytes len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+static u8 *lz4_write_literals(u8 *op, const u8 *literals, bytes len, u8 match_nibble)
+{
+    *op++ = (MIN(len, LZ4_RUN_MASK) << 4) | match_nibble;
+    if (len >= LZ4_RUN_MASK)
+        op = lz4_write_length(op, len - LZ4_RUN_MASK);
+    runtime_memcpy(op, literals, len);
+    return op + len;
+}
+
+/* Returns the compressed length, or 0 if the result would not fit in dest_len bytes. The
+   workspace must be LZ4_COMPRESS_WORKSPACE bytes. */
+bytes lz4_compress(void *dest, bytes dest_len, const void *src, bytes src_len, void *workspace)
+{
+    const u8 *base = src;
+    const u8 *ip = base, *anchor = base, *iend = base + src_len;
+    u8 *op = dest, *oend = op + dest_len;
+    u32 *table = workspace;
+
+    if (src_len > LZ4_MFLIMIT) {
+        const u8 *mflimit = iend - LZ4_MFLIMIT;
+        const u8 *matchlimit = iend - LZ4_LASTLITERALS;
+        zero(table, LZ4_COMPRESS_WORKSPACE);
+        while (ip < mflimit) {
+            u32 seq = lz4_read32(ip);
+            u32 h = lz4_hash(seq);
+            const u8 *ref = base + table[h];
+            table[h] = ip - base;
+            if ((ref >= ip) || (ip - ref > LZ4_MAX_OFFSET) || (lz4_read32(ref) != seq)) {
+                ip++;
+                continue;
+            }
+            while ((ip > anchor) && (ref > base) && (ip[-1] == ref[-1])) {
+                ip--;
+                ref--;
+            }
+            const u8 *mp = ip + LZ4_MINMATCH, *rp = ref + LZ4_MINMATCH;
+            while ((mp < matchlimit) && (*mp == *rp)) {
+                mp++;
+                rp++;
+            }
+            bytes literals = ip - anchor;
+            bytes match = mp - ip - LZ4_MINMATCH;
+            if (lz4_sequence_max(literals, match) > oend - op)
+                return 0;
+            op = lz4_write_literals(op, anchor, literals, MIN(match, LZ4_RUN_MASK));
+            u16 offset = ip - ref;
+            *op++ = offset;
+            *op++ = offset >> 8;
+            if (match >= LZ4_RUN_MASK)
+                op = lz4_write_length(op, match - LZ4_RUN_MASK);
+            ip = anchor = mp;
+        }
+    }
+    bytes literals = iend - anchor;
+    if (1 + literals + literals / 255 + 1 > oend - op)
+        return 0;
+    op = lz4_write_literals(op, anchor, literals, 0);
+    return op - (u8 *)dest;
+}
+
+static boolean lz4_read_length(const u8 **ip, const u8 *iend, bytes *len)
+{
+    u8 b;
+    do {
+        if (*ip >= iend)
+            return false;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+/* Returns the decompressed length, or -1 if the input is malformed or would decompress past
+   dest_len bytes. */
+s64 lz4_decompress(void *dest, bytes dest_len, const void *src, bytes src_len)
+{
+    const u8 *ip = src, *iend = ip + src_len;
+    u8 *op = dest, *oend = op + dest_len;
+
+    while (ip < iend) {
+        u8 token = *ip++;
+        bytes len = token >> 4;
+        if ((len == LZ4_RUN_MASK) && !lz4_read_length(&ip, iend, &len))
+            return -1;
+        if ((len > iend - ip) || (len > oend - op))
+            return -1;
+        runtime_memcpy(op, ip, len);
+        op += len;
+        ip += len;
+        if (ip == iend)
+            break;
+        if (iend - ip < 2)
+            return -1;
+        bytes offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if ((offset == 0) || (offset > op - (u8 *)dest))
+            return -1;
+        len = token & LZ4_RUN_MASK;
+        if ((len == LZ4_RUN_MASK) && !lz4_read_length(&ip, iend, &len))
+            return -1;
+        len += LZ4_MINMATCH;
+        if (len > oend - op)
+            return -1;
+        const u8 *ref = op - offset;
+        if (offset >= len) {
+            runtime_memcpy(op, ref, len);
+            op += len;
+        } else {
+            /* overlapping match repeats the last offset bytes */
+            while (len--)
+                *op++ = *ref++;
+        }
+    }
+    return op - (u8 *)dest;
+}
@@ -127,6 +127,12 @@ boolean validate_virtual(void *base, u64 length);
 
 void sha256(buffer dest, buffer source);
 
+#define LZ4_HASH_ORDER          12
+#define LZ4_COMPRESS_WORKSPACE  (sizeof(u32) << LZ4_HASH_ORDER)
+
+bytes lz4_compress(void *dest, bytes dest_len, const void *src, bytes src_len, void *workspace);
+s64 lz4_decompress(void *dest, bytes dest_len, const void *src, bytes src_len);
+
 #define stack_allocate __builtin_alloca
 
 typedef struct buffer *buffer;
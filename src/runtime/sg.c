@@ -62,6 +62,27 @@ u64 sg_copy_to_buf(void *target, sg_list sg, u64 n)
     return n - remain;
 }
 
+/* copy up to n bytes from source into the buffers of sg, releasing filled buffers */
+u64 sg_copy_from_buf(void *source, sg_list sg, u64 n)
+{
+    sg_buf sgb;
+    u64 remain = n;
+
+    while (remain > 0 && (sgb = sg_list_head_peek(sg)) != INVALID_ADDRESS) {
+        assert(sgb->size > sgb->offset);
+        u64 len = MIN(remain, sgb->size - sgb->offset);
+        runtime_memcpy(sgb->buf + sgb->offset, source, len);
+        source += len;
+        sgb->offset += len;
+        remain -= len;
+        if (sgb->offset < sgb->size)
+            break;
+        sg_list_head_remove(sg);
+        sg_buf_release(sgb);
+    }
+    return n - remain;
+}
+
 u64 sg_move(sg_list dest, sg_list src, u64 n)
 {
     sg_buf ssgb;
@@ -85,6 +106,24 @@ u64 sg_move(sg_list dest, sg_list src, u64 n)
     return n - remain;
 }
 
+/* consume up to n bytes of sg without accessing the data, releasing consumed buffers */
+u64 sg_consume(sg_list sg, u64 n)
+{
+    sg_buf sgb;
+    u64 remain = n;
+    while (remain > 0 && (sgb = sg_list_head_peek(sg)) != INVALID_ADDRESS) {
+        assert(sgb->size > sgb->offset);
+        u64 len = MIN(remain, sgb->size - sgb->offset);
+        sgb->offset += len;
+        remain -= len;
+        if (sgb->offset < sgb->size)
+            break;
+        sg_list_head_remove(sg);
+        sg_buf_release(sgb);
+    }
+    return n - remain;
+}
+
 u64 sg_zero_fill(sg_list sg, u64 n)
 {
     sg_buf sgb;
@@ -12,6 +12,16 @@
 #define TFS_READ_ONLY
 #endif
 
+#ifdef KERNEL
+#define filesystem_lock_init(fs)    spin_lock_init(&(fs)->lock)
+#define filesystem_lock(fs)         spin_lock(&(fs)->lock)
+#define filesystem_unlock(fs)       spin_unlock(&(fs)->lock)
+#else
+#define filesystem_lock_init(fs)
+#define filesystem_lock(fs)
+#define filesystem_unlock(fs)
+#endif
+
 #if defined(TFS_REPORT_SHA256) && !defined(BOOT)
 static inline void report_sha256(buffer b)
 {
@@ -44,6 +54,8 @@ const char *string_from_fs_status(fs_status s)
         return "out of memory";
     case FS_STATUS_LINKLOOP:
         return "maximum link hops reached";
+    case FS_STATUS_READONLY:
+        return "read-only file";
     default:
         return "unknown error";
     }
@@ -70,11 +82,17 @@ u64 fsfile_get_blocks(fsfile f)
 {
     u64 blocks = 0;
     rangemap_foreach(f->extentmap, n) {
-        blocks += range_span(n->r);
+        extent e = (extent)n;
+        blocks += e->compressed ? e->allocated : range_span(n->r);
     }
     return blocks;
 }
 
+boolean fsfile_is_compressed(fsfile f)
+{
+    return f->compressed;
+}
+
 tuple fsfile_get_meta(fsfile f)
 {
     return f->md;
@@ -199,6 +217,10 @@ static inline extent allocate_extent(heap h, range file_blocks, range storage_bl
     e->start_block = storage_blocks.start;
     e->allocated = range_span(storage_blocks);
     e->uninited = false;
+    e->compressed = 0;
+    e->shared = false;
+    e->cow_pending = 0;
+    e->destroyed = false;
     return e;
 }
 
@@ -223,6 +245,70 @@ boolean filesystem_free_storage(filesystem fs, range blocks)
     return true;
 }
 
+/* Storage shared between extents (with the "shared" attribute) is reserved
+   once, and freed when the last extent referencing it is destroyed. */
+typedef struct shared_storage {
+    struct rmnode n;
+    u64 refcount;
+} *shared_storage;
+
+static shared_storage filesystem_shared_storage(filesystem fs, range storage_blocks)
+{
+    rmnode n = rangemap_lookup(fs->shared, storage_blocks.start);
+    if (n == INVALID_ADDRESS)
+        return 0;
+    assert(range_equal(n->r, storage_blocks));
+    return (shared_storage)n;
+}
+
+/* Returns false if the storage was not shared yet (the caller owns the first
+   reference). */
+static boolean filesystem_share_storage(filesystem fs, range storage_blocks)
+{
+    shared_storage ss = filesystem_shared_storage(fs, storage_blocks);
+    if (ss) {
+        ss->refcount++;
+        return true;
+    }
+    ss = allocate(fs->h, sizeof(*ss));
+    assert(ss != INVALID_ADDRESS);
+    rmnode_init(&ss->n, storage_blocks);
+    ss->refcount = 1;
+    assert(rangemap_insert(fs->shared, &ss->n));
+    return false;
+}
+
+#ifndef TFS_READ_ONLY
+/* Returns true if the last reference was dropped and the storage can be freed. */
+static boolean filesystem_unshare_storage(filesystem fs, range storage_blocks)
+{
+    shared_storage ss = filesystem_shared_storage(fs, storage_blocks);
+    if (!ss)
+        return true;
+    if (--ss->refcount > 0)
+        return false;
+    rangemap_remove_node(fs->shared, &ss->n);
+    deallocate(fs->h, ss, sizeof(*ss));
+    return true;
+}
+#endif
+
+/* Storage of all file extents is reserved when the log is read, whereas the
+   extent maps themselves are only built once a file is used. */
+void reserve_extent_storage(filesystem fs, tuple value)
+{
+    u64 start_block, allocated;
+    assert(ingest_parse_int(value, sym(offset), &start_block));
+    assert(ingest_parse_int(value, sym(allocated), &allocated));
+    range storage_blocks = irangel(start_block, allocated);
+    if (fs->w && get(value, sym(shared)) && filesystem_share_storage(fs, storage_blocks))
+        return;
+    if (!filesystem_reserve_storage(fs, storage_blocks)) {
+        /* soft error... */
+        msg_err("unable to reserve storage blocks %R\n", storage_blocks);
+    }
+}
+
 void ingest_extent(fsfile f, symbol off, tuple value)
 {
     tfs_debug("ingest_extent: f %p, off %b, value %v\n", f, symbol_string(off), value);
@@ -236,10 +322,6 @@ void ingest_extent(fsfile f, symbol off, tuple value)
               file_offset, length, start_block, allocated);
 
     range storage_blocks = irangel(start_block, allocated);
-    if (!filesystem_reserve_storage(f->fs, storage_blocks)) {
-        /* soft error... */
-        msg_err("unable to reserve storage blocks %R\n", storage_blocks);
-    }
     range r = irangel(file_offset, length);
     extent ex = allocate_extent(f->fs->h, r, storage_blocks);
     if (ex == INVALID_ADDRESS)
@@ -247,6 +329,10 @@ void ingest_extent(fsfile f, symbol off, tuple value)
     ex->md = value;
     if (get(value, sym(uninited)))
         ex->uninited = true;
+    if (get_u64(value, sym(compressed), &ex->compressed))
+        f->compressed = true;
+    if (get(value, sym(shared)))
+        ex->shared = true;
     assert(rangemap_insert(f->extentmap, &ex->node));
 }
 
@@ -292,8 +378,113 @@ void zero_blocks(filesystem fs, range blocks, merge m)
     }
 }
 
-closure_function(4, 1, void, read_extent,
-                 filesystem, fs, sg_list, sg, merge, m, range, blocks,
+#ifndef BOOT
+#ifdef KERNEL
+#define fsfile_cluster_lock(f)      spin_lock(&(f)->cluster.lock)
+#define fsfile_cluster_unlock(f)    spin_unlock(&(f)->cluster.lock)
+#else
+#define fsfile_cluster_lock(f)
+#define fsfile_cluster_unlock(f)
+#endif
+
+/* Keep a decompressed cluster for the next reads from the same extent. Page cache fills come
+   one page at a time, so without this every page of a cluster would read and decompress the
+   whole cluster again. */
+static void fsfile_cluster_set(fsfile f, extent e, void *data, u64 len)
+{
+    fsfile_cluster_lock(f);
+    void *old = f->cluster.data;
+    u64 old_len = f->cluster.len;
+    f->cluster.e = e;
+    f->cluster.data = data;
+    f->cluster.len = len;
+    fsfile_cluster_unlock(f);
+    if (old)
+        deallocate(f->fs->h, old, old_len);
+}
+
+static boolean fsfile_cluster_read(fsfile f, extent e, sg_list sg, range q)
+{
+    fsfile_cluster_lock(f);
+    boolean hit = f->cluster.data && (f->cluster.e == e);
+    if (hit)
+        sg_copy_from_buf(f->cluster.data + q.start, sg, range_span(q));
+    fsfile_cluster_unlock(f);
+    return hit;
+}
+
+closure_function(8, 1, void, read_compressed_complete,
+                 fsfile, f, extent, e, sg_list, sg, void *, buf, u64, compressed, u64, cluster_len,
+                 range, q, status_handler, sh,
+                 status, s)
+{
+    fsfile f = bound(f);
+    filesystem fs = f->fs;
+    sg_list sg = bound(sg);
+    u64 cluster_len = bound(cluster_len);
+    if (is_ok(s)) {
+        void *cluster = allocate(fs->h, cluster_len);
+        if (cluster != INVALID_ADDRESS) {
+            s64 len = lz4_decompress(cluster, cluster_len, bound(buf), bound(compressed));
+            if (len >= 0) {
+                zero(cluster + len, cluster_len - len);
+                sg_copy_from_buf(cluster + bound(q).start, sg, range_span(bound(q)));
+                fsfile_cluster_set(f, bound(e), cluster, cluster_len);
+            } else {
+                s = timm("result", "failed to decompress extent data",
+                         "fsstatus", "%d", FS_STATUS_IOERR);
+                deallocate(fs->h, cluster, cluster_len);
+            }
+        } else {
+            s = timm("result", "failed to allocate cluster buffer",
+                     "fsstatus", "%d", FS_STATUS_NOMEM);
+        }
+    }
+    sg_list_release(sg);
+    deallocate_sg_list(sg);
+    deallocate(fs->dma, bound(buf), pad(bound(compressed), U64_FROM_BIT(fs->blocksize_order)));
+    apply(bound(sh), s);
+    closure_finish();
+}
+
+/* A compressed extent holds one cluster, which is read and decompressed as a whole; the
+   requested blocks are then copied out of it. The sg buffers for these blocks are moved to a
+   separate list, so that the following extents can be read in the meantime. */
+static void read_compressed_extent(fsfile f, sg_list sg, merge m, extent e, range i)
+{
+    filesystem fs = f->fs;
+    int order = fs->blocksize_order;
+    range q = range_lshift(range_add(i, -e->node.r.start), order);
+    if (fsfile_cluster_read(f, e, sg, q))
+        return;
+    status_handler sh = apply_merge(m);
+    u64 buf_len = pad(e->compressed, U64_FROM_BIT(order));
+    status s;
+    sg_list csg = allocate_sg_list();
+    if (csg == INVALID_ADDRESS) {
+        s = timm("result", "failed to allocate sg list", "fsstatus", "%d", FS_STATUS_NOMEM);
+        goto fail;
+    }
+    void *buf = allocate(fs->dma, buf_len);
+    if (buf == INVALID_ADDRESS) {
+        deallocate_sg_list(csg);
+        s = timm("result", "failed to allocate compressed data buffer",
+                 "fsstatus", "%d", FS_STATUS_NOMEM);
+        goto fail;
+    }
+    sg_move(csg, sg, range_span(q));
+    apply(fs->r, buf, irangel(e->start_block, buf_len >> order),
+          closure(fs->h, read_compressed_complete, f, e, csg, buf, e->compressed,
+                  range_span(e->node.r) << order, q, sh));
+    return;
+  fail:
+    sg_zero_fill(sg, range_span(q));
+    apply(sh, s);
+}
+#endif
+
+closure_function(5, 1, void, read_extent,
+                 filesystem, fs, fsfile, f, sg_list, sg, merge, m, range, blocks,
                  rmnode, node)
 {
     filesystem fs = bound(fs);
@@ -305,10 +496,14 @@ closure_function(4, 1, void, read_extent,
     range blocks = irangel(e->start_block + e_offset, len);
     tfs_debug("%s: e %p, uninited %d, sg %p m %p blocks %R, i %R, len %ld, blocks %R\n",
               __func__, e, e->uninited, bound(sg), bound(m), bound(blocks), i, len, blocks);
-    if (!e->uninited) {
-        filesystem_storage_op(fs, sg, bound(m), blocks, fs->r);
-    } else {
+    if (e->uninited) {
         sg_zero_fill(sg, range_span(blocks) << fs->blocksize_order);
+#ifndef BOOT
+    } else if (e->compressed) {
+        read_compressed_extent(bound(f), sg, bound(m), e, i);
+#endif
+    } else {
+        filesystem_storage_op(fs, sg, bound(m), blocks, fs->r);
     }
 }
 
@@ -338,7 +533,7 @@ closure_function(2, 3, void, filesystem_storage_read,
     /* read extent data and zero gaps */
     range blocks = range_rshift_pad(q, fs->blocksize_order);
     rangemap_range_lookup_with_gaps(f->extentmap, blocks,
-                                    stack_closure(read_extent, fs, sg, m, blocks),
+                                    stack_closure(read_extent, fs, f, sg, m, blocks),
                                     stack_closure(zero_hole, fs, sg, blocks));
     apply(k, STATUS_OK);
 }
@@ -391,7 +586,7 @@ void filesystem_read_entire(filesystem fs, tuple t, heap bufheap, buffer_handler
     tfs_debug("filesystem_read_entire: t %v, bufheap %p, buffer_handler %p, status_handler %p\n",
               t, bufheap, c, sh);
     fsfile f;
-    if (!(f = table_find(fs->files, t))) {
+    if (!(f = fsfile_from_node(fs, t))) {
         apply(sh, timm("result", "no such file %v", t,
                        "fsstatus", "%d", FS_STATUS_NOENT));
         return;
@@ -434,29 +629,59 @@ fs_status filesystem_write_eav(filesystem fs, tuple t, symbol a, value v)
         return FS_STATUS_NOSPACE;
 }
 
+/* Record a change to file metadata that is needed to read back file data
+   (extents and length), so that a subsequent fdatasync commits the log. */
+static inline void fsfile_md_changed(fsfile f)
+{
+    f->md_gen++;
+}
+
 /* create a new extent in the filesystem
 
    The life an extent depends on a particular allocation of contiguous
    storage space. The extent is tied to this allocated area (nominally
-   page size). Only the extent data length may be updated; the file
-   offset, block start and allocation size are immutable. As an
-   optimization, adjacent extents on the disk could be joined into
-   larger extents with only a meta update.
+   page size). The file offset and block start are immutable; the data
+   length may be updated, and the allocation may grow in place (up to
+   MAX_EXTENT_SIZE) when the storage following it is free, so that a file
+   being appended to keeps extending the same extent.
+
+   Allocations for a file prefer the storage right after its preceding
+   extent, and writes past the last extent of a file preallocate in
+   proportion to the size of the file.
 
 */
 
-static fs_status create_extent(filesystem fs, range blocks, boolean uninited, extent *ex)
+#define max_extent_blocks(fs) (MAX_EXTENT_SIZE >> (fs)->blocksize_order)
+
+/* Try to allocate storage at the given block, falling back to anywhere. */
+static u64 filesystem_allocate_storage_at(filesystem fs, u64 start_block, u64 nblocks)
+{
+    if ((start_block != INVALID_PHYSICAL) && fs->w &&
+        (start_block + nblocks <= fs->storage->total) &&
+        filesystem_reserve_storage(fs, irangel(start_block, nblocks)))
+        return start_block;
+    return filesystem_allocate_storage(fs, nblocks);
+}
+
+static fs_status create_extent(filesystem fs, range blocks, boolean uninited, u64 start_hint,
+                               u64 nblocks, extent *ex)
 {
     heap h = fs->h;
-    u64 nblocks = MAX(range_span(blocks), MIN_EXTENT_SIZE >> fs->blocksize_order);
+    nblocks = MAX(MAX(range_span(blocks), nblocks), MIN_EXTENT_SIZE >> fs->blocksize_order);
 
-    tfs_debug("create_extent: blocks %R, uninited %d, nblocks %ld\n", blocks, uninited, nblocks);
+    tfs_debug("create_extent: blocks %R, uninited %d, nblocks %ld, hint 0x%lx\n", blocks,
+              uninited, nblocks, start_hint);
     if (!filesystem_reserve_log_space(fs, &fs->next_extend_log_offset, 0, 0) ||
         !filesystem_reserve_log_space(fs, &fs->next_new_log_offset, 0, 0))
         return FS_STATUS_NOSPACE;
 
-    u64 start_block = filesystem_allocate_storage(fs, nblocks);
-    if (start_block == u64_from_pointer(INVALID_ADDRESS))
+    u64 start_block = filesystem_allocate_storage_at(fs, start_hint, nblocks);
+    if ((start_block == INVALID_PHYSICAL) && (nblocks > range_span(blocks))) {
+        /* drop the preallocation */
+        nblocks = MAX(range_span(blocks), MIN_EXTENT_SIZE >> fs->blocksize_order);
+        start_block = filesystem_allocate_storage_at(fs, start_hint, nblocks);
+    }
+    if (start_block == INVALID_PHYSICAL)
         return FS_STATUS_NOSPACE;
 
     range storage_blocks = irangel(start_block, nblocks);
@@ -472,7 +697,16 @@ static fs_status create_extent(filesystem fs, range blocks, boolean uninited, ex
 
 static void destroy_extent(filesystem fs, extent ex)
 {
+    /* the copy is still reading the shared storage, and writes are queued on the extent */
+    if (ex->cow_pending) {
+        ex->destroyed = true;
+        return;
+    }
     range q = irangel(ex->start_block, ex->allocated);
+    if (ex->shared && !filesystem_unshare_storage(fs, q)) {
+        deallocate(fs->h, ex, sizeof(*ex));
+        return;
+    }
     if (!filesystem_free_storage(fs, q))
         msg_err("failed to mark extent at %R as free", q);
     deallocate(fs->h, ex, sizeof(*ex));
@@ -502,6 +736,10 @@ static fs_status add_extent_to_file(fsfile f, extent ex)
     set(e, sym(allocated), value_from_u64(h, ex->allocated));
     if (ex->uninited)
         set(e, sym(uninited), null_value);
+    if (ex->compressed)
+        set(e, sym(compressed), value_from_u64(h, ex->compressed));
+    if (ex->shared)
+        set(e, sym(shared), null_value);
     symbol offs = intern_u64(ex->node.r.start);
     fs_status s = filesystem_write_eav(f->fs, extents, offs, e);
     if (s != FS_STATUS_OK) {
@@ -509,6 +747,7 @@ static fs_status add_extent_to_file(fsfile f, extent ex)
         return s;
     }
     set(extents, offs, e);
+    fsfile_md_changed(f);
     tfs_debug("%s: f %p, reserve %R\n", __func__, f, ex->node.r);
     if (!rangemap_insert(f->extentmap, &ex->node)) {
         rbtree_dump(&f->extentmap->t, RB_INORDER);
@@ -527,6 +766,7 @@ static void remove_extent_from_file(fsfile f, extent ex)
     symbol offs = intern_u64(ex->node.r.start);
     filesystem_write_eav(f->fs, extents, offs, 0);
     set(extents, offs, 0);
+    fsfile_md_changed(f);
     rangemap_remove_node(f->extentmap, &ex->node);
 }
 
@@ -534,16 +774,18 @@ static fs_status add_extents(filesystem fs, range i, rangemap rm)
 {
     extent ex;
     fs_status fss;
+    u64 hint = INVALID_PHYSICAL;
     while (range_span(i) >= MAX_EXTENT_SIZE) {
         range r = {.start = i.start, .end = i.start + MAX_EXTENT_SIZE};
-        fss = create_extent(fs, r, true, &ex);
+        fss = create_extent(fs, r, true, hint, 0, &ex);
         if (fss != FS_STATUS_OK)
             return fss;
         assert(rangemap_insert(rm, &ex->node));
+        hint = ex->start_block + ex->allocated;
         i.start += MAX_EXTENT_SIZE;
     }
     if (range_span(i)) {
-        fss = create_extent(fs, i, true, &ex);
+        fss = create_extent(fs, i, true, hint, 0, &ex);
         if (fss != FS_STATUS_OK)
             return fss;
         assert(rangemap_insert(rm, &ex->node));
@@ -551,8 +793,208 @@ static fs_status add_extents(filesystem fs, range i, rangemap rm)
     return FS_STATUS_OK;
 }
 
+/* Copy-on-write of shared extents
+
+   The first write to an extent with shared storage moves the extent to storage of its own,
+   unless it holds the last reference, in which case the storage simply becomes private. The
+   extent data is copied from the shared storage first; the write, and any writes to the extent
+   that arrive in the meantime, are held until the copy is complete. Until then the extent
+   still points to the shared storage, so that reads of blocks that are not in the page cache
+   see the shared data, while the blocks being written are held in the page cache. An extent
+   destroyed in the meantime (by truncation or removal of the file) is only marked; the queued
+   writes are failed and the extent is destroyed once the copy is complete. */
+
+closure_function(6, 1, void, cow_write,
+                 filesystem, fs, extent, ex, sg_list, sg, range, r, merge, m, status_handler, sh,
+                 status, s)
+{
+    filesystem fs = bound(fs);
+    sg_list sg = bound(sg);
+    if (is_ok(s)) {
+        range blocks = range_add(bound(r), bound(ex)->start_block);
+        if (sg)
+            filesystem_storage_op(fs, sg, bound(m), blocks, fs->w);
+        else
+            zero_blocks(fs, blocks, bound(m));
+    }
+    if (sg) {
+        sg_list_release(sg);
+        deallocate_sg_list(sg);
+    }
+    apply(bound(sh), s);
+    closure_finish();
+}
+
+static fs_status extent_set_private(fsfile f, extent ex, u64 start_block)
+{
+    filesystem fs = f->fs;
+    value v = 0;
+    fs_status s;
+    if (start_block != ex->start_block) {
+        v = value_from_u64(fs->h, start_block);
+        if (v == INVALID_ADDRESS)
+            return FS_STATUS_NOMEM;
+        s = filesystem_write_eav(fs, ex->md, sym(offset), v);
+        if (s != FS_STATUS_OK) {
+            deallocate_value(v);
+            return s;
+        }
+    }
+    s = filesystem_write_eav(fs, ex->md, sym(shared), 0);
+    if (s != FS_STATUS_OK)
+        return s;
+    range q = irangel(ex->start_block, ex->allocated);
+    boolean last = filesystem_unshare_storage(fs, q);
+    if (v) {
+        value oldval = get(ex->md, sym(offset));
+        assert(oldval);
+        deallocate_value(oldval);
+        set(ex->md, sym(offset), v);
+        ex->start_block = start_block;
+        if (last)
+            filesystem_free_storage(fs, q);
+    }
+    set(ex->md, sym(shared), 0);
+    ex->shared = false;
+    fsfile_md_changed(f);
+    return FS_STATUS_OK;
+}
+
+/* f is not referenced if the extent has been destroyed, as the file may be gone too. */
+static void extent_cow_complete(filesystem fs, fsfile f, extent ex, u64 start_block,
+                                fs_status fss)
+{
+    if (ex->destroyed)
+        fss = FS_STATUS_NOENT;
+    else if (fss == FS_STATUS_OK)
+        fss = extent_set_private(f, ex, start_block);
+    if ((fss != FS_STATUS_OK) && (start_block != INVALID_PHYSICAL))
+        filesystem_free_storage(fs, irangel(start_block, ex->allocated));
+    tfs_debug("%s: ex %p, start_block 0x%lx, status %d\n", __func__, ex, start_block, fss);
+    vector pending = ex->cow_pending;
+    ex->cow_pending = 0;
+    status_handler sh;
+    vector_foreach(pending, sh)
+        apply(sh, fss == FS_STATUS_OK ? STATUS_OK :
+              timm("result", "copy-on-write of shared extent failed", "fsstatus", "%d", fss));
+    deallocate_vector(pending);
+    if (ex->destroyed)
+        destroy_extent(fs, ex);
+}
+
+closure_function(5, 1, void, cow_copy_complete,
+                 filesystem, fs, fsfile, f, extent, ex, void *, buf, u64, start_block,
+                 status, s)
+{
+    filesystem fs = bound(fs);
+    extent ex = bound(ex);
+    deallocate(fs->dma, bound(buf), range_span(ex->node.r) << fs->blocksize_order);
+    fs_status fss = FS_STATUS_OK;
+    if (!is_ok(s)) {
+        timm_dealloc(s);
+        fss = FS_STATUS_IOERR;
+    }
+    extent_cow_complete(fs, bound(f), ex, bound(start_block), fss);
+    closure_finish();
+}
+
+closure_function(5, 1, void, cow_copy_read_complete,
+                 filesystem, fs, fsfile, f, extent, ex, void *, buf, u64, start_block,
+                 status, s)
+{
+    filesystem fs = bound(fs);
+    extent ex = bound(ex);
+    status_handler k = closure(fs->h, cow_copy_complete, fs, bound(f), ex, bound(buf),
+                               bound(start_block));
+    if (is_ok(s) && !ex->destroyed)
+        apply(fs->w, bound(buf), irangel(bound(start_block), range_span(ex->node.r)), k);
+    else
+        apply(k, s);
+    closure_finish();
+}
+
+static void extent_cow_start(fsfile f, extent ex)
+{
+    filesystem fs = f->fs;
+    u64 start_block = INVALID_PHYSICAL;
+    fs_status fss;
+    if (!fs->r) {
+        fss = FS_STATUS_IOERR;
+        goto fail;
+    }
+    start_block = filesystem_allocate_storage_at(fs, INVALID_PHYSICAL, ex->allocated);
+    if (start_block == INVALID_PHYSICAL) {
+        fss = FS_STATUS_NOSPACE;
+        goto fail;
+    }
+    void *buf = allocate(fs->dma, range_span(ex->node.r) << fs->blocksize_order);
+    if (buf == INVALID_ADDRESS) {
+        fss = FS_STATUS_NOMEM;
+        goto fail;
+    }
+    tfs_debug("%s: ex %p, copy %R to 0x%lx\n", __func__, ex, irangel(ex->start_block,
+              range_span(ex->node.r)), start_block);
+    apply(fs->r, buf, irangel(ex->start_block, range_span(ex->node.r)),
+          closure(fs->h, cow_copy_read_complete, fs, f, ex, buf, start_block));
+    return;
+  fail:
+    extent_cow_complete(fs, f, ex, start_block, fss);
+}
+
+static u64 write_extent(fsfile f, extent ex, sg_list sg, range blocks, merge m);
+
+static u64 write_shared_extent(fsfile f, extent ex, sg_list sg, range blocks, merge m)
+{
+    filesystem fs = f->fs;
+    range i = range_intersection(blocks, ex->node.r);
+    u64 length = range_span(i) << fs->blocksize_order;
+    status_handler sh = apply_merge(m);
+    fs_status fss;
+    boolean start = false;
+    if (!ex->cow_pending) {
+        shared_storage ss = filesystem_shared_storage(fs, irangel(ex->start_block, ex->allocated));
+        if (!ss || (ss->refcount == 1)) {
+            fss = extent_set_private(f, ex, ex->start_block);
+            if (fss != FS_STATUS_OK)
+                goto fail;
+            apply(sh, STATUS_OK);
+            return write_extent(f, ex, sg, blocks, m);
+        }
+        ex->cow_pending = allocate_vector(fs->h, 4);
+        if (ex->cow_pending == INVALID_ADDRESS) {
+            ex->cow_pending = 0;
+            fss = FS_STATUS_NOMEM;
+            goto fail;
+        }
+        start = true;
+    }
+    sg_list csg = 0;
+    if (sg) {
+        csg = allocate_sg_list();
+        if (csg == INVALID_ADDRESS) {
+            fss = FS_STATUS_NOMEM;
+            goto fail;
+        }
+        sg_move(csg, sg, length);
+    }
+    vector_push(ex->cow_pending, closure(fs->h, cow_write, fs, ex, csg,
+                                         range_add(i, -ex->node.r.start), m, sh));
+    if (start)
+        extent_cow_start(f, ex);
+    return i.end;
+  fail:
+    if (sg)
+        sg_consume(sg, length);
+    apply(sh, timm("result", "failed to write shared extent", "fsstatus", "%d", fss));
+    if (start)
+        extent_cow_complete(fs, f, ex, INVALID_PHYSICAL, fss);
+    return i.end;
+}
+
 static u64 write_extent(fsfile f, extent ex, sg_list sg, range blocks, merge m)
 {
+    if (ex->shared)
+        return write_shared_extent(f, ex, sg, blocks, m);
     filesystem fs = f->fs;
     range i = range_intersection(blocks, ex->node.r);
     u64 data_offset = i.start - ex->node.r.start;
@@ -579,6 +1021,7 @@ static u64 write_extent(fsfile f, extent ex, sg_list sg, range blocks, merge m)
             assert(ex->md);
             set(ex->md, a, 0);
             ex->uninited = false;
+            fsfile_md_changed(f);
         }
         filesystem_storage_op(fs, sg, m, r, fs->w);
     } else {
@@ -589,13 +1032,26 @@ static u64 write_extent(fsfile f, extent ex, sg_list sg, range blocks, merge m)
     return i.end;
 }
 
-static fs_status fill_gap(fsfile f, sg_list sg, range blocks, merge m, u64 *edge)
+/* Speculative preallocation for a file growing at its end, in proportion to
+   the size of the file. */
+static u64 extent_prealloc_blocks(fsfile f, range blocks)
 {
-    blocks = irangel(blocks.start, MIN(MAX_EXTENT_SIZE >> f->fs->blocksize_order,
-                                       range_span(blocks)));
+    filesystem fs = f->fs;
+    return MIN(max_extent_blocks(fs), MAX(range_span(blocks), blocks.start));
+}
+
+/* *prev is the extent preceding the gap, if any, and is updated to the new
+   extent. */
+static fs_status fill_gap(fsfile f, extent *prev, boolean at_end, sg_list sg, range blocks,
+                          merge m, u64 *edge)
+{
+    filesystem fs = f->fs;
+    blocks = irangel(blocks.start, MIN(max_extent_blocks(fs), range_span(blocks)));
     tfs_debug("   %s: writing new extent blocks %R\n", __func__, blocks);
+    u64 hint = *prev ? (*prev)->start_block + (*prev)->allocated : INVALID_PHYSICAL;
     extent ex;
-    fs_status fss = create_extent(f->fs, blocks, false, &ex);
+    fs_status fss = create_extent(fs, blocks, false, hint,
+                                  at_end ? extent_prealloc_blocks(f, blocks) : 0, &ex);
     if (fss != FS_STATUS_OK)
         return fss;
     fss = add_extent_to_file(f, ex);
@@ -606,6 +1062,7 @@ static fs_status fill_gap(fsfile f, sg_list sg, range blocks, merge m, u64 *edge
     if (m)
         write_extent(f, ex, sg, blocks, m);
     *edge = blocks.end;
+    *prev = ex;
     return FS_STATUS_OK;
 }
 
@@ -625,11 +1082,81 @@ static fs_status update_extent_length(fsfile f, extent ex, u64 new_length)
     assert(oldval);
     deallocate_value(oldval);
     set(ex->md, sym(length), v);
+    fsfile_md_changed(f);
     return FS_STATUS_OK;
 }
 
-static fs_status extend(fsfile f, extent ex, sg_list sg, range blocks, merge m, u64 *edge)
+/* Grow the allocation of an extent in place to cover up to end_block (file
+   offset), with preallocation beyond it if at the end of the file. */
+static void extent_grow(fsfile f, extent ex, u64 end_block, boolean at_end)
+{
+    filesystem fs = f->fs;
+    u64 need = end_block - ex->node.r.start;
+    if ((need <= ex->allocated) || (ex->allocated >= max_extent_blocks(fs)) || !ex->md ||
+        ex->shared)
+        return;
+    need = MIN(need, max_extent_blocks(fs));
+    u64 target = at_end ? MIN(max_extent_blocks(fs), MAX(need, 2 * ex->allocated)) : need;
+    u64 start = ex->start_block + ex->allocated;
+    if (!fs->w || (ex->start_block + target > fs->storage->total))
+        return;
+    if (!filesystem_reserve_storage(fs, irange(start, ex->start_block + target))) {
+        if ((target == need) ||
+            !filesystem_reserve_storage(fs, irange(start, ex->start_block + need)))
+            return;
+        target = need;
+    }
+    range grown = irange(start, ex->start_block + target);
+    value v = value_from_u64(fs->h, target);
+    if ((v == INVALID_ADDRESS) ||
+        (filesystem_write_eav(fs, ex->md, sym(allocated), v) != FS_STATUS_OK)) {
+        if (v != INVALID_ADDRESS)
+            deallocate_value(v);
+        filesystem_free_storage(fs, grown);
+        return;
+    }
+    tfs_debug("   %s: ex %p, allocated %ld -> %ld\n", __func__, ex, ex->allocated, target);
+    value oldval = get(ex->md, sym(allocated));
+    assert(oldval);
+    deallocate_value(oldval);
+    set(ex->md, sym(allocated), v);
+    ex->allocated = target;
+    fsfile_md_changed(f);
+}
+
+/* Give back the storage allocated past the data of the last extent of a file,
+   i.e. what is left of the preallocation for appending writes. */
+static void fsfile_trim_prealloc(fsfile f)
+{
+    filesystem fs = f->fs;
+    rmnode n = rangemap_lookup_max_lte(f->extentmap, infinity);
+    if (!fs->w || (n == INVALID_ADDRESS))
+        return;
+    extent ex = (extent)n;
+    u64 used = MAX(range_span(n->r), MIN_EXTENT_SIZE >> fs->blocksize_order);
+    if ((used >= ex->allocated) || !ex->md || ex->shared || ex->compressed || ex->cow_pending)
+        return;
+    value v = value_from_u64(fs->h, used);
+    if (v == INVALID_ADDRESS)
+        return;
+    if (filesystem_write_eav(fs, ex->md, sym(allocated), v) != FS_STATUS_OK) {
+        deallocate_value(v);
+        return;
+    }
+    tfs_debug("%s: ex %p, allocated %ld -> %ld\n", __func__, ex, ex->allocated, used);
+    value oldval = get(ex->md, sym(allocated));
+    assert(oldval);
+    deallocate_value(oldval);
+    set(ex->md, sym(allocated), v);
+    filesystem_free_storage(fs, irange(ex->start_block + used, ex->start_block + ex->allocated));
+    ex->allocated = used;
+    fsfile_md_changed(f);
+}
+
+static fs_status extend(fsfile f, extent ex, boolean at_end, sg_list sg, range blocks, merge m,
+                        u64 *edge)
 {
+    extent_grow(f, ex, blocks.end, at_end);
     u64 free = ex->allocated - range_span(ex->node.r);
     range r = irangel(ex->node.r.end, free);
     range i = range_intersection(r, blocks);
@@ -680,19 +1207,24 @@ static status extents_range_handler(filesystem fs, fsfile f, range blocks, sg_li
         fs_status fss;
         if (!m || sg) {
             if (blocks.start < limit) {
+                boolean at_end = (next == INVALID_ADDRESS);
+
                 /* try to extend previous node */
                 if (prev != INVALID_ADDRESS && prev->r.end < limit) {
                     tfs_debug("   extent start 0x%lx, limit 0x%lx\n", blocks.start, limit);
-                    fss = extend(f, (extent)prev, sg, irange(blocks.start, limit), m, &blocks.start);
+                    fss = extend(f, (extent)prev, at_end, sg, irange(blocks.start, limit), m,
+                                 &blocks.start);
                     if (fss != FS_STATUS_OK) {
                         return timm("result", "unable to extend extent", "fsstatus", "%d", fss);
                     }
                 }
 
                 /* fill space */
+                extent last = prev != INVALID_ADDRESS ? (extent)prev : 0;
                 while (blocks.start < limit) {
                     tfs_debug("   fill start 0x%lx, limit 0x%lx\n", blocks.start, limit);
-                    fss = fill_gap(f, sg, irange(blocks.start, limit), m, &blocks.start);
+                    fss = fill_gap(f, &last, at_end, sg, irange(blocks.start, limit), m,
+                                   &blocks.start);
                     if (fss != FS_STATUS_OK) {
                         return timm("result", "unable to create extent", "fsstatus", "%d", fss);
                     }
@@ -736,6 +1268,8 @@ closure_function(2, 1, status, filesystem_check_or_reserve_extent,
     assert(range_span(q) > 0);
     range blocks = range_rshift_pad(q, fs->blocksize_order);
     tfs_debug("%s: file %p range %R blocks %R\n", __func__, f, q, blocks);
+    if (f->compressed)
+        return timm("result", "compressed file", "fsstatus", "%d", FS_STATUS_READONLY);
 
     return extents_range_handler(fs, f, blocks, 0, 0);
 }
@@ -756,7 +1290,12 @@ closure_function(2, 3, void, filesystem_storage_write,
     merge m = allocate_merge(fs->h, complete);
     status_handler sh = apply_merge(m);
 
-    status s = extents_range_handler(fs, f, blocks, sg, m);
+    status s;
+    if (f->compressed) {
+        s = timm("result", "compressed file", "fsstatus", "%d", FS_STATUS_READONLY);
+        goto out;
+    }
+    s = extents_range_handler(fs, f, blocks, sg, m);
     if (s != STATUS_OK)
         goto out;
     if (fsfile_get_length(f) < q.end) {
@@ -800,8 +1339,189 @@ void filesystem_write_linear(fsfile f, void *src, range q, io_status_handler io_
 }
 KLIB_EXPORT(filesystem_write_linear);
 
+closure_function(4, 1, void, write_cluster_complete,
+                 heap, h, void *, buf, u64, len, status_handler, sh,
+                 status, s)
+{
+    deallocate(bound(h), bound(buf), bound(len));
+    apply(bound(sh), s);
+    closure_finish();
+}
+
+typedef struct dedup_entry {
+    u8 hash[32];                /* must be first */
+    extent ex;
+} *dedup_entry;
+
+static key dedup_key(void *a)
+{
+    return *(u64 *)a;
+}
+
+static boolean dedup_equal(void *a, void *b)
+{
+    return !runtime_memcmp(a, b, sizeof(((dedup_entry)0)->hash));
+}
+
+/* Add an extent sharing the storage of an identical cluster written before. */
+static fs_status write_shared_cluster(fsfile f, range blocks, extent src)
+{
+    filesystem fs = f->fs;
+    range storage_blocks = irangel(src->start_block, src->allocated);
+    if (!src->shared) {
+        fs_status fss = filesystem_write_eav(fs, src->md, sym(shared), null_value);
+        if (fss != FS_STATUS_OK)
+            return fss;
+        set(src->md, sym(shared), null_value);
+        src->shared = true;
+        filesystem_share_storage(fs, storage_blocks);
+    }
+    extent ex = allocate_extent(fs->h, blocks, storage_blocks);
+    if (ex == INVALID_ADDRESS)
+        return FS_STATUS_NOMEM;
+    ex->md = 0;
+    ex->compressed = src->compressed;
+    ex->shared = true;
+    fs_status fss = add_extent_to_file(f, ex);
+    if (fss != FS_STATUS_OK) {
+        deallocate(fs->h, ex, sizeof(*ex));
+        return fss;
+    }
+    filesystem_share_storage(fs, storage_blocks);
+    if (ex->compressed)
+        f->compressed = true;
+    return FS_STATUS_OK;
+}
+
+static fs_status write_cluster(fsfile f, void *src, u64 offset, u64 length, u64 flags,
+                               void *workspace, u64 *hint, merge m)
+{
+    filesystem fs = f->fs;
+    int order = fs->blocksize_order;
+    u64 blocksize = U64_FROM_BIT(order);
+    range blocks = irangel(offset >> order, pad(length, blocksize) >> order);
+    dedup_entry de = 0;
+    if (flags & TFS_WRITE_DEDUP) {
+        de = allocate(fs->h, sizeof(*de));
+        if (de == INVALID_ADDRESS)
+            return FS_STATUS_NOMEM;
+        buffer hash = little_stack_buffer(sizeof(de->hash));
+        sha256(hash, alloca_wrap_buffer(src, length));
+        runtime_memcpy(de->hash, buffer_ref(hash, 0), sizeof(de->hash));
+        dedup_entry match = table_find(fs->dedup, de->hash);
+        if (match) {
+            deallocate(fs->h, de, sizeof(*de));
+            return write_shared_cluster(f, blocks, match->ex);
+        }
+    }
+
+    u64 buf_len = range_span(blocks) << order;
+    void *buf = allocate(fs->dma, buf_len);
+    fs_status fss = FS_STATUS_NOMEM;
+    if (buf == INVALID_ADDRESS)
+        goto fail_dealloc_entry;
+
+    /* keep the compressed data only if it saves at least one block */
+    u64 compressed = (flags & TFS_WRITE_COMPRESS) ?
+        lz4_compress(buf, buf_len - blocksize, src, length, workspace) : 0;
+    u64 data_len = compressed ? compressed : length;
+    if (!compressed)
+        runtime_memcpy(buf, src, length);
+    zero(buf + data_len, pad(data_len, blocksize) - data_len);
+    u64 nblocks = pad(data_len, blocksize) >> order;
+
+    fss = FS_STATUS_NOSPACE;
+    if (!filesystem_reserve_log_space(fs, &fs->next_extend_log_offset, 0, 0) ||
+        !filesystem_reserve_log_space(fs, &fs->next_new_log_offset, 0, 0))
+        goto fail_dealloc_buf;
+    u64 start_block = filesystem_allocate_storage_at(fs, *hint, nblocks);
+    if (start_block == INVALID_PHYSICAL)
+        goto fail_dealloc_buf;
+    range storage_blocks = irangel(start_block, nblocks);
+    extent ex = allocate_extent(fs->h, blocks, storage_blocks);
+    if (ex == INVALID_ADDRESS) {
+        filesystem_free_storage(fs, storage_blocks);
+        fss = FS_STATUS_NOMEM;
+        goto fail_dealloc_buf;
+    }
+    ex->md = 0;
+    ex->compressed = compressed;
+    fss = add_extent_to_file(f, ex);
+    if (fss != FS_STATUS_OK) {
+        destroy_extent(fs, ex);
+        goto fail_dealloc_buf;
+    }
+    if (compressed)
+        f->compressed = true;
+    if (de) {
+        de->ex = ex;
+        table_set(fs->dedup, de->hash, de);
+    }
+    *hint = storage_blocks.end;
+    apply(fs->w, buf, storage_blocks,
+          closure(fs->h, write_cluster_complete, fs->dma, buf, buf_len, apply_merge(m)));
+    return FS_STATUS_OK;
+  fail_dealloc_buf:
+    deallocate(fs->dma, buf, buf_len);
+  fail_dealloc_entry:
+    if (de)
+        deallocate(fs->h, de, sizeof(*de));
+    return fss;
+}
+
+/* Write the contents of a new, empty file in clusters, each in an extent of its own, for
+   building images (mkfs); the file data does not go through the page cache.
+
+   With TFS_WRITE_COMPRESS, clusters are TFS_COMPRESSION_CLUSTER_SIZE bytes and are stored
+   LZ4-compressed, unless they do not compress; a file with compressed extents is read-only.
+   With TFS_WRITE_DEDUP, a cluster identical to one written before (by SHA-256 of its
+   contents) shares its storage, which is copied on write. */
+void filesystem_write_clusters(fsfile f, void *src, u64 length, u64 flags,
+                               status_handler completion)
+{
+    filesystem fs = f->fs;
+    merge m = allocate_merge(fs->h, completion);
+    status_handler sh = apply_merge(m);
+    status s = STATUS_OK;
+    void *workspace = 0;
+    assert(rangemap_first_node(f->extentmap) == INVALID_ADDRESS);
+    fs_status fss = filesystem_truncate(fs, f, length);
+    if (fss != FS_STATUS_OK)
+        goto out;
+    fss = FS_STATUS_NOMEM;
+    if ((flags & TFS_WRITE_DEDUP) && !fs->dedup) {
+        fs->dedup = allocate_table(fs->h, dedup_key, dedup_equal);
+        if (fs->dedup == INVALID_ADDRESS) {
+            fs->dedup = 0;
+            goto out;
+        }
+    }
+    if (flags & TFS_WRITE_COMPRESS) {
+        workspace = allocate(fs->h, LZ4_COMPRESS_WORKSPACE);
+        if (workspace == INVALID_ADDRESS)
+            goto out;
+    }
+    u64 cluster_size = (flags & TFS_WRITE_COMPRESS) ? TFS_COMPRESSION_CLUSTER_SIZE :
+        MAX_EXTENT_SIZE;
+    u64 hint = INVALID_PHYSICAL;
+    for (u64 offset = 0; offset < length; offset += cluster_size) {
+        fss = write_cluster(f, src + offset, offset, MIN(length - offset, cluster_size), flags,
+                            workspace, &hint, m);
+        if (fss != FS_STATUS_OK)
+            break;
+    }
+    if (workspace)
+        deallocate(fs->h, workspace, LZ4_COMPRESS_WORKSPACE);
+  out:
+    if (fss != FS_STATUS_OK)
+        s = timm("result", "failed to write file clusters", "fsstatus", "%d", fss);
+    apply(sh, s);
+}
+
 fs_status filesystem_truncate(filesystem fs, fsfile f, u64 len)
 {
+    if (f->compressed)
+        return FS_STATUS_READONLY;
     value v = value_from_u64(fs->h, len);
     if (v == INVALID_ADDRESS)
         return FS_STATUS_NOMEM;
@@ -810,10 +1530,23 @@ fs_status filesystem_truncate(filesystem fs, fsfile f, u64 len)
     if (s == FS_STATUS_OK) {
         set(f->md, l, v);
         fsfile_set_length(f, len);
+        fsfile_md_changed(f);
+        fsfile_trim_prealloc(f);
     }
     return s;
 }
 
+void fsfile_reserve(fsfile f)
+{
+    fetch_and_add(&f->open_count, 1);
+}
+
+void fsfile_release(fsfile f)
+{
+    if (fetch_and_add(&f->open_count, (word)-1) == 1)
+        fsfile_trim_prealloc(f);
+}
+
 closure_function(3, 1, void, log_flush_completed,
                  filesystem, fs, status_handler, completion, boolean, sync_complete,
                  status, s)
@@ -835,6 +1568,48 @@ void filesystem_flush(filesystem fs, status_handler completion)
     log_flush(fs->tl, closure(fs->h, log_flush_completed, fs, completion, false));
 }
 
+closure_function(4, 1, void, fsfile_flush_complete,
+                 fsfile, f, boolean, datasync, status_handler, completion, u64, md_gen,
+                 status, s)
+{
+    fsfile f = bound(f);
+    filesystem fs = f->fs;
+    if (bound(md_gen) != infinity) {
+        /* log flush complete */
+        if (is_ok(s) && (bound(md_gen) > f->md_synced_gen))
+            f->md_synced_gen = bound(md_gen);
+        apply(bound(completion), s);
+    } else if (!is_ok(s)) {
+        apply(bound(completion), s);
+    } else if (bound(datasync) && (f->md_gen == f->md_synced_gen)) {
+        /* Only data within allocated extents changed; the log need not be
+           committed, but the data must still reach stable storage. */
+        tfs_debug("%s: f %p, skipping log flush\n", __func__, f);
+        if (fs->flush)
+            apply(fs->flush, bound(completion));
+        else
+            apply(bound(completion), s);
+    } else {
+        bound(md_gen) = f->md_gen;
+        filesystem_flush(fs, (status_handler)closure_self());
+        return;
+    }
+    closure_finish();
+}
+
+void fsfile_flush(fsfile f, boolean datasync, status_handler completion)
+{
+    tfs_debug("%s: f %p, datasync %d, completion %F\n", __func__, f, datasync, completion);
+    status_handler sh = closure(f->fs->h, fsfile_flush_complete, f, datasync, completion,
+                                infinity);
+    if (sh == INVALID_ADDRESS) {
+        apply(completion, timm("result", "failed to allocate closure",
+                               "fsstatus", "%d", FS_STATUS_NOMEM));
+        return;
+    }
+    pagecache_sync_node(f->cache_node, sh);
+}
+
 closure_function(2, 1, void, filesystem_op_complete,
                  fsfile, f, fs_status_handler, sh,
                  status, s)
@@ -873,13 +1648,17 @@ static fs_status add_extents_to_file(fsfile f, rangemap rm)
 void filesystem_alloc(filesystem fs, tuple t, long offset, long len,
                       boolean keep_size, fs_status_handler completion)
 {
-    fsfile f = table_find(fs->files, t);
+    fsfile f = fsfile_from_node(fs, t);
     assert(f);
     tuple extents = get(t, sym(extents));
     if (!extents) {
         apply(completion, f, FS_STATUS_NOENT);
         return;
     }
+    if (f->compressed) {
+        apply(completion, f, FS_STATUS_READONLY);
+        return;
+    }
 
     range blocks = range_rshift_pad(irangel(offset, len), fs->blocksize_order);
     tfs_debug("%s: t %v, blocks %R%s\n", __func__, t, blocks,
@@ -927,8 +1706,12 @@ done:
 void filesystem_dealloc(filesystem fs, tuple t, long offset, long len,
                         fs_status_handler completion)
 {
-    fsfile f = table_find(fs->files, t);
+    fsfile f = fsfile_from_node(fs, t);
     assert(f);
+    if (f->compressed) {
+        apply(completion, f, FS_STATUS_READONLY);
+        return;
+    }
     /* A write with !sg indicates that the pagecache should zero the
        range. The null sg is propagated to the storage write for
        extent removal. */
@@ -966,6 +1749,8 @@ static void cleanup_directory(tuple dir)
     iterate(c, stack_closure(cleanup_directory_each));
 }
 
+static void fs_lookup_cache_update(tuple parent, symbol name_sym, tuple child);
+
 static fs_status fs_set_dir_entry(filesystem fs, tuple parent, symbol name_sym,
                                   tuple child)
 {
@@ -976,8 +1761,10 @@ static fs_status fs_set_dir_entry(filesystem fs, tuple parent, symbol name_sym,
     }
     tuple c = children(parent);
     fs_status s = filesystem_write_eav(fs, c, name_sym, child);
-    if (s == FS_STATUS_OK)
+    if (s == FS_STATUS_OK) {
+        fs_lookup_cache_update(parent, name_sym, child);
         set(c, name_sym, child);
+    }
     if (child) {
         /* If this is a directory, re-add its . and .. directory entries. */
         fixup_directory(parent, child);
@@ -1012,8 +1799,10 @@ fs_status do_mkentry(filesystem fs, tuple parent, const char *name, tuple entry,
         s = FS_STATUS_OK;
     }
 
-    if (s == FS_STATUS_OK)
+    if (s == FS_STATUS_OK) {
+        fs_lookup_cache_update(parent, name_sym, entry);
         set(c, name_sym, entry);
+    }
     fixup_directory(parent, entry);
     return s;
 }
@@ -1195,7 +1984,7 @@ void filesystem_log_rebuild_done(filesystem fs, log new_tl)
 
 #endif /* !TFS_READ_ONLY */
 
-fsfile allocate_fsfile(filesystem fs, tuple md)
+static fsfile fsfile_init(filesystem fs, tuple md)
 {
     fsfile f = allocate(fs->h, sizeof(struct fsfile));
     if (f == INVALID_ADDRESS)
@@ -1222,16 +2011,101 @@ fsfile allocate_fsfile(filesystem fs, tuple md)
     f->fs = fs;
     f->md = md;
     f->length = 0;
-    table_set(fs->files, f->md, f);
+    f->md_gen = f->md_synced_gen = 0;
+    f->compressed = false;
+    f->open_count = 0;
+    f->cluster.e = 0;
+    f->cluster.data = 0;
+    f->cluster.len = 0;
+#ifdef KERNEL
+    spin_lock_init(&f->cluster.lock);
+#endif
     f->cache_node = pn;
     f->read = pagecache_node_get_reader(pn);
     f->write = pagecache_node_get_writer(pn);
     return f;
 }
 
+fsfile allocate_fsfile(filesystem fs, tuple md)
+{
+    fsfile f = fsfile_init(fs, md);
+    if (f == INVALID_ADDRESS)
+        return f;
+    filesystem_lock(fs);
+    table_set(fs->files, f->md, f);
+    filesystem_unlock(fs);
+    return f;
+}
+
+closure_function(1, 2, boolean, fsfile_ingest_extent,
+                 fsfile, f,
+                 value, s, value, v)
+{
+    assert(is_symbol(s));
+    ingest_extent(bound(f), s, v);
+    return true;
+}
+
+#ifndef BOOT
+closure_function(1, 1, void, dealloc_extent_node,
+                 filesystem, fs,
+                 rmnode, n)
+{
+    extent ex = (extent)n;
+    if (ex->cow_pending)
+        ex->destroyed = true;   /* freed once the copy-on-write completes */
+    else
+        deallocate(bound(fs)->h, ex, sizeof(struct extent));
+}
+
+static void fsfile_free(filesystem fs, fsfile f)
+{
+    if (f->cluster.data)
+        deallocate(fs->h, f->cluster.data, f->cluster.len);
+    deallocate_rangemap(f->extentmap, stack_closure(dealloc_extent_node, fs));
+    pagecache_deallocate_node(f->cache_node);
+    deallocate(fs->h, f, sizeof(*f));
+}
+
+#endif
+
 fsfile fsfile_from_node(filesystem fs, tuple n)
 {
-    return table_find(fs->files, n);
+    filesystem_lock(fs);
+    fsfile f = table_find(fs->files, n);
+    filesystem_unlock(fs);
+    if (f)
+        return f;
+
+    /* A regular file read from the log gets its fsfile and extent map on
+       first use; directories are not affected, since the log replay has to
+       build the whole tree anyway. Once loaded, an fsfile stays in the files
+       table until the file is deleted: nothing references fsfiles by count,
+       so they are not evicted. The fsfile is only published once complete,
+       and a concurrent lookup of the same file may have won the race. */
+    tuple extents = get_tuple(n, sym(extents));
+    if (!extents)
+        return 0;
+    f = fsfile_init(fs, n);
+    if (f == INVALID_ADDRESS)
+        return 0;
+    tfs_debug("%s: loading fsfile %p for %p\n", __func__, f, n);
+    iterate(extents, stack_closure(fsfile_ingest_extent, f));
+    u64 length;
+    if (get_u64(n, sym(filelength), &length))
+        fsfile_set_length(f, length);
+    filesystem_lock(fs);
+    fsfile winner = table_find(fs->files, n);
+    if (!winner)
+        table_set(fs->files, n, f);
+    filesystem_unlock(fs);
+#ifndef BOOT
+    if (winner) {
+        fsfile_free(fs, f);
+        f = winner;
+    }
+#endif
+    return f;
 }
 
 closure_function(2, 1, void, log_complete,
@@ -1261,6 +2135,11 @@ void filesystem_get_uuid(filesystem fs, u8 *uuid)
     runtime_memcpy(uuid, fs->uuid, UUID_LEN);
 }
 
+tfs_mount_stats filesystem_get_mount_stats(filesystem fs)
+{
+    return &fs->mount_stats;
+}
+
 boolean filesystem_reserve_log_space(filesystem fs, u64 *next_offset, u64 *offset, u64 size)
 {
     if (size == 0)
@@ -1277,6 +2156,10 @@ boolean filesystem_reserve_log_space(filesystem fs, u64 *next_offset, u64 *offse
     return true;
 }
 
+#ifndef TFS_READ_ONLY
+static void fs_lookup_cache_init(heap h);
+#endif
+
 void create_filesystem(heap h,
                        u64 blocksize,
                        u64 size,
@@ -1293,8 +2176,10 @@ void create_filesystem(heap h,
     if (!ignore_io_status)
         ignore_io_status = closure(h, ignore_io);
     fs->files = allocate_table(h, identity_key, pointer_equal);
+    filesystem_lock_init(fs);
     fs->zero_page = pagecache_get_zero_page();
     assert(fs->zero_page);
+    fs->dma = pagecache_get_contiguous_heap();
     fs->r = read;
     fs->root = 0;
     fs->page_order = pagecache_get_page_order();
@@ -1309,10 +2194,14 @@ void create_filesystem(heap h,
     fs->storage = create_id_heap(h, h, 0, size >> fs->blocksize_order, 1, false);
     assert(fs->storage != INVALID_ADDRESS);
     fs->temp_log = 0;
+    fs->shared = allocate_rangemap(h);
+    assert(fs->shared != INVALID_ADDRESS);
 #else
     fs->w = 0;
     fs->storage = 0;
+    fs->shared = 0;
 #endif
+    fs->dedup = 0;
     if (label) {
         int label_len = runtime_strlen(label);
         if (label_len >= sizeof(fs->label))
@@ -1322,24 +2211,21 @@ void create_filesystem(heap h,
     }
     fs->next_extend_log_offset = INVALID_PHYSICAL;
     fs->next_new_log_offset = INVALID_PHYSICAL;
+    zero(&fs->mount_stats, sizeof(fs->mount_stats));
+#ifndef TFS_READ_ONLY
+    fs_lookup_cache_init(h);
+#endif
     fs->tl = log_create(h, fs, label != 0, closure(h, log_complete, complete, fs));
 }
 
 #ifndef BOOT
 
-closure_function(1, 1, void, dealloc_extent_node,
-                 filesystem, fs,
-                 rmnode, n)
-{
-    deallocate(bound(fs)->h, n, sizeof(struct extent));
-}
-
 void deallocate_fsfile(filesystem fs, fsfile f)
 {
+    filesystem_lock(fs);
     table_set(fs->files, f->md, 0);
-    deallocate_rangemap(f->extentmap, stack_closure(dealloc_extent_node, fs));
-    pagecache_deallocate_node(f->cache_node);
-    deallocate(fs->h, f, sizeof(*f));
+    filesystem_unlock(fs);
+    fsfile_free(fs, f);
 }
 
 /* This is only for freeing up a filesystem that is only read; any pending
@@ -1409,6 +2295,141 @@ void fs_set_path_helper(filesystem (*get_root_fs)(), tuple (*lookup_follow)(file
     fs_path_helper.lookup_follow = lookup_follow;
 }
 
+/* Lookup caches shared by all filesystems: a direct-mapped cache of path
+   resolution results (including negative ones) keyed by starting directory
+   and path, and the name of each directory entry looked up by lookup_sym().
+   A change to a directory entry invalidates the negative path entries and
+   those resolved into that directory; replacing or removing a directory or a
+   symlink, or mounting a volume, invalidates all path entries. The names
+   table is emptied when it reaches FS_NAME_CACHE_MAX entries, and names are
+   checked against the parent before being returned. */
+#define FS_PATH_CACHE_ENTRIES   1024
+#define FS_PATH_CACHE_MAX_PATH  120
+#define FS_NAME_CACHE_MAX       4096
+
+typedef struct fs_path_cache_entry {
+    u64 gen;
+    u64 neg_gen;
+    tuple cwd;                  /* 0 for absolute paths */
+    filesystem fs;              /* filesystem resolved into, 0 if unchanged */
+    tuple entry, parent;        /* INVALID_ADDRESS if not set by the lookup */
+    int err;
+    int path_len;
+    char path[FS_PATH_CACHE_MAX_PATH];
+} *fs_path_cache_entry;
+
+static struct {
+    fs_path_cache_entry paths;
+    u64 gen;                    /* bumped to invalidate all path entries */
+    u64 neg_gen;                /* bumped to invalidate negative path entries */
+    u64 seq;                    /* bumped on any invalidation */
+    table names;                /* tuple -> name in its parent directory */
+#ifdef KERNEL
+    struct spinlock lock;       /* covers all of the above */
+#endif
+} fs_lookup_cache;
+
+#ifdef KERNEL
+#define fs_lookup_lock()    spin_lock(&fs_lookup_cache.lock)
+#define fs_lookup_unlock()  spin_unlock(&fs_lookup_cache.lock)
+#else
+#define fs_lookup_lock()
+#define fs_lookup_unlock()
+#endif
+
+/* must be called with the lookup cache locked */
+static void fs_name_cache_set(table names, tuple t, symbol s)
+{
+    if (table_elements(names) >= FS_NAME_CACHE_MAX)
+        table_clear(names);
+    table_set(names, t, s);
+}
+
+#ifndef TFS_READ_ONLY
+static void fs_lookup_cache_init(heap h)
+{
+    if (fs_lookup_cache.paths)
+        return;
+#ifdef KERNEL
+    spin_lock_init(&fs_lookup_cache.lock);
+#endif
+    fs_lookup_cache.names = allocate_table(h, identity_key, pointer_equal);
+    if (fs_lookup_cache.names == INVALID_ADDRESS)
+        goto fail;
+    fs_lookup_cache.paths = allocate_zero(h, FS_PATH_CACHE_ENTRIES *
+                                          sizeof(struct fs_path_cache_entry));
+    if (fs_lookup_cache.paths == INVALID_ADDRESS) {
+        deallocate_table(fs_lookup_cache.names);
+        goto fail;
+    }
+    fs_lookup_cache.gen = 1;
+    return;
+  fail:
+    fs_lookup_cache.names = 0;
+    fs_lookup_cache.paths = 0;
+}
+
+void fs_invalidate_path_cache(void)
+{
+    fs_lookup_lock();
+    fs_lookup_cache.gen++;
+    fs_lookup_cache.seq++;
+    fs_lookup_unlock();
+}
+
+/* Called on any change of a directory entry, before it takes effect. */
+static void fs_lookup_cache_update(tuple parent, symbol name_sym, tuple child)
+{
+    tuple old = get_tuple(children(parent), name_sym);
+    fs_lookup_lock();
+    fs_lookup_cache.seq++;
+    if (old && (children(old) || is_symlink(old))) {
+        /* paths through the old entry may resolve anywhere */
+        fs_lookup_cache.gen++;
+    } else {
+        fs_lookup_cache.neg_gen++;
+        if (old && fs_lookup_cache.paths) {
+            for (int i = 0; i < FS_PATH_CACHE_ENTRIES; i++) {
+                fs_path_cache_entry e = &fs_lookup_cache.paths[i];
+                if (e->parent == parent)
+                    e->gen = 0;
+            }
+        }
+    }
+    table names = fs_lookup_cache.names;
+    if (names) {
+        if (old && (table_find(names, old) == name_sym))
+            table_set(names, old, 0);
+        if (child)
+            fs_name_cache_set(names, child, name_sym);
+    }
+    fs_lookup_unlock();
+}
+#endif
+
+static fs_path_cache_entry fs_path_cache_slot(tuple cwd, const char *f, int *len)
+{
+    if (!fs_lookup_cache.paths)
+        return 0;
+    u64 hash = 14695981039346656037ull ^ u64_from_pointer(cwd);
+    int i;
+    for (i = 0; f[i]; i++) {
+        if (i == FS_PATH_CACHE_MAX_PATH)
+            return 0;
+        hash = (hash ^ (u8)f[i]) * 1099511628211ull;
+    }
+    *len = i;
+    return &fs_lookup_cache.paths[hash & (FS_PATH_CACHE_ENTRIES - 1)];
+}
+
+/* must be called with the lookup cache locked */
+static boolean fs_path_cache_hit(fs_path_cache_entry e, tuple cwd, const char *f, int len)
+{
+    return (e->gen == fs_lookup_cache.gen) &&
+        (!e->err || (e->neg_gen == fs_lookup_cache.neg_gen)) &&
+        (e->cwd == cwd) && (e->path_len == len) && !runtime_memcmp(e->path, f, len);
+}
+
 closure_function(2, 2, boolean, lookup_sym_each,
                  tuple, t, symbol *, s,
                  value, k, value, v)
@@ -1424,9 +2445,21 @@ closure_function(2, 2, boolean, lookup_sym_each,
 symbol lookup_sym(tuple parent, tuple t)
 {
     tuple c = children(parent);
-    symbol s = 0;
-    if (c)
-        iterate(c, stack_closure(lookup_sym_each, t, &s));
+    if (!c)
+        return 0;
+    fs_lookup_lock();
+    table names = fs_lookup_cache.names;
+    symbol s = names ? table_find(names, t) : 0;
+    fs_lookup_unlock();
+    if (s && (get(c, s) == t))
+        return s;
+    s = 0;
+    iterate(c, stack_closure(lookup_sym_each, t, &s));
+    if (s && names) {
+        fs_lookup_lock();
+        fs_name_cache_set(names, t, s);
+        fs_lookup_unlock();
+    }
     return s;
 }
 
@@ -1441,16 +2474,10 @@ static tuple lookup_follow(filesystem *fs, tuple t, symbol a, tuple *p)
     return t;
 }
 
-/* If the file path being resolved crosses a filesystem boundary (i.e. a mount
- * point), the 'fs' argument (if non-null) is updated to point to the new
- * filesystem. */
 // fused buffer wrap, split, and resolve
-int filesystem_resolve_cstring(filesystem *fs, tuple cwd, const char *f, tuple *entry,
-                    tuple *parent)
+static int resolve_cstring_internal(filesystem *fs, tuple cwd, const char *f, tuple *entry,
+                                    tuple *parent)
 {
-    assert(fs_path_helper.get_root_fs);
-    assert(f);
-
     tuple t = *f == '/' ? filesystem_getroot(fs_path_helper.get_root_fs()) : cwd;
     if (fs && (*f == '/'))
         *fs = fs_path_helper.get_root_fs();
@@ -1506,6 +2533,60 @@ done:
     return (t ? 0 : err);
 }
 
+/* If the file path being resolved crosses a filesystem boundary (i.e. a mount
+ * point), the 'fs' argument (if non-null) is updated to point to the new
+ * filesystem. */
+int filesystem_resolve_cstring(filesystem *fs, tuple cwd, const char *f, tuple *entry,
+                    tuple *parent)
+{
+    assert(fs_path_helper.get_root_fs);
+    assert(f);
+
+    if (*f == '/')
+        cwd = 0;
+    int len;
+    fs_path_cache_entry e = fs_path_cache_slot(cwd, f, &len);
+    if (!e)
+        return resolve_cstring_internal(fs, cwd, f, entry, parent);
+    filesystem rfs = 0;
+    tuple t = INVALID_ADDRESS, p = INVALID_ADDRESS;
+    int err;
+    fs_lookup_lock();
+    if (fs_path_cache_hit(e, cwd, f, len)) {
+        rfs = e->fs;
+        t = e->entry;
+        p = e->parent;
+        err = e->err;
+        fs_lookup_unlock();
+    } else {
+        /* The lookup may recurse through symlinks, so it runs unlocked; its
+           result is only cached if nothing was invalidated in the meantime. */
+        u64 seq = fs_lookup_cache.seq;
+        fs_lookup_unlock();
+        err = resolve_cstring_internal(&rfs, cwd, f, &t, &p);
+        fs_lookup_lock();
+        if (fs_lookup_cache.seq == seq) {
+            e->gen = fs_lookup_cache.gen;
+            e->neg_gen = fs_lookup_cache.neg_gen;
+            e->cwd = cwd;
+            e->fs = rfs;
+            e->entry = t;
+            e->parent = p;
+            e->err = err;
+            e->path_len = len;
+            runtime_memcpy(e->path, f, len);
+        }
+        fs_lookup_unlock();
+    }
+    if (fs && rfs)
+        *fs = rfs;
+    if (entry && (t != INVALID_ADDRESS))
+        *entry = t;
+    if (parent && (p != INVALID_ADDRESS))
+        *parent = p;
+    return err;
+}
+
 /* If the file path being resolved crosses a filesystem boundary (i.e. a mount
  * point), the 'fs' argument (if non-null) is updated to point to the new
  * filesystem. */
@@ -1588,26 +2669,19 @@ boolean dirname_from_path(buffer dest, const char *path)
     return true;
 }
 
-closure_function(4, 2, boolean, file_get_path_each,
-                 tuple, p, char *, buf, u64, len, int *, cur_len,
-                 value, k, value, v)
+static void file_get_path_prepend(symbol k, char *buf, u64 len, int *cur_len)
 {
-    if (v != bound(p))
-        return true;
-
     buffer tmpbuf = little_stack_buffer(NAME_MAX + 1);
     char *name = cstring(symbol_string(k), tmpbuf);
     int name_len = runtime_strlen(name);
-    if (bound(len) < 1 + name_len + *bound(cur_len)) {
-        *bound(cur_len) = 0;
-        return false;
+    if (len < 1 + name_len + *cur_len) {
+        *cur_len = 0;
+        return;
     }
-    char *buf = bound(buf);
-    runtime_memcpy(buf + 1 + name_len, buf, *bound(cur_len));
+    runtime_memcpy(buf + 1 + name_len, buf, *cur_len);
     buf[0] = '/';
     runtime_memcpy(buf + 1, name, name_len);
-    *bound(cur_len) += 1 + name_len;
-    return false;
+    *cur_len += 1 + name_len;
 }
 
 int file_get_path(tuple n, char *buf, u64 len)
@@ -1638,7 +2712,9 @@ int file_get_path(tuple n, char *buf, u64 len)
         if (!c)
             return cur_len;
 
-        iterate(c, stack_closure(file_get_path_each, p, buf, len, &cur_len));
+        symbol s = lookup_sym(n, p);
+        if (s)
+            file_get_path_prepend(s, buf, len, &cur_len);
     } while (cur_len > 0);
     return -1;
 }
@@ -17,6 +17,7 @@ extern io_status_handler ignore_io_status;
 
 #define MIN_EXTENT_SIZE PAGESIZE
 #define MAX_EXTENT_SIZE (1 * MB)
+#define TFS_COMPRESSION_CLUSTER_SIZE    (64 * KB)
 
 boolean filesystem_probe(u8 *first_sector, u8 *uuid, char *label);
 const char *filesystem_get_label(filesystem fs);
@@ -46,6 +47,21 @@ void filesystem_write_linear(fsfile f, void *src, range q, io_status_handler com
 
 void filesystem_flush(filesystem fs, status_handler completion);
 
+/* statistics from reading the log at filesystem open */
+typedef struct tfs_mount_stats {
+    u64 log_extensions;
+    u64 log_bytes;
+    u64 log_entries;
+    timestamp read_time;        /* waiting on log extension reads */
+    timestamp total_time;       /* from the first log read until the root is ready */
+} *tfs_mount_stats;
+
+tfs_mount_stats filesystem_get_mount_stats(filesystem fs);
+
+/* Write back the file's pages and commit the log; with datasync, the log is
+   skipped if the file extents and length are unchanged since its last flush. */
+void fsfile_flush(fsfile f, boolean datasync, status_handler completion);
+
 timestamp filesystem_get_atime(filesystem fs, tuple t);
 timestamp filesystem_get_mtime(filesystem fs, tuple t);
 void filesystem_set_atime(filesystem fs, tuple t, timestamp tim);
@@ -59,6 +75,7 @@ void filesystem_set_mtime(filesystem fs, tuple t, timestamp tim);
 u64 fsfile_get_length(fsfile f);
 void fsfile_set_length(fsfile f, u64);
 u64 fsfile_get_blocks(fsfile f);    /* returns the number of allocated blocks */
+boolean fsfile_is_compressed(fsfile f);
 fsfile fsfile_from_node(filesystem fs, tuple n);
 fsfile file_lookup(filesystem fs, vector v);
 void filesystem_read_entire(filesystem fs, tuple t, heap bufheap, buffer_handler c, status_handler s);
@@ -74,6 +91,7 @@ typedef enum {
     FS_STATUS_NOTDIR,
     FS_STATUS_NOMEM,
     FS_STATUS_LINKLOOP,
+    FS_STATUS_READONLY,
 } fs_status;
 
 const char *string_from_fs_status(fs_status s);
@@ -89,6 +107,18 @@ void filesystem_dealloc(filesystem fs, tuple t, long offset, long len,
         fs_status_handler completion);
 fs_status filesystem_truncate(filesystem fs, fsfile f, u64 len);
 
+/* Track open file descriptions; on the last release, unused preallocated
+   storage is given back. */
+void fsfile_reserve(fsfile f);
+void fsfile_release(fsfile f);
+
+/* flags for filesystem_write_clusters() */
+#define TFS_WRITE_COMPRESS  U64_FROM_BIT(0)
+#define TFS_WRITE_DEDUP     U64_FROM_BIT(1)
+
+void filesystem_write_clusters(fsfile f, void *src, u64 length, u64 flags,
+                               status_handler completion);
+
 fs_status do_mkentry(filesystem fs, tuple parent, const char *name, tuple entry,
         boolean persistent);
 
@@ -161,6 +191,10 @@ boolean dirname_from_path(buffer dest, const char *path);
 
 void fs_set_path_helper(filesystem (*get_root_fs)(), tuple (*lookup_follow)(filesystem *, tuple, symbol, tuple *));
 
+/* Must be called on namespace changes made outside of the filesystem
+   functions, such as attaching a mount. */
+void fs_invalidate_path_cache(void);
+
 int filesystem_resolve_cstring(filesystem *fs, tuple cwd, const char *f, tuple *entry,
                     tuple *parent);
 
@@ -7,7 +7,9 @@
 #include <storage.h>
 #include <tfs.h>
 
-#define TFS_VERSION 0x00000004
+#define TFS_VERSION 0x00000005
+/* version 4 logs only have default-size extensions, which version 5 can read */
+#define TFS_VERSION_MIN 0x00000004
 
 typedef struct log *log;
 
@@ -21,6 +23,9 @@ typedef struct filesystem {
     u8 uuid[UUID_LEN];
     char label[VOLUME_LABEL_MAX_LEN];
     table files; // maps tuple to fsfile
+#ifdef KERNEL
+    struct spinlock lock;       /* covers the files table */
+#endif
     closure_type(log, void, tuple);
     heap dma;
     void *zero_page;
@@ -33,6 +38,9 @@ typedef struct filesystem {
     u64 next_extend_log_offset;
     u64 next_new_log_offset;
     tuple root;
+    struct tfs_mount_stats mount_stats;
+    rangemap shared;            /* reference counts of storage shared between extents */
+    table dedup;                /* cluster hashes to extents, while writing an image */
 } *filesystem;
 
 typedef struct fsfile {
@@ -43,6 +51,18 @@ typedef struct fsfile {
     tuple md;
     sg_io read;
     sg_io write;
+    u64 md_gen;                 /* bumped on changes to extents or length */
+    u64 md_synced_gen;          /* md_gen as of the last completed log flush */
+    boolean compressed;         /* has compressed extents, and is read-only */
+    word open_count;            /* open file descriptions */
+    struct {                    /* last decompressed cluster of a compressed file */
+        struct extent *e;
+        void *data;
+        u64 len;
+#ifdef KERNEL
+        struct spinlock lock;
+#endif
+    } cluster;
 } *fsfile;
 
 typedef struct extent {
@@ -52,9 +72,14 @@ typedef struct extent {
     u64 allocated;
     tuple md;                   /* shortcut to extent meta */
     boolean uninited;
+    u64 compressed;             /* length in bytes of LZ4-compressed data, 0 if uncompressed */
+    boolean shared;             /* storage is shared with other extents */
+    vector cow_pending;         /* writes waiting for a copy-on-write of shared storage */
+    boolean destroyed;          /* destruction deferred until the copy-on-write completes */
 } *extent;
 
 void ingest_extent(fsfile f, symbol foff, tuple value);
+void reserve_extent_storage(filesystem fs, tuple value);
 
 log log_create(heap h, filesystem fs, boolean initialize, status_handler sh);
 boolean log_write(log tl, tuple t);
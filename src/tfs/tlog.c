@@ -30,6 +30,12 @@ static const char *tfs_magic = "NVMTFS";
 #define TFS_LOG_RESERVED_BYTES (TFS_EXTENSION_HEADER_BYTES + TFS_EXTENSION_LINK_BYTES)
 #define TFS_LOG_MAX_TUPLE_STAGING_BYTES (32 * MB)
 
+#ifndef TLOG_READ_ONLY
+#define tlog_timestamp() now(CLOCK_ID_MONOTONIC_RAW)
+#else
+#define tlog_timestamp() 0      /* no clock in stage2 */
+#endif
+
 typedef struct log *log;
 typedef struct log_ext *log_ext;
 
@@ -55,7 +61,7 @@ declare_closure_struct(1, 0, void, log_free,
 struct log {
     heap h;
     filesystem fs;
-    table extents; // maps extent tuples to files
+    table extents; // maps extent tuples to files, while reading the log
     table dictionary;
     u64 total_entries, obsolete_entries;
     rangemap extensions;
@@ -63,6 +69,9 @@ struct log {
     buffer tuple_staging;
     vector encoding_lengths;
     u64 tuple_bytes_remain;
+    u64 extension_count;
+    u64 checkpoint_extensions;  /* extension_count as of the last compaction */
+    timestamp open_time, read_start;
 
     timer flush_timer;
     vector flush_completions;
@@ -128,7 +137,7 @@ static log_ext open_log_extension(log tl, range sectors)
     if (ext->cache_node == INVALID_ADDRESS)
         goto fail_dealloc_staging;
 
-    pagecache_set_node_length(ext->cache_node, TFS_LOG_DEFAULT_EXTENSION_SIZE);
+    pagecache_set_node_length(ext->cache_node, size_bytes);
     ext->sectors = sectors;
     ext->read = pagecache_node_get_reader(ext->cache_node);
     ext->write = pagecache_node_get_writer(ext->cache_node);
@@ -142,6 +151,7 @@ static log_ext open_log_extension(log tl, range sectors)
         }
         rmnode_init(n, sectors);
         rangemap_insert(tl->extensions, n);
+        tl->extension_count++;
     }
 #endif
     refcount_reserve(&tl->refcount);
@@ -201,6 +211,7 @@ static log log_new(heap h, filesystem fs)
     if (tl->flush_completions == INVALID_ADDRESS)
         goto fail_dealloc_encoding_lengths;
     tl->total_entries = tl->obsolete_entries = 0;
+    tl->extension_count = tl->checkpoint_extensions = 0;
     tl->extents = 0;
 #ifndef TLOG_READ_ONLY
     tl->extensions = allocate_rangemap(h);
@@ -353,17 +364,38 @@ log_ext log_extend(log tl, u64 size, status_handler sh) {
     tlog_debug("log_extend: tl %p, size 0x%lx\n", tl, size);
 
     /* allocate new log and write with end of log */
-    size >>= tl->fs->blocksize_order;
+    filesystem fs = tl->fs;
+    size >>= fs->blocksize_order;
+    log_ext new_ext = INVALID_ADDRESS;
     u64 offset;
-    if (!filesystem_reserve_log_space(tl->fs, &tl->fs->next_extend_log_offset, &offset, size)) {
-        apply(sh, timm("result", "failed to extend log"));
-        return INVALID_ADDRESS;
+    range r;
+    if (size > filesystem_log_blocks(fs)) {
+        /* The space held in next_extend_log_offset is of default size; a
+           larger extension is allocated here, falling back to the default
+           size if that fails. */
+        offset = filesystem_allocate_storage(fs, size);
+        if (offset != INVALID_PHYSICAL) {
+            r = irangel(offset, size);
+            new_ext = open_log_extension(tl, r);
+            if (new_ext == INVALID_ADDRESS)
+                filesystem_free_storage(fs, r);
+        }
+    }
+    if (new_ext == INVALID_ADDRESS) {
+        size = filesystem_log_blocks(fs);
+        if (!filesystem_reserve_log_space(fs, &fs->next_extend_log_offset, &offset, size)) {
+            apply(sh, timm("result", "failed to extend log"));
+            return INVALID_ADDRESS;
+        }
+        r = irangel(offset, size);
+        new_ext = open_log_extension(tl, r);
+        if (new_ext == INVALID_ADDRESS) {
+            filesystem_free_storage(fs, r);
+            apply(sh, timm("result", "failed to open log extension"));
+            return INVALID_ADDRESS;
+        }
     }
-
-    /* new log extension */
-    range r = irangel(offset, size);
     tlog_debug("new log extension sectors %R\n", r);
-    log_ext new_ext = open_log_extension(tl, r);
 
     /* flush new extension and link on completion */
     log_ext old_ext = tl->current;
@@ -381,6 +413,25 @@ static inline u64 log_size(log_ext ext)
     return bytes_from_sectors(ext->tl->fs, range_span(ext->sectors));
 }
 
+static inline u64 varint_size(u64 x)
+{
+    u64 n = 1;
+    while (x >>= 7)
+        n++;
+    return n;
+}
+
+/* Size a new extension to take all of the remaining staged tuples, so that a
+   large batch of metadata - such as the snapshot written on log compaction or
+   by mkfs - is laid out in a few large extensions rather than a long chain. */
+static u64 log_extension_size(log tl, int first)
+{
+    u64 staged = buffer_length(tl->tuple_staging) + TFS_LOG_RESERVED_BYTES;
+    for (int i = first; i < vector_length(tl->encoding_lengths); i++)
+        staged += 1 + 2 * varint_size((u64)vector_get(tl->encoding_lengths, i));
+    return MIN(pad(staged, TFS_LOG_DEFAULT_EXTENSION_SIZE), TFS_LOG_MAX_EXTENSION_SIZE);
+}
+
 static inline boolean log_write_internal(log tl, merge m)
 {
     log_ext ext = tl->current;
@@ -398,7 +449,7 @@ static inline boolean log_write_internal(log tl, merge m)
             u64 min = TFS_EXTENSION_LINK_BYTES + TUPLE_AVAILABLE_MIN_SIZE;
             if (ext->staging->end + min >= size) {
                 status_handler sh = apply_merge(m);
-                ext = log_extend(tl, TFS_LOG_DEFAULT_EXTENSION_SIZE, sh);
+                ext = log_extend(tl, log_extension_size(tl, i), sh);
                 if (ext == INVALID_ADDRESS)
                     return false;
                 size = log_size(ext);
@@ -459,6 +510,7 @@ closure_function(2, 1, void, log_switch_complete,
     if (is_ok(s)) {
         to_be_used = new_tl;
         to_be_destroyed = old_tl;
+        new_tl->checkpoint_extensions = new_tl->extension_count;
     } else {
         old_tl->compacting = false;
         to_be_used = old_tl;
@@ -486,6 +538,28 @@ closure_function(2, 1, void, log_switch_complete,
     closure_finish();
 }
 
+static boolean log_compaction_needed(log tl)
+{
+    if ((tl->obsolete_entries >= TFS_LOG_COMPACT_OBSOLETE) &&
+        (tl->total_entries <= TFS_LOG_COMPACT_RATIO * tl->obsolete_entries)) {
+        tlog_debug("%ld obsolete entries out of %ld, starting log compaction\n",
+            tl->obsolete_entries, tl->total_entries);
+        return true;
+    }
+#ifdef KERNEL
+    /* Checkpoint a long chain of extensions, so that the next mount can read
+       the metadata back as a snapshot with a few large reads. (mkfs writes its
+       metadata into large extensions to begin with.) */
+    if ((tl->extension_count >= TFS_LOG_CHECKPOINT_EXTENSIONS) &&
+        (tl->extension_count >= 2 * tl->checkpoint_extensions)) {
+        tlog_debug("%ld log extensions (%ld at last checkpoint), starting log compaction\n",
+            tl->extension_count, tl->checkpoint_extensions);
+        return true;
+    }
+#endif
+    return false;
+}
+
 void log_flush(log tl, status_handler completion)
 {
     tlog_debug("%s: log %p, completion %p, dirty %d\n", __func__, tl, completion, tl->dirty);
@@ -514,10 +588,7 @@ void log_flush(log tl, status_handler completion)
     /* completion merge will close out with the flush; compaction is independent */
     flush_log_extension(tl->current, false, sh);
 
-    if (!tl->failed && !tl->compacting && (tl->obsolete_entries >= TFS_LOG_COMPACT_OBSOLETE) &&
-        (tl->total_entries <= TFS_LOG_COMPACT_RATIO * tl->obsolete_entries)) {
-        tlog_debug("%ld obsolete entries out of %ld, starting log compaction\n",
-            tl->obsolete_entries, tl->total_entries);
+    if (!tl->failed && !tl->compacting && log_compaction_needed(tl)) {
         filesystem fs = tl->fs;
         log new_tl = log_new(fs->h, fs);
         if (new_tl == INVALID_ADDRESS)
@@ -575,14 +646,12 @@ static void log_set_dirty(log tl)
                                      closure(tl->h, log_flush_timer_expired, tl));
 }
 #else
-/* mkfs: flush on close */
+/* mkfs: flush on close, or once enough is staged to fill a large extension */
 static void log_set_dirty(log tl)
 {
     tl->dirty = true;
-    if (buffer_length(tl->tuple_staging) >=
-            bytes_from_sectors(tl->fs, range_span(tl->current->sectors))) {
+    if (buffer_length(tl->tuple_staging) >= TFS_LOG_MAX_EXTENSION_SIZE)
         log_flush(tl, 0);
-    }
 }
 #endif
 
@@ -617,26 +686,17 @@ boolean log_write(log tl, tuple t)
 
 static void log_process_tuple(log tl, tuple t);
 
-closure_function(4, 2, boolean, log_process_tuple_each,
-                 log, tl, tuple, t, fsfile *, f, u64 *, filelength,
+closure_function(2, 2, boolean, log_process_tuple_each,
+                 log, tl, tuple, t,
                  value, k, value, v)
 {
     log tl = bound(tl);
     assert(is_symbol(k));
     if (k == sym(extents)) {
+        /* fsfiles are set up on first use (fsfile_from_node); just keep
+           track of the extents for reserving storage at the end of the log */
         tlog_debug("extents: %p\n", v);
-        /* don't know why this needs to be in fs, it's really tlog-specific */
-        fsfile f;
-        if (!(f = table_find(tl->extents, v))) {
-            f = allocate_fsfile(tl->fs, bound(t));
-            table_set(tl->extents, v, f);
-            tlog_debug("   created fsfile %p\n", f);
-        } else {
-            tlog_debug("   found fsfile %p\n", f);
-        }
-        *bound(f) = f;
-    } else if (k == sym(filelength)) {
-        assert(u64_from_value(v, bound(filelength)));
+        table_set(tl->extents, v, bound(t));
     } else if (is_tuple(v)) {
         log_process_tuple(tl, v);
     }
@@ -645,15 +705,7 @@ closure_function(4, 2, boolean, log_process_tuple_each,
 
 static void log_process_tuple(log tl, tuple t)
 {
-    fsfile f = 0;
-    u64 filelength = infinity;
-
-    iterate(t, stack_closure(log_process_tuple_each, tl, t, &f, &filelength));
-        
-    if (f && filelength != infinity) {
-        tlog_debug("   update fsfile length to %ld\n", filelength);
-        fsfile_set_length(f, filelength);
-    }
+    iterate(t, stack_closure(log_process_tuple_each, tl, t));
 }
 
 static boolean log_parse_tuple(log tl, buffer b)
@@ -682,7 +734,7 @@ static status log_hdr_parse(buffer b, boolean first_ext, u64 *length, u8 *uuid,
         return timm("result", "tfs magic mismatch");
     buffer_consume(b, TFS_MAGIC_BYTES);
     u64 version = pop_varint(b);
-    if (version != TFS_VERSION)
+    if ((version < TFS_VERSION_MIN) || (version > TFS_VERSION))
         return timm("result", "tfs version mismatch (read %ld, build %ld)",
             version, TFS_VERSION);
     *length = pop_varint(b);
@@ -694,13 +746,13 @@ static status log_hdr_parse(buffer b, boolean first_ext, u64 *length, u8 *uuid,
     return STATUS_OK;
 }
 
-closure_function(1, 2, boolean, log_read_ingest_extent,
-                 fsfile, f,
+closure_function(1, 2, boolean, log_read_reserve_extent,
+                 filesystem, fs,
                  value, s, value, v)
 {
     assert(is_symbol(s));
-    tlog_debug("   tlog ingesting sym %p, val %p\n", symbol_string(off), e);
-    ingest_extent(bound(f), s, v);
+    tlog_debug("   tlog reserving storage for sym %b, val %p\n", symbol_string(s), v);
+    reserve_extent_storage(bound(fs), v);
     return true;
 }
 
@@ -728,6 +780,10 @@ closure_function(4, 1, void, log_read_complete,
     buffer b = ext->staging;
     u64 n = sg_copy_to_buf_and_release(buffer_ref(b, 0), bound(sg), bound(length));
     buffer_produce(b, n);
+    tfs_mount_stats stats = &tl->fs->mount_stats;
+    stats->log_extensions++;
+    stats->log_bytes += n;
+    stats->read_time += tlog_timestamp() - tl->read_start;
     dump_staging(ext);
     tlog_debug("log_read_complete: buffer len %d, status %v\n", buffer_length(b), read_status);
     tlog_debug("-> new log extension, checking magic and version\n");
@@ -833,16 +889,20 @@ closure_function(4, 1, void, log_read_complete,
     b->start = 0;
     tlog_debug("   log parse finished, end now at %d\n", b->end);
 
-    binding_handler bh = stack_closure(log_read_ingest_extent, 0);
-    table_foreach(tl->extents, t, f) {
-        assert(is_tuple(t));
-        closure_member(log_read_ingest_extent, bh, f) = (fsfile)f;
-        iterate((tuple)t, bh);
+    if (tl->fs->w) {
+        binding_handler bh = stack_closure(log_read_reserve_extent, tl->fs);
+        table_foreach(tl->extents, t, md) {
+            (void)md;
+            assert(is_tuple(t));
+            iterate((tuple)t, bh);
+        }
     }
     deallocate_table(tl->extents);  /* not needed anymore */
     tl->extents = 0;
 
     tl->fs->root = (tuple)table_find(tl->dictionary, pointer_from_u64(1));
+    stats->log_entries = tl->total_entries;
+    stats->total_time = tlog_timestamp() - tl->open_time;
 
     if (tl->fs->w) {
         /* Reverse pairs in dictionary so that we can use it for writing
@@ -886,6 +946,7 @@ static void log_read(log tl, status_handler sh)
     range r = irangel(0, bytes_from_sectors(tl->fs, range_span(ext->sectors)));
     status_handler tlc = closure(tl->h, log_read_complete, ext, sg, range_span(r), sh);
     tlog_debug("%s: issuing sg read, sg %p, r %R\n", __func__, sg, r);
+    tl->read_start = tlog_timestamp();
     apply(ext->read, sg, r, tlc);
 }
 
@@ -935,6 +996,7 @@ log log_create(heap h, filesystem fs, boolean initialize, status_handler sh)
               STATUS_OK);
 #endif
     } else {
+        tl->open_time = tlog_timestamp();
         log_read(tl, sh);
     }
     return tl;
@@ -141,6 +141,7 @@ static void build_exec_stack(process p, thread t, Elf64_Ehdr * e, void *start,
 void start_process(thread t, void *start)
 {
     t->default_frame[SYSCALL_FRAME_PC] = u64_from_pointer(start);
+    boot_timeline_complete(t->p->process_root);
     if (get(t->p->process_root, sym(gdb))) {
         rputs("TODO: in-kernel gdb needs revisiting\n");
 //        init_tcp_gdb(heap_general(get_kernel_heaps()), t->p, 9090);
@@ -157,51 +158,212 @@ closure_function(0, 1, void, load_interp_fail,
     halt("read interp failed %v\n", s);
 }
 
-closure_function(3, 4, u64, exec_elf_map,
-                 process, p, kernel_heaps, kh, u32, allowed_flags,
-                 u64, vaddr, u64, paddr, u64, size, pageflags, flags)
+/* Number of bytes at the beginning of an ELF file that exec needs: the file header, the program
+   header table and the interpreter path. */
+static u64 elf_headers_length(buffer b)
 {
-    kernel_heaps kh = bound(kh);
-    u64 vmflags = 0;
-    if (pageflags_is_exec(flags))
-        vmflags |= VMAP_FLAG_EXEC;
-    if (pageflags_is_writable(flags))
-        vmflags |= VMAP_FLAG_WRITABLE;
-
-    range r = irangel(vaddr, size);
-    boolean is_bss = paddr == INVALID_PHYSICAL;
-    exec_debug("%s: add to vmap: %R vmflags 0x%lx%s\n",
-               __func__, r, vmflags, is_bss ? " bss" : "");
-    assert(allocate_vmap(bound(p)->vmaps, r, ivmap(vmflags, bound(allowed_flags), 0, 0)) !=
-            INVALID_ADDRESS);
-    if (is_bss) {
-        /* bss */
-        paddr = allocate_u64((heap)heap_physical(kh), size);
-        assert(paddr != INVALID_PHYSICAL);
+    Elf64_Ehdr *e = buffer_ref(b, 0);
+    if (buffer_length(b) < sizeof(*e))
+        return sizeof(*e);
+    u64 len = e->e_phoff + e->e_phnum * e->e_phentsize;
+    if (len > buffer_length(b))
+        return len;
+    foreach_phdr(e, p) {
+        if (p->p_type == PT_INTERP)
+            len = MAX(len, p->p_offset + p->p_filesz);
+    }
+    return MAX(len, sizeof(*e));
+}
+
+static void read_elf_headers_length(fsfile f, heap h, u64 length, buffer_handler bh,
+                                    status_handler sh);
+
+closure_function(5, 2, void, read_elf_headers_complete,
+                 fsfile, f, heap, h, buffer, b, buffer_handler, bh, status_handler, sh,
+                 status, s, bytes, len)
+{
+    fsfile f = bound(f);
+    heap h = bound(h);
+    buffer b = bound(b);
+    buffer_handler bh = bound(bh);
+    status_handler sh = bound(sh);
+    closure_finish();
+    if (!is_ok(s)) {
+        deallocate_buffer(b);
+        apply(sh, s);
+        return;
+    }
+    buffer_produce(b, len);
+    u64 hlen = elf_headers_length(b);
+    if (hlen <= buffer_length(b)) {
+        apply(bh, b);
+        return;
+    }
+    deallocate_buffer(b);
+    if (hlen > fsfile_get_length(f))
+        apply(sh, timm("result", "truncated ELF headers (0x%lx bytes needed)", hlen));
+    else
+        read_elf_headers_length(f, h, hlen, bh, sh);
+}
+
+static void read_elf_headers_length(fsfile f, heap h, u64 length, buffer_handler bh,
+                                    status_handler sh)
+{
+    length = MIN(length, fsfile_get_length(f));
+    buffer b = allocate_buffer(h, length);
+    if (b == INVALID_ADDRESS) {
+        apply(sh, timm("result", "failed to allocate ELF header buffer"));
+        return;
+    }
+    io_status_handler completion = closure(h, read_elf_headers_complete, f, h, b, bh, sh);
+    if (completion == INVALID_ADDRESS) {
+        deallocate_buffer(b);
+        apply(sh, timm("result", "failed to allocate ELF header completion"));
+        return;
+    }
+    filesystem_read_linear(f, buffer_ref(b, 0), irange(0, length), completion);
+}
+
+/* Read the headers of an ELF file, so that it can be passed to exec_elf() without reading the
+   segment contents: these are mapped from the page cache and faulted in on demand. */
+void read_elf_headers(filesystem fs, tuple t, heap h, buffer_handler bh, status_handler sh)
+{
+    fsfile f = fsfile_from_node(fs, t);
+    if (!f) {
+        apply(sh, timm("result", "no such file %v", t,
+                       "fsstatus", "%d", FS_STATUS_NOENT));
+        return;
+    }
+    /* program headers and interpreter path normally follow the file header in the first page */
+    read_elf_headers_length(f, h, PAGESIZE, bh, sh);
+}
+
+closure_function(3, 2, void, exec_elf_tail_complete,
+                 u64, vaddr, pageflags, flags, status_handler, sh,
+                 status, s, bytes, len)
+{
+    if (is_ok(s))
+        update_map_flags(bound(vaddr), PAGESIZE, bound(flags));
+    apply(bound(sh), s);
+    closure_finish();
+}
+
+/* Map the loadable segments of an ELF file. As with a private file mapping, segment contents are
+   paged in from the page cache on first access and copied on write, and the bss is zero-filled on
+   demand. The only page populated here is the one where file contents end and the bss begins,
+   which is read asynchronously under merge m. */
+static void *exec_elf_map(process p, kernel_heaps kh, Elf64_Ehdr *e, fsfile f, u64 load_offset,
+                          u32 allowed_flags, merge m)
+{
+    pagecache_node pn = fsfile_get_cachenode(f);
+    foreach_phdr(e, ph) {
+        if (ph->p_type != PT_LOAD)
+            continue;
+        if (ph->p_memsz < ph->p_filesz)
+            halt("exec_elf_map with p_memsz (%ld) < p_filesz (%ld)\n",
+                 ph->p_memsz, ph->p_filesz);
+        u64 vmflags = VMAP_FLAG_MMAP;
+        if (ph->p_flags & PF_X)
+            vmflags |= VMAP_FLAG_EXEC;
+        if (ph->p_flags & PF_W)
+            vmflags |= VMAP_FLAG_WRITABLE;
+        u64 vaddr = ph->p_vaddr + load_offset;
+        u64 map_start = vaddr & ~PAGEMASK;
+        u64 file_end = vaddr + ph->p_filesz;
+        u64 mem_end = pad(vaddr + ph->p_memsz, PAGESIZE);
+        boolean bss = ph->p_memsz > ph->p_filesz;
+
+        /* If there is a bss in this segment and it doesn't start on a page boundary, the page
+           holding the end of the file data belongs to the bss mapping. */
+        u64 tail = bss ? (file_end & PAGEMASK) : 0;
+        u64 file_map_end = bss ? (file_end & ~PAGEMASK) : pad(file_end, PAGESIZE);
+        if (file_map_end > map_start) {
+            range r = irange(map_start, file_map_end);
+            exec_debug("%s: file-backed vmap %R, offset 0x%lx, vmflags 0x%lx\n", __func__, r,
+                       ph->p_offset & ~PAGEMASK, vmflags);
+            assert(allocate_vmap(p->vmaps, r,
+                                 ivmap(vmflags | VMAP_MMAP_TYPE_FILEBACKED, allowed_flags,
+                                       ph->p_offset & ~PAGEMASK, pn)) != INVALID_ADDRESS);
+        }
+        if (!bss)
+            continue;
+        u64 bss_start = MAX(file_map_end, map_start);
+        range r = irange(bss_start, mem_end);
+        exec_debug("%s: bss vmap %R, tail 0x%lx, vmflags 0x%lx\n", __func__, r, tail, vmflags);
+        assert(allocate_vmap(p->vmaps, r, ivmap(vmflags | VMAP_MMAP_TYPE_ANONYMOUS,
+                                                allowed_flags, 0, 0)) != INVALID_ADDRESS);
+        if (tail) {
+            pageflags flags = pageflags_from_vmflags(vmflags);
+            assert(map_zeroed_pages(bss_start, PAGESIZE, pageflags_writable(flags)));
+            filesystem_read_linear(f, pointer_from_u64(bss_start),
+                                   irangel(ph->p_offset + ph->p_filesz - tail, tail),
+                                   closure(heap_general(kh), exec_elf_tail_complete, bss_start,
+                                           flags, apply_merge(m)));
+        }
+    }
+    return pointer_from_u64(e->e_entry + load_offset);
+}
+
+closure_function(2, 1, void, exec_elf_start,
+                 thread, t, void *, entry,
+                 status, s)
+{
+    if (!is_ok(s))
+        halt("exec_elf failed to load program: %v\n", s);
+    thread t = bound(t);
+
+    /* current needs to be valid for further setup */
+    set_current_thread(&t->thrd);
+
+    string cwd = get_string(t->p->process_root, sym(cwd));
+    if (cwd) {
+        buffer tmpbuf = little_stack_buffer(NAME_MAX + 1);
+        fs_status fss = filesystem_chdir(t->p, cstring(cwd, tmpbuf));
+        if (fss != FS_STATUS_OK)
+            halt("unable to change cwd to \"%b\"; %s\n", cwd, string_from_fs_status(fss));
     }
-    map(vaddr, paddr, size, pageflags_user(flags));
-    if (is_bss)
-        zero(pointer_from_u64(vaddr), size);
-    return vaddr;
+
+    exec_debug("starting process tid %d, start %p\n", t->tid, bound(entry));
+    start_process(t, bound(entry));
+    closure_finish();
 }
 
-closure_function(2, 1, status, load_interp_complete,
-                 thread, t, kernel_heaps, kh,
+closure_function(6, 1, status, load_interp_complete,
+                 thread, t, kernel_heaps, kh, fsfile, f, merge, m, status_handler, start,
+                 status_handler, sh,
                  buffer, b)
 {
     thread t = bound(t);
-    kernel_heaps kh = bound(kh);
 
-    exec_debug("interpreter load complete, reading elf\n");
+    exec_debug("interpreter headers read, mapping elf\n");
     u64 where = process_get_virt_range(t->p, HUGE_PAGESIZE);
     assert(where != INVALID_PHYSICAL);
-    void * start = load_elf(b, where, stack_closure(exec_elf_map, t->p, kh, 0));
-    exec_debug("starting process tid %d, start %p\n", t->tid, start);
-    start_process(t, start);
+    void *entry = exec_elf_map(t->p, bound(kh), buffer_ref(b, 0), bound(f), where, 0, bound(m));
+    closure_member(exec_elf_start, bound(start), entry) = entry;
+    deallocate_buffer(b);
+    apply(bound(sh), STATUS_OK);
+    closure_finish();
+    return STATUS_OK;
+}
+
+closure_function(1, 1, status, exec_syms_complete,
+                 u64, load_offset,
+                 buffer, b)
+{
+    exec_debug("ingesting symbols...\n");
+    add_elf_syms(b, bound(load_offset));    /* symbol names point into b */
+    exec_debug("...done\n");
     closure_finish();
     return STATUS_OK;
 }
 
+closure_function(0, 1, void, exec_syms_fail,
+                 status, s)
+{
+    msg_err("failed to read program symbols: %v\n", s);
+    closure_finish();
+}
+
 closure_function(1, 1, boolean, trace_notify,
                  process, p,
                  value, v)
@@ -210,11 +372,12 @@ closure_function(1, 1, boolean, trace_notify,
     return true;
 }
 
-process exec_elf(buffer ex, process kp)
+process exec_elf(buffer ex, tuple program, process kp)
 {
     // is process md always root?
     unix_heaps uh = kp->uh;
     kernel_heaps kh = (kernel_heaps)uh;
+    heap h = heap_general(kh);
     tuple root = kp->process_root;
     filesystem fs = kp->root_fs;
     process proc = create_process(uh, root, fs);
@@ -226,12 +389,19 @@ process exec_elf(buffer ex, process kp)
     proc->brk = 0;
 
     exec_debug("exec_elf enter\n");
+    register_root_notify(sym(trace), closure(h, trace_notify, proc));
+
+    if (snapshot_restore(proc, t)) {
+        exec_debug("resuming snapshot\n");
+        deallocate_buffer(ex);
+        return proc;
+    }
 
     range load_range = irange(infinity, 0);
     foreach_phdr(e, p) {
         if (p->p_type == PT_INTERP) {
             char *n = (void *)e + p->p_offset;
-            interp = resolve_path(root, split(heap_general(kh), alloca_wrap_buffer(n, runtime_strlen(n)), '/'));
+            interp = resolve_path(root, split(h, alloca_wrap_buffer(n, runtime_strlen(n)), '/'));
             if (!interp) 
                 halt("couldn't find program interpreter %s\n", n);
         } else if (p->p_type == PT_LOAD) {
@@ -268,7 +438,13 @@ process exec_elf(buffer ex, process kp)
                load_offset, load_range, range_span(load_range));
     u32 allowed_flags = proc_is_exec_protected(proc) ? 0 :
             (VMAP_FLAG_READABLE | VMAP_FLAG_WRITABLE | VMAP_FLAG_EXEC);
-    void * entry = load_elf(ex, load_offset, stack_closure(exec_elf_map, proc, kh, allowed_flags));
+    fsfile f = fsfile_from_node(fs, program);
+    assert(f);
+    status_handler start = closure(h, exec_elf_start, t, 0);
+    merge m = allocate_merge(h, start);
+    status_handler sh = apply_merge(m);
+    void * entry = exec_elf_map(proc, kh, e, f, load_offset, allowed_flags, m);
+    closure_member(exec_elf_start, start, entry) = entry;
 
     u64 brk_offset = aslr ? get_aslr_offset(PROCESS_HEAP_ASLR_RANGE) : 0;
     u64 brk = pad(load_range.end, PAGESIZE) + brk_offset;
@@ -285,34 +461,24 @@ process exec_elf(buffer ex, process kp)
     build_exec_stack(proc, t, e, entry, load_range.start, root, aslr);
 
     if (get(proc->process_root, sym(ingest_program_symbols))) {
-        exec_debug("ingesting symbols...\n");
-        add_elf_syms(ex, load_offset);
-        exec_debug("...done\n");
+        /* the symbol table is not covered by the program headers */
+        exec_debug("reading program symbols...\n");
+        filesystem_read_entire(fs, program, heap_backed(kh),
+                               closure(h, exec_syms_complete, load_offset),
+                               closure(h, exec_syms_fail));
     }
 
-    register_root_notify(sym(trace), closure(heap_general(kh), trace_notify, proc));
-
     if (interp) {
         exec_debug("reading interp...\n");
-        filesystem_read_entire(fs, interp, heap_backed(kh),
-                               closure(heap_general(kh), load_interp_complete, t, kh),
-                               closure(heap_general(kh), load_interp_fail));
-        return proc;
+        fsfile interp_f = fsfile_from_node(fs, interp);
+        if (!interp_f)
+            halt("program interpreter %v is not a file\n", interp);
+        read_elf_headers(fs, interp, h,
+                         closure(h, load_interp_complete, t, kh, interp_f, m, start,
+                                 apply_merge(m)),
+                         closure(h, load_interp_fail));
     }
-
-    /* current needs to be valid for further setup */
-    set_current_thread(&t->thrd);
-
-    string cwd = get_string(root, sym(cwd));
-    if (cwd) {
-        buffer tmpbuf = little_stack_buffer(NAME_MAX + 1);
-        fs_status fss = filesystem_chdir(proc, cstring(cwd, tmpbuf));
-        if (fss != FS_STATUS_OK)
-            halt("unable to change cwd to \"%b\"; %s\n", cwd, string_from_fs_status(fss));
-    }
-
-    exec_debug("starting process...\n");
-    start_process(t, entry);
-    return proc;    
+    deallocate_buffer(ex);
+    apply(sh, STATUS_OK);
+    return proc;
 }
-
@@ -17,6 +17,8 @@ sysreturn sysreturn_from_fs_status(fs_status s)
         return -ENOTDIR;
     case FS_STATUS_LINKLOOP:
         return -ELOOP;
+    case FS_STATUS_READONLY:
+        return -EROFS;
     default:
         return 0;
     }
@@ -136,28 +138,24 @@ fs_status filesystem_chdir(process p, const char *path)
     return FS_STATUS_OK;
 }
 
-closure_function(4, 1, void, fs_sync_complete,
-                 filesystem, fs, pagecache_node, pn, status_handler, sh, boolean, fs_flushed,
+closure_function(3, 1, void, fs_sync_complete,
+                 filesystem, fs, status_handler, sh, boolean, fs_flushed,
                  status, s)
 {
     if (is_ok(s) && !bound(fs_flushed)) {
         bound(fs_flushed) = true;
-        if (bound(pn))
-            pagecache_sync_node(bound(pn), (status_handler)closure_self());
-        else
-            pagecache_sync_volume(filesystem_get_pagecache_volume(bound(fs)),
-                (status_handler)closure_self());
+        pagecache_sync_volume(filesystem_get_pagecache_volume(bound(fs)),
+            (status_handler)closure_self());
         return;
     }
     apply(bound(sh), s);
     closure_finish();
 }
 
-static void filesystem_sync_internal(filesystem fs, pagecache_node pn,
-                                     status_handler sh)
+void filesystem_sync(filesystem fs, status_handler sh)
 {
     status_handler sync_complete = closure(heap_general(get_kernel_heaps()),
-        fs_sync_complete, fs, pn, sh, false);
+        fs_sync_complete, fs, sh, false);
     if (sync_complete == INVALID_ADDRESS) {
         apply(sh, timm("result", "cannot allocate closure"));
         return;
@@ -165,16 +163,6 @@ static void filesystem_sync_internal(filesystem fs, pagecache_node pn,
     filesystem_flush(fs, sync_complete);
 }
 
-void filesystem_sync(filesystem fs, status_handler sh)
-{
-    filesystem_sync_internal(fs, 0, sh);
-}
-
-void filesystem_sync_node(filesystem fs, pagecache_node pn, status_handler sh)
-{
-    filesystem_sync_internal(fs, pn, sh);
-}
-
 closure_function(2, 2, void, fs_op_complete,
                  thread, t, file, f,
                  fsfile, fsf, fs_status, s)
@@ -372,7 +360,13 @@ sysreturn fadvise64(int fd, s64 off, u64 len, int advice)
         pagecache_node_fetch_pages(pn, r);
         break;
     }
-    case POSIX_FADV_DONTNEED:
+    case POSIX_FADV_DONTNEED: {
+        pagecache_node pn = fsfile_get_cachenode(f->fsf);
+        range r = (len != 0) ? irangel(off, len) :
+                irange(off, pagecache_get_node_length(pn));
+        pagecache_node_evict_clean(pn, r);
+        break;
+    }
     case POSIX_FADV_NOREUSE:
         break;
     default:
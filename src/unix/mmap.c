@@ -91,13 +91,11 @@ boolean do_demand_page(u64 vaddr, vmap vm, context frame)
 
     int mmap_type = vm->flags & VMAP_MMAP_TYPE_MASK;
     if (mmap_type == VMAP_MMAP_TYPE_ANONYMOUS) {
-        u64 paddr = allocate_u64((heap)heap_physical(get_kernel_heaps()), PAGESIZE);
-        if (paddr == INVALID_PHYSICAL) {
+        if (!map_zeroed_pages(vaddr & ~MASK(PAGELOG), PAGESIZE,
+                              pageflags_from_vmflags(vm->flags))) {
             msg_err("cannot get physical page; OOM\n");
             return false;
         }
-
-        map_and_zero(vaddr & ~MASK(PAGELOG), paddr, PAGESIZE, pageflags_from_vmflags(vm->flags));
         count_minor_fault();
     } else if (mmap_type == VMAP_MMAP_TYPE_FILEBACKED) {
         u64 page_addr = vaddr & ~PAGEMASK;
@@ -129,9 +127,10 @@ boolean do_demand_page(u64 vaddr, vmap vm, context frame)
         if (in_kernel) {
             /* Kernel-mode page faults are exclusively for faulting-in user pages within the confines
                of a syscall (under the kernel lock). As such, we are free to set up an asynchronous page
-               fill, allocate memory, etc. */
+               fill, allocate memory, etc. Syscalls that run without the kernel lock take it
+               here. */
+            syscall_kern_lock();
             assert(!faulting_kernel_context);
-            assert(this_cpu_has_kernel_lock());
             kernel_demand_page_completed = false;
             pagecache_map_page(vm->cache_node, node_offset, page_addr, flags,
                                (status_handler)&do_kernel_demand_pf_complete,
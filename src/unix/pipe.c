@@ -7,8 +7,8 @@
 #define pipe_debug(x, ...)
 #endif
 
-#define INITIAL_PIPE_DATA_SIZE  100
 #define PIPE_MIN_CAPACITY       PAGESIZE
+#define PIPE_MAX_CAPACITY       U64_FROM_BIT(30)
 #define DEFAULT_PIPE_MAX_SIZE   (16 * PAGESIZE) /* see pipe(7) */
 #define PIPE_READ               0
 #define PIPE_WRITE              1
@@ -24,25 +24,30 @@ struct pipe_file {
     blockq bq;
 };
 
+/* Pipe data is kept in a ring of page-sized segments, one per page of capacity. Writes fill
+   the last segment and then take a new page, while reads consume the first segment and
+   recycle its page once emptied, so that data is never moved nor reallocated. */
+typedef struct pipe_seg {
+    void *page;
+    u32 offset;                 /* of the first unread byte */
+    u32 len;
+} *pipe_seg;
+
 struct pipe {
     struct pipe_file files[2];
     process proc;
     heap h;
+    heap pages;
     u64 ref_cnt;
-    u64 max_size;
-    buffer data;
+    u64 max_size;               /* nsegs pages */
+    pipe_seg segs;
+    u32 nsegs;
+    u32 head;                   /* index of the first segment in use */
+    u32 count;                  /* segments in use */
+    u64 length;                 /* bytes in the pipe */
+    void *spare;                /* recycled page */
 };
 
-#define BUFFER_DEBUG(BUF,LENGTH) do { \
-    pipe_debug("%s:%d - requested %d -- contents %p start/end %d/%d  -- len %d %d\n", \
-        __func__, __LINE__, \
-        (LENGTH), \
-        (BUF)->contents, \
-        (BUF)->start, \
-        (BUF)->end, \
-        (BUF)->length, buffer_length((BUF))); \
-} while(0)
-
 boolean pipe_init(unix_heaps uh)
 {
     heap general = heap_general((kernel_heaps)uh);
@@ -52,6 +57,103 @@ boolean pipe_init(unix_heaps uh)
     return (uh->pipe_cache == INVALID_ADDRESS ? false : true);
 }
 
+static inline pipe_seg pipe_seg_get(pipe p, u32 i)
+{
+    return &p->segs[(p->head + i) % p->nsegs];
+}
+
+/* bytes that can be written without blocking */
+static u64 pipe_space(pipe p)
+{
+    u64 space = (p->nsegs - p->count) * PAGESIZE;
+    if (p->count > 0) {
+        pipe_seg s = pipe_seg_get(p, p->count - 1);
+        space += PAGESIZE - (s->offset + s->len);
+    }
+    return space;
+}
+
+/* Copy up to length bytes into the pipe, from src or, if src is null, from sg. */
+static u64 pipe_fill(pipe p, void *src, sg_list sg, u64 length)
+{
+    u64 written = 0;
+    while (written < length) {
+        pipe_seg s = p->count > 0 ? pipe_seg_get(p, p->count - 1) : 0;
+        if (!s || (s->offset + s->len == PAGESIZE)) {
+            if (p->count == p->nsegs)
+                break;
+            void *page = p->spare;
+            if (page) {
+                p->spare = 0;
+            } else {
+                page = allocate(p->pages, PAGESIZE);
+                if (page == INVALID_ADDRESS)
+                    break;
+            }
+            s = pipe_seg_get(p, p->count++);
+            s->page = page;
+            s->offset = s->len = 0;
+        }
+        void *dest = s->page + s->offset + s->len;
+        u64 n = MIN(length - written, PAGESIZE - (s->offset + s->len));
+        if (src)
+            runtime_memcpy(dest, src + written, n);
+        else
+            n = sg_copy_to_buf(dest, sg, n);
+        s->len += n;
+        written += n;
+        if (n == 0)
+            break;
+    }
+    p->length += written;
+    return written;
+}
+
+static void pipe_seg_release(pipe p)
+{
+    pipe_seg s = pipe_seg_get(p, 0);
+    if (!p->spare)
+        p->spare = s->page;
+    else
+        deallocate(p->pages, s->page, PAGESIZE);
+    p->head = (p->head + 1) % p->nsegs;
+    p->count--;
+}
+
+static u64 pipe_drain(pipe p, void *dest, u64 length)
+{
+    u64 read = 0;
+    while ((read < length) && (p->count > 0)) {
+        pipe_seg s = pipe_seg_get(p, 0);
+        u64 n = MIN(length - read, s->len);
+        runtime_memcpy(dest + read, s->page + s->offset, n);
+        s->offset += n;
+        s->len -= n;
+        read += n;
+        if (s->len > 0)
+            break;
+        if (p->count > 1) {
+            pipe_seg_release(p);
+        } else {
+            /* keep filling the page that was written last */
+            s->offset = 0;
+            break;
+        }
+    }
+    p->length -= read;
+    return read;
+}
+
+static void pipe_free_data(pipe p)
+{
+    while (p->count > 0)
+        pipe_seg_release(p);
+    if (p->spare)
+        deallocate(p->pages, p->spare, PAGESIZE);
+    if (p->segs)
+        deallocate(p->h, p->segs, p->nsegs * sizeof(struct pipe_seg));
+}
+
 static inline void pipe_notify_reader(pipe_file pf, int events)
 {
     pipe_file read_pf = &pf->pipe->files[PIPE_READ];
@@ -98,8 +200,7 @@ static void pipe_release(pipe p)
 {
     if (!p->ref_cnt || (fetch_and_add(&p->ref_cnt, -1) == 1)) {
         pipe_debug("%s(%p): deallocating pipe\n", __func__, p);
-        if (p->data != INVALID_ADDRESS)
-            deallocate_buffer(p->data);
+        pipe_free_data(p);
 
         pipe_file_release(&(p->files[PIPE_READ]));
         pipe_file_release(&(p->files[PIPE_WRITE]));
@@ -122,6 +223,7 @@ static inline void pipe_dealloc_end(pipe p, pipe_file pf)
             pipe_notify_reader(pf, EPOLLIN | EPOLLHUP);
             pipe_debug("%s(%p): reader notified\n", __func__, p);
             deallocate_closure(pf->f.write);
+            deallocate_closure(pf->f.sg_write);
             deallocate_closure(pf->f.close);
             deallocate_closure(pf->f.events);
         }
@@ -143,16 +245,15 @@ closure_function(5, 1, sysreturn, pipe_read_bh,
                  u64, flags)
 {
     pipe_file pf = bound(pf);
-    int rv;
+    int rv = 0;
 
     if (flags & BLOCKQ_ACTION_NULLIFY) {
         rv = -ERESTARTSYS;
         goto out;
     }
 
-    buffer b = pf->pipe->data;
-    rv = MIN(buffer_length(b), bound(length));
-    if (rv == 0) {
+    pipe p = pf->pipe;
+    if (p->length == 0) {
         if (pf->pipe->files[PIPE_WRITE].fd == -1)
             goto out;
         if (pf->f.flags & O_NONBLOCK) {
@@ -162,15 +263,10 @@ closure_function(5, 1, sysreturn, pipe_read_bh,
         return BLOCKQ_BLOCK_REQUIRED;
     }
 
-    buffer_read(b, bound(dest), rv);
+    rv = pipe_drain(p, bound(dest), bound(length));
     pipe_notify_writer(pf, EPOLLOUT);
-
-    // If we have consumed all of the buffer, reset it. This might prevent future writes to allocte new buffer
-    // in buffer_write/buffer_extend. Can improve things until a proper circular buffer is available
-    if (buffer_length(b) == 0) {
-        buffer_clear(b);
+    if (p->length == 0)
         notify_dispatch(pf->f.ns, 0); /* for edge trigger */
-    }
   out:
     blockq_handle_completion(pf->bq, flags, bound(completion), bound(t), rv);
     closure_finish();
@@ -191,8 +287,8 @@ closure_function(1, 6, sysreturn, pipe_read,
     return blockq_check(pf->bq, t, ba, bh);
 }
 
-closure_function(5, 1, sysreturn, pipe_write_bh,
-                 pipe_file, pf, thread, t, void *, dest, u64, length, io_completion, completion,
+closure_function(6, 1, sysreturn, pipe_write_bh,
+                 pipe_file, pf, thread, t, void *, dest, sg_list, sg, u64, length, io_completion, completion,
                  u64, flags)
 {
     sysreturn rv = 0;
@@ -205,8 +301,7 @@ closure_function(5, 1, sysreturn, pipe_write_bh,
 
     u64 length = bound(length);
     pipe p = pf->pipe;
-    buffer b = p->data;
-    u64 avail = p->max_size - buffer_length(b);
+    u64 avail = pipe_space(p);
 
     if (avail == 0) {
         if (pf->pipe->files[PIPE_READ].fd == -1) {
@@ -220,9 +315,12 @@ closure_function(5, 1, sysreturn, pipe_write_bh,
         return BLOCKQ_BLOCK_REQUIRED;
     }
 
-    u64 real_length = MIN(length, avail);
-    assert(buffer_write(b, bound(dest), real_length));
-    if (avail == length)
+    u64 real_length = pipe_fill(p, bound(dest), bound(sg), MIN(length, avail));
+    if (real_length == 0) {
+        rv = -ENOMEM;
+        goto out;
+    }
+    if (real_length == avail)
         notify_dispatch(pf->f.ns, 0); /* for edge trigger */
 
     pipe_notify_reader(pf, EPOLLIN);
@@ -242,8 +340,24 @@ closure_function(1, 6, sysreturn, pipe_write,
         return io_complete(completion, t, 0);
 
     pipe_file pf = bound(pf);
-    blockq_action ba = closure(pf->pipe->h, pipe_write_bh, pf, t, dest, length,
+    blockq_action ba = closure(pf->pipe->h, pipe_write_bh, pf, t, dest, 0, length,
+            completion);
+    return blockq_check(pf->bq, t, ba, bh);
+}
+
+/* writev copies straight from the iovecs into the pipe pages */
+closure_function(1, 6, sysreturn, pipe_sg_write,
+                 pipe_file, pf,
+                 sg_list, sg, u64, length, u64, offset, thread, t, boolean, bh, io_completion, completion)
+{
+    if (length == 0)
+        return io_complete(completion, t, 0);
+
+    pipe_file pf = bound(pf);
+    blockq_action ba = closure(pf->pipe->h, pipe_write_bh, pf, t, 0, sg, length,
             completion);
+    if (ba == INVALID_ADDRESS)
+        return io_complete(completion, t, -ENOMEM);
     return blockq_check(pf->bq, t, ba, bh);
 }
 
@@ -253,7 +367,7 @@ closure_function(1, 1, u32, pipe_read_events,
 {
     pipe_file pf = bound(pf);
     assert(pf->f.read);
-    u32 events = buffer_length(pf->pipe->data) ? EPOLLIN : 0;
+    u32 events = pf->pipe->length ? EPOLLIN : 0;
     if (pf->pipe->files[PIPE_WRITE].fd == -1)
         events |= EPOLLIN | EPOLLHUP;
     return events;
@@ -265,7 +379,7 @@ closure_function(1, 1, u32, pipe_write_events,
 {
     pipe_file pf = bound(pf);
     assert(pf->f.write);
-    u32 events = buffer_length(pf->pipe->data) < pf->pipe->max_size ? EPOLLOUT : 0;
+    u32 events = pipe_space(pf->pipe) ? EPOLLOUT : 0;
     if (pf->pipe->files[PIPE_READ].fd == -1)
         events |= EPOLLHUP;
     return events;
@@ -290,7 +404,11 @@ int do_pipe2(int fds[2], int flags)
     }
 
     pipe->h = heap_general((kernel_heaps)uh);
-    pipe->data = INVALID_ADDRESS;
+    pipe->pages = heap_backed((kernel_heaps)uh);
+    pipe->segs = 0;
+    pipe->count = pipe->head = 0;
+    pipe->length = 0;
+    pipe->spare = 0;
     pipe->proc = current->p;
 
     pipe->files[PIPE_READ].fd = -1;
@@ -304,9 +422,11 @@ int do_pipe2(int fds[2], int flags)
     pipe->ref_cnt = 0;
     pipe->max_size = DEFAULT_PIPE_MAX_SIZE;
 
-    pipe->data = allocate_buffer(pipe->h, INITIAL_PIPE_DATA_SIZE);
-    if (pipe->data == INVALID_ADDRESS) {
-        msg_err("failed to allocate pipe's data buffer\n");
+    pipe->nsegs = pipe->max_size / PAGESIZE;
+    pipe->segs = allocate(pipe->h, pipe->nsegs * sizeof(struct pipe_seg));
+    if (pipe->segs == INVALID_ADDRESS) {
+        pipe->segs = 0;
+        msg_err("failed to allocate pipe's segment ring\n");
         goto err;
     }
 
@@ -345,6 +465,7 @@ int do_pipe2(int fds[2], int flags)
         }
 
         writer->f.write = closure(pipe->h, pipe_write, writer);
+        writer->f.sg_write = closure(pipe->h, pipe_sg_write, writer);
         writer->f.close = closure(pipe->h, pipe_close, writer);
         writer->f.events = closure(pipe->h, pipe_write_events, writer);
         writer->f.flags = (flags & O_NONBLOCK) | O_WRONLY;
@@ -364,15 +485,31 @@ err:
     return -ENOMEM;
 }
 
+/* As in Linux, the capacity is rounded up to a power-of-two number of pages. */
 int pipe_set_capacity(fdesc f, int capacity)
 {
     pipe_file pf = (pipe_file)f;
     pipe p = pf->pipe;
     if (capacity < PIPE_MIN_CAPACITY)
         capacity = PIPE_MIN_CAPACITY;
-    if (capacity < buffer_length(p->data))
+    u64 nsegs = U64_FROM_BIT(find_order(pad(capacity, PAGESIZE) / PAGESIZE));
+    if (nsegs * PAGESIZE > PIPE_MAX_CAPACITY)
+        return -EINVAL;
+    if (nsegs == p->nsegs)
+        return (int)p->max_size;
+    if (nsegs < p->count)
         return -EBUSY;
-    p->max_size = buffer_set_capacity(p->data, (bytes)capacity);
+    pipe_seg segs = allocate(p->h, nsegs * sizeof(struct pipe_seg));
+    if (segs == INVALID_ADDRESS)
+        return -ENOMEM;
+    for (u32 i = 0; i < p->count; i++)
+        segs[i] = *pipe_seg_get(p, i);
+    deallocate(p->h, p->segs, p->nsegs * sizeof(struct pipe_seg));
+    p->segs = segs;
+    p->nsegs = nsegs;
+    p->head = 0;
+    p->max_size = nsegs * PAGESIZE;
+    pipe_notify_writer(pf, EPOLLOUT);
     return (int)p->max_size;
 }
 
@@ -0,0 +1,877 @@
+#include <unix_internal.h>
+#include <filesystem.h>
+
+/* Process snapshots
+
+   When the root tuple has a "snapshot" attribute, a write to /sys/kernel/snapshot checkpoints
+   the (single-threaded) program to that file in the root filesystem: its memory mappings,
+   register state, signal dispositions, open files and working directory. On the next boot of
+   the same image, the program is resumed from the snapshot instead of being started from its
+   entry point, returning from the write that took the snapshot; reads of /sys/kernel/snapshot
+   then return "1" instead of "0".
+
+   Memory contents are stored at their offset within each mapping, so that the snapshot file can
+   be mapped like a program segment: only the stack and heap are read at restore, all other
+   mappings become private mappings of the snapshot file and are paged in from the page cache on
+   first access. A snapshot is only resumed with the kernel, program and address space layout
+   (which requires "noaslr") that it was taken with; otherwise the program is started normally. */
+
+//#define SNAPSHOT_DEBUG
+#ifdef SNAPSHOT_DEBUG
+#define snapshot_debug(x, ...) do {log_printf("SNAP", x, ##__VA_ARGS__);} while(0)
+#else
+#define snapshot_debug(x, ...)
+#endif
+
+#define SNAPSHOT_MAGIC      0x50414e534f4e414eull   /* "NANOSNAP" */
+#define SNAPSHOT_VERSION    1
+
+/* memory contents start after the header page */
+#define SNAPSHOT_DATA_START PAGESIZE
+
+struct snapshot_header {
+    u64 magic;
+    u64 version;
+    u64 meta_offset;
+    u64 meta_length;
+};
+
+typedef struct snapshot_writer {
+    heap h;
+    thread t;
+    fsfile f;
+    u64 length;     /* of the write that took the snapshot */
+    buffer meta;
+    struct snapshot_header hdr;
+} *snapshot_writer;
+
+static struct {
+    fsfile f;
+    tuple meta;
+} snapshot_image;
+
+static boolean snapshot_restored;
+
+closure_function(1, 2, void, snapshot_io_complete,
+                 status_handler, sh,
+                 status, s, bytes, len)
+{
+    apply(bound(sh), s);
+    closure_finish();
+}
+
+static boolean snapshot_set_u64(heap h, tuple t, symbol a, u64 n)
+{
+    value v = value_from_u64(h, n);
+    if (v == INVALID_ADDRESS)
+        return false;
+    set(t, a, v);
+    return true;
+}
+
+static boolean snapshot_set_bytes(heap h, tuple t, symbol a, void *p, u64 len)
+{
+    buffer b = allocate_buffer(h, len);
+    if (b == INVALID_ADDRESS)
+        return false;
+    assert(buffer_write(b, p, len));
+    set(t, a, b);
+    return true;
+}
+
+static boolean snapshot_get_bytes(tuple t, symbol a, void *p, u64 len)
+{
+    buffer b = get(t, a);
+    if (!b || is_tuple(b) || buffer_length(b) != len)
+        return false;
+    runtime_memcpy(p, buffer_ref(b, 0), len);
+    return true;
+}
+
+/* Capture */
+
+static boolean snapshot_node_path(tuple dir, tuple target, buffer b);
+
+closure_function(3, 2, boolean, snapshot_path_each,
+                 tuple, target, buffer, b, boolean *, found,
+                 value, s, value, v)
+{
+    if (!is_tuple(v) || sym_cstring_compare(s, ".") || sym_cstring_compare(s, ".."))
+        return true;
+    buffer b = bound(b);
+    bytes end = b->end;
+    if (!buffer_write_byte(b, '/') || !push_buffer(b, symbol_string(s)))
+        return false;
+    if (v == bound(target) || snapshot_node_path(v, bound(target), b)) {
+        *bound(found) = true;
+        return false;
+    }
+    b->end = end;
+    return true;
+}
+
+/* file_get_path() only resolves directories, so look up other nodes from the root */
+static boolean snapshot_node_path(tuple dir, tuple target, buffer b)
+{
+    tuple c = children(dir);
+    if (!c)
+        return false;
+    boolean found = false;
+    iterate(c, stack_closure(snapshot_path_each, target, b, &found));
+    return found;
+}
+
+static boolean snapshot_save_file(heap h, process p, tuple files, int fd, fdesc f)
+{
+    tuple t = allocate_tuple();
+    if (t == INVALID_ADDRESS)
+        return false;
+    set(files, intern_u64(fd), t);
+    if (f->type == FDESC_TYPE_STDIO) {
+        set(t, sym(stdio), null_value);
+        return true;
+    }
+    file fl = (file)f;
+    if (fl->fs != p->root_fs)
+        return false;
+    buffer b = allocate_buffer(h, 64);
+    if (b == INVALID_ADDRESS)
+        return false;
+    set(t, sym(path), b);
+    if (!snapshot_node_path(filesystem_getroot(p->root_fs), file_get_meta(fl), b))
+        return false;
+    return snapshot_set_u64(h, t, sym(flags), f->flags) &&
+        snapshot_set_u64(h, t, sym(offset), fl->offset);
+}
+
+static boolean snapshot_save_files(heap h, process p, tuple meta)
+{
+    tuple files = allocate_tuple();
+    if (files == INVALID_ADDRESS)
+        return false;
+    set(meta, sym(files), files);
+
+    /* take a reference to every open file under fd_lock, then save them without it */
+    vector fds = allocate_vector(h, 16);
+    if (fds == INVALID_ADDRESS)
+        return false;
+    spin_lock(&p->fd_lock);
+    int nfds = vector_length(p->files);
+    for (int fd = 0; fd < nfds; fd++) {
+        fdesc f = vector_get(p->files, fd);
+        if (f)
+            fetch_and_add(&f->refcnt, 1);
+        vector_push(fds, f);
+    }
+    spin_unlock(&p->fd_lock);
+
+    boolean ok = true;
+    for (int fd = 0; fd < nfds; fd++) {
+        fdesc f = vector_get(fds, fd);
+        if (!f)
+            continue;
+        if (!ok) {
+            fdesc_put(f);
+            continue;
+        }
+        switch (f->type) {
+        case FDESC_TYPE_STDIO:
+        case FDESC_TYPE_REGULAR:
+        case FDESC_TYPE_DIRECTORY:
+        case FDESC_TYPE_SPECIAL:
+        case FDESC_TYPE_SYMLINK:
+            ok = snapshot_save_file(h, p, files, fd, f);
+            break;
+        default:
+            snapshot_debug("fd %d of unsupported type %d\n", fd, f->type);
+            ok = false;
+        }
+        fdesc_put(f);
+    }
+    deallocate_vector(fds);
+    return ok;
+}
+
+closure_function(4, 1, void, snapshot_collect_vmap,
+                 process, p, range, vdso, vector, vmaps, boolean *, supported,
+                 vmap, vm)
+{
+    process p = bound(p);
+    range r = vm->node.r;
+    if (ranges_intersect(r, bound(vdso)))
+        return;
+#ifdef __x86_64__
+    if (r.start == VSYSCALL_BASE)
+        return;
+#endif
+    if (vm != p->stack_map && vm != p->heap_map) {
+        int type = vm->flags & VMAP_MMAP_TYPE_MASK;
+        if (!(vm->flags & VMAP_FLAG_MMAP) || (vm->flags & (VMAP_FLAG_SHARED | VMAP_FLAG_PREALLOC)) ||
+            (type != VMAP_MMAP_TYPE_ANONYMOUS && type != VMAP_MMAP_TYPE_FILEBACKED)) {
+            snapshot_debug("unsupported vmap %R, flags 0x%x\n", r, vm->flags);
+            *bound(supported) = false;
+            return;
+        }
+    }
+    vector_push(bound(vmaps), vm);
+}
+
+/* Fault in the file contents of a private file mapping, so that all of it is saved. */
+static void snapshot_prefault(vmap vm)
+{
+    u64 length = pad(pagecache_get_node_length(vm->cache_node), PAGESIZE);
+    if (length <= vm->node_offset)
+        return;
+    u64 end = vm->node.r.start + MIN(range_span(vm->node.r), length - vm->node_offset);
+    for (u64 addr = vm->node.r.start; addr < end; addr += PAGESIZE)
+        (void)*(volatile u8 *)pointer_from_u64(addr);
+}
+
+closure_function(2, 3, boolean, snapshot_present_pte,
+                 range, q, buffer, runs,
+                 int, level, u64, addr, pteptr, entry)
+{
+    pte e = pte_from_pteptr(entry);
+    u64 size;
+    if (!pte_is_present(e) || (size = pte_map_size(level, e)) == INVALID_PHYSICAL)
+        return true;
+    range r = range_intersection(bound(q), irangel(addr & ~(size - 1), size));
+    if (range_empty(r))
+        return true;
+    buffer runs = bound(runs);
+    if (buffer_length(runs) >= sizeof(range)) {
+        range *last = buffer_ref(runs, buffer_length(runs) - sizeof(range));
+        if (last->end == r.start) {
+            last->end = r.end;
+            return true;
+        }
+    }
+    return buffer_write(runs, &r, sizeof(r));
+}
+
+/* Write the present pages of vm at offset data of the snapshot file. Returns the number of
+   bytes written, or -1 on failure. */
+static s64 snapshot_write_vmap(snapshot_writer w, vmap vm, u64 data, buffer runs, merge m)
+{
+    buffer_clear(runs);
+    range q = vm->node.r;
+    if (!range_empty(q) &&
+        !traverse_ptes(q.start, range_span(q), stack_closure(snapshot_present_pte, q, runs)))
+        return -1;
+    s64 written = 0;
+    for (bytes i = 0; i < buffer_length(runs); i += sizeof(range)) {
+        range *r = buffer_ref(runs, i);
+        io_status_handler ish = closure(w->h, snapshot_io_complete, apply_merge(m));
+        if (ish == INVALID_ADDRESS)
+            return -1;
+        snapshot_debug("   %R at 0x%lx\n", *r, data + r->start - q.start);
+        filesystem_write_linear(w->f, pointer_from_u64(r->start),
+                                irangel(data + r->start - q.start, range_span(*r)), ish);
+        written += range_span(*r);
+    }
+    return written;
+}
+
+static boolean snapshot_save_vmaps(snapshot_writer w, process p, vector vmaps, tuple meta,
+                                   merge m, u64 *offset)
+{
+    heap h = w->h;
+    tuple tv = allocate_tuple();
+    if (tv == INVALID_ADDRESS)
+        return false;
+    set(meta, sym(vmaps), tv);
+    buffer runs = allocate_buffer(h, 16 * sizeof(range));
+    if (runs == INVALID_ADDRESS)
+        return false;
+    boolean ok = true;
+    vmap vm;
+    int i = 0;
+    vector_foreach(vmaps, vm) {
+        tuple t = allocate_tuple();
+        if (t == INVALID_ADDRESS) {
+            ok = false;
+            break;
+        }
+        set(tv, intern_u64(i++), t);
+        if (!snapshot_set_u64(h, t, sym(start), vm->node.r.start) ||
+            !snapshot_set_u64(h, t, sym(end), vm->node.r.end) ||
+            !snapshot_set_u64(h, t, sym(flags), vm->flags) ||
+            !snapshot_set_u64(h, t, sym(allowed_flags), vm->allowed_flags)) {
+            ok = false;
+            break;
+        }
+        if (vm == p->stack_map)
+            set(t, sym(stack), null_value);
+        else if (vm == p->heap_map)
+            set(t, sym(heap), null_value);
+        s64 written = snapshot_write_vmap(w, vm, *offset, runs, m);
+        if (written < 0) {
+            ok = false;
+            break;
+        }
+        if (written == 0)
+            continue;
+        if (!snapshot_set_u64(h, t, sym(data), *offset)) {
+            ok = false;
+            break;
+        }
+        *offset += range_span(vm->node.r);
+    }
+    deallocate_buffer(runs);
+    return ok;
+}
+
+static boolean snapshot_save_state(heap h, process p, thread t, tuple meta, u64 length)
+{
+    thread_frame_save_fpsimd(t->default_frame);
+    u64 frame_size = total_frame_size();
+    buffer b = allocate_buffer(h, frame_size);
+    if (b == INVALID_ADDRESS)
+        return false;
+    assert(buffer_write(b, t->default_frame, frame_size));
+    /* the program resumes by returning from the write */
+    ((context)buffer_ref(b, 0))[SYSCALL_FRAME_RETVAL1] = length;
+    set(meta, sym(frame), b);
+
+    char cwd[PATH_MAX];
+    if (file_get_path(p->cwd, cwd, sizeof(cwd)) < 0)
+        return false;
+    value v = buffer_cstring(h, cwd);
+    if (v == INVALID_ADDRESS)
+        return false;
+    set(meta, sym(cwd), v);
+
+    v = buffer_cstring(h, gitversion);
+    if (v == INVALID_ADDRESS)
+        return false;
+    set(meta, sym(gitversion), v);
+    value program = get(p->process_root, sym(program));
+    v = allocate_buffer(h, buffer_length(program));
+    if (v == INVALID_ADDRESS)
+        return false;
+    assert(push_buffer(v, program));
+    set(meta, sym(program), v);
+    tuple pt;
+    if (resolve_cstring(0, filesystem_getroot(p->root_fs), buffer_to_cstring(program), &pt, 0))
+        return false;
+    fsfile pf = fsfile_from_node(p->root_fs, pt);
+    return pf &&
+        snapshot_set_u64(h, meta, sym(program_length), fsfile_get_length(pf)) &&
+        snapshot_set_u64(h, meta, sym(vdso_base), p->vdso_base) &&
+        snapshot_set_u64(h, meta, sym(brk), u64_from_pointer(p->brk)) &&
+        snapshot_set_u64(h, meta, sym(heap_base), p->heap_base) &&
+        snapshot_set_bytes(h, meta, sym(sigactions), p->sigactions, sizeof(p->sigactions)) &&
+        snapshot_set_u64(h, meta, sym(sigignored), p->signals.ignored) &&
+        snapshot_set_u64(h, meta, sym(sigmask), t->signals.mask) &&
+        snapshot_set_u64(h, meta, sym(clear_tid), u64_from_pointer(t->clear_tid)) &&
+        snapshot_set_u64(h, meta, sym(robust_list), u64_from_pointer(t->robust_list)) &&
+        snapshot_set_u64(h, meta, sym(signal_stack), u64_from_pointer(t->signal_stack)) &&
+        snapshot_set_u64(h, meta, sym(signal_stack_length), t->signal_stack_length) &&
+        snapshot_set_bytes(h, meta, sym(name), t->name, sizeof(t->name));
+}
+
+static void snapshot_writer_finish(snapshot_writer w, sysreturn rv)
+{
+    snapshot_debug("snapshot complete, rv %ld\n", rv);
+    syscall_return(w->t, rv);
+    if (w->meta)
+        deallocate_buffer(w->meta);
+    deallocate(w->h, w, sizeof(*w));
+}
+
+closure_function(1, 1, void, snapshot_flush_complete,
+                 snapshot_writer, w,
+                 status, s)
+{
+    if (!is_ok(s))
+        msg_err("failed to flush snapshot: %v\n", s);
+    snapshot_writer w = bound(w);
+    snapshot_writer_finish(w, is_ok(s) ? w->length : -EIO);
+    closure_finish();
+}
+
+closure_function(1, 2, void, snapshot_header_complete,
+                 snapshot_writer, w,
+                 status, s, bytes, len)
+{
+    snapshot_writer w = bound(w);
+    closure_finish();
+    status_handler sh = closure(w->h, snapshot_flush_complete, w);
+    if (sh == INVALID_ADDRESS) {
+        snapshot_writer_finish(w, -ENOMEM);
+        return;
+    }
+    if (!is_ok(s))
+        apply(sh, s);
+    else
+        fsfile_flush(w->f, false, sh);
+}
+
+/* The header is written last, so that a snapshot interrupted by a crash is not resumed. */
+closure_function(1, 1, void, snapshot_data_complete,
+                 snapshot_writer, w,
+                 status, s)
+{
+    snapshot_writer w = bound(w);
+    closure_finish();
+    if (!is_ok(s)) {
+        msg_err("failed to write snapshot: %v\n", s);
+        snapshot_writer_finish(w, -EIO);
+        return;
+    }
+    io_status_handler ish = closure(w->h, snapshot_header_complete, w);
+    if (ish == INVALID_ADDRESS) {
+        snapshot_writer_finish(w, -ENOMEM);
+        return;
+    }
+    w->hdr.magic = SNAPSHOT_MAGIC;
+    w->hdr.version = SNAPSHOT_VERSION;
+    filesystem_write_linear(w->f, &w->hdr, irangel(0, sizeof(w->hdr)), ish);
+}
+
+static sysreturn snapshot_capture(process p, thread t, u64 length)
+{
+    heap h = heap_general(get_kernel_heaps());
+    if (rbtree_get_count(p->threads) != 1 || thread_frame(t) != t->default_frame ||
+        p->cwd_fs != p->root_fs)
+        return -EBUSY;
+    vector vmaps = allocate_vector(h, 16);
+    if (vmaps == INVALID_ADDRESS)
+        return -ENOMEM;
+    sysreturn rv = -EBUSY;
+    boolean supported = true;
+    range vdso = irangel(p->vdso_base, vdso_raw_length + VVAR_NR_PAGES * PAGESIZE);
+    vmap_iterator(p, stack_closure(snapshot_collect_vmap, p, vdso, vmaps, &supported));
+    tuple meta = allocate_tuple();
+    if (meta == INVALID_ADDRESS) {
+        rv = -ENOMEM;
+        goto out_vmaps;
+    }
+    if (!supported || !snapshot_save_files(h, p, meta))
+        goto out_meta;
+    rv = -ENOMEM;
+    if (!snapshot_save_state(h, p, t, meta, length))
+        goto out_meta;
+
+    /* faults take the vmap lock, so this is done outside of the iterator */
+    vmap vm;
+    vector_foreach(vmaps, vm) {
+        if ((vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_FILEBACKED)
+            snapshot_prefault(vm);
+    }
+
+    rv = -EIO;
+    fsfile f = fsfile_open_or_create(get_string(p->process_root, sym(snapshot)));
+    if (!f || filesystem_truncate(p->root_fs, f, 0) != FS_STATUS_OK)
+        goto out_meta;
+    rv = -ENOMEM;
+    snapshot_writer w = allocate(h, sizeof(*w));
+    if (w == INVALID_ADDRESS)
+        goto out_meta;
+    zero(w, sizeof(*w));
+    w->h = h;
+    w->t = t;
+    w->f = f;
+    w->length = length;
+    status_handler complete = closure(h, snapshot_data_complete, w);
+    if (complete == INVALID_ADDRESS) {
+        deallocate(h, w, sizeof(*w));
+        goto out_meta;
+    }
+    merge m = allocate_merge(h, complete);
+    status_handler sh = apply_merge(m);
+    u64 offset = SNAPSHOT_DATA_START;
+    status s = STATUS_OK;
+    if (!snapshot_save_vmaps(w, p, vmaps, meta, m, &offset)) {
+        s = timm("result", "failed to save memory mappings");
+        goto out_write;
+    }
+    w->meta = allocate_buffer(h, PAGESIZE);
+    if (w->meta == INVALID_ADDRESS) {
+        w->meta = 0;
+        s = timm("result", "failed to allocate metadata buffer");
+        goto out_write;
+    }
+    table dict = allocate_table(h, identity_key, pointer_equal);
+    if (dict == INVALID_ADDRESS) {
+        s = timm("result", "failed to allocate dictionary");
+        goto out_write;
+    }
+    encode_tuple(w->meta, dict, meta, 0);
+    deallocate_table(dict);
+    w->hdr.meta_offset = offset;
+    w->hdr.meta_length = buffer_length(w->meta);
+    io_status_handler ish = closure(h, snapshot_io_complete, apply_merge(m));
+    if (ish == INVALID_ADDRESS) {
+        s = timm("result", "failed to allocate completion");
+        goto out_write;
+    }
+    snapshot_debug("metadata at 0x%lx, length 0x%lx\n", offset, w->hdr.meta_length);
+    filesystem_write_linear(f, buffer_ref(w->meta, 0), irangel(offset, w->hdr.meta_length), ish);
+  out_write:
+    apply(sh, s);
+    destruct_tuple(meta, true);
+    deallocate_vector(vmaps);
+    return thread_maybe_sleep_uninterruptible(t);
+  out_meta:
+    destruct_tuple(meta, true);
+  out_vmaps:
+    deallocate_vector(vmaps);
+    return rv;
+}
+
+sysreturn snapshot_special_write(file f, void *dest, u64 length, u64 offset)
+{
+    /* memory of a restored program is mapped from the snapshot file */
+    if (snapshot_restored)
+        return -EBUSY;
+    return snapshot_capture(current->p, current, length);
+}
+
+sysreturn snapshot_special_read(file f, void *dest, u64 length, u64 offset)
+{
+    const char *s = snapshot_restored ? "1\n" : "0\n";
+    if (offset >= 2)
+        return 0;
+    length = MIN(length, 2 - offset);
+    runtime_memcpy(dest, s + offset, length);
+    return length;
+}
+
+/* Restore */
+
+closure_function(1, 1, void, snapshot_restore_start,
+                 thread, t,
+                 status, s)
+{
+    thread t = bound(t);
+    process p = t->p;
+    tuple meta = snapshot_image.meta;
+    closure_finish();
+    if (!is_ok(s))
+        halt("failed to restore snapshot: %v\n", s);
+
+    /* current needs to be valid for opening files */
+    set_current_thread(&t->thrd);
+    fs_status fss = filesystem_chdir(p, buffer_to_cstring((buffer)get(meta, sym(cwd))));
+    if (fss != FS_STATUS_OK)
+        halt("snapshot: unable to change cwd; %s\n", string_from_fs_status(fss));
+
+    tuple files = get_tuple(meta, sym(files));
+    for (int fd = 0; fd <= 2; fd++) {
+        if (!get(files, intern_u64(fd))) {
+            fdesc old = take_fd(p, fd);
+            if (old)
+                fdesc_put(old);
+        }
+    }
+    /* install files in fd order; a file is opened at the lowest free fd and then moved */
+    u64 nfiles = tuple_count(files);
+    for (u64 fd = 0; nfiles > 0; fd++) {
+        tuple ft = get_tuple(files, intern_u64(fd));
+        if (!ft)
+            continue;
+        nfiles--;
+        fdesc f;
+        if (get(ft, sym(stdio))) {
+            if (fd <= 2)
+                continue;
+            f = fdesc_get(p, 1);
+            assert(f);
+        } else {
+            u64 flags, offset;
+            assert(get_u64(ft, sym(flags), &flags) && get_u64(ft, sym(offset), &offset));
+            buffer path = get(ft, sym(path));
+            sysreturn tmpfd = open_path(p->root_fs, p->cwd, buffer_to_cstring(path),
+                                        flags & ~(O_CREAT | O_EXCL | O_TRUNC), 0);
+            if (tmpfd < 0)
+                halt("snapshot: unable to open \"%b\" (%ld)\n", path, tmpfd);
+            f = take_fd(p, tmpfd);
+            f->flags = flags;
+            ((file)f)->offset = offset;
+        }
+        fdesc old = replace_fd(p, fd, f);
+        if (old == INVALID_ADDRESS)
+            halt("snapshot: unable to install fd %ld\n", fd);
+        if (old)
+            fdesc_put(old);
+    }
+
+    clone_frame_pstate(t->default_frame, buffer_ref((buffer)get(meta, sym(frame)), 0));
+    u64 v;
+    assert(snapshot_get_bytes(meta, sym(sigactions), p->sigactions, sizeof(p->sigactions)));
+    assert(get_u64(meta, sym(sigignored), &v));
+    p->signals.ignored = v;
+    assert(get_u64(meta, sym(sigmask), &t->signals.mask));
+    assert(get_u64(meta, sym(clear_tid), &v));
+    t->clear_tid = pointer_from_u64(v);
+    assert(get_u64(meta, sym(robust_list), &v));
+    t->robust_list = pointer_from_u64(v);
+    assert(get_u64(meta, sym(signal_stack), &v));
+    t->signal_stack = pointer_from_u64(v);
+    assert(get_u64(meta, sym(signal_stack_length), &t->signal_stack_length));
+    assert(snapshot_get_bytes(meta, sym(name), t->name, sizeof(t->name)));
+
+    snapshot_restored = true;
+    snapshot_debug("program resumed\n");
+    start_process(t, pointer_from_u64(t->default_frame[SYSCALL_FRAME_PC]));
+}
+
+static boolean snapshot_parse_vmap(tuple vt, range *r, u64 *flags, u64 *allowed_flags, u64 *data)
+{
+    if (!get_u64(vt, sym(start), &r->start) || !get_u64(vt, sym(end), &r->end) ||
+        !get_u64(vt, sym(flags), flags) || !get_u64(vt, sym(allowed_flags), allowed_flags) ||
+        (r->start & PAGEMASK) || (r->end & PAGEMASK) || r->end < r->start)
+        return false;
+    if (!get(vt, sym(data))) {
+        *data = infinity;
+        return true;
+    }
+    return get_u64(vt, sym(data), data) && !(*data & PAGEMASK);
+}
+
+/* Check that the snapshot can be resumed in process p, before anything is changed. */
+static boolean snapshot_validate(process p, tuple meta)
+{
+    u64 vdso_base;
+    if (!get_u64(meta, sym(vdso_base), &vdso_base) || vdso_base != p->vdso_base) {
+        rprintf("snapshot: address space layout differs (\"noaslr\" is required)\n");
+        return false;
+    }
+    buffer frame = get(meta, sym(frame));
+    if (!frame || is_tuple(frame) || buffer_length(frame) != total_frame_size() ||
+        !get_string(meta, sym(cwd))) {
+        rprintf("snapshot: invalid processor state\n");
+        return false;
+    }
+    tuple vmaps = get_tuple(meta, sym(vmaps));
+    if (!vmaps)
+        return false;
+    tuple vt;
+    for (int i = 0; (vt = get_tuple(vmaps, intern_u64(i))); i++) {
+        range r;
+        u64 flags, allowed_flags, data;
+        if (!snapshot_parse_vmap(vt, &r, &flags, &allowed_flags, &data)) {
+            rprintf("snapshot: invalid memory mapping\n");
+            return false;
+        }
+    }
+    tuple files = get_tuple(meta, sym(files));
+    if (!files)
+        return false;
+    tuple root = filesystem_getroot(p->root_fs);
+    for (u64 fd = 0, n = tuple_count(files); n > 0; fd++) {
+        tuple ft = get_tuple(files, intern_u64(fd));
+        if (!ft)
+            continue;
+        n--;
+        if (get(ft, sym(stdio)))
+            continue;
+        string path = get_string(ft, sym(path));
+        u64 v;
+        tuple node;
+        if (!path || !get_u64(ft, sym(flags), &v) || !get_u64(ft, sym(offset), &v) ||
+            resolve_cstring(0, root, buffer_to_cstring(path), &node, 0)) {
+            rprintf("snapshot: unable to reopen fd %ld\n", fd);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Called by exec in place of loading the program. Returns false if the program is to be started
+   normally. The stack and heap are read before the thread is started; all other mappings are
+   paged in on demand. */
+boolean snapshot_restore(process p, thread t)
+{
+    tuple meta = snapshot_image.meta;
+    if (!meta || !snapshot_validate(p, meta))
+        return false;
+    heap h = heap_general(get_kernel_heaps());
+    status_handler start = closure(h, snapshot_restore_start, t);
+    if (start == INVALID_ADDRESS)
+        return false;
+    merge m = allocate_merge(h, start);
+    status_handler sh = apply_merge(m);
+    pagecache_node pn = fsfile_get_cachenode(snapshot_image.f);
+    tuple vmaps = get_tuple(meta, sym(vmaps));
+    tuple vt;
+    for (int i = 0; (vt = get_tuple(vmaps, intern_u64(i))); i++) {
+        range r;
+        u64 flags, allowed_flags, data;
+        assert(snapshot_parse_vmap(vt, &r, &flags, &allowed_flags, &data));
+        boolean is_stack = get(vt, sym(stack)) != 0;
+        boolean is_heap = get(vt, sym(heap)) != 0;
+        vmap vm;
+        snapshot_debug("vmap %R, flags 0x%lx, data 0x%lx%s%s\n", r, flags, data,
+                       is_stack ? " (stack)" : "", is_heap ? " (heap)" : "");
+        if (is_stack || is_heap) {
+            vm = allocate_vmap(p->vmaps, r, ivmap(flags, allowed_flags, 0, 0));
+            if (vm != INVALID_ADDRESS && !range_empty(r)) {
+                if (!map_zeroed_pages(r.start, range_span(r),
+                                      pageflags_writable(pageflags_noexec(pageflags_user(
+                                          pageflags_memory())))))
+                    halt("snapshot: unable to allocate memory for %R\n", r);
+                if (data != infinity)
+                    filesystem_read_linear(snapshot_image.f, pointer_from_u64(r.start),
+                                           irangel(data, range_span(r)),
+                                           closure(h, snapshot_io_complete, apply_merge(m)));
+            }
+            if (is_stack)
+                p->stack_map = vm;
+            else
+                p->heap_map = vm;
+        } else {
+            flags &= ~VMAP_MMAP_TYPE_MASK;
+            if (data != infinity)
+                vm = allocate_vmap(p->vmaps, r, ivmap(flags | VMAP_MMAP_TYPE_FILEBACKED,
+                                                      allowed_flags, data, pn));
+            else
+                vm = allocate_vmap(p->vmaps, r, ivmap(flags | VMAP_MMAP_TYPE_ANONYMOUS,
+                                                      allowed_flags, 0, 0));
+        }
+        if (vm == INVALID_ADDRESS)
+            halt("snapshot: unable to restore mapping %R\n", r);
+#ifdef __x86_64__
+        if (p->virtual32 && !range_empty(r) && r.start < 0x100000000ull)
+            id_heap_set_area(p->virtual32, r.start, MIN(r.end, 0x100000000ull) - r.start,
+                             false, true);
+#endif
+    }
+    u64 v;
+    assert(get_u64(meta, sym(brk), &v));
+    p->brk = pointer_from_u64(v);
+    assert(get_u64(meta, sym(heap_base), &p->heap_base));
+    apply(sh, STATUS_OK);
+    return true;
+}
+
+typedef struct snapshot_loader {
+    heap h;
+    filesystem fs;
+    tuple root;
+    fsfile f;
+    buffer meta;
+    status_handler complete;
+    struct snapshot_header hdr;
+} *snapshot_loader;
+
+static void snapshot_load_finish(snapshot_loader l, const char *err)
+{
+    if (err)
+        rprintf("snapshot: %s; starting program\n", err);
+    if (l->meta)
+        deallocate_buffer(l->meta);
+    apply(l->complete, STATUS_OK);
+    deallocate(l->h, l, sizeof(*l));
+}
+
+static const char *snapshot_check_meta(snapshot_loader l, tuple meta)
+{
+    string v = get_string(meta, sym(gitversion));
+    if (!v || !buffer_compare_with_cstring(v, gitversion))
+        return "kernel version differs";
+    value program = get(l->root, sym(program));
+    v = get_string(meta, sym(program));
+    if (!v || !buffer_compare(v, program))
+        return "program differs";
+    tuple pt;
+    u64 length;
+    fsfile pf;
+    if (resolve_cstring(0, filesystem_getroot(l->fs), buffer_to_cstring(program), &pt, 0) ||
+        !(pf = fsfile_from_node(l->fs, pt)) ||
+        !get_u64(meta, sym(program_length), &length) || length != fsfile_get_length(pf))
+        return "program differs";
+    return 0;
+}
+
+closure_function(1, 2, void, snapshot_meta_read,
+                 snapshot_loader, l,
+                 status, s, bytes, len)
+{
+    snapshot_loader l = bound(l);
+    closure_finish();
+    if (!is_ok(s) || len != l->hdr.meta_length) {
+        snapshot_load_finish(l, "unable to read metadata");
+        return;
+    }
+    buffer_produce(l->meta, len);
+    table dict = allocate_table(l->h, identity_key, pointer_equal);
+    if (dict == INVALID_ADDRESS) {
+        snapshot_load_finish(l, "out of memory");
+        return;
+    }
+    tuple meta = decode_value(l->h, dict, l->meta, 0, 0);
+    deallocate_table(dict);
+    const char *err = is_tuple(meta) ? snapshot_check_meta(l, meta) : "invalid metadata";
+    if (!err) {
+        snapshot_image.f = l->f;
+        snapshot_image.meta = meta;
+    } else if (is_tuple(meta)) {
+        destruct_tuple(meta, true);
+    }
+    snapshot_load_finish(l, err);
+}
+
+closure_function(1, 2, void, snapshot_header_read,
+                 snapshot_loader, l,
+                 status, s, bytes, len)
+{
+    snapshot_loader l = bound(l);
+    closure_finish();
+    if (!is_ok(s) || len != sizeof(l->hdr) || l->hdr.magic != SNAPSHOT_MAGIC) {
+        snapshot_load_finish(l, "no valid snapshot header");
+        return;
+    }
+    if (l->hdr.version != SNAPSHOT_VERSION) {
+        snapshot_load_finish(l, "unsupported snapshot version");
+        return;
+    }
+    if (l->hdr.meta_offset < SNAPSHOT_DATA_START || l->hdr.meta_length == 0 ||
+        l->hdr.meta_offset + l->hdr.meta_length > fsfile_get_length(l->f)) {
+        snapshot_load_finish(l, "invalid snapshot header");
+        return;
+    }
+    l->meta = allocate_buffer(l->h, l->hdr.meta_length);
+    io_status_handler ish = (l->meta == INVALID_ADDRESS) ? INVALID_ADDRESS :
+        closure(l->h, snapshot_meta_read, l);
+    if (ish == INVALID_ADDRESS) {
+        if (l->meta == INVALID_ADDRESS)
+            l->meta = 0;
+        snapshot_load_finish(l, "out of memory");
+        return;
+    }
+    filesystem_read_linear(l->f, buffer_ref(l->meta, 0),
+                           irangel(l->hdr.meta_offset, l->hdr.meta_length), ish);
+}
+
+/* Look for a snapshot to resume, before the program is started. */
+void snapshot_load(filesystem fs, tuple root, status_handler complete)
+{
+    string path = get_string(root, sym(snapshot));
+    tuple n;
+    fsfile f;
+    if (!path || resolve_cstring(0, filesystem_getroot(fs), buffer_to_cstring(path), &n, 0) ||
+        !(f = fsfile_from_node(fs, n)) || fsfile_get_length(f) < SNAPSHOT_DATA_START) {
+        apply(complete, STATUS_OK);
+        return;
+    }
+    heap h = heap_general(get_kernel_heaps());
+    snapshot_loader l = allocate(h, sizeof(*l));
+    if (l == INVALID_ADDRESS) {
+        apply(complete, STATUS_OK);
+        return;
+    }
+    zero(l, sizeof(*l));
+    l->h = h;
+    l->fs = fs;
+    l->root = root;
+    l->f = f;
+    l->complete = complete;
+    io_status_handler ish = closure(h, snapshot_header_read, l);
+    if (ish == INVALID_ADDRESS) {
+        snapshot_load_finish(l, "out of memory");
+        return;
+    }
+    filesystem_read_linear(f, &l->hdr, irangel(0, sizeof(l->hdr)), ish);
+}
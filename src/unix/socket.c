@@ -3,8 +3,8 @@
 #include <filesystem.h>
 #include <socket.h>
 
-declare_closure_struct(1, 0, void, sharedbuf_free,
-    struct sharedbuf *, shb);
+declare_closure_struct(1, 0, void, unixsock_msg_free,
+    struct unixsock_msg *, m);
 
 declare_closure_struct(1, 0, void, unixsock_free,
     struct unixsock *, s);
@@ -14,71 +14,209 @@ struct sockaddr_un {
     char sun_path[108];
 };
 
-typedef struct sharedbuf {
-    buffer b;
+struct ucred {
+    u32 pid;
+    u32 uid;
+    u32 gid;
+};
+
+/* Descriptors passed with SCM_RIGHTS, holding a reference to each file until received. */
+typedef struct unixsock_rights {
+    struct list l;
+    u64 pos, len;               /* SOCK_STREAM: stream range of the data sent along */
+    int nfds;
+    fdesc fds[0];
+} *unixsock_rights;
+
+/* Datagrams are allocated from an object cache; payloads that do not fit in the object are
+   allocated separately. */
+typedef struct unixsock_msg {
     struct refcount refcount;
-    closure_struct(sharedbuf_free, free);
+    closure_struct(unixsock_msg_free, free);
     struct sockaddr_un from_addr;
-} *sharedbuf;
-
+    unixsock_rights rights;
+    void *data;
+    u64 len;
+    u8 inline_data[0];
+} *unixsock_msg;
+
+#define UNIXSOCK_MSG_SIZE       512
+#define UNIXSOCK_MSG_INLINE_LEN (UNIXSOCK_MSG_SIZE - sizeof(struct unixsock_msg))
 #define UNIXSOCK_BUF_MAX_SIZE   PAGESIZE
 #define UNIXSOCK_QUEUE_MAX_LEN  64
+#define UNIXSOCK_RING_SIZE      (64 * KB)
+#define UNIXSOCK_MAX_FDS        253 /* SCM_MAX_FD in Linux */
+#define UNIXSOCK_CONTROL_MAX    (20 * KB)   /* optmem_max in Linux */
 
 typedef struct unixsock {
     struct sock sock; /* must be first */
-    queue data;
+    queue data;                 /* SOCK_DGRAM: received datagrams */
+    u8 *ring;                   /* SOCK_STREAM: received data, allocated on first write */
+    u64 ring_head;
+    u64 ring_len;
+    u64 rx_pos;                 /* SOCK_STREAM: stream offset of the first byte in the ring */
+    struct list rights;         /* SOCK_STREAM: received descriptors, in stream order */
     tuple fs_entry;
     struct sockaddr_un local_addr;
     queue conn_q;
     boolean connecting;
+    boolean closed;
     struct unixsock *peer;
     closure_struct(unixsock_free, free);
     struct refcount refcount;
 } *unixsock;
 
-static inline void sharedbuf_deallocate(sharedbuf shb)
+boolean unixsock_init(unix_heaps uh)
 {
-    heap h = shb->b->h;
-    deallocate_buffer(shb->b);
-    deallocate(h, shb, sizeof(*shb));
+    uh->unixsock_msg_cache = allocate_objcache(heap_general((kernel_heaps)uh),
+                                               heap_backed((kernel_heaps)uh),
+                                               UNIXSOCK_MSG_SIZE, PAGESIZE);
+    return (uh->unixsock_msg_cache == INVALID_ADDRESS ? false : true);
 }
 
-define_closure_function(1, 0, void, sharedbuf_free,
-                        sharedbuf, shb)
+static void unixsock_rights_release(unixsock_rights r)
 {
-    sharedbuf_deallocate(bound(shb));
+    for (int i = 0; i < r->nfds; i++)
+        fdesc_put(r->fds[i]);
+    deallocate(heap_general(get_kernel_heaps()), r, sizeof(*r) + r->nfds * sizeof(fdesc));
 }
 
-define_closure_function(1, 0, void, unixsock_free,
-                        unixsock, s)
+/* Takes a reference to the files in the SCM_RIGHTS control messages of msg. The control data
+   is copied before it is parsed, since other threads can modify the user buffer meanwhile. */
+static sysreturn unixsock_get_rights(process p, const struct msghdr *msg, unixsock_rights *rights)
 {
-    unixsock s = bound(s);
-    deallocate(s->sock.h, s, sizeof(*s));
+    *rights = 0;
+    void *control = msg->msg_control;
+    u64 control_len = msg->msg_controllen;
+    if (!control || (control_len < sizeof(struct cmsghdr)))
+        return 0;
+    if (control_len > UNIXSOCK_CONTROL_MAX)
+        return -ENOBUFS;
+    heap h = heap_general(get_kernel_heaps());
+    void *buf = allocate(h, control_len);
+    if (buf == INVALID_ADDRESS)
+        return -ENOMEM;
+    runtime_memcpy(buf, control, control_len);
+    sysreturn rv = 0;
+    int nfds = 0;
+    u64 offset = 0;
+    while (offset + sizeof(struct cmsghdr) <= control_len) {
+        struct cmsghdr *cmsg = buf + offset;
+        if ((cmsg->cmsg_len < sizeof(struct cmsghdr)) ||
+            (cmsg->cmsg_len > control_len - offset) ||
+            (cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS)) {
+            rv = -EINVAL;
+            goto out;
+        }
+        nfds += (cmsg->cmsg_len - sizeof(struct cmsghdr)) / sizeof(int);
+        offset += CMSG_ALIGN(cmsg->cmsg_len);
+    }
+    if (nfds == 0)
+        goto out;
+    if (nfds > UNIXSOCK_MAX_FDS) {
+        rv = -EINVAL;
+        goto out;
+    }
+    unixsock_rights r = allocate(h, sizeof(*r) + nfds * sizeof(fdesc));
+    if (r == INVALID_ADDRESS) {
+        rv = -ENOMEM;
+        goto out;
+    }
+    r->nfds = 0;
+    for (offset = 0; r->nfds < nfds; ) {
+        struct cmsghdr *cmsg = buf + offset;
+        int *fds = CMSG_DATA(cmsg);
+        int n = (cmsg->cmsg_len - sizeof(struct cmsghdr)) / sizeof(int);
+        for (int i = 0; i < n; i++) {
+            fdesc f = fdesc_get(p, fds[i]);
+            if (!f) {
+                /* r was allocated for nfds descriptors */
+                while (r->nfds > 0)
+                    fdesc_put(r->fds[--r->nfds]);
+                deallocate(h, r, sizeof(*r) + nfds * sizeof(fdesc));
+                rv = -EBADF;
+                goto out;
+            }
+            r->fds[r->nfds++] = f;
+        }
+        offset += CMSG_ALIGN(cmsg->cmsg_len);
+    }
+    *rights = r;
+  out:
+    deallocate(h, buf, control_len);
+    return rv;
 }
 
-static inline sharedbuf sharedbuf_allocate(heap h, u64 len)
+/* Installs the descriptors in the process, as an SCM_RIGHTS control message if msg has room for
+   it (descriptors that do not fit are closed); returns the length of the control data. */
+static u64 unixsock_put_rights(process p, unixsock_rights r, struct msghdr *msg)
 {
-    sharedbuf shb = allocate(h, sizeof(*shb));
-    if (shb == INVALID_ADDRESS)
-        return shb;
-    shb->b = allocate_buffer(h, len);
-    if (shb->b == INVALID_ADDRESS) {
-        deallocate(h, shb, sizeof(*shb));
-        return INVALID_ADDRESS;
+    u64 control_len = 0;
+    int n = 0;
+    if (msg && msg->msg_control && (msg->msg_controllen >= CMSG_LEN(sizeof(int)))) {
+        struct cmsghdr *cmsg = msg->msg_control;
+        int *fds = CMSG_DATA(cmsg);
+        int max = MIN(r->nfds, (msg->msg_controllen - CMSG_LEN(0)) / sizeof(int));
+        for (; n < max; n++) {
+            u64 fd = allocate_fd(p, r->fds[n]);
+            if (fd == INVALID_PHYSICAL)
+                break;
+            fds[n] = fd;
+        }
+        cmsg->cmsg_len = CMSG_LEN(n * sizeof(int));
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        control_len = MIN(CMSG_SPACE(n * sizeof(int)), msg->msg_controllen);
     }
-    init_closure(&shb->free, sharedbuf_free, shb);
-    init_refcount(&shb->refcount, 1, (thunk)&shb->free);
-    return shb;
+    if (n < r->nfds) {
+        if (msg)
+            msg->msg_flags |= MSG_CTRUNC;
+        for (int i = n; i < r->nfds; i++)
+            fdesc_put(r->fds[i]);
+    }
+    deallocate(heap_general(get_kernel_heaps()), r, sizeof(*r) + r->nfds * sizeof(fdesc));
+    return control_len;
 }
 
-static inline void sharedbuf_reserve(sharedbuf shb)
+define_closure_function(1, 0, void, unixsock_msg_free,
+                        unixsock_msg, m)
 {
-    refcount_reserve(&shb->refcount);
+    unixsock_msg m = bound(m);
+    unix_heaps uh = get_unix_heaps();
+    if (m->rights)
+        unixsock_rights_release(m->rights);
+    if (m->data != m->inline_data)
+        deallocate(heap_general((kernel_heaps)uh), m->data, m->len);
+    unix_cache_free(uh, unixsock_msg, m);
 }
 
-static inline void sharedbuf_release(sharedbuf shb)
+define_closure_function(1, 0, void, unixsock_free,
+                        unixsock, s)
 {
-    refcount_release(&shb->refcount);
+    unixsock s = bound(s);
+    deallocate(s->sock.h, s, sizeof(*s));
+}
+
+static unixsock_msg unixsock_msg_alloc(u64 len)
+{
+    unix_heaps uh = get_unix_heaps();
+    unixsock_msg m = unix_cache_alloc(uh, unixsock_msg);
+    if (m == INVALID_ADDRESS)
+        return m;
+    if (len <= UNIXSOCK_MSG_INLINE_LEN) {
+        m->data = m->inline_data;
+    } else {
+        m->data = allocate(heap_general((kernel_heaps)uh), len);
+        if (m->data == INVALID_ADDRESS) {
+            unix_cache_free(uh, unixsock_msg, m);
+            return INVALID_ADDRESS;
+        }
+    }
+    m->len = len;
+    m->rights = 0;
+    init_closure(&m->free, unixsock_msg_free, m);
+    init_refcount(&m->refcount, 1, (thunk)&m->free);
+    return m;
 }
 
 /* A socket is in connecting state when connect() has been called but the
@@ -99,10 +237,27 @@ static void unixsock_dealloc(unixsock s)
 {
     if (s->sock.type == SOCK_DGRAM && s->peer)
         refcount_release(&s->peer->refcount);
-    deallocate_queue(s->data);
-    s->data = 0;
+    if (s->data) {
+        unixsock_msg m;
+        while ((m = dequeue(s->data)) != INVALID_ADDRESS)
+            refcount_release(&m->refcount);
+        deallocate_queue(s->data);
+        s->data = 0;
+    }
+    if (s->ring) {
+        deallocate(s->sock.h, s->ring, UNIXSOCK_RING_SIZE);
+        s->ring = 0;
+    }
+    list_foreach(&s->rights, l) {
+        list_delete(l);
+        unixsock_rights_release(struct_from_list(l, unixsock_rights, l));
+    }
+    s->closed = true;
     deallocate_closure(s->sock.f.read);
     deallocate_closure(s->sock.f.write);
+    if (s->sock.f.sg_read)
+        deallocate_closure(s->sock.f.sg_read);
+    deallocate_closure(s->sock.f.sg_write);
     deallocate_closure(s->sock.f.events);
     deallocate_closure(s->sock.f.close);
     socket_deinit(&s->sock);
@@ -121,87 +276,142 @@ static inline void unixsock_notify_writer(unixsock s)
     fdesc_notify_events(&s->sock.f);
 }
 
-closure_function(8, 1, sysreturn, unixsock_read_bh,
-                 unixsock, s, thread, t, void *, dest, sg_list, sg, u64, length, io_completion, completion, struct sockaddr_un *, from_addr, socklen_t *, from_length,
+/* copy len bytes to dest or, if dest is null, to the iovecs of msg, starting at offset */
+static void unixsock_copy_out(void *dest, struct msghdr *msg, u64 offset, void *src, u64 len)
+{
+    if (dest) {
+        runtime_memcpy(dest + offset, src, len);
+        return;
+    }
+    struct iovec *iov = msg->msg_iov;
+    for (u64 i = 0; (len > 0) && (i < msg->msg_iovlen); i++) {
+        if (offset >= iov[i].iov_len) {
+            offset -= iov[i].iov_len;
+            continue;
+        }
+        u64 n = MIN(len, iov[i].iov_len - offset);
+        runtime_memcpy(iov[i].iov_base + offset, src, n);
+        src += n;
+        len -= n;
+        offset = 0;
+    }
+}
+
+/* As in Linux, a read ends with the data sent along with descriptors, which are received with
+   the first read of that data. */
+static sysreturn unixsock_stream_read(unixsock s, thread t, void *dest, struct msghdr *msg,
+                                      u64 length, u64 *control_len)
+{
+    if (s->ring_len == 0)
+        return -EAGAIN;
+    u64 xfer = MIN(length, s->ring_len);
+    if (!list_empty(&s->rights)) {
+        unixsock_rights r = struct_from_list(list_begin(&s->rights), unixsock_rights, l);
+        if (r->pos < s->rx_pos + xfer) {
+            xfer = MIN(xfer, r->pos + r->len - s->rx_pos);
+            list_delete(&r->l);
+            *control_len = unixsock_put_rights(t->p, r, msg);
+        }
+    }
+    u64 first = MIN(xfer, UNIXSOCK_RING_SIZE - s->ring_head);
+    unixsock_copy_out(dest, msg, 0, s->ring + s->ring_head, first);
+    if (xfer > first)
+        unixsock_copy_out(dest, msg, first, s->ring, xfer - first);
+    s->ring_head = (s->ring_head + xfer) % UNIXSOCK_RING_SIZE;
+    s->ring_len -= xfer;
+    s->rx_pos += xfer;
+    if (s->ring_len == 0) { /* no more data available to read */
+        s->ring_head = 0;
+        fdesc_notify_events(&s->sock.f);
+    }
+    return xfer;
+}
+
+static sysreturn unixsock_dgram_read(unixsock s, thread t, void *dest, sg_list sg,
+                                     struct msghdr *msg, u64 length,
+                                     struct sockaddr_un *from_addr, socklen_t *from_length,
+                                     u64 *control_len)
+{
+    unixsock_msg m = dequeue(s->data);
+    if (m == INVALID_ADDRESS)
+        return -EAGAIN;
+    u64 xfer = MIN(m->len, length);
+    if (sg) {
+        if (xfer > 0) {
+            sg_buf sgb = sg_list_tail_add(sg, xfer);
+            refcount_reserve(&m->refcount);
+            sgb->buf = m->data;
+            sgb->size = xfer;
+            sgb->offset = 0;
+            sgb->refcount = &m->refcount;
+        }
+    } else {
+        unixsock_copy_out(dest, msg, 0, m->data, xfer);
+    }
+    if (msg && (xfer < m->len))
+        msg->msg_flags |= MSG_TRUNC;
+    if (from_addr && from_length) {
+        runtime_memcpy(from_addr, &m->from_addr, MIN(*from_length, sizeof(m->from_addr)));
+        *from_length = __builtin_offsetof(struct sockaddr_un, sun_path) + runtime_strlen(m->from_addr.sun_path) + 1;
+    }
+    if (m->rights) {
+        *control_len = unixsock_put_rights(t->p, m->rights, msg);
+        m->rights = 0;
+    }
+    refcount_release(&m->refcount);
+    if (queue_empty(s->data)) /* no more data available to read */
+        fdesc_notify_events(&s->sock.f);
+    return xfer;
+}
+
+closure_function(9, 1, sysreturn, unixsock_read_bh,
+                 unixsock, s, thread, t, void *, dest, sg_list, sg, struct msghdr *, msg, u64, length, io_completion, completion, struct sockaddr_un *, from_addr, socklen_t *, from_length,
                  u64, flags)
 {
     unixsock s = bound(s);
-    void *dest = bound(dest);
-    u64 length = bound(length);
-
-    sharedbuf shb;
+    struct msghdr *msg = bound(msg);
+    u64 control_len = 0;
     sysreturn rv;
 
     if ((flags & BLOCKQ_ACTION_NULLIFY) && (s->peer || s->sock.type == SOCK_DGRAM)) {
         rv = -ERESTARTSYS;
         goto out;
     }
-    shb = queue_peek(s->data);
-    if (shb == INVALID_ADDRESS) {
+    if (s->sock.type == SOCK_STREAM)
+        rv = unixsock_stream_read(s, bound(t), bound(dest), msg, bound(length), &control_len);
+    else
+        rv = unixsock_dgram_read(s, bound(t), bound(dest), bound(sg), msg, bound(length),
+                                 bound(from_addr), bound(from_length), &control_len);
+    if (rv == -EAGAIN) {
         if (s->sock.type == SOCK_STREAM && !s->peer) {
             rv = 0;
             goto out;
         } else if (s->sock.f.flags & SOCK_NONBLOCK) {
-            rv = -EAGAIN;
             goto out;
         }
         return BLOCKQ_BLOCK_REQUIRED;
     }
-    rv = 0;
-    do {
-        buffer b = shb->b;
-        u64 xfer = MIN(buffer_length(b), length);
-        if (dest) {
-            buffer_read(b, dest, xfer);
-            dest = (u8 *)dest + xfer;
-        } else if (xfer > 0) {
-            sg_buf sgb = sg_list_tail_add(bound(sg), xfer);
-            if (!sgb)
-                break;
-            sharedbuf_reserve(shb);
-            sgb->buf = buffer_ref(b, 0);
-            sgb->size = xfer;
-            sgb->offset = 0;
-            sgb->refcount = &shb->refcount;
-            buffer_consume(b, xfer);
-        }
-        rv += xfer;
-        length -= xfer;
-        if (!buffer_length(b) || (s->sock.type == SOCK_DGRAM)) {
-            assert(dequeue(s->data) == shb);
-            if (s->sock.type == SOCK_DGRAM) {
-                struct sockaddr_un *from_addr = bound(from_addr);
-                socklen_t *from_length = bound(from_length);
-                if (from_addr && from_length) {
-                    runtime_memcpy(from_addr, &shb->from_addr, MIN(*from_length, sizeof(shb->from_addr)));
-                    *from_length = __builtin_offsetof(struct sockaddr_un, sun_path) + runtime_strlen(from_addr->sun_path) + 1;
-                }
-            }
-            sharedbuf_release(shb);
-            shb = queue_peek(s->data);
-            if (shb == INVALID_ADDRESS) { /* no more data available to read */
-                fdesc_notify_events(&s->sock.f);
-                break;
-            }
-        }
-    } while ((s->sock.type == SOCK_STREAM) && (length > 0));
     if (s->peer) {
         unixsock_notify_writer(s->peer);
     }
 out:
+    if (msg && (rv >= 0))
+        msg->msg_controllen = control_len;
     blockq_handle_completion(s->sock.rxbq, flags, bound(completion), bound(t),
             rv);
     closure_finish();
     return rv;
 }
 
-static sysreturn unixsock_read_with_addr(unixsock s, void *dest, u64 length, u64 offset_arg, thread t, boolean bh, io_completion completion, void *addr, socklen_t *addrlen)
+static sysreturn unixsock_read_with_addr(unixsock s, void *dest, struct msghdr *msg, u64 length, u64 offset_arg, thread t, boolean bh, io_completion completion, void *addr, socklen_t *addrlen)
 {
     if ((s->sock.type == SOCK_STREAM) && (length == 0))
         return io_complete(completion, t, 0);
 
-    blockq_action ba = closure(s->sock.h, unixsock_read_bh, s, t, dest, 0, length,
+    blockq_action ba = closure(s->sock.h, unixsock_read_bh, s, t, dest, 0, msg, length,
             completion, addr, addrlen);
+    if (ba == INVALID_ADDRESS)
+        return io_complete(completion, t, -ENOMEM);
     return blockq_check(s->sock.rxbq, t, ba, bh);
 }
 
@@ -209,7 +419,7 @@ closure_function(1, 6, sysreturn, unixsock_read,
                  unixsock, s,
                  void *, dest, u64, length, u64, offset_arg, thread, t, boolean, bh, io_completion, completion)
 {
-    return unixsock_read_with_addr(bound(s), dest, length, offset_arg, t, bh, completion, 0, 0);
+    return unixsock_read_with_addr(bound(s), dest, 0, length, offset_arg, t, bh, completion, 0, 0);
 }
 
 static sysreturn unixsock_write_check(unixsock s, u64 len)
@@ -221,37 +431,71 @@ static sysreturn unixsock_write_check(unixsock s, u64 len)
     return 1;   /* any value > 0 will do */
 }
 
-static sysreturn unixsock_write_to(void *src, sg_list sg, u64 length,
-                                   unixsock dest, unixsock from)
+static inline boolean unixsock_ring_full(unixsock s)
 {
-    if (queue_full(dest->data)) {
+    return (s->ring_len == UNIXSOCK_RING_SIZE);
+}
+
+static sysreturn unixsock_stream_write(void *src, sg_list sg, u64 length, unixsock dest,
+                                       unixsock_rights rights)
+{
+    if (!dest->ring) {
+        dest->ring = allocate(dest->sock.h, UNIXSOCK_RING_SIZE);
+        if (dest->ring == INVALID_ADDRESS) {
+            dest->ring = 0;
+            return -ENOMEM;
+        }
+    }
+    if (unixsock_ring_full(dest))
         return -EAGAIN;
+    u64 xfer = MIN(length, UNIXSOCK_RING_SIZE - dest->ring_len);
+    u64 tail = (dest->ring_head + dest->ring_len) % UNIXSOCK_RING_SIZE;
+    u64 first = MIN(xfer, UNIXSOCK_RING_SIZE - tail);
+    if (src) {
+        runtime_memcpy(dest->ring + tail, src, first);
+        runtime_memcpy(dest->ring, src + first, xfer - first);
+    } else {
+        assert(sg_copy_to_buf(dest->ring + tail, sg, first) == first);
+        if (xfer > first)
+            assert(sg_copy_to_buf(dest->ring, sg, xfer - first) == xfer - first);
     }
+    if (rights) {
+        rights->pos = dest->rx_pos + dest->ring_len;
+        rights->len = xfer;
+        list_push_back(&dest->rights, &rights->l);
+    }
+    dest->ring_len += xfer;
+    return xfer;
+}
 
-    sysreturn rv = 0;
-    do {
-        u64 xfer = MIN(UNIXSOCK_BUF_MAX_SIZE, length);
-        sharedbuf shb = sharedbuf_allocate(dest->sock.h, xfer);
-        if (shb == INVALID_ADDRESS) {
-            if (rv == 0) {
-                rv = -ENOMEM;
-            }
-            break;
-        }
-        if (from && from->sock.type == SOCK_DGRAM)
-            runtime_memcpy(&shb->from_addr, &from->local_addr, sizeof(struct sockaddr_un));
-        if (src) {
-            assert(buffer_write(shb->b, src, xfer));
-            src = (u8 *) src + xfer;
-        } else {
-            u64 len = sg_copy_to_buf(buffer_ref(shb->b, 0), sg, xfer);
-            assert(len == xfer);
-            buffer_produce(shb->b, xfer);
-        }
-        assert(enqueue(dest->data, shb));
-        rv += xfer;
-        length -= xfer;
-    } while ((length > 0) && !queue_full(dest->data));
+static sysreturn unixsock_dgram_write(void *src, sg_list sg, u64 length, unixsock dest,
+                                      unixsock from, unixsock_rights rights)
+{
+    if (queue_full(dest->data))
+        return -EAGAIN;
+    unixsock_msg m = unixsock_msg_alloc(length);
+    if (m == INVALID_ADDRESS)
+        return -ENOMEM;
+    if (from)
+        runtime_memcpy(&m->from_addr, &from->local_addr, sizeof(struct sockaddr_un));
+    else
+        zero(&m->from_addr, sizeof(m->from_addr));
+    if (src)
+        runtime_memcpy(m->data, src, length);
+    else
+        assert(sg_copy_to_buf(m->data, sg, length) == length);
+    m->rights = rights;
+    assert(enqueue(dest->data, m));
+    return length;
+}
+
+/* On success, the descriptors (if any) are handed over to the destination socket. */
+static sysreturn unixsock_write_to(void *src, sg_list sg, u64 length,
+                                   unixsock dest, unixsock from, unixsock_rights rights)
+{
+    sysreturn rv = (dest->sock.type == SOCK_STREAM) ?
+        unixsock_stream_write(src, sg, length, dest, rights) :
+        unixsock_dgram_write(src, sg, length, dest, from, rights);
     if ((rv > 0) || ((rv == 0) && (dest->sock.type == SOCK_DGRAM))) {
         unixsock_notify_reader(dest);
     }
@@ -275,8 +519,13 @@ static int lookup_socket(unixsock *s, char *path)
     return 0;
 }
 
-closure_function(8, 1, sysreturn, unixsock_write_bh,
-                 unixsock, s, thread, t, void *, src, sg_list, sg, u64, length, io_completion, completion, struct sockaddr_un *, addr, socklen_t, addrlen,
+static boolean unixsock_dest_full(unixsock dest)
+{
+    return (dest->sock.type == SOCK_STREAM) ? unixsock_ring_full(dest) : queue_full(dest->data);
+}
+
+closure_function(9, 1, sysreturn, unixsock_write_bh,
+                 unixsock, s, thread, t, void *, src, sg_list, sg, u64, length, io_completion, completion, struct sockaddr_un *, addr, socklen_t, addrlen, unixsock_rights, rights,
                  u64, flags)
 {
     unixsock s = bound(s);
@@ -311,20 +560,22 @@ closure_function(8, 1, sysreturn, unixsock_write_bh,
             rv = lookup_socket(&dest, daddr.sun_path);
             if (rv != 0)
                 goto out;
-        } else if (!dest || !dest->data) {
+        } else if (!dest || dest->closed) {
             rv = -ENOTCONN;
             goto out;
         }
     }
 
-    rv = unixsock_write_to(src, bound(sg), length, dest, s);
+    rv = unixsock_write_to(src, bound(sg), length, dest, s, bound(rights));
     if ((rv == -EAGAIN) && !(s->sock.f.flags & SOCK_NONBLOCK)) {
         return BLOCKQ_BLOCK_REQUIRED;
     }
-    if (queue_full(dest->data)) { /* no more space available to write */
+    if (unixsock_dest_full(dest)) { /* no more space available to write */
         fdesc_notify_events(&s->sock.f);
     }
 out:
+    if ((rv < 0) && bound(rights))
+        unixsock_rights_release(bound(rights));
     blockq_handle_completion(s->sock.txbq, flags, bound(completion), bound(t),
             rv);
     closure_finish();
@@ -338,7 +589,9 @@ static sysreturn unixsock_write_with_addr(unixsock s, void *src, u64 length, u64
         return io_complete(completion, t, rv);
 
     blockq_action ba = closure(s->sock.h, unixsock_write_bh, s, t, src, 0, length,
-            completion, addr, addrlen);
+            completion, addr, addrlen, 0);
+    if (ba == INVALID_ADDRESS)
+        return io_complete(completion, t, -ENOMEM);
     return blockq_check(s->sock.txbq, t, ba, bh);
 }
 
@@ -349,12 +602,13 @@ closure_function(1, 6, sysreturn, unixsock_write,
     return unixsock_write_with_addr(bound(s), src, length, offset, t, bh, completion, 0, 0);
 }
 
+/* SOCK_DGRAM only: received datagrams are referenced by the sg list without copying */
 closure_function(1, 6, sysreturn, unixsock_sg_read,
                  unixsock, s,
                  sg_list, sg, u64, length, u64, offset, thread, t, boolean, bh, io_completion, completion)
 {
     unixsock s = bound(s);
-    blockq_action ba = closure(s->sock.h, unixsock_read_bh, s, t, 0, sg, length,
+    blockq_action ba = closure(s->sock.h, unixsock_read_bh, s, t, 0, sg, 0, length,
         completion, 0, 0);
     if (ba == INVALID_ADDRESS)
         return io_complete(completion, t, -ENOMEM);
@@ -370,7 +624,7 @@ closure_function(1, 6, sysreturn, unixsock_sg_write,
     if (rv <= 0)
         return io_complete(completion, t, rv);
     blockq_action ba = closure(s->sock.h, unixsock_write_bh, s, t, 0, sg, length,
-        completion, 0, 0);
+        completion, 0, 0, 0);
     if (ba == INVALID_ADDRESS)
         return io_complete(completion, t, -ENOMEM);
     return blockq_check(s->sock.txbq, t, ba, bh);
@@ -392,10 +646,10 @@ closure_function(1, 1, u32, unixsock_events,
             events |= EPOLLOUT;
         }
     } else {
-        if (!queue_empty(s->data)) {
+        if ((s->sock.type == SOCK_STREAM) ? (s->ring_len > 0) : !queue_empty(s->data)) {
             events |= EPOLLIN;
         }
-        if (s->sock.type == SOCK_DGRAM || (s->peer && !queue_full(s->peer->data))) {
+        if (s->sock.type == SOCK_DGRAM || (s->peer && !unixsock_ring_full(s->peer))) {
             events |= EPOLLOUT;
         }
         if (!s->peer && s->sock.type != SOCK_DGRAM) {
@@ -420,7 +674,7 @@ closure_function(1, 2, sysreturn, unixsock_close,
     unixsock s = bound(s);
     if (s->peer) {
         s->peer->peer = 0;
-        if (s->peer->data) {
+        if (!s->peer->closed) {
             socket_flush_q(&s->peer->sock);
             fdesc_notify_events(&s->peer->sock.f);
         }
@@ -676,7 +930,7 @@ sysreturn unixsock_recvfrom(struct sock *sock, void *buf, u64 len, int flags,
         if (!(src_addr && addrlen))
             return -EFAULT;
     }
-    return unixsock_read_with_addr((unixsock)sock, buf, len, 0, current, false,
+    return unixsock_read_with_addr((unixsock)sock, buf, 0, len, 0, current, false,
         syscall_io_complete, src_addr, addrlen);
 }
 
@@ -693,51 +947,108 @@ closure_function(1, 2, void, sendmsg_complete,
 sysreturn unixsock_sendmsg(struct sock *sock, const struct msghdr *msg,
         int flags)
 {
+    unixsock s = (unixsock)sock;
+    u64 length = iov_total_len(msg->msg_iov, msg->msg_iovlen);
+    sysreturn rv = unixsock_write_check(s, length);
+    if (rv <= 0)
+        return rv;
+    unixsock_rights rights;
+    rv = unixsock_get_rights(current->p, msg, &rights);
+    if (rv < 0)
+        return rv;
+    rv = -ENOMEM;
     sg_list sg = allocate_sg_list();
     if (sg == INVALID_ADDRESS)
-        return -ENOMEM;
+        goto err_release_rights;
     if (!iov_to_sg(sg, msg->msg_iov, msg->msg_iovlen))
         goto err_dealloc_sg;
     io_completion complete = closure(sock->h, sendmsg_complete, sg);
     if (complete == INVALID_ADDRESS)
         goto err_dealloc_sg;
-    return apply(sock->f.sg_write, sg, sg->count, 0, current, false, complete);
+    struct sockaddr_un *addr = (sock->type == SOCK_DGRAM) ? msg->msg_name : 0;
+    blockq_action ba = closure(sock->h, unixsock_write_bh, s, current, 0, sg, length,
+        complete, addr, addr ? msg->msg_namelen : 0, rights);
+    if (ba == INVALID_ADDRESS)
+        goto err_dealloc_complete;
+    return blockq_check(sock->txbq, current, ba, false);
+  err_dealloc_complete:
+    deallocate_closure(complete);
   err_dealloc_sg:
     deallocate_sg_list(sg);
-    return -ENOMEM;
+  err_release_rights:
+    if (rights)
+        unixsock_rights_release(rights);
+    return rv;
 }
 
-closure_function(3, 2, void, recvmsg_complete,
-                 sg_list, sg, struct iovec *, iov, int, iovlen,
-                 thread, t, sysreturn, rv)
+/* Data is copied straight to the iovecs, along with any descriptors passed with it. */
+sysreturn unixsock_recvmsg(struct sock *sock, struct msghdr *msg, int flags)
 {
-    thread_resume(t);
-    sg_list sg = bound(sg);
-    sg_to_iov(sg, bound(iov), bound(iovlen));
-    deallocate_sg_list(sg);
-    apply(syscall_io_complete, t, rv);
-    closure_finish();
+    struct sockaddr_un *addr = 0;
+    socklen_t *addrlen = 0;
+    if ((sock->type == SOCK_DGRAM) && msg->msg_name) {
+        addr = msg->msg_name;
+        addrlen = &msg->msg_namelen;
+    } else {
+        msg->msg_namelen = 0;
+    }
+    msg->msg_flags = 0;
+    return unixsock_read_with_addr((unixsock)sock, 0, msg,
+        iov_total_len(msg->msg_iov, msg->msg_iovlen), 0, current, false,
+        syscall_io_complete, addr, addrlen);
 }
 
-sysreturn unixsock_recvmsg(struct sock *sock, struct msghdr *msg, int flags)
+static sysreturn unixsock_getsockopt(struct sock *sock, int level, int optname,
+        void *optval, socklen_t *optlen)
 {
-    sg_list sg = allocate_sg_list();
-    if (sg == INVALID_ADDRESS)
-        return -ENOMEM;
-    io_completion complete = closure(sock->h, recvmsg_complete, sg,
-        msg->msg_iov, msg->msg_iovlen);
-    if (complete == INVALID_ADDRESS)
-        goto err_dealloc_sg;
+    unixsock s = (unixsock)sock;
+    if (!validate_user_memory(optlen, sizeof(socklen_t), true) ||
+        !validate_user_memory(optval, *optlen, true))
+        return -EFAULT;
 
-    /* Non-connected sockets are not supported, so source address is not set. */
-    msg->msg_namelen = 0;
+    union {
+        int val;
+        struct ucred cred;
+    } ret_optval;
+    int ret_optlen;
 
-    return apply(sock->f.sg_read, sg,
-        iov_total_len(msg->msg_iov, msg->msg_iovlen), 0, current, false,
-        complete);
-  err_dealloc_sg:
-    deallocate_sg_list(sg);
-    return -ENOMEM;
+    if (level != SOL_SOCKET)
+        return -EOPNOTSUPP;
+    switch (optname) {
+    case SO_TYPE:
+        ret_optval.val = sock->type;
+        ret_optlen = sizeof(ret_optval.val);
+        break;
+    case SO_ERROR:
+        ret_optval.val = 0;
+        ret_optlen = sizeof(ret_optval.val);
+        break;
+    case SO_SNDBUF:
+    case SO_RCVBUF:
+        ret_optval.val = (sock->type == SOCK_STREAM) ? UNIXSOCK_RING_SIZE :
+            UNIXSOCK_QUEUE_MAX_LEN * UNIXSOCK_BUF_MAX_SIZE;
+        ret_optlen = sizeof(ret_optval.val);
+        break;
+    case SO_PEERCRED:
+        /* all sockets belong to the same process, with root credentials */
+        if ((sock->type == SOCK_STREAM) && s->peer) {
+            ret_optval.cred.pid = current->p->pid;
+            ret_optval.cred.uid = ret_optval.cred.gid = 0;
+        } else {
+            ret_optval.cred.pid = 0;
+            ret_optval.cred.uid = ret_optval.cred.gid = -1;
+        }
+        ret_optlen = sizeof(ret_optval.cred);
+        break;
+    default:
+        return -ENOPROTOOPT;
+    }
+    if (optval && optlen) {
+        ret_optlen = MIN(*optlen, ret_optlen);
+        runtime_memcpy(optval, &ret_optval, ret_optlen);
+        *optlen = ret_optlen;
+    }
+    return 0;
 }
 
 static unixsock unixsock_alloc(heap h, int type, u32 flags)
@@ -747,10 +1058,14 @@ static unixsock unixsock_alloc(heap h, int type, u32 flags)
         msg_err("failed to allocate socket structure\n");
         return 0;
     }
-    s->data = allocate_queue(h, UNIXSOCK_QUEUE_MAX_LEN);
-    if (s->data == INVALID_ADDRESS) {
-        msg_err("failed to allocate data buffer\n");
-        goto err_queue;
+    if (type == SOCK_DGRAM) {
+        s->data = allocate_queue(h, UNIXSOCK_QUEUE_MAX_LEN);
+        if (s->data == INVALID_ADDRESS) {
+            msg_err("failed to allocate data queue\n");
+            goto err_queue;
+        }
+    } else {
+        s->data = 0;
     }
     if (socket_init(current->p, h, AF_UNIX, type, flags, &s->sock) < 0) {
         msg_err("failed to initialize socket\n");
@@ -758,7 +1073,7 @@ static unixsock unixsock_alloc(heap h, int type, u32 flags)
     }
     s->sock.f.read = closure(h, unixsock_read, s);
     s->sock.f.write = closure(h, unixsock_write, s);
-    s->sock.f.sg_read = closure(h, unixsock_sg_read, s);
+    s->sock.f.sg_read = (type == SOCK_DGRAM) ? closure(h, unixsock_sg_read, s) : 0;
     s->sock.f.sg_write = closure(h, unixsock_sg_write, s);
     s->sock.f.events = closure(h, unixsock_events, s);
     s->sock.f.ioctl = closure(h, unixsock_ioctl, s);
@@ -771,17 +1086,23 @@ static unixsock unixsock_alloc(heap h, int type, u32 flags)
     s->sock.recvfrom = unixsock_recvfrom;
     s->sock.sendmsg = unixsock_sendmsg;
     s->sock.recvmsg = unixsock_recvmsg;
+    s->sock.getsockopt = unixsock_getsockopt;
     s->fs_entry = 0;
     s->local_addr.sun_family = AF_UNIX;
     s->local_addr.sun_path[0] = '\0';
     s->conn_q = 0;
+    s->ring = 0;
+    s->ring_head = s->ring_len = s->rx_pos = 0;
+    list_init(&s->rights);
     s->connecting = false;
+    s->closed = false;
     s->peer = 0;
     init_closure(&s->free, unixsock_free, s);
     init_refcount(&s->refcount, 1, (thunk)&s->free);
     return s;
 err_socket:
-    deallocate_queue(s->data);
+    if (s->data)
+        deallocate_queue(s->data);
 err_queue:
     deallocate(h, s, sizeof(*s));
     return 0;
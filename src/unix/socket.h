@@ -20,6 +20,31 @@ struct msghdr {
     int msg_flags;
 };
 
+struct cmsghdr {
+    u64 cmsg_len;
+    int cmsg_level;
+    int cmsg_type;
+};
+
+#define CMSG_ALIGN(len) pad(len, sizeof(u64))
+#define CMSG_LEN(len)   (sizeof(struct cmsghdr) + (len))
+#define CMSG_SPACE(len) (sizeof(struct cmsghdr) + CMSG_ALIGN(len))
+#define CMSG_DATA(cmsg) ((void *)((cmsg) + 1))
+
+/* error queue (MSG_ERRQUEUE) messages */
+struct sock_extended_err {
+    u32 ee_errno;
+    u8 ee_origin;
+    u8 ee_type;
+    u8 ee_code;
+    u8 ee_pad;
+    u32 ee_info;
+    u32 ee_data;
+};
+
+#define SO_EE_ORIGIN_ZEROCOPY       5
+#define SO_EE_CODE_ZEROCOPY_COPIED  1
+
 #define IFNAMSIZ    16
 
 struct ifmap {
@@ -74,6 +99,9 @@ struct sock {
             int flags);
     sysreturn (*recvmsg)(struct sock *sock, struct msghdr *msg, int flags);
     sysreturn (*shutdown)(struct sock *sock, int how);
+    /* optional: options of sockets other than AF_INET/AF_INET6 */
+    sysreturn (*getsockopt)(struct sock *sock, int level, int optname, void *optval,
+            socklen_t *optlen);
 };
 
 static inline int socket_init(process p, heap h, int domain, int type, u32 flags,
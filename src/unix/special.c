@@ -96,6 +96,15 @@ static u32 cpu_online_events(file f)
     return (EPOLLIN | EPOLLOUT);
 }
 
+static u32 snapshot_events(file f)
+{
+    return (EPOLLIN | EPOLLOUT);
+}
+
+static special_file snapshot_file =
+    { "/sys/kernel/snapshot", .read = snapshot_special_read, .write = snapshot_special_write,
+      .events = snapshot_events };
+
 static special_file special_files[] = {
     { "/dev/urandom", .read = urandom_read, .write = 0, .events = urandom_events },
     { "/dev/null", .read = null_read, .write = null_write, .events = null_events },
@@ -263,6 +272,12 @@ void register_special_files(process p)
         assert(create_special_file(sf->path, open));
     }
 
+    if (get(p->process_root, sym(snapshot))) {
+        spec_file_open open = closure(h, special_open, &snapshot_file);
+        assert(open != INVALID_ADDRESS);
+        assert(create_special_file(snapshot_file.path, open));
+    }
+
     filesystem_mkdirpath(p->root_fs, 0, "/sys/devices/system/cpu/cpu0", false);
 }
 
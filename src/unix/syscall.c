@@ -1,6 +1,7 @@
 #include <unix_internal.h>
 #include <filesystem.h>
 #include <storage.h>
+#include <http.h>
 
 // lifted from linux UAPI
 #define DT_UNKNOWN	0
@@ -13,13 +14,11 @@
 #define DT_SOCK		12
 #define DT_WHT		14
 
-typedef struct syscall_stat {
-    u64 calls;
-    u64 errors;
-    u64 usecs;
-} *syscall_stat;
+#define SYSCALL_STATS_URI   "syscalls"
 
-static struct syscall_stat stats[SYS_MAX];
+/* per-CPU tables of SYS_MAX entries, merged when read */
+static syscall_stat cpu_syscall_stats[MAX_CPUS];
+static process syscall_stats_process;
 boolean do_syscall_stats;
 static boolean do_missing_files;
 static vector missing_files;
@@ -634,6 +633,8 @@ closure_function(2, 2, sysreturn, file_close,
                  thread, t, io_completion, completion)
 {
     file f = bound(f);
+    if (bound(fsf))
+        fsfile_release(bound(fsf));
     deallocate_closure(f->f.read);
     deallocate_closure(f->f.write);
     deallocate_closure(f->f.sg_read);
@@ -697,8 +698,8 @@ boolean validate_user_string(const char *name)
     return false;
 }
 
-sysreturn open_internal(filesystem fs, tuple cwd, const char *name, int flags,
-                        int mode)
+/* Open a file for the current process, with name in kernel memory. */
+sysreturn open_path(filesystem fs, tuple cwd, const char *name, int flags, int mode)
 {
     heap h = heap_general(get_kernel_heaps());
     unix_heaps uh = get_unix_heaps();
@@ -707,9 +708,6 @@ sysreturn open_internal(filesystem fs, tuple cwd, const char *name, int flags,
     int ret;
     buffer b = 0;
 
-    if (!validate_user_string(name))
-        return -EFAULT;
-
     if (flags & O_NOFOLLOW) {
         ret = resolve_cstring(&fs, cwd, name, &n, &parent);
         if (!ret && is_symlink(n) && !(flags & O_PATH)) {
@@ -776,6 +774,10 @@ sysreturn open_internal(filesystem fs, tuple cwd, const char *name, int flags,
     if (type == FDESC_TYPE_REGULAR) {
         fsf = fsfile_from_node(fs, n);
         assert(fsf);
+        if (((flags & O_ACCMODE) != O_RDONLY) && fsfile_is_compressed(fsf)) {
+            thread_log(current, "\"%s\" is compressed and cannot be written", name);
+            return set_syscall_error(current, EROFS);
+        }
         length = fsfile_get_length(fsf);
     }
 
@@ -824,6 +826,8 @@ sysreturn open_internal(filesystem fs, tuple cwd, const char *name, int flags,
         f->f.sg_write = closure(h, file_sg_write, f, fsf);
         f->f.close = closure(h, file_close, f, fsf);
         f->f.events = closure(h, file_events, f);
+        if (fsf)
+            fsfile_reserve(fsf);
     }
 
     if (do_missing_files) {
@@ -841,6 +845,14 @@ sysreturn open_internal(filesystem fs, tuple cwd, const char *name, int flags,
     return fd;
 }
 
+sysreturn open_internal(filesystem fs, tuple cwd, const char *name, int flags,
+                        int mode)
+{
+    if (!validate_user_string(name))
+        return -EFAULT;
+    return open_path(fs, cwd, name, flags, mode);
+}
+
 #ifdef __x86_64__
 sysreturn open(const char *name, int flags, int mode)
 {
@@ -850,40 +862,51 @@ sysreturn open(const char *name, int flags, int mode)
 }
 #endif
 
+/* The fd table syscalls run without the kernel lock, which is only taken to
+   close a file when its last reference is dropped. */
+static void syscall_fdesc_put(fdesc f)
+{
+    if (fetch_and_add(&f->refcnt, -1) == 1) {
+        syscall_kern_lock();
+        apply(f->close, current, io_completion_ignore);
+    }
+}
+
 sysreturn dup(int fd)
 {
     thread_log(current, "dup: fd %d", fd);
-    fdesc f = resolve_fd(current->p, fd);
+    fdesc f = fdesc_get(current->p, fd);
+    if (!f)
+        return set_syscall_error(current, EBADF);
 
+    /* the reference taken above is held by the new fd */
     int newfd = allocate_fd(current->p, f);
     if (newfd == INVALID_PHYSICAL) {
         thread_log(current, "failed to allocate fd");
+        syscall_fdesc_put(f);
         return set_syscall_error(current, EMFILE);
     }
-
-    fetch_and_add(&f->refcnt, 1);
     return newfd;
 }
 
 sysreturn dup2(int oldfd, int newfd)
 {
     thread_log(current, "%s: oldfd %d, newfd %d", __func__, oldfd, newfd);
-    fdesc f = resolve_fd(current->p, oldfd);
-    if (newfd != oldfd) {
-        fdesc newf = fdesc_get(current->p, newfd);
-        if (newf) {
-            assert(vector_set(current->p->files, newfd, f));
-            if (fetch_and_add(&newf->refcnt, -2) == 2)
-                apply(newf->close, current, io_completion_ignore);
-        } else {
-            newfd = allocate_fd_gte(current->p, newfd, f);
-            if (newfd == INVALID_PHYSICAL) {
-                thread_log(current, "  failed to use newfd");
-                return -EMFILE;
-            }
-        }
-        fetch_and_add(&f->refcnt, 1);
-    }
+    fdesc f = fdesc_get(current->p, oldfd);
+    if (!f)
+        return set_syscall_error(current, EBADF);
+    if (newfd == oldfd) {
+        syscall_fdesc_put(f);
+        return newfd;
+    }
+    fdesc newf = replace_fd(current->p, newfd, f);
+    if (newf == INVALID_ADDRESS) {
+        thread_log(current, "  failed to use newfd");
+        syscall_fdesc_put(f);
+        return -EMFILE;
+    }
+    if (newf)
+        syscall_fdesc_put(newf);
     return newfd;
 }
 
@@ -1216,17 +1239,18 @@ sysreturn syncfs(int fd)
     return sync();
 }
 
-sysreturn fsync(int fd)
+static sysreturn fsync_internal(int fd, boolean datasync)
 {
     fdesc f = resolve_fd(current->p, fd);
     switch (f->type) {
-    case FDESC_TYPE_REGULAR:
+    case FDESC_TYPE_REGULAR: {
         assert(((file)f)->fsf);
-        filesystem_sync_node(((file)f)->fs,
-                             fsfile_get_cachenode(((file)f)->fsf),
-                             closure(heap_general(get_kernel_heaps()),
-                                 sync_complete, current));
+        status_handler sh = closure(heap_general(get_kernel_heaps()), sync_complete, current);
+        if (sh == INVALID_ADDRESS)
+            return -ENOMEM;
+        fsfile_flush(((file)f)->fsf, datasync, sh);
         return thread_maybe_sleep_uninterruptible(current);
+    }
     case FDESC_TYPE_DIRECTORY:
     case FDESC_TYPE_SYMLINK:
         return 0;
@@ -1235,9 +1259,48 @@ sysreturn fsync(int fd)
     }
 }
 
+sysreturn fsync(int fd)
+{
+    return fsync_internal(fd, false);
+}
+
 sysreturn fdatasync(int fd)
 {
-    return fsync(fd);
+    return fsync_internal(fd, true);
+}
+
+/* Writes are issued to storage as they are made to the page cache, so only
+   dirty pages of shared mappings need to be committed here. No metadata is
+   written and no device cache flush is issued. */
+sysreturn sync_file_range(int fd, s64 offset, s64 nbytes, unsigned int flags)
+{
+    thread_log(current, "%s: fd %d, offset 0x%lx, nbytes 0x%lx, flags 0x%x",
+               __func__, fd, offset, nbytes, flags);
+    fdesc f = resolve_fd(current->p, fd);
+    if ((offset < 0) || (nbytes < 0) || (flags & ~(SYNC_FILE_RANGE_WAIT_BEFORE |
+            SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER)))
+        return -EINVAL;
+    switch (f->type) {
+    case FDESC_TYPE_REGULAR:
+        break;
+    case FDESC_TYPE_DIRECTORY:
+    case FDESC_TYPE_SYMLINK:
+        return 0;
+    default:
+        return -ESPIPE;
+    }
+    pagecache_node pn = fsfile_get_cachenode(((file)f)->fsf);
+    range q = irange(offset, nbytes ? offset + nbytes : infinity);
+    if (flags & SYNC_FILE_RANGE_WRITE)
+        pagecache_node_scan_and_commit_shared_pages(pn, q);
+    if (flags & (SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WAIT_AFTER)) {
+        status_handler sh = closure(heap_general(get_kernel_heaps()), sync_complete, current);
+        if (sh == INVALID_ADDRESS)
+            return -ENOMEM;
+        pagecache_node_finish_pending_writes(pn, sh);
+        return thread_maybe_sleep_uninterruptible(current);
+    }
+    return 0;
 }
 
 static sysreturn access_internal(tuple cwd, const char *pathname, int mode)
@@ -1588,7 +1651,6 @@ static sysreturn getcwd(char *buf, u64 length)
 static sysreturn brk(void *addr)
 {
     process p = current->p;
-    id_heap physical = heap_physical(get_kernel_heaps());
 
     /* on failure, return the current break */
     if (!addr || p->brk == addr)
@@ -1600,23 +1662,19 @@ static sysreturn brk(void *addr)
         if (u64_from_pointer(addr) < p->heap_base ||
             !adjust_process_heap(p, irange(p->heap_base, new_end)))
             goto out;
-        u64 len = old_end - new_end;
-        u64 phys = physical_from_virtual(pointer_from_u64(new_end));
+        /* pages may come from the zero page pool and are not contiguous */
         write_barrier();
-        unmap(new_end, len);
-        id_heap_set_area(physical, phys, len, true, false);
+        unmap_and_free_phys(new_end, old_end - new_end);
     } else if (new_end > old_end) {
         u64 alloc = new_end - old_end;
         if (!validate_user_memory(pointer_from_u64(old_end), alloc, true) ||
             !adjust_process_heap(p, irange(p->heap_base, new_end)))
             goto out;
-        u64 phys = allocate_u64((heap)physical, alloc);
-        if (phys == INVALID_PHYSICAL) {
+        pageflags flags = pageflags_writable(pageflags_noexec(pageflags_user(pageflags_memory())));
+        if (!map_zeroed_pages(old_end, alloc, flags)) {
             adjust_process_heap(p, irange(p->heap_base, old_end));
             goto out;
         }
-        pageflags flags = pageflags_writable(pageflags_noexec(pageflags_user(pageflags_memory())));
-        map_and_zero(old_end, phys, alloc, flags);
     }
     p->brk = addr;
   out:
@@ -1891,29 +1949,42 @@ KLIB_EXPORT(fs_rename);
 sysreturn close(int fd)
 {
     thread_log(current, "close: fd %d", fd);
-    fdesc f = resolve_fd(current->p, fd);
-    deallocate_fd(current->p, fd);
+    fdesc f = take_fd(current->p, fd);
+    if (!f)
+        return set_syscall_error(current, EBADF);
 
     if (fetch_and_add(&f->refcnt, -1) == 1) {
-        if (f->close)
+        if (f->close) {
+            syscall_kern_lock();
             return apply(f->close, current, syscall_io_complete);
+        }
         msg_err("no close handler for fd %d\n", fd);
     }
 
     return 0;
 }
 
+static sysreturn fcntl_internal(fdesc f, int fd, int cmd, s64 arg);
+
 sysreturn fcntl(int fd, int cmd, s64 arg)
 {
-    fdesc f = resolve_fd(current->p, fd);
+    fdesc f = fdesc_get(current->p, fd);
+    if (!f)
+        return set_syscall_error(current, EBADF);
+    sysreturn rv = fcntl_internal(f, fd, cmd, arg);
+    syscall_fdesc_put(f);
+    return rv;
+}
 
+static sysreturn fcntl_internal(fdesc f, int fd, int cmd, s64 arg)
+{
     thread_log(current, "fcntl: fd %d, cmd %d, arg %d", fd, cmd, arg);
 
     switch (cmd) {
     case F_GETFD:
         return set_syscall_return(current, f->flags & O_CLOEXEC);
     case F_SETFD:
-        f->flags = (f->flags & ~O_CLOEXEC) | (arg & O_CLOEXEC);
+        fdesc_update_flags(f, O_CLOEXEC, arg & O_CLOEXEC);
         return set_syscall_return(current, 0);
     case F_GETFL:
         return set_syscall_return(current, f->flags & ~O_CLOEXEC);
@@ -1923,7 +1994,7 @@ sysreturn fcntl(int fd, int cmd, s64 arg)
         /* Ignore file access mode and file creation flags. */
         arg &= ~(O_ACCMODE | O_CREAT | O_EXCL | O_NOCTTY | O_TRUNC);
 
-        f->flags = (f->flags & O_ACCMODE) | (arg & ~O_CLOEXEC);
+        fdesc_update_flags(f, ~(O_ACCMODE | O_CLOEXEC), arg & ~O_CLOEXEC);
         return set_syscall_return(current, 0);
     case F_GETLK:
         if (arg) {
@@ -1940,22 +2011,25 @@ sysreturn fcntl(int fd, int cmd, s64 arg)
         if (arg < 0) {
             return set_syscall_error(current, EINVAL);
         }
+        fetch_and_add(&f->refcnt, 1);
         int newfd = allocate_fd_gte(current->p, arg, f);
         if (newfd == INVALID_PHYSICAL) {
             thread_log(current, "failed to allocate fd");
+            fetch_and_add(&f->refcnt, -1);
             return set_syscall_error(current, EMFILE);
         }
-        fetch_and_add(&f->refcnt, 1);
         return set_syscall_return(current, newfd);
     }
     case F_SETPIPE_SZ:
         if (f->type == FDESC_TYPE_PIPE) {
+            syscall_kern_lock();
             return pipe_set_capacity(f, (int)arg);
         } else {
             return -EINVAL;
         }
     case F_GETPIPE_SZ:
         if (f->type == FDESC_TYPE_PIPE) {
+            syscall_kern_lock();
             return pipe_get_capacity(f);
         } else {
             return -EINVAL;
@@ -1972,12 +2046,10 @@ sysreturn ioctl_generic(fdesc f, unsigned long request, vlist ap)
         int *opt = varg(ap, int *);
         if (!validate_user_memory(opt, sizeof(int), false))
             return -EFAULT;
-        if (*opt) {
-            f->flags |= O_NONBLOCK;
-        }
-        else {
-            f->flags &= ~O_NONBLOCK;
-        }
+        if (*opt)
+            fdesc_update_flags(f, 0, O_NONBLOCK);
+        else
+            fdesc_update_flags(f, O_NONBLOCK, 0);
         return 0;
     }
     case FIONCLEX:
@@ -2093,6 +2165,9 @@ sysreturn sched_getaffinity(int pid, u64 cpusetsize, cpu_set_t *mask)
     if (!validate_user_memory(mask, sizeof(mask->mask[0]), true))
         return set_syscall_error(current, EFAULT);
     thread t;
+    /* keep another thread from exiting while it is looked at */
+    if (pid != 0 && pid != current->tid)
+        syscall_kern_lock();
     if (!(t = lookup_thread(pid)) ||
         (!mask || cpusetsize < sizeof(mask->mask[0])))
             return set_syscall_error(current, EINVAL);                    
@@ -2175,7 +2250,7 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, pwrite64, pwrite);
 #ifdef __x86_64__
     register_syscall(map, open, open);
-    register_syscall(map, dup2, dup2);
+    register_syscall_nolock(map, dup2, dup2);
     register_syscall(map, stat, stat);
     register_syscall(map, lstat, lstat);
     register_syscall(map, access, access);
@@ -2194,8 +2269,8 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, symlink, symlink);
 #endif
     register_syscall(map, openat, openat);
-    register_syscall(map, dup, dup);
-    register_syscall(map, dup3, dup3);
+    register_syscall_nolock(map, dup, dup);
+    register_syscall_nolock(map, dup3, dup3);
     register_syscall(map, fallocate, fallocate);
     register_syscall(map, faccessat, faccessat);
     register_syscall(map, fadvise64, fadvise64);
@@ -2208,6 +2283,7 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, ftruncate, ftruncate);
     register_syscall(map, fdatasync, fdatasync);
     register_syscall(map, fsync, fsync);
+    register_syscall(map, sync_file_range, sync_file_range);
     register_syscall(map, sync, sync);
     register_syscall(map, syncfs, syncfs);
     register_syscall(map, io_setup, io_setup);
@@ -2215,7 +2291,7 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, io_getevents, io_getevents);
     register_syscall(map, io_destroy, io_destroy);
     register_syscall(map, lseek, lseek);
-    register_syscall(map, fcntl, fcntl);
+    register_syscall_nolock(map, fcntl, fcntl);
     register_syscall(map, ioctl, (sysreturn (*)())ioctl);
     register_syscall(map, getcwd, getcwd);
     register_syscall(map, symlinkat, symlinkat);
@@ -2223,15 +2299,15 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, unlinkat, unlinkat);
     register_syscall(map, renameat, renameat);
     register_syscall(map, renameat2, renameat2);
-    register_syscall(map, close, close);
+    register_syscall_nolock(map, close, close);
     register_syscall(map, sched_yield, sched_yield);
     register_syscall(map, brk, brk);
     register_syscall(map, uname, uname);
     register_syscall(map, getrlimit, getrlimit);
     register_syscall(map, setrlimit, setrlimit);
     register_syscall(map, prlimit64, prlimit64);
-    register_syscall(map, getrusage, getrusage);
-    register_syscall(map, getpid, getpid);
+    register_syscall_nolock(map, getrusage, getrusage);
+    register_syscall_nolock(map, getpid, getpid);
     register_syscall(map, exit_group, exit_group);
     register_syscall(map, exit, (sysreturn (*)())exit);
     register_syscall(map, getdents64, getdents64);
@@ -2242,10 +2318,10 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, eventfd2, eventfd2);
     register_syscall(map, chdir, chdir);
     register_syscall(map, fchdir, fchdir);
-    register_syscall(map, sched_getaffinity, sched_getaffinity);
+    register_syscall_nolock(map, sched_getaffinity, sched_getaffinity);
     register_syscall(map, sched_setaffinity, sched_setaffinity);
-    register_syscall(map, getuid, syscall_ignore);
-    register_syscall(map, geteuid, syscall_ignore);
+    register_syscall_nolock(map, getuid, syscall_ignore);
+    register_syscall_nolock(map, geteuid, syscall_ignore);
     register_syscall(map, setgroups, syscall_ignore);
     register_syscall(map, setuid, syscall_ignore);
     register_syscall(map, setgid, syscall_ignore);
@@ -2259,11 +2335,9 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, io_uring_setup, io_uring_setup);
     register_syscall(map, io_uring_enter, io_uring_enter);
     register_syscall(map, io_uring_register, io_uring_register);
-    register_syscall(map, getcpu, getcpu);
+    register_syscall_nolock(map, getcpu, getcpu);
 }
 
-#define SYSCALL_F_NOTRACE 0x1
-
 struct syscall {
     void *handler;
     const char *name;
@@ -2273,26 +2347,72 @@ struct syscall {
 static struct syscall _linux_syscalls[SYS_MAX];
 struct syscall *linux_syscalls = _linux_syscalls;
 
+static inline int syscall_hist_bucket(u64 ns)
+{
+    return ns ? MIN(msb(ns), SYSCALL_HIST_BUCKETS - 1) : 0;
+}
+
+static inline void syscall_stat_add(syscall_stat ss, boolean error, u64 us, u64 blocked_us,
+                                    int bucket)
+{
+    ss->calls++;
+    if (error)
+        ss->errors++;
+    ss->usecs += us;
+    ss->blocked_usecs += blocked_us;
+    ss->hist[bucket]++;
+}
+
 void count_syscall(thread t, sysreturn rv)
 {
     if (t->last_syscall == -1)
         return;
-    syscall_stat ss = &stats[t->last_syscall];
+    int call = t->last_syscall;
     t->last_syscall = -1;
-    fetch_and_add(&ss->calls, 1);
-    if (rv < 0 && rv >= -255)
-        fetch_and_add(&ss->errors, 1);
+    timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
     u64 us;
     if (t->syscall_enter_ts)
-        us = usec_from_timestamp(now(CLOCK_ID_MONOTONIC_RAW) - t->syscall_enter_ts) + t->syscall_time;
+        us = usec_from_timestamp(here - t->syscall_enter_ts) + t->syscall_time;
     else
         us = t->syscall_time;
-    fetch_and_add(&ss->usecs, us);
     t->syscall_time = 0;
+    timestamp elapsed = here - t->syscall_start_ts;
+    u64 elapsed_us = usec_from_timestamp(elapsed);
+    u64 blocked_us = elapsed_us > us ? elapsed_us - us : 0;
+    int bucket = syscall_hist_bucket(nsec_from_timestamp(elapsed));
+    boolean error = rv < 0 && rv >= -255;
+
+    /* The per-thread counters need no protection, as a thread has at most one syscall in
+       flight; the per-CPU ones only need to keep out interrupts on this CPU. */
+    syscall_stat_add(&t->syscall_stats, error, us, blocked_us, bucket);
+    u64 flags = irq_disable_save();
+    syscall_stat_add(&cpu_syscall_stats[current_cpu()->id][call], error, us, blocked_us, bucket);
+    irq_restore(flags);
+    if (syscall_stats_process != t->p)
+        syscall_stats_process = t->p;
 }
 
 static boolean debugsyscalls;
 
+/* A syscall that completed synchronously may return straight to the thread,
+   skipping the runloop, if there is no other work pending for this CPU. */
+static inline boolean syscall_direct_return_ok(thread t)
+{
+    return !shutting_down && thread_is_runnable(t) && queue_empty(bhqueue) &&
+        queue_empty(runqueue) && queue_empty(current_cpu()->thread_queue);
+}
+
+static void __attribute__((noreturn)) syscall_direct_return(context f)
+{
+    if (this_cpu_has_kernel_lock())
+        kern_unlock();
+    disable_interrupts();
+    page_invalidate_flush();
+    apply(((nanos_thread)pointer_from_u64(f[FRAME_THREAD]))->pause);
+    apply((thunk)pointer_from_u64(f[FRAME_RUN]));
+    halt("%s: return from thread run\n", __func__);
+}
+
 void syscall_debug(context f)
 {
     if (shutting_down)
@@ -2312,7 +2432,7 @@ void syscall_debug(context f)
     if (do_syscall_stats) {
         assert(t->last_syscall == -1);
         t->last_syscall = call;
-        t->syscall_enter_ts = now(CLOCK_ID_MONOTONIC_RAW);
+        t->syscall_start_ts = t->syscall_enter_ts = now(CLOCK_ID_MONOTONIC_RAW);
     }
     struct syscall *s = t->p->syscalls + call;
     if (debugsyscalls) {
@@ -2342,11 +2462,14 @@ void syscall_debug(context f)
     if (do_syscall_stats)
         count_syscall(t, 0);
     t->syscall = -1;
+    if (syscall_direct_return_ok(t))
+        syscall_direct_return(f);
     // i dont know that we actually want to defer the syscall return...its just easier for the moment to hew
     // to the general model and make exceptions later
     schedule_frame(f);
   out:
-    kern_unlock();
+    if (this_cpu_has_kernel_lock())
+        kern_unlock();
     runloop();
 }
 
@@ -2373,6 +2496,28 @@ closure_function(0, 2, void, io_complete_ignore,
 {
 }
 
+/* Returns a SYS_MAX table with the per-CPU counters summed up. */
+static syscall_stat merge_syscall_stats(heap h)
+{
+    syscall_stat merged = allocate(h, SYS_MAX * sizeof(struct syscall_stat));
+    if (merged == INVALID_ADDRESS)
+        return merged;
+    zero(merged, SYS_MAX * sizeof(struct syscall_stat));
+    for (int cpu = 0; cpu < present_processors; cpu++) {
+        syscall_stat cs = cpu_syscall_stats[cpu];
+        for (int i = 0; i < SYS_MAX; i++) {
+            syscall_stat ss = &merged[i];
+            ss->calls += cs[i].calls;
+            ss->errors += cs[i].errors;
+            ss->usecs += cs[i].usecs;
+            ss->blocked_usecs += cs[i].blocked_usecs;
+            for (int b = 0; b < SYSCALL_HIST_BUCKETS; b++)
+                ss->hist[b] += cs[i].hist[b];
+        }
+    }
+    return merged;
+}
+
 static boolean stat_compare(void *za, void *zb)
 {
     syscall_stat sa = za;
@@ -2397,6 +2542,38 @@ static inline char *print_pct(buffer b, u64 x, u64 y)
     return buffer_ref(b, 0);
 }
 
+/* Prints the upper bound of a latency histogram bucket. */
+static inline char *print_bucket(buffer b, int bucket)
+{
+    u64 ns = U64_FROM_BIT(bucket + 1);
+    buffer_clear(b);
+    if (bucket == SYSCALL_HIST_BUCKETS - 1)
+        buffer_write_byte(b, '>');
+    if (ns < 10 * THOUSAND)
+        bprintf(b, "%dns", ns);
+    else if (ns < 10 * MILLION)
+        bprintf(b, "%dus", ns / THOUSAND);
+    else if (ns < 10 * BILLION)
+        bprintf(b, "%dms", ns / MILLION);
+    else
+        bprintf(b, "%ds", ns / BILLION);
+    buffer_write_byte(b, 0);
+    return buffer_ref(b, 0);
+}
+
+static inline char *print_quantile(buffer b, syscall_stat ss, int permille)
+{
+    u64 target = (ss->calls * permille + 999) / 1000;
+    u64 count = 0;
+    int bucket;
+    for (bucket = 0; bucket < SYSCALL_HIST_BUCKETS - 1; bucket++) {
+        count += ss->hist[bucket];
+        if (count >= target)
+            break;
+    }
+    return print_bucket(b, bucket);
+}
+
 #define LINE "------"
 #define LINE2 LINE LINE
 #define LINE3 LINE LINE LINE
@@ -2415,11 +2592,16 @@ closure_function(0, 2, void, print_syscall_stats_cfn,
     u64 tot_errs = 0;
     buffer tbuf = little_stack_buffer(24);
     buffer pbuf = little_stack_buffer(24);
-    pqueue pq = allocate_pqueue(heap_general(get_kernel_heaps()), stat_compare);
-    syscall_stat ss;
+    heap h = heap_general(get_kernel_heaps());
+    syscall_stat stats, ss;
+    pqueue pq;
 
     if (status != 0)
         return;
+    stats = merge_syscall_stats(h);
+    if (stats == INVALID_ADDRESS)
+        return;
+    pq = allocate_pqueue(h, stat_compare);
     rprintf("\n" HDR_FMT SEPARATOR, "% time", "seconds", "usecs/call", "calls", "errors", "syscall");
     for (int i = 0; i < SYS_MAX; i++) {
         ss = &stats[i];
@@ -2436,6 +2618,142 @@ closure_function(0, 2, void, print_syscall_stats_cfn,
     }
     rprintf(SEPARATOR SUM_FMT, "100.00", print_usecs(tbuf, tot_usecs), 0, tot_calls, tot_errs, "total");
     deallocate_pqueue(pq);
+    deallocate(h, stats, SYS_MAX * sizeof(struct syscall_stat));
+}
+
+#define LIVE_HDR_FMT "%-18s %10s %8s %14s %14s %8s %8s %8s %8s\n"
+#define LIVE_DATA_FMT "%-18s %10d %8d %14d %14d %8s %8s %8s %8s\n"
+#define THREAD_HDR_FMT "%8s %-16s %10s %8s %14s %14s %8s %8s %8s\n"
+#define THREAD_DATA_FMT "%8d %-16s %10d %8d %14d %14d %8s %8s %8s\n"
+
+/* Per-syscall view, hottest (most time on CPU) first. */
+static void syscall_stats_summary(heap h, buffer b, syscall_stat stats)
+{
+    buffer q50 = little_stack_buffer(16);
+    buffer q99 = little_stack_buffer(16);
+    buffer q999 = little_stack_buffer(16);
+    buffer qmax = little_stack_buffer(16);
+    pqueue pq = allocate_pqueue(h, stat_compare);
+    syscall_stat ss;
+
+    bprintf(b, LIVE_HDR_FMT, "syscall", "calls", "errors", "cpu usecs", "blocked usecs",
+            "p50", "p99", "p99.9", "max");
+    for (int i = 0; i < SYS_MAX; i++) {
+        if (stats[i].calls)
+            pqueue_insert(pq, &stats[i]);
+    }
+    while ((ss = pqueue_pop(pq)) != INVALID_ADDRESS)
+        bprintf(b, LIVE_DATA_FMT, _linux_syscalls[ss - stats].name, ss->calls, ss->errors,
+                ss->usecs, ss->blocked_usecs, print_quantile(q50, ss, 500),
+                print_quantile(q99, ss, 990), print_quantile(q999, ss, 999),
+                print_quantile(qmax, ss, 1000));
+    deallocate_pqueue(pq);
+}
+
+/* Per-syscall latency histograms; each bucket is labeled with its upper bound. */
+static void syscall_stats_histograms(buffer b, syscall_stat stats)
+{
+    buffer bound = little_stack_buffer(16);
+    for (int i = 0; i < SYS_MAX; i++) {
+        syscall_stat ss = &stats[i];
+        if (ss->calls == 0)
+            continue;
+        bprintf(b, "%s:", _linux_syscalls[i].name);
+        for (int bucket = 0; bucket < SYSCALL_HIST_BUCKETS; bucket++) {
+            if (ss->hist[bucket])
+                bprintf(b, " %s:%d", print_bucket(bound, bucket), ss->hist[bucket]);
+        }
+        buffer_write_byte(b, '\n');
+    }
+}
+
+closure_function(1, 1, boolean, syscall_stats_thread,
+                 buffer, b,
+                 rbnode, n)
+{
+    thread t = struct_from_field(n, thread, n);
+    syscall_stat ss = &t->syscall_stats;
+    buffer q50 = little_stack_buffer(16);
+    buffer q99 = little_stack_buffer(16);
+    buffer qmax = little_stack_buffer(16);
+    if (ss->calls)
+        bprintf(bound(b), THREAD_DATA_FMT, t->tid, t->name, ss->calls, ss->errors, ss->usecs,
+                ss->blocked_usecs, print_quantile(q50, ss, 500), print_quantile(q99, ss, 990),
+                print_quantile(qmax, ss, 1000));
+    return true;
+}
+
+/* Per-thread view of the program's threads, all syscalls combined. */
+static void syscall_stats_threads(buffer b)
+{
+    process p = syscall_stats_process;
+    bprintf(b, THREAD_HDR_FMT, "tid", "name", "calls", "errors", "cpu usecs", "blocked usecs",
+            "p50", "p99", "max");
+    if (!p)
+        return;
+    spin_lock(&p->threads_lock);
+    rbtree_traverse(p->threads, RB_INORDER, stack_closure(syscall_stats_thread, b));
+    spin_unlock(&p->threads_lock);
+}
+
+closure_function(1, 3, void, syscall_stats_http_request,
+                 heap, h,
+                 http_method, method, buffer_handler, out, value, v)
+{
+    heap h = bound(h);
+    if (method != HTTP_REQUEST_METHOD_GET) {
+        send_http_response(out, timm("status", "501 Not Implemented"),
+                           aprintf(h, "only GET is supported\r\n"));
+        return;
+    }
+    buffer relative_uri = get(v, sym(relative_uri));
+    boolean threads = relative_uri && buffer_compare_with_cstring(relative_uri, "threads");
+    boolean hist = relative_uri && buffer_compare_with_cstring(relative_uri, "hist");
+    if (relative_uri && !threads && !hist &&
+        !buffer_compare_with_cstring(relative_uri, "summary")) {
+        send_http_response(out, timm("status", "404 Not Found"),
+                           aprintf(h, "usage: /" SYSCALL_STATS_URI "[/summary|/hist|/threads]\r\n"));
+        return;
+    }
+    buffer b = allocate_buffer(h, PAGESIZE);
+    if (b == INVALID_ADDRESS)
+        goto fail;
+    if (threads) {
+        syscall_stats_threads(b);
+    } else {
+        syscall_stat stats = merge_syscall_stats(h);
+        if (stats == INVALID_ADDRESS) {
+            deallocate_buffer(b);
+            goto fail;
+        }
+        if (hist)
+            syscall_stats_histograms(b, stats);
+        else
+            syscall_stats_summary(h, b, stats);
+        deallocate(h, stats, SYS_MAX * sizeof(struct syscall_stat));
+    }
+    status s = send_http_response(out, timm("ContentType", "text/plain"), b);
+    if (!is_ok(s))
+        msg_err("failed to send HTTP response: %v\n", s);
+    return;
+  fail:
+    send_http_response(out, timm("status", "500 Internal Server Error"),
+                       aprintf(h, "out of memory\r\n"));
+}
+
+static void init_syscall_stats_http(heap h, u64 port)
+{
+    http_listener hl = allocate_http_listener(h, port);
+    if (hl == INVALID_ADDRESS) {
+        msg_err("could not allocate syscall stats HTTP listener\n");
+        return;
+    }
+    http_register_uri_handler(hl, SYSCALL_STATS_URI, closure(h, syscall_stats_http_request, h));
+    status s = listen_port(h, port, connection_handler_from_http_listener(hl));
+    if (!is_ok(s)) {
+        msg_err("listen_port(port=%d) failed for syscall stats HTTP listener: %v\n", port, s);
+        deallocate_http_listener(h, hl);
+    }
 }
 
 static boolean syscall_defer;
@@ -2444,6 +2762,9 @@ static boolean syscall_defer;
 static void syscall_schedule(context f)
 {
     /* kernel context set on syscall entry */
+    u64 call = f[FRAME_VECTOR];
+    if (call < SYS_MAX && (current->p->syscalls[call].flags & SYSCALL_F_NOLOCK))
+        goto nolock;
     if (!syscall_defer)
         kern_lock();
     else if (!kern_try_lock()) {
@@ -2451,6 +2772,7 @@ static void syscall_schedule(context f)
         thread_pause(current);
         runloop();
     }
+  nolock:
     current_cpu()->state = cpu_kernel;
     syscall_debug(f);
 }
@@ -2484,11 +2806,24 @@ void init_syscalls(tuple root)
     syscall = syscall_schedule;
     syscall_io_complete = closure(h, syscall_io_complete_cfn);
     io_completion_ignore = closure(h, io_complete_ignore);
-    do_syscall_stats = get(root, sym(syscall_summary)) != 0;
-    if (do_syscall_stats) {
+    boolean syscall_summary = get(root, sym(syscall_summary)) != 0;
+    u64 stats_port;
+    boolean syscall_stats_http = get_u64(root, sym(syscall_stats_port), &stats_port);
+    if (syscall_summary || syscall_stats_http) {
+        /* cover every cpu that may come online, not only those running now */
+        for (int cpu = 0; cpu < present_processors; cpu++) {
+            cpu_syscall_stats[cpu] = allocate(h, SYS_MAX * sizeof(struct syscall_stat));
+            assert(cpu_syscall_stats[cpu] != INVALID_ADDRESS);
+            zero(cpu_syscall_stats[cpu], SYS_MAX * sizeof(struct syscall_stat));
+        }
+        do_syscall_stats = true;
+    }
+    if (syscall_summary) {
         print_syscall_stats = closure(h, print_syscall_stats_cfn);
         add_shutdown_completion(print_syscall_stats);
     }
+    if (syscall_stats_http)
+        init_syscall_stats_http(h, stats_port);
     do_missing_files = get(root, sym(missing_files)) != 0;
     if (do_missing_files) {
         missing_files = allocate_vector(h, 8);
@@ -2498,11 +2833,12 @@ void init_syscalls(tuple root)
     }
 }
 
-void _register_syscall(struct syscall *m, int n, sysreturn (*f)(), const char *name)
+void _register_syscall(struct syscall *m, int n, sysreturn (*f)(), const char *name, int flags)
 {
     assert(m[n].handler == 0);
     m[n].handler = f;
     m[n].name = name;
+    m[n].flags = flags;
 }
 
 static void notrace_reset(process p)
@@ -722,7 +722,10 @@ struct io_uring_params {
 };
 
 /* Socket option levels */
+#define SOL_IP          0
 #define SOL_SOCKET      1
+#define IPPROTO_TCP     6
+#define SOL_UDP         17
 #define IPPROTO_IPV6    41
 
 /* set/getsockopt optnames */
@@ -734,9 +737,20 @@ struct io_uring_params {
 #define SO_RCVBUF    8
 #define SO_PRIORITY  12
 #define SO_LINGER    13
+#define SO_PEERCRED  17
+#define SO_ZEROCOPY  60
 
+/* socket control message types */
+#define SCM_RIGHTS   1
+
+#define IP_RECVERR      11
+
+#define IPV6_RECVERR    25
 #define IPV6_V6ONLY     26
 
+#define UDP_SEGMENT     103
+#define UDP_GRO         104
+
 /* eventfd flags */
 #define EFD_CLOEXEC     O_CLOEXEC
 #define EFD_NONBLOCK    O_NONBLOCK
@@ -770,3 +784,8 @@ struct io_uring_params {
 #define POSIX_FADV_WILLNEED     3
 #define POSIX_FADV_DONTNEED     4
 #define POSIX_FADV_NOREUSE      5
+
+/* sync_file_range flags */
+#define SYNC_FILE_RANGE_WAIT_BEFORE 0x01
+#define SYNC_FILE_RANGE_WRITE       0x02
+#define SYNC_FILE_RANGE_WAIT_AFTER  0x04
@@ -105,7 +105,7 @@ void register_thread_syscalls(struct syscall *map)
     register_syscall(map, arch_prctl, arch_prctl);
 #endif
     register_syscall(map, set_tid_address, set_tid_address);
-    register_syscall(map, gettid, gettid);
+    register_syscall_nolock(map, gettid, gettid);
 }
 
 void thread_log_internal(thread t, const char *desc, ...)
@@ -346,6 +346,7 @@ thread create_thread(process p)
     t->utime = t->stime = 0;
     t->start_time = now(CLOCK_ID_MONOTONIC_RAW);
     t->last_syscall = -1;
+    zero(&t->syscall_stats, sizeof(t->syscall_stats));
 
     // XXX sigframe
     spin_lock(&p->threads_lock);
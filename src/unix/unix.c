@@ -21,8 +21,10 @@ unix_heaps get_unix_heaps()
 
 u64 allocate_fd(process p, void *f)
 {
+    spin_lock(&p->fd_lock);
     u64 fd = allocate_u64((heap)p->fdallocator, 1);
     if (fd == INVALID_PHYSICAL) {
+        spin_unlock(&p->fd_lock);
 	msg_err("fail; maxed out\n");
 	return fd;
     }
@@ -30,11 +32,13 @@ u64 allocate_fd(process p, void *f)
         deallocate_u64((heap)p->fdallocator, fd, 1);
         fd = INVALID_PHYSICAL;
     }
+    spin_unlock(&p->fd_lock);
     return fd;
 }
 
 u64 allocate_fd_gte(process p, u64 min, void *f)
 {
+    spin_lock(&p->fd_lock);
     u64 fd = id_heap_alloc_gte(p->fdallocator, 1, min);
     if (fd == INVALID_PHYSICAL) {
         msg_err("failed\n");
@@ -45,13 +49,50 @@ u64 allocate_fd_gte(process p, u64 min, void *f)
             fd = INVALID_PHYSICAL;
         }
     }
+    spin_unlock(&p->fd_lock);
     return fd;
 }
 
 void deallocate_fd(process p, int fd)
 {
+    spin_lock(&p->fd_lock);
     assert(vector_set(p->files, fd, 0)); 
     deallocate_u64((heap)p->fdallocator, fd, 1);
+    spin_unlock(&p->fd_lock);
+}
+
+fdesc take_fd(process p, int fd)
+{
+    spin_lock(&p->fd_lock);
+    fdesc f = vector_get(p->files, fd);
+    if (f) {
+        assert(vector_set(p->files, fd, 0));
+        deallocate_u64((heap)p->fdallocator, fd, 1);
+    }
+    spin_unlock(&p->fd_lock);
+    return f;
+}
+
+fdesc replace_fd(process p, u64 fd, fdesc f)
+{
+    spin_lock(&p->fd_lock);
+    fdesc old = vector_get(p->files, fd);
+    if (old) {
+        assert(vector_set(p->files, fd, f));
+    } else {
+        /* a free fd is allocated exactly, unless it is out of range */
+        u64 newfd = id_heap_alloc_gte(p->fdallocator, 1, fd);
+        if (newfd != fd) {
+            if (newfd != INVALID_PHYSICAL)
+                deallocate_u64((heap)p->fdallocator, newfd, 1);
+            old = INVALID_ADDRESS;
+        } else if (!vector_set(p->files, fd, f)) {
+            deallocate_u64((heap)p->fdallocator, fd, 1);
+            old = INVALID_ADDRESS;
+        }
+    }
+    spin_unlock(&p->fd_lock);
+    return old;
 }
 
 void deliver_fault_signal(u32 signo, thread t, u64 vaddr, s32 si_code)
@@ -348,6 +389,7 @@ process create_process(unix_heaps uh, tuple root, filesystem fs)
     p->cwd = root;
     p->process_root = root;
     p->fdallocator = create_id_heap(h, h, 0, infinity, 1, false);
+    spin_lock_init(&p->fd_lock);
     p->files = allocate_vector(h, 64);
     zero(p->files, sizeof(p->files));
     create_stdfiles(uh, p);
@@ -483,6 +525,8 @@ process init_unix(kernel_heaps kh, tuple root, filesystem fs)
 	goto alloc_fail;
     if (!pipe_init(uh))
 	goto alloc_fail;
+    if (!unixsock_init(uh))
+	goto alloc_fail;
     if (!unix_timers_init(uh))
         goto alloc_fail;
     if (ftrace_init(uh, fs))
@@ -565,5 +609,6 @@ void dump_mem_stats(buffer b)
     dump_heap_stats(b, "epollfd cache", uh->epollfd_cache);
     dump_heap_stats(b, "epoll_blocked cache", uh->epoll_blocked_cache);
     dump_heap_stats(b, "pipe cache", uh->pipe_cache);
+    dump_heap_stats(b, "unix socket message cache", uh->unixsock_msg_cache);
     dump_heap_stats(b, "socket cache", uh->socket_cache);
 }
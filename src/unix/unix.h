@@ -6,12 +6,13 @@ typedef struct thread *thread;
 process init_unix(kernel_heaps kh, tuple root, filesystem fs);
 process create_process(unix_heaps uh, tuple root, filesystem fs);
 thread create_thread(process p);
-process exec_elf(buffer ex, process kernel_process);
+void read_elf_headers(filesystem fs, tuple t, heap h, buffer_handler bh, status_handler sh);
+process exec_elf(buffer ex, tuple program, process kernel_process);
+void snapshot_load(filesystem fs, tuple root, status_handler complete);
 
 void dump_mem_stats(buffer b);
 
 void filesystem_sync(filesystem fs, status_handler sh);
-void filesystem_sync_node(filesystem fs, pagecache_node pn, status_handler sh);
 
 void thread_enter_user(thread in);
 void thread_enter_system(thread t);
@@ -58,6 +58,16 @@ typedef s64 sysreturn;
 boolean netsyscall_init(unix_heaps uh);
 
 typedef struct process *process;
+
+#define SYSCALL_HIST_BUCKETS    40  /* log2 nanosecond latency buckets, the last one is open-ended */
+
+typedef struct syscall_stat {
+    u64 calls;
+    u64 errors;
+    u64 usecs;          /* time spent on a CPU */
+    u64 blocked_usecs;  /* time spent blocked or waiting for a CPU */
+    u64 hist[SYSCALL_HIST_BUCKETS];
+} *syscall_stat;
 typedef struct thread *thread;
 
 thread create_thread(process);
@@ -132,6 +142,7 @@ typedef struct unix_heaps {
     heap epollfd_cache;
     heap epoll_blocked_cache;
     heap pipe_cache;
+    heap unixsock_msg_cache;
 #ifdef NET
     heap socket_cache;
 #endif
@@ -283,8 +294,10 @@ typedef struct thread {
     timestamp utime, stime;
     timestamp start_time;
     int last_syscall;
+    timestamp syscall_start_ts;
     timestamp syscall_enter_ts;
     u64 syscall_time;
+    struct syscall_stat syscall_stats;
 
     /* signals pending and saved state */
     struct sigstate signals;
@@ -423,6 +436,7 @@ typedef struct process {
     rbtree            threads;
     struct spinlock   threads_lock;
     struct syscall   *syscalls;
+    struct spinlock   fd_lock;  /* fd allocation and files vector */
     vector            files;
     rangemap          vareas;   /* available address space */
     struct spinlock   vmap_lock;
@@ -569,14 +583,23 @@ static inline int fdesc_type(fdesc f)
     return f->type;
 }
 
+/* The files vector may be changed by syscalls running without the kernel
+   lock, so it is only accessed under fd_lock. */
+static inline fdesc fdesc_lookup(process p, int fd)
+{
+    spin_lock(&p->fd_lock);
+    fdesc f = vector_get(p->files, fd);
+    spin_unlock(&p->fd_lock);
+    return f;
+}
+
 static inline fdesc fdesc_get(process p, int fd)
 {
-    /* XXX To ensure atomicity, we need a mutex that protects against concurrent
-     * access to fdesc vector; the same mutex will have to be taken at every fd
-     * number allocation/deallocation. */
+    spin_lock(&p->fd_lock);
     fdesc f = vector_get(p->files, fd);
     if (f)
         fetch_and_add(&f->refcnt, 1);
+    spin_unlock(&p->fd_lock);
     return f;
 }
 
@@ -586,6 +609,16 @@ static inline void fdesc_put(fdesc f)
         apply(f->close, 0, io_completion_ignore);
 }
 
+/* fcntl and ioctl may update the flags of a file description concurrently. */
+static inline void fdesc_update_flags(fdesc f, int clear, int set)
+{
+    u32 old, new;
+    do {
+        old = f->flags;
+        new = (old & ~clear) | set;
+    } while (!compare_and_swap_32((u32 *)&f->flags, old, new));
+}
+
 static inline void fdesc_notify_events(fdesc f)
 {
     u32 events = apply(f->events, 0);
@@ -599,6 +632,13 @@ u64 allocate_fd_gte(process p, u64 min, void *f);
 
 void deallocate_fd(process p, int fd);
 
+/* Install f at fd, allocating fd if it is free. Returns the fdesc it
+   replaces, 0 if fd was free, or INVALID_ADDRESS on failure. */
+fdesc replace_fd(process p, u64 fd, fdesc f);
+
+/* Remove and return the fdesc at fd, or 0 if fd is not open. */
+fdesc take_fd(process p, int fd);
+
 void init_vdso(process p);
 
 void mmap_process_init(process p, boolean aslr);
@@ -706,9 +746,23 @@ void setup_ucontext(struct ucontext * uctx, struct sigaction * sa,
                     struct siginfo * si, context f);
 void restore_ucontext(struct ucontext * uctx, context f);
 
-void _register_syscall(struct syscall *m, int n, sysreturn (*f)(), const char *name);
+#define SYSCALL_F_NOTRACE   0x1
+#define SYSCALL_F_NOLOCK    0x2 /* handler runs without the kernel lock */
+
+void _register_syscall(struct syscall *m, int n, sysreturn (*f)(), const char *name, int flags);
 
-#define register_syscall(m, n, f) _register_syscall(m, SYS_##n, f, #n)
+#define register_syscall(m, n, f) _register_syscall(m, SYS_##n, f, #n, 0)
+
+/* For handlers that only touch the calling thread, per-CPU state or data
+   protected by its own lock. Such a handler may take the kernel lock itself
+   (kern_lock()) for any other work; it is released on syscall return. */
+#define register_syscall_nolock(m, n, f) _register_syscall(m, SYS_##n, f, #n, SYSCALL_F_NOLOCK)
+
+static inline void syscall_kern_lock(void)
+{
+    if (!this_cpu_has_kernel_lock())
+        kern_lock();
+}
 
 void configure_syscalls(process p);
 boolean syscall_notrace(process p, int syscall);
@@ -753,6 +807,7 @@ void notify_unix_timers_of_rtc_change(void);
 
 boolean poll_init(unix_heaps uh);
 boolean pipe_init(unix_heaps uh);
+boolean unixsock_init(unix_heaps uh);
 boolean unix_timers_init(unix_heaps uh);
 
 #define sysreturn_from_pointer(__x) ((s64)u64_from_pointer(__x));
@@ -832,7 +887,7 @@ static inline u64 iov_total_len(struct iovec *iov, int iovcnt)
     return len;
 }
 
-#define resolve_fd_noret(__p, __fd) vector_get(__p->files, __fd)
+#define resolve_fd_noret(__p, __fd) fdesc_lookup(__p, __fd)
 #define resolve_fd(__p, __fd) ({void *f ; if (!(f = resolve_fd_noret(__p, __fd))) return set_syscall_error(current, EBADF); f;})
 
 void init_syscalls(tuple root);
@@ -877,6 +932,13 @@ typedef closure_type(spec_file_open, sysreturn, file f);
 void register_special_files(process p);
 sysreturn spec_open(file f);
 
+sysreturn open_path(filesystem fs, tuple cwd, const char *name, int flags, int mode);
+
+sysreturn snapshot_special_read(file f, void *dest, u64 length, u64 offset);
+sysreturn snapshot_special_write(file f, void *dest, u64 length, u64 offset);
+boolean snapshot_restore(process p, thread t);
+void start_process(thread t, void *start);
+
 /* Values to pass as first argument to prctl() */
 #define PR_SET_NAME    15               /* Set process name */
 #define PR_GET_NAME    16               /* Get process name */
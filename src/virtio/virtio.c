@@ -81,7 +81,7 @@ void vtdev_set_status(vtdev dev, u8 status)
     }
 }
 
-status virtio_alloc_virtqueue(vtdev dev, const char *name, int idx, queue sched_queue,
+status virtio_alloc_virtqueue(vtdev dev, const char *name, int idx, sched_queue_kind sched_queue,
                               struct virtqueue **result)
 {
     switch (dev->transport) {
@@ -94,7 +94,7 @@ status virtio_alloc_virtqueue(vtdev dev, const char *name, int idx, queue sched_
     }
 }
 
-status virtio_register_config_change_handler(vtdev dev, thunk handler, queue sched_queue)
+status virtio_register_config_change_handler(vtdev dev, thunk handler, sched_queue_kind sched_queue)
 {
     switch (dev->transport) {
     case VTIO_TRANSPORT_MMIO:
@@ -162,7 +162,7 @@ define_closure_function(1, 0, void, vtmmio_irq,
     }
 }
 
-status vtmmio_alloc_virtqueue(vtmmio dev, const char *name, int idx, queue sched_queue,
+status vtmmio_alloc_virtqueue(vtmmio dev, const char *name, int idx, sched_queue_kind sched_queue,
                               struct virtqueue **result)
 {
     virtio_mmio_debug("allocating virtqueue %d (%s)", idx, name);
@@ -66,5 +66,5 @@ typedef closure_type(vtmmio_probe, void, vtmmio);
 void vtmmio_probe_devs(vtmmio_probe probe);
 void vtmmio_set_status(vtmmio dev, u8 status);
 boolean attach_vtmmio(heap h, backed_heap page_allocator, vtmmio d, u64 feature_mask);
-status vtmmio_alloc_virtqueue(vtmmio dev, const char *name, int idx, queue sched_queue,
+status vtmmio_alloc_virtqueue(vtmmio dev, const char *name, int idx, sched_queue_kind sched_queue,
                               struct virtqueue **result);
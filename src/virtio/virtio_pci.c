@@ -213,9 +213,9 @@ closure_function(1, 0, void, vtpci_non_msix_irq,
     }
 
     if ((isr_status & VIRTIO_PCI_ISR_CONFIG) && dev->config_handler) {
-        virtio_pci_debug("       queueing config change handler %F to queue %p\n",
+        virtio_pci_debug("       queueing config change handler %F to queue %d\n",
                          dev->config_handler, dev->config_sched_queue);
-        enqueue(dev->config_sched_queue, dev->config_handler);
+        enqueue(sched_queue_local(dev->config_sched_queue), dev->config_handler);
     }
 }
 
@@ -238,7 +238,8 @@ static void vtpci_register_non_msix_queue_handler(vtpci dev, thunk handler)
     vector_push(dev->vq_handlers, handler);
 }
 
-static void vtpci_register_non_msix_config_handler(vtpci dev, thunk handler, queue sched_queue)
+static void vtpci_register_non_msix_config_handler(vtpci dev, thunk handler,
+                                                   sched_queue_kind sched_queue)
 {
     vtpci_register_non_msix_irq(dev);
     assert(!dev->config_handler);
@@ -249,7 +250,7 @@ static void vtpci_register_non_msix_config_handler(vtpci dev, thunk handler, que
 status vtpci_alloc_virtqueue(vtpci dev,
                              const char *name,
                              int idx,
-                             queue sched_queue,
+                             sched_queue_kind sched_queue,
                              struct virtqueue **result)
 {
     // allocate virtqueue
@@ -298,16 +299,16 @@ status vtpci_alloc_virtqueue(vtpci dev,
 }
 
 closure_function(3, 0, void, vtpci_config_change_msix_irq,
-                 vtpci, dev, thunk, handler, queue, sched_queue)
+                 vtpci, dev, thunk, handler, sched_queue_kind, sched_queue)
 {
-    virtio_pci_debug("%s: dev %p, queueing config change handler %F to queue %p\n",
+    virtio_pci_debug("%s: dev %p, queueing config change handler %F to queue %d\n",
                      __func__, bound(dev), bound(handler), bound(sched_queue));
-    enqueue(bound(sched_queue), bound(handler));
+    enqueue(sched_queue_local(bound(sched_queue)), bound(handler));
 }
 
-status vtpci_register_config_change_handler(vtpci dev, thunk handler, queue sched_queue)
+status vtpci_register_config_change_handler(vtpci dev, thunk handler, sched_queue_kind sched_queue)
 {
-    virtio_pci_debug("%s: dev %p, handler %p (%F), sched_queue %p\n",
+    virtio_pci_debug("%s: dev %p, handler %p (%F), sched_queue %d\n",
                      __func__, dev, handler, handler, sched_queue);
     if (dev->msix_enabled) {
         thunk t = closure(dev->virtio_dev.general, vtpci_config_change_msix_irq, dev, handler, sched_queue);
@@ -449,6 +450,6 @@ vtpci attach_vtpci(heap h, backed_heap page_allocator, pci_dev d, u64 feature_ma
     dev->non_msix_handler = 0;
     dev->vq_handlers = 0;
     dev->config_handler = 0;
-    dev->config_sched_queue = 0;
+    dev->config_sched_queue = SCHED_QUEUE_BH;
     return dev;
 }
@@ -490,11 +490,11 @@ static void virtio_scsi_attach(heap general, storage_attach a, backed_heap page_
     s->max_lun = pci_bar_read_4(&s->v->device_config, VIRTIO_SCSI_R_MAX_LUN);
     virtio_scsi_debug("max lun %d\n", s->max_lun);
 
-    status st = vtpci_alloc_virtqueue(s->v, "virtio scsi command", 0, bhqueue, &s->command);
+    status st = vtpci_alloc_virtqueue(s->v, "virtio scsi command", 0, SCHED_QUEUE_BH, &s->command);
     assert(st == STATUS_OK);
-    st = vtpci_alloc_virtqueue(s->v, "virtio scsi event", 1, bhqueue, &s->eventq);
+    st = vtpci_alloc_virtqueue(s->v, "virtio scsi event", 1, SCHED_QUEUE_BH, &s->eventq);
     assert(st == STATUS_OK);
-    st = vtpci_alloc_virtqueue(s->v, "virtio scsi request", 2, bhqueue, &s->requestq);
+    st = vtpci_alloc_virtqueue(s->v, "virtio scsi request", 2, SCHED_QUEUE_BH, &s->requestq);
     assert(st == STATUS_OK);
 
     // On reset, the device MUST set sense_size to 96 and cdb_size to 32
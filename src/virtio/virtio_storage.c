@@ -204,7 +204,7 @@ static void virtio_blk_attach(heap general, storage_attach a, vtdev v)
     s->capacity = (vtdev_cfg_read_4(v, VIRTIO_BLK_R_CAPACITY_LOW) |
 		   ((u64) vtdev_cfg_read_4(v, VIRTIO_BLK_R_CAPACITY_HIGH) << 32)) * s->block_size;
     virtio_blk_debug("%s: capacity 0x%lx, block size 0x%x\n", __func__, s->capacity, s->block_size);
-    virtio_alloc_virtqueue(v, "virtio blk", 0, bhqueue, &s->command);
+    virtio_alloc_virtqueue(v, "virtio blk", 0, SCHED_QUEUE_BH, &s->command);
 
     block_flush flush;
     if (v->features & VIRTIO_BLK_F_FLUSH) {
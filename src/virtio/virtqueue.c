@@ -103,7 +103,7 @@ typedef struct virtqueue {
     struct list msg_queue;
     queue service_queue;
     thunk service;
-    queue sched_queue;
+    sched_queue_kind sched_queue;
     struct spinlock lock;
     vqmsg msgs[0];
 } *virtqueue;
@@ -210,7 +210,7 @@ closure_function(1, 0, void, vq_interrupt,
         assert(l);
         list_delete(&q);
         assert(enqueue(vq->service_queue, l));
-        enqueue(vq->sched_queue, vq->service);
+        enqueue(sched_queue_local(vq->sched_queue), vq->service);
     }
 }
 
@@ -242,7 +242,7 @@ status virtqueue_alloc(vtdev dev,
                        int align,
                        virtqueue *vqp,
                        thunk *t,
-                       queue sched_queue)
+                       sched_queue_kind sched_queue)
 {
     u64 vq_alloc_size = sizeof(struct virtqueue) + size * sizeof(vqmsg);
     virtqueue vq = allocate_zero(dev->general, vq_alloc_size);
@@ -255,6 +255,7 @@ void common_handler()
     /* invoke handler if available, else general fault handler */
     if (handlers[i]) {
         ci->state = cpu_interrupt;
+        ci->irq_counts[i]++;
         apply(handlers[i]);
         if (i >= INTERRUPT_VECTOR_START)
             lapic_eoi();
@@ -393,6 +394,7 @@ void init_interrupts(kernel_heaps kh)
     interrupt_vector_heap = create_id_heap(general, general, INTERRUPT_VECTOR_START,
                                            n_interrupt_vectors - INTERRUPT_VECTOR_START, 1, false);
     assert(interrupt_vector_heap != INVALID_ADDRESS);
+    init_irq_affinity(general, n_interrupt_vectors);
 
     int_general = general;
 
@@ -72,6 +72,14 @@ static inline __attribute__((always_inline)) void memory_barrier(void)
     asm volatile("mfence" ::: "memory");
 }
 
+/* zero memory with non-temporal stores, bypassing the cache; x and length are 8-byte aligned */
+static inline void zero_nontemporal(void *x, bytes length)
+{
+    for (u64 *p = x; p < (u64 *)(x + length); p++)
+        asm volatile("movnti %1, %0" : "=m"(*p) : "r"(0ull));
+    write_barrier();
+}
+
 static inline __attribute__((always_inline)) word fetch_and_add(word *variable, word value)
 {
     return __sync_fetch_and_add(variable, value);
@@ -123,16 +123,15 @@ void deallocate_apboot(heap stackheap)
     unmap((u64)apboot, PAGESIZE);
 }
 
-#define AP_START_TIMEOUT_MS 200
-void start_cpu(int index) {
-    u8 vector = (((u64)apboot) >> 12) & 0xff;
-
-    int nproc = total_processors;
+/* The INIT-SIPI-SIPI sequence is split so that the platform can signal all APs at once and
+   overlap the INIT delay with other initialization; APs serialize on ap_lock as they come up. */
+void ap_send_init(int index)
+{
     apic_ipi(index, ICR_TYPE_INIT | ICR_ASSERT, 0);
-    kernel_delay(milliseconds(10));
-    apic_ipi(index, ICR_TYPE_STARTUP | ICR_ASSERT, vector);
-    kernel_delay(microseconds(200));
+}
+
+void ap_send_startup(int index)
+{
+    u8 vector = (((u64)apboot) >> 12) & 0xff;
     apic_ipi(index, ICR_TYPE_STARTUP | ICR_ASSERT, vector);
-    for (u64 to = 0; total_processors != nproc + 1 && to < AP_START_TIMEOUT_MS; to++)
-        kernel_delay(milliseconds(1));
 }
@@ -0,0 +1,217 @@
+/* Connection rate benchmark: client threads open short-lived TCP connections to a server thread
+ * over the loopback interface, each one carrying a single request and response, as an HTTP/1.0
+ * server would see. Reports connections per second and the connection latency distribution;
+ * fails if any connection is refused or reset, which is what overflowing the listen backlog
+ * used to cause. */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_CONNS       10000
+#define DEFAULT_CLIENTS     32
+#define DEFAULT_BACKLOG     128
+#define DEFAULT_PORT        8090
+#define DEFAULT_MSG_SIZE    64
+
+#define LAT_BUCKETS         64  /* log2 nanosecond buckets */
+
+#define test_assert(expr) do { \
+    if (!(expr)) { \
+        printf("Error: %s -- failed at %s:%d (%s)\n", #expr, __FILE__, __LINE__, \
+               strerror(errno)); \
+        exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+static struct sockaddr_in server_addr;
+static size_t msg_size = DEFAULT_MSG_SIZE;
+static unsigned long long conns_per_client;
+
+struct client {
+    pthread_t thread;
+    unsigned long long hist[LAT_BUCKETS];
+    unsigned long long lat_sum;
+    unsigned long long done;
+    unsigned long long errors;
+};
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int lat_bucket(unsigned long long ns)
+{
+    return ns ? 63 - __builtin_clzll(ns) : 0;
+}
+
+/* returns the upper bound of the bucket containing the given per-mille quantile */
+static unsigned long long lat_quantile(unsigned long long *hist, unsigned long long total,
+                                       int permille)
+{
+    unsigned long long target = (total * permille + 999) / 1000, count = 0;
+
+    for (int i = 0; i < LAT_BUCKETS; i++) {
+        count += hist[i];
+        if (count >= target)
+            return 2ull << i;
+    }
+    return 0;
+}
+
+static int read_full(int fd, char *buf, size_t len)
+{
+    size_t n = 0;
+
+    while (n < len) {
+        ssize_t rv = read(fd, buf + n, len - n);
+        if (rv <= 0)
+            return -1;
+        n += rv;
+    }
+    return 0;
+}
+
+static void *server_thread(void *arg)
+{
+    int lfd = (long)arg;
+    char *buf = malloc(msg_size);
+
+    test_assert(buf);
+    while (1) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            test_assert(errno == EINTR || errno == ECONNABORTED || errno == ECONNRESET);
+            continue;
+        }
+        /* the server closes first, so that TIME_WAIT does not exhaust the client's ports */
+        if (read_full(fd, buf, msg_size) == 0)
+            test_assert(write(fd, buf, msg_size) == msg_size);
+        close(fd);
+    }
+    return NULL;
+}
+
+static void *client_thread(void *arg)
+{
+    struct client *c = arg;
+    char *buf = malloc(msg_size);
+
+    test_assert(buf);
+    memset(buf, 'x', msg_size);
+    while (c->done + c->errors < conns_per_client) {
+        unsigned long long start = now_ns();
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        test_assert(fd >= 0);
+        if ((connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) ||
+            (write(fd, buf, msg_size) != msg_size) || read_full(fd, buf, msg_size) ||
+            (read(fd, buf, 1) != 0)) {
+            c->errors++;
+        } else {
+            unsigned long long lat = now_ns() - start;
+            c->lat_sum += lat;
+            c->hist[lat_bucket(lat)]++;
+            c->done++;
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n connections] [-c clients] [-b backlog] [-d defer_accept_s] "
+            "[-p port] [-s msg_size]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long long conns = DEFAULT_CONNS;
+    int clients = DEFAULT_CLIENTS, backlog = DEFAULT_BACKLOG, defer = 0, port = DEFAULT_PORT;
+    int opt;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    while ((opt = getopt(argc, argv, "n:c:b:d:p:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            conns = strtoull(optarg, NULL, 0);
+            break;
+        case 'c':
+            clients = atoi(optarg);
+            break;
+        case 'b':
+            backlog = atoi(optarg);
+            break;
+        case 'd':
+            defer = atoi(optarg);
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 's':
+            msg_size = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (conns == 0 || clients <= 0 || msg_size == 0 || port <= 0 || port > 0xffff)
+        usage(argv[0]);
+    conns_per_client = (conns + clients - 1) / clients;
+    conns = conns_per_client * clients;
+
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server_addr.sin_port = htons(port);
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(lfd >= 0);
+    int val = 1;
+    test_assert(setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val)) == 0);
+    if (defer)
+        test_assert(setsockopt(lfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer, sizeof(defer)) == 0);
+    test_assert(bind(lfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == 0);
+    test_assert(listen(lfd, backlog) == 0);
+    pthread_t server;
+    test_assert(pthread_create(&server, NULL, server_thread, (void *)(long)lfd) == 0);
+
+    struct client *c = calloc(clients, sizeof(*c));
+    test_assert(c);
+    printf("connrate: %llu connections, %d clients, backlog %d, defer accept %d s, "
+           "message size %zu\n", conns, clients, backlog, defer, msg_size);
+    unsigned long long start = now_ns();
+    for (int i = 0; i < clients; i++)
+        test_assert(pthread_create(&c[i].thread, NULL, client_thread, &c[i]) == 0);
+    unsigned long long hist[LAT_BUCKETS] = {0};
+    unsigned long long lat_sum = 0, done = 0, errors = 0;
+    for (int i = 0; i < clients; i++) {
+        test_assert(pthread_join(c[i].thread, NULL) == 0);
+        for (int b = 0; b < LAT_BUCKETS; b++)
+            hist[b] += c[i].hist[b];
+        lat_sum += c[i].lat_sum;
+        done += c[i].done;
+        errors += c[i].errors;
+    }
+    unsigned long long elapsed = now_ns() - start;
+
+    printf("  %llu connections in %llu.%03llu s: %llu conn/s, %llu failed\n", done,
+           elapsed / 1000000000ull, (elapsed / 1000000ull) % 1000,
+           done * 1000000000ull / elapsed, errors);
+    if (done)
+        printf("  latency (us): avg %llu, p50 < %llu, p99 < %llu, p99.9 < %llu\n",
+               lat_sum / done / 1000, lat_quantile(hist, done, 500) / 1000,
+               lat_quantile(hist, done, 990) / 1000, lat_quantile(hist, done, 999) / 1000);
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
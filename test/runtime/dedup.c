@@ -0,0 +1,104 @@
+/* Tests copy-on-write of deduplicated file data: the image is built with mkfs -d, and /twin and
+ * /twin2 have the same contents as /dedup, so that all of their clusters share storage with it.
+ * Writing to /twin, and truncating /twin2 right after a write, must leave /dedup unchanged. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TWIN_FILE       "/twin"
+#define TWIN2_FILE      "/twin2"
+#define ORIG_FILE       "/dedup"
+#define WRITE_OFFSET    1000
+#define WRITE_LENGTH    10000
+
+#define test_assert(expr) do { \
+    if (!(expr)) { \
+        printf("Error: %s -- failed at %s:%d (%s)\n", #expr, __FILE__, __LINE__, \
+               strerror(errno)); \
+        exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+/* reads the whole file, after dropping its pages from the page cache so that the data comes
+   from storage */
+static char *read_file(const char *path, size_t *size)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    test_assert(fd >= 0);
+    test_assert(fstat(fd, &st) == 0);
+    test_assert(posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0);
+    char *buf = malloc(st.st_size + 1);
+    test_assert(buf);
+    size_t total = 0;
+    while (total < st.st_size) {
+        ssize_t rv = read(fd, buf + total, st.st_size - total);
+        test_assert(rv > 0);
+        total += rv;
+    }
+    close(fd);
+    *size = total;
+    return buf;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t orig_size, size;
+    char *orig, *buf;
+
+    setbuf(stdout, NULL);
+    orig = read_file(ORIG_FILE, &orig_size);
+    test_assert(orig_size > WRITE_OFFSET + WRITE_LENGTH);
+    buf = read_file(TWIN_FILE, &size);
+    test_assert(size == orig_size && !memcmp(buf, orig, size));
+    free(buf);
+
+    int fd = open(TWIN_FILE, O_RDWR);
+    test_assert(fd >= 0);
+    char *data = malloc(WRITE_LENGTH);
+    test_assert(data);
+    memset(data, 0x5a, WRITE_LENGTH);
+    test_assert(pwrite(fd, data, WRITE_LENGTH, WRITE_OFFSET) == WRITE_LENGTH);
+    test_assert(fsync(fd) == 0);
+    close(fd);
+
+    /* the written range is new, and the rest of the copied cluster is intact */
+    buf = read_file(TWIN_FILE, &size);
+    test_assert(size == orig_size);
+    test_assert(!memcmp(buf, orig, WRITE_OFFSET));
+    test_assert(!memcmp(buf + WRITE_OFFSET, data, WRITE_LENGTH));
+    test_assert(!memcmp(buf + WRITE_OFFSET + WRITE_LENGTH, orig + WRITE_OFFSET + WRITE_LENGTH,
+                        size - WRITE_OFFSET - WRITE_LENGTH));
+    free(buf);
+    buf = read_file(ORIG_FILE, &size);
+    test_assert(size == orig_size && !memcmp(buf, orig, size));
+    free(buf);
+
+    /* truncate right after a write to a shared cluster, whose copy-on-write may still be in
+       progress */
+    fd = open(TWIN2_FILE, O_RDWR);
+    test_assert(fd >= 0);
+    test_assert(pwrite(fd, data, WRITE_LENGTH, orig_size - WRITE_LENGTH) == WRITE_LENGTH);
+    test_assert(ftruncate(fd, 0) == 0);
+    test_assert(fsync(fd) == 0);
+    close(fd);
+    buf = read_file(TWIN2_FILE, &size);
+    test_assert(size == 0);
+    free(buf);
+    buf = read_file(ORIG_FILE, &size);
+    test_assert(size == orig_size && !memcmp(buf, orig, size));
+    free(buf);
+
+    test_assert(unlink(TWIN_FILE) == 0);
+    test_assert(unlink(TWIN2_FILE) == 0);
+    free(data);
+    free(orig);
+    printf("dedup test passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+/* Tests the contents of program segments, which the kernel maps from the page cache on demand
+ * rather than reading the whole program before exec. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ARRAY_WORDS (64 * 1024)   /* spans multiple pages */
+
+#define test_assert(expr) do { \
+    if (!(expr)) { \
+        printf("Error: %s -- failed at %s:%d\n", #expr, __FILE__, __LINE__); \
+        exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+static const unsigned int ro_data[ARRAY_WORDS] = { [0 ... ARRAY_WORDS - 1] = 0x5a5aa5a5 };
+static const unsigned int ro_untouched[ARRAY_WORDS] = { [0 ... ARRAY_WORDS - 1] = 0xc3c3c3c3 };
+static unsigned int rw_data[ARRAY_WORDS] = { [0 ... ARRAY_WORDS - 1] = 0x12345678 };
+static unsigned int rw_bss[ARRAY_WORDS];
+
+/* last initialized data and first bss, which normally share a page */
+static volatile unsigned long data_tail = 0xfeedfacecafebeefull;
+static volatile unsigned long bss_head;
+
+static void test_rodata(void)
+{
+    for (int i = 0; i < ARRAY_WORDS; i++)
+        test_assert(ro_data[i] == 0x5a5aa5a5);
+}
+
+static void test_data(void)
+{
+    for (int i = 0; i < ARRAY_WORDS; i++)
+        test_assert(rw_data[i] == 0x12345678);
+
+    /* private mapping: writes must not affect the file or other pages */
+    for (int i = 0; i < ARRAY_WORDS; i += 2)
+        rw_data[i] = i;
+    for (int i = 0; i < ARRAY_WORDS; i++)
+        test_assert(rw_data[i] == ((i & 1) ? 0x12345678 : i));
+    test_assert(data_tail == 0xfeedfacecafebeefull);
+    data_tail = 0;
+    test_assert(data_tail == 0);
+}
+
+static void test_bss(void)
+{
+    test_assert(bss_head == 0);
+    bss_head = 1;
+    for (int i = 0; i < ARRAY_WORDS; i++)
+        test_assert(rw_bss[i] == 0);
+    for (int i = 0; i < ARRAY_WORDS; i++)
+        rw_bss[i] = ~i;
+    for (int i = 0; i < ARRAY_WORDS; i++)
+        test_assert(rw_bss[i] == ~i);
+    test_assert(bss_head == 1);
+}
+
+/* the kernel faults in program pages that are first accessed by a syscall */
+static void test_syscall_access(void)
+{
+    int fds[2];
+    unsigned int buf[1024];
+
+    test_assert(pipe(fds) == 0);
+    for (int off = 0; off < ARRAY_WORDS; off += 1024) {
+        test_assert(write(fds[1], ro_untouched + off, sizeof(buf)) == sizeof(buf));
+        test_assert(read(fds[0], buf, sizeof(buf)) == sizeof(buf));
+        for (int i = 0; i < 1024; i++)
+            test_assert(buf[i] == 0xc3c3c3c3);
+    }
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main(int argc, char *argv[])
+{
+    setbuf(stdout, NULL);
+    test_rodata();
+    test_data();
+    test_bss();
+    test_syscall_access();
+    printf("elfload test passed\n");
+    return EXIT_SUCCESS;
+}
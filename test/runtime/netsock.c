@@ -1,4 +1,5 @@
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,6 +10,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/epoll.h>
+#include <linux/errqueue.h>
 
 #include <runtime.h>
 
@@ -18,6 +20,19 @@
 
 #define NETSOCK_TEST_PEEK_COUNT 8
 
+#define NETSOCK_TEST_ZC_SENDS   16
+#define NETSOCK_TEST_ZC_SIZE    (64 * 1024)
+
+#define NETSOCK_TEST_BUF_SIZE   (32 * KB)
+#define NETSOCK_TEST_BUF_XFER   (4 * MB)
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY    0x4000000
+#endif
+
 #define test_assert(expr) do { \
     if (!(expr)) { \
         printf("Error: %s -- failed at %s:%d\n", #expr, __FILE__, __LINE__); \
@@ -381,6 +396,219 @@ static void netsock_test_peek(void)
     test_assert(close(fd) == 0);
 }
 
+static void *netsock_test_zerocopy_thread(void *arg)
+{
+    int fd = (long)arg;
+    char *buf = malloc(NETSOCK_TEST_ZC_SIZE);
+    long total = 0;
+
+    test_assert(buf);
+    while (total < NETSOCK_TEST_ZC_SENDS * NETSOCK_TEST_ZC_SIZE) {
+        ssize_t rv = read(fd, buf, NETSOCK_TEST_ZC_SIZE);
+        test_assert(rv > 0);
+        for (int i = 0; i < rv; i++)
+            test_assert(buf[i] == (char)((total + i) / NETSOCK_TEST_ZC_SIZE));
+        total += rv;
+    }
+    free(buf);
+    return (void *)EXIT_SUCCESS;
+}
+
+static void netsock_test_zerocopy(void)
+{
+    int fd, tx_fd, rx_fd;
+    struct sockaddr_in addr;
+    const int port = 1237;
+    pthread_t pt;
+    void *thread_ret;
+    int val = 1;
+    char *buf;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(fd > 0);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    test_assert(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    test_assert(listen(fd, 1) == 0);
+    tx_fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(tx_fd > 0);
+    test_assert(connect(tx_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    rx_fd = accept(fd, NULL, NULL);
+    test_assert(rx_fd > 0);
+    test_assert(setsockopt(tx_fd, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof(val)) == 0);
+    test_assert(pthread_create(&pt, NULL, netsock_test_zerocopy_thread, (void *)(long)rx_fd) == 0);
+
+    /* each send uses its own buffer, which must not be modified until its completion */
+    buf = malloc(NETSOCK_TEST_ZC_SENDS * NETSOCK_TEST_ZC_SIZE);
+    test_assert(buf);
+    unsigned int sends = 0;
+    for (int i = 0; i < NETSOCK_TEST_ZC_SENDS; i++) {
+        char *p = buf + i * NETSOCK_TEST_ZC_SIZE;
+        int sent = 0;
+        memset(p, i, NETSOCK_TEST_ZC_SIZE);
+        while (sent < NETSOCK_TEST_ZC_SIZE) {
+            ssize_t rv = send(tx_fd, p + sent, NETSOCK_TEST_ZC_SIZE - sent, MSG_ZEROCOPY);
+            test_assert(rv > 0);
+            sent += rv;
+            sends++;
+        }
+    }
+    test_assert(pthread_join(pt, &thread_ret) == 0);
+    test_assert(thread_ret == (void *)EXIT_SUCCESS);
+
+    /* all data has been received, so every send is eventually reported as complete */
+    unsigned int next_id = 0;
+    for (int retries = 0; (next_id < sends) && (retries < 1000); ) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+        struct msghdr msg = {
+            .msg_control = control,
+            .msg_controllen = sizeof(control),
+        };
+        if (recvmsg(tx_fd, &msg, MSG_ERRQUEUE) < 0) {
+            test_assert(errno == EAGAIN);
+            retries++;
+            usleep(1000);
+            continue;
+        }
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        test_assert(cmsg && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == IP_RECVERR));
+        struct sock_extended_err *ee = (struct sock_extended_err *)CMSG_DATA(cmsg);
+        test_assert(ee->ee_origin == SO_EE_ORIGIN_ZEROCOPY);
+        test_assert(ee->ee_info == next_id);
+        test_assert(ee->ee_data >= ee->ee_info);
+        next_id = ee->ee_data + 1;
+    }
+    test_assert(next_id == sends);
+    free(buf);
+    test_assert(close(tx_fd) == 0);
+    test_assert(close(rx_fd) == 0);
+    test_assert(close(fd) == 0);
+}
+
+static void *netsock_test_bufsize_thread(void *arg)
+{
+    int fd = (long)arg;
+    char buf[4096];
+    long total = 0;
+
+    while (total < NETSOCK_TEST_BUF_XFER) {
+        ssize_t rv = read(fd, buf, sizeof(buf));
+        test_assert(rv > 0);
+        for (int i = 0; i < rv; i++)
+            test_assert(buf[i] == (char)(total + i));
+        total += rv;
+    }
+    return (void *)EXIT_SUCCESS;
+}
+
+static void netsock_test_bufsize(void)
+{
+    int fd, tx_fd, rx_fd;
+    struct sockaddr_in addr;
+    const int port = 1238;
+    pthread_t pt;
+    void *thread_ret;
+    int val = NETSOCK_TEST_BUF_SIZE;
+    socklen_t len = sizeof(val);
+    char buf[8192];
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(fd > 0);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    test_assert(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+
+    /* the receive buffer size is inherited by accepted sockets */
+    test_assert(setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val)) == 0);
+    test_assert(listen(fd, 1) == 0);
+    tx_fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(tx_fd > 0);
+    test_assert(setsockopt(tx_fd, SOL_SOCKET, SO_SNDBUF, &val, sizeof(val)) == 0);
+    test_assert(connect(tx_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    rx_fd = accept(fd, NULL, NULL);
+    test_assert(rx_fd > 0);
+    test_assert(getsockopt(rx_fd, SOL_SOCKET, SO_RCVBUF, &val, &len) == 0);
+    test_assert((len == sizeof(val)) && (val == 2 * NETSOCK_TEST_BUF_SIZE));
+    test_assert(getsockopt(tx_fd, SOL_SOCKET, SO_SNDBUF, &val, &len) == 0);
+    test_assert((len == sizeof(val)) && (val == 2 * NETSOCK_TEST_BUF_SIZE));
+
+    /* transfer more data than the buffers hold, then shrink the receive window mid-stream */
+    test_assert(pthread_create(&pt, NULL, netsock_test_bufsize_thread, (void *)(long)rx_fd) == 0);
+    for (long total = 0; total < NETSOCK_TEST_BUF_XFER; ) {
+        long n = MIN(sizeof(buf), NETSOCK_TEST_BUF_XFER - total);
+        for (int i = 0; i < n; i++)
+            buf[i] = total + i;
+        ssize_t rv = write(tx_fd, buf, n);
+        test_assert(rv > 0);
+        total += rv;
+        if (total == NETSOCK_TEST_BUF_XFER / 2) {
+            val = NETSOCK_TEST_BUF_SIZE / 4;
+            test_assert(setsockopt(rx_fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val)) == 0);
+        }
+    }
+    test_assert(pthread_join(pt, &thread_ret) == 0);
+    test_assert(thread_ret == (void *)EXIT_SUCCESS);
+    test_assert(close(tx_fd) == 0);
+    test_assert(close(rx_fd) == 0);
+    test_assert(close(fd) == 0);
+}
+
+static void netsock_test_congestion(const char *cc, int port)
+{
+    int fd, tx_fd, rx_fd;
+    struct sockaddr_in addr;
+    pthread_t pt;
+    void *thread_ret;
+    char name[16];
+    struct tcp_info info;
+    socklen_t len;
+    char buf[8192];
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(fd > 0);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    test_assert(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    test_assert(listen(fd, 1) == 0);
+    tx_fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(tx_fd > 0);
+    test_assert(setsockopt(tx_fd, IPPROTO_TCP, TCP_CONGESTION, "none", 4) == -1);
+    test_assert(errno == ENOENT);
+    test_assert(setsockopt(tx_fd, IPPROTO_TCP, TCP_CONGESTION, cc, strlen(cc)) == 0);
+    len = sizeof(name);
+    test_assert(getsockopt(tx_fd, IPPROTO_TCP, TCP_CONGESTION, name, &len) == 0);
+    test_assert(!strcmp(name, cc));
+    test_assert(connect(tx_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    rx_fd = accept(fd, NULL, NULL);
+    test_assert(rx_fd > 0);
+
+    test_assert(pthread_create(&pt, NULL, netsock_test_bufsize_thread, (void *)(long)rx_fd) == 0);
+    for (long total = 0; total < NETSOCK_TEST_BUF_XFER; ) {
+        long n = MIN(sizeof(buf), NETSOCK_TEST_BUF_XFER - total);
+        for (int i = 0; i < n; i++)
+            buf[i] = total + i;
+        ssize_t rv = write(tx_fd, buf, n);
+        test_assert(rv > 0);
+        total += rv;
+    }
+    test_assert(pthread_join(pt, &thread_ret) == 0);
+    test_assert(thread_ret == (void *)EXIT_SUCCESS);
+
+    len = sizeof(info);
+    test_assert(getsockopt(tx_fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0);
+    test_assert(len > 0 && len <= sizeof(info));
+    test_assert(info.tcpi_state == TCP_ESTABLISHED);
+    test_assert(info.tcpi_snd_mss > 0);
+    test_assert(info.tcpi_snd_cwnd > 0);
+    test_assert(info.tcpi_rtt > 0);
+    test_assert(close(tx_fd) == 0);
+    test_assert(close(rx_fd) == 0);
+    test_assert(close(fd) == 0);
+}
+
 int main(int argc, char **argv)
 {
     setbuf(stdout, NULL);
@@ -391,6 +619,11 @@ int main(int argc, char **argv)
     netsock_test_connclosed();
     netsock_test_nonblocking_connect();
     netsock_test_peek();
+    netsock_test_zerocopy();
+    netsock_test_bufsize();
+    netsock_test_congestion("reno", 1239);
+    netsock_test_congestion("cubic", 1240);
+    netsock_test_congestion("bbr", 1241);
     printf("Network socket tests OK\n");
     return EXIT_SUCCESS;
 }
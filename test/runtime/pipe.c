@@ -7,6 +7,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sys/uio.h>
 
 #include <runtime.h>
 
@@ -152,6 +153,47 @@ void blocking_test(heap h, int * fds)
     printf("blocking test passed\n");
 }
 
+/* writev spanning several pages, and a capacity that is not a power-of-two number of pages */
+void writev_test(int *fds)
+{
+    const int iovcnt = 4;
+    const int iovlen = 3000;
+    static char src[4 * 3000], dst[4 * 3000];
+    struct iovec iov[iovcnt];
+    long capacity = fcntl(fds[1], F_SETPIPE_SZ, 3 * 4096);
+    if (capacity < 0)
+        handle_error("writev test F_SETPIPE_SZ");
+    if (capacity != 4 * 4096) {
+        printf("writev test: unexpected pipe capacity %ld\n", capacity);
+        exit(EXIT_FAILURE);
+    }
+    for (int round = 0; round < 8; round++) {
+        for (int i = 0; i < sizeof(src); i++)
+            src[i] = (char)(i * 7 + round);
+        for (int i = 0; i < iovcnt; i++) {
+            iov[i].iov_base = src + i * iovlen;
+            iov[i].iov_len = iovlen;
+        }
+        ssize_t nbytes = writev(fds[1], iov, iovcnt);
+        if (nbytes != sizeof(src)) {
+            printf("writev test: writev returned %ld\n", nbytes);
+            exit(EXIT_FAILURE);
+        }
+        int nread = 0;
+        while (nread < sizeof(dst)) {
+            nbytes = read(fds[0], dst + nread, 1000);
+            if (nbytes <= 0)
+                handle_error("writev test read");
+            nread += nbytes;
+        }
+        if (memcmp(src, dst, sizeof(src))) {
+            printf("writev test: data mismatch (round %d)\n", round);
+            exit(EXIT_FAILURE);
+        }
+    }
+    printf("writev test passed\n");
+}
+
 int main(int argc, char **argv)
 {
     int fds[2] = {0,0};
@@ -170,6 +212,8 @@ int main(int argc, char **argv)
 
     blocking_test(h, fds);
 
+    writev_test(fds);
+
     close(fds[0]);
     close(fds[1]);
     return(EXIT_SUCCESS);
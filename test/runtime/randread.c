@@ -0,0 +1,190 @@
+/* fio-style random read benchmark: keeps a fixed number of asynchronous reads in flight
+ * against a file and reports throughput and completion latency.
+ * The file is dropped from the page cache (POSIX_FADV_DONTNEED) before the run, and each block
+ * is dropped again once its read completes, so that reads go to the storage device rather than
+ * being served from memory. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/aio_abi.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_FILE        "randread.dat"
+#define DEFAULT_FILE_MB     64
+#define DEFAULT_BLOCK_SIZE  4096
+#define DEFAULT_IODEPTH     32
+#define DEFAULT_IOS         100000
+
+#define LAT_BUCKETS         64  /* log2 nanosecond buckets */
+
+#define test_assert(expr) do { \
+    if (!(expr)) { \
+        printf("Error: %s -- failed at %s:%d (%s)\n", #expr, __FILE__, __LINE__, \
+               strerror(errno)); \
+        exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int lat_bucket(unsigned long long ns)
+{
+    return ns ? 63 - __builtin_clzll(ns) : 0;
+}
+
+/* returns the upper bound of the bucket containing the given per-mille quantile */
+static unsigned long long lat_quantile(unsigned long long *hist, unsigned long long total,
+                                       int permille)
+{
+    unsigned long long target = (total * permille + 999) / 1000, count = 0;
+
+    for (int i = 0; i < LAT_BUCKETS; i++) {
+        count += hist[i];
+        if (count >= target)
+            return 2ull << i;
+    }
+    return 0;
+}
+
+static void create_file(const char *path, off_t size, size_t bs)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    test_assert(fd >= 0);
+    char *buf = malloc(bs);
+    test_assert(buf);
+    for (off_t off = 0; off < size; off += bs) {
+        for (size_t i = 0; i < bs; i += sizeof(off_t))
+            *(off_t *)(buf + i) = off + i;
+        test_assert(write(fd, buf, bs) == bs);
+    }
+    free(buf);
+    test_assert(fsync(fd) == 0);
+    close(fd);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-f file] [-s size_mb] [-b block_size] [-d iodepth] [-n ios]\n",
+            prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = DEFAULT_FILE;
+    unsigned long long size_mb = DEFAULT_FILE_MB, ios = DEFAULT_IOS;
+    size_t bs = DEFAULT_BLOCK_SIZE;
+    int iodepth = DEFAULT_IODEPTH;
+    int opt;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    while ((opt = getopt(argc, argv, "f:s:b:d:n:")) != -1) {
+        switch (opt) {
+        case 'f':
+            path = optarg;
+            break;
+        case 's':
+            size_mb = strtoull(optarg, NULL, 0);
+            break;
+        case 'b':
+            bs = strtoull(optarg, NULL, 0);
+            break;
+        case 'd':
+            iodepth = atoi(optarg);
+            break;
+        case 'n':
+            ios = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (size_mb == 0 || bs == 0 || (bs % 512) || iodepth <= 0 || ios == 0)
+        usage(argv[0]);
+
+    struct stat st;
+    off_t size = size_mb << 20;
+    if (stat(path, &st) == 0 && st.st_size >= bs) {
+        size = st.st_size;
+    } else {
+        printf("creating %s (%llu MB)\n", path, size_mb);
+        create_file(path, size, bs);
+    }
+    unsigned long long nblocks = size / bs;
+
+    int fd = open(path, O_RDONLY);
+    test_assert(fd >= 0);
+    test_assert(posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0);
+    test_assert(posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM) == 0);
+
+    aio_context_t ioc = 0;
+    test_assert(syscall(SYS_io_setup, iodepth, &ioc) == 0);
+    struct iocb *iocbs = calloc(iodepth, sizeof(struct iocb));
+    struct io_event *events = calloc(iodepth, sizeof(struct io_event));
+    unsigned long long *submit_ns = calloc(iodepth, sizeof(unsigned long long));
+    char *bufs = aligned_alloc(4096, iodepth * bs);
+    test_assert(iocbs && events && submit_ns && bufs);
+    unsigned long long hist[LAT_BUCKETS] = {0};
+    unsigned long long lat_sum = 0, submitted = 0, completed = 0;
+    unsigned int seed = 1;
+
+    printf("randread: %s, %llu MB, bs %zu, iodepth %d, %llu ios\n", path,
+           (unsigned long long)size >> 20, bs, iodepth, ios);
+    unsigned long long start = now_ns();
+    for (int i = 0; i < iodepth && submitted < ios; i++, submitted++) {
+        struct iocb *iocb = &iocbs[i];
+        iocb->aio_fildes = fd;
+        iocb->aio_lio_opcode = IOCB_CMD_PREAD;
+        iocb->aio_buf = (uint64_t)(bufs + i * bs);
+        iocb->aio_nbytes = bs;
+        iocb->aio_offset = (rand_r(&seed) % nblocks) * bs;
+        iocb->aio_data = i;
+        submit_ns[i] = now_ns();
+        test_assert(syscall(SYS_io_submit, ioc, 1, &iocb) == 1);
+    }
+    while (completed < ios) {
+        int n = syscall(SYS_io_getevents, ioc, 1, iodepth, events, NULL);
+        test_assert(n > 0);
+        unsigned long long t = now_ns();
+        for (int i = 0; i < n; i++) {
+            int slot = events[i].data;
+            test_assert(events[i].res == bs);
+            posix_fadvise(fd, iocbs[slot].aio_offset, bs, POSIX_FADV_DONTNEED);
+            unsigned long long lat = t - submit_ns[slot];
+            lat_sum += lat;
+            hist[lat_bucket(lat)]++;
+            completed++;
+            if (submitted < ios) {
+                struct iocb *iocb = &iocbs[slot];
+                iocb->aio_offset = (rand_r(&seed) % nblocks) * bs;
+                submit_ns[slot] = now_ns();
+                test_assert(syscall(SYS_io_submit, ioc, 1, &iocb) == 1);
+                submitted++;
+            }
+        }
+    }
+    unsigned long long elapsed = now_ns() - start;
+
+    printf("  %llu ios in %llu.%03llu s: %llu IOPS, %llu KB/s\n", completed,
+           elapsed / 1000000000ull, (elapsed / 1000000ull) % 1000,
+           completed * 1000000000ull / elapsed, completed * bs * 1000000000ull / elapsed / 1024);
+    printf("  latency (us): avg %llu, p50 < %llu, p99 < %llu, p99.9 < %llu\n",
+           lat_sum / completed / 1000, lat_quantile(hist, completed, 500) / 1000,
+           lat_quantile(hist, completed, 990) / 1000, lat_quantile(hist, completed, 999) / 1000);
+    syscall(SYS_io_destroy, ioc);
+    close(fd);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,118 @@
+/* Tests process snapshots: the program checkpoints itself by writing to /sys/kernel/snapshot and
+ * checks that its state is intact when the write returns. Booting the same image again (make
+ * resume, run after the snapshot test by make runtime-tests) resumes the program from the
+ * snapshot, where the same checks are repeated. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define HEAP_SIZE   (1024 * 1024)
+#define MMAP_SIZE   (4 * 1024 * 1024)
+#define PAGE_SIZE   4096
+
+#define SNAPSHOT_CTL    "/sys/kernel/snapshot"
+#define DATA_FILE       "/snapshot_data"
+#define DATA_CONTENTS   "0123456789abcdef"
+#define DATA_OFFSET     5
+
+#define test_assert(expr) do { \
+    if (!(expr)) { \
+        printf("Error: %s -- failed at %s:%d (%s)\n", #expr, __FILE__, __LINE__, \
+               strerror(errno)); \
+        exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+static unsigned long bss_counter;
+static unsigned long data_value = 0x1122334455667788ul;
+static volatile int usr1_count;
+
+static void usr1_handler(int sig)
+{
+    usr1_count++;
+}
+
+static int snapshot_restored(void)
+{
+    char buf[4];
+    int fd = open(SNAPSHOT_CTL, O_RDONLY);
+
+    test_assert(fd >= 0);
+    test_assert(read(fd, buf, sizeof(buf)) == 2);
+    test_assert(buf[1] == '\n' && (buf[0] == '0' || buf[0] == '1'));
+    close(fd);
+    return buf[0] == '1';
+}
+
+static unsigned char pattern(unsigned long i)
+{
+    return (i * 7 + (i >> 12)) & 0xff;
+}
+
+int main(int argc, char *argv[])
+{
+    setbuf(stdout, NULL);
+    test_assert(!snapshot_restored());
+
+    /* the data file is left by a previous boot, which must be resumed rather than started over */
+    test_assert(access(DATA_FILE, F_OK) != 0);
+
+    unsigned char *heap = malloc(HEAP_SIZE);
+    test_assert(heap);
+    for (unsigned long i = 0; i < HEAP_SIZE; i++)
+        heap[i] = pattern(i);
+
+    /* only the first half is touched; the rest must still read as zero */
+    unsigned char *anon = mmap(NULL, MMAP_SIZE, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    test_assert(anon != MAP_FAILED);
+    for (unsigned long i = 0; i < MMAP_SIZE / 2; i += PAGE_SIZE / 2)
+        anon[i] = pattern(i >> 11);
+
+    int dfd = open(DATA_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    test_assert(dfd >= 0);
+    test_assert(write(dfd, DATA_CONTENTS, strlen(DATA_CONTENTS)) == strlen(DATA_CONTENTS));
+    test_assert(lseek(dfd, DATA_OFFSET, SEEK_SET) == DATA_OFFSET);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = usr1_handler;
+    test_assert(sigaction(SIGUSR1, &sa, NULL) == 0);
+    bss_counter = 42;
+    data_value++;
+
+    int sfd = open(SNAPSHOT_CTL, O_WRONLY);
+    test_assert(sfd >= 0);
+    test_assert(write(sfd, "1", 1) == 1);
+    int restored = snapshot_restored();
+    printf("snapshot %s\n", restored ? "resumed" : "taken");
+
+    for (unsigned long i = 0; i < HEAP_SIZE; i++)
+        test_assert(heap[i] == pattern(i));
+    for (unsigned long i = 0; i < MMAP_SIZE; i += PAGE_SIZE / 2)
+        test_assert(anon[i] == ((i < MMAP_SIZE / 2) ? pattern(i >> 11) : 0));
+    test_assert(bss_counter == 42);
+    test_assert(data_value == 0x1122334455667789ul);
+
+    char c;
+    test_assert(read(dfd, &c, 1) == 1);
+    test_assert(c == DATA_CONTENTS[DATA_OFFSET]);
+    test_assert(raise(SIGUSR1) == 0);
+    test_assert(usr1_count == 1);
+
+    /* the memory of a resumed program is mapped from the snapshot */
+    if (restored)
+        test_assert(write(sfd, "1", 1) == -1 && errno == EBUSY);
+    close(sfd);
+    close(dfd);
+    munmap(anon, MMAP_SIZE);
+    free(heap);
+    printf("snapshot test passed\n");
+    return EXIT_SUCCESS;
+}
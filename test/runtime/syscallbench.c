@@ -0,0 +1,51 @@
+/* syscall round-trip microbenchmark */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define DEFAULT_ITERATIONS  10000000ull
+
+static unsigned long long ns_from_timespec(struct timespec *ts)
+{
+    return ts->tv_sec * 1000000000ull + ts->tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long long iterations = DEFAULT_ITERATIONS;
+    struct timespec start, end;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if (argc > 1) {
+        iterations = strtoull(argv[1], NULL, 0);
+        if (iterations == 0) {
+            fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* glibc does not cache getppid, but go through syscall() to be sure */
+    if (syscall(SYS_getppid) < 0) {
+        printf("getppid failed: %s (%d)\n", strerror(errno), errno);
+        return EXIT_FAILURE;
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &start) < 0) {
+        printf("clock_gettime failed: %s (%d)\n", strerror(errno), errno);
+        return EXIT_FAILURE;
+    }
+    for (unsigned long long i = 0; i < iterations; i++)
+        syscall(SYS_getppid);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    unsigned long long elapsed = ns_from_timespec(&end) - ns_from_timespec(&start);
+    printf("getppid: %llu calls in %llu.%09llu s, %llu.%02llu ns/call\n", iterations,
+           elapsed / 1000000000ull, elapsed % 1000000000ull, elapsed / iterations,
+           (elapsed * 100 / iterations) % 100);
+    return EXIT_SUCCESS;
+}
@@ -1,14 +1,23 @@
+#define _GNU_SOURCE
 #include <runtime.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <netinet/udp.h>
 #include <sys/socket.h>
 
 #define DEFAULT_PORT 5309
 #define BUFLEN 1500
 
+/* benchmark defaults; the batch must fit in the kernel socket receive queue */
+#define BENCH_DEFAULT_COUNT 100000
+#define BENCH_DEFAULT_SIZE  1200
+#define BENCH_DEFAULT_BATCH 32
+#define BENCH_MAX_BATCH     64
+
 void fail(char * s)
 {
     rprintf("%s failed: %s (errno %d)\n", s, strerror(errno), errno);
@@ -17,6 +26,131 @@ void fail(char * s)
 
 tuple parse_arguments(heap h, int argc, char **argv);
 
+static u64 now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * BILLION + ts.tv_nsec;
+}
+
+static void bench_report(const char *mode, u64 count, u64 size, u64 ns)
+{
+    rprintf("  %s: %ld datagrams in %ld us, %ld datagrams/s, %ld KB/s\n", mode, count,
+            ns / THOUSAND, count * BILLION / ns, count * size * BILLION / ns / KB);
+}
+
+/* Loopback throughput benchmark: datagrams are sent from one socket to another bound to
+   localhost, in batches of the given size, first with one syscall per datagram, then with
+   sendmmsg()/recvmmsg(), then with one UDP_SEGMENT send and UDP_GRO receive per batch. */
+static void bench(u16 port, u64 count, u64 size, int batch)
+{
+    struct sockaddr_in sin;
+    socklen_t sin_len = sizeof(sin);
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+    if (rx < 0 || tx < 0)
+        fail("socket");
+    if (bind(rx, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+        fail("bind");
+
+    char *buf = malloc(batch * size);
+    if (!buf)
+        fail("malloc");
+    memset(buf, 0xa5, batch * size);
+    struct mmsghdr msgs[BENCH_MAX_BATCH];
+    struct iovec iovs[BENCH_MAX_BATCH];
+    rprintf("udploop bench: %ld datagrams of %ld bytes, batch %d\n", count, size, batch);
+
+    u64 start = now_ns();
+    for (u64 n = 0; n < count; n++) {
+        if (sendto(tx, buf, size, 0, (struct sockaddr *)&sin, sin_len) != size)
+            fail("sendto");
+        if (recvfrom(rx, buf, size, 0, 0, 0) != size)
+            fail("recvfrom");
+    }
+    bench_report("sendto/recvfrom", count, size, now_ns() - start);
+
+    for (int i = 0; i < batch; i++) {
+        iovs[i].iov_base = buf + i * size;
+        iovs[i].iov_len = size;
+    }
+    start = now_ns();
+    for (u64 n = 0; n < count; n += batch) {
+        int vlen = MIN(batch, count - n);
+        for (int i = 0; i < vlen; i++) {
+            memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+            msgs[i].msg_hdr.msg_name = &sin;
+            msgs[i].msg_hdr.msg_namelen = sin_len;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        if (sendmmsg(tx, msgs, vlen, 0) != vlen)
+            fail("sendmmsg");
+        for (int i = 0; i < vlen; i++) {
+            msgs[i].msg_hdr.msg_name = 0;
+            msgs[i].msg_hdr.msg_namelen = 0;
+        }
+        for (int received = 0; received < vlen; ) {
+            int rv = recvmmsg(rx, msgs + received, vlen - received, MSG_WAITFORONE, 0);
+            if (rv <= 0)
+                fail("recvmmsg");
+            received += rv;
+        }
+    }
+    bench_report("sendmmsg/recvmmsg", count, size, now_ns() - start);
+
+    int on = 1;
+    if (setsockopt(rx, SOL_UDP, UDP_GRO, &on, sizeof(on)) < 0)
+        fail("setsockopt UDP_GRO");
+    /* a segmented send must fit in a single UDP datagram */
+    int gso_batch = MIN(batch, 65507 / size);
+    char control[CMSG_SPACE(sizeof(int))];
+    start = now_ns();
+    for (u64 n = 0; n < count; n += gso_batch) {
+        int segs = MIN(gso_batch, count - n);
+        struct iovec iov = { .iov_base = buf, .iov_len = segs * size };
+        struct msghdr msg = {
+            .msg_name = &sin,
+            .msg_namelen = sin_len,
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control,
+            .msg_controllen = CMSG_SPACE(sizeof(u16)),
+        };
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(u16));
+        *(u16 *)CMSG_DATA(cmsg) = size;
+        if (sendmsg(tx, &msg, 0) != iov.iov_len)
+            fail("sendmsg UDP_SEGMENT");
+        msg.msg_name = 0;
+        msg.msg_namelen = 0;
+        for (int received = 0; received < segs; ) {
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            int rv = recvmsg(rx, &msg, 0);
+            if (rv <= 0)
+                fail("recvmsg UDP_GRO");
+            int gso_size = rv;
+            cmsg = CMSG_FIRSTHDR(&msg);
+            if (cmsg && cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+                gso_size = *(int *)CMSG_DATA(cmsg);
+            received += (rv + gso_size - 1) / gso_size;
+        }
+    }
+    bench_report("UDP_SEGMENT/UDP_GRO", count, size, now_ns() - start);
+
+    free(buf);
+    close(tx);
+    close(rx);
+}
+
 int main(int argc, char ** argv)
 {
     heap h = init_process_runtime();
@@ -29,6 +163,23 @@ int main(int argc, char ** argv)
         lport = result;
     rprintf("using local port %d\n", lport);
 
+    /* e.g. "udploop -bench 100000 -size 1200 -batch 32" */
+    if (get_u64(t, sym(bench), &result)) {
+        u64 count = result ? result : BENCH_DEFAULT_COUNT;
+        u64 size = BENCH_DEFAULT_SIZE;
+        int batch = BENCH_DEFAULT_BATCH;
+        if (get_u64(t, sym(size), &result))
+            size = result;
+        if (get_u64(t, sym(batch), &result))
+            batch = result;
+        if (size == 0 || size > BUFLEN || batch <= 0 || batch > BENCH_MAX_BATCH) {
+            rprintf("invalid benchmark parameters\n");
+            exit(EXIT_FAILURE);
+        }
+        bench(lport, count, size, batch);
+        exit(EXIT_SUCCESS);
+    }
+
     int fd = socket(AF_INET, SOCK_DGRAM, 0);
     if (fd < 0)
 	fail("socket");
@@ -1,9 +1,11 @@
+#define _GNU_SOURCE
 #include <errno.h>
 #include <poll.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -309,12 +311,149 @@ static void uds_nonblocking_test(void)
     test_assert(unlink(SERVER_SOCKET_PATH) == 0);
 }
 
+static void uds_send_fds(int fd, int *fds, int nfds, char data)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        char buf[CMSG_SPACE(4 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct cmsghdr *cmsg;
+
+    iov.iov_base = &data;
+    iov.iov_len = 1;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    test_assert(sendmsg(fd, &msg, 0) == 1);
+}
+
+/* receives len bytes of data; returns the number of descriptors received */
+static int uds_recv_fds(int fd, int *fds, char *data, int len)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        char buf[CMSG_SPACE(4 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct cmsghdr *cmsg;
+
+    iov.iov_base = data;
+    iov.iov_len = 16;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    test_assert(recvmsg(fd, &msg, 0) == len);
+    test_assert(!(msg.msg_flags & MSG_CTRUNC));
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg)
+        return 0;
+    test_assert((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS));
+    int nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+    return nfds;
+}
+
+static void uds_rights_test(int type)
+{
+    int sv[2], pipefds[2], fds[4];
+    char buf[16];
+
+    test_assert(socketpair(AF_UNIX, type, 0, sv) == 0);
+    test_assert(pipe(pipefds) == 0);
+
+    /* the received descriptors refer to the same files */
+    uds_send_fds(sv[0], pipefds, 2, 'a');
+    test_assert(close(pipefds[0]) == 0);
+    test_assert(close(pipefds[1]) == 0);
+    test_assert(uds_recv_fds(sv[1], fds, buf, 1) == 2);
+    test_assert(buf[0] == 'a');
+    test_assert(write(fds[1], "pipe", 4) == 4);
+    test_assert(read(fds[0], buf, sizeof(buf)) == 4);
+    test_assert(!memcmp(buf, "pipe", 4));
+
+    test_assert(send(sv[0], "x", 1, 0) == 1);
+    uds_send_fds(sv[0], &fds[0], 1, 'b');
+    test_assert(send(sv[0], "y", 1, 0) == 1);
+    if (type == SOCK_STREAM) {
+        /* a read ends with the data sent along with descriptors */
+        test_assert(uds_recv_fds(sv[1], &fds[2], buf, 2) == 1);
+        test_assert(!memcmp(buf, "xb", 2));
+    } else {
+        test_assert((recv(sv[1], buf, sizeof(buf), 0) == 1) && (buf[0] == 'x'));
+        test_assert(uds_recv_fds(sv[1], &fds[2], buf, 1) == 1);
+        test_assert(buf[0] == 'b');
+    }
+    test_assert((recv(sv[1], buf, sizeof(buf), 0) == 1) && (buf[0] == 'y'));
+    test_assert(write(fds[1], "z", 1) == 1);
+    test_assert((read(fds[2], buf, sizeof(buf)) == 1) && (buf[0] == 'z'));
+
+    /* descriptors not received with recvmsg are discarded */
+    uds_send_fds(sv[0], &fds[1], 1, 'c');
+    test_assert((recv(sv[1], buf, sizeof(buf), 0) == 1) && (buf[0] == 'c'));
+
+    test_assert((send(sv[0], "bad", 3, 0) == 3) && (recv(sv[1], buf, 3, 0) == 3));
+    int badfd = 1000;
+    struct msghdr msg;
+    struct iovec iov = { .iov_base = buf, .iov_len = 1 };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &badfd, sizeof(int));
+    test_assert((sendmsg(sv[0], &msg, 0) == -1) && (errno == EBADF));
+
+    for (int i = 0; i < 3; i++)
+        test_assert(close(fds[i]) == 0);
+    test_assert(close(sv[0]) == 0);
+    test_assert(close(sv[1]) == 0);
+}
+
+static void uds_peercred_test(void)
+{
+    int sv[2];
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    test_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    test_assert(getsockopt(sv[0], SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0);
+    test_assert(len == sizeof(cred));
+    test_assert(cred.pid == getpid());
+    test_assert(cred.uid == getuid());
+    test_assert(cred.gid == getgid());
+    test_assert(close(sv[0]) == 0);
+    test_assert(close(sv[1]) == 0);
+}
+
 int main(int argc, char **argv)
 {
     setbuf(stdout, NULL);
     uds_stream_test();
     uds_dgram_test();
     uds_nonblocking_test();
+    uds_rights_test(SOCK_STREAM);
+    uds_rights_test(SOCK_DGRAM);
+    uds_peercred_test();
     printf("Unix domain socket tests OK\n");
     return EXIT_SUCCESS;
 }
@@ -398,6 +398,66 @@ static inline void timerspec_sub(struct timespec *a, struct timespec *b, struct
     }
 }
 
+/* overwrite within allocated extents, which fdatasync can commit without a log flush */
+static void datasync_test(void)
+{
+    int rv, fd;
+    char buf[BUFLEN];
+    ssize_t len = strlen(str);
+    fd = open("datasync_file", O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        perror("datasync_test: open");
+        exit(EXIT_FAILURE);
+    }
+    _WRITE(str, len);
+    if (fdatasync(fd) < 0) {
+        perror("datasync_test: fdatasync");
+        goto out_fail;
+    }
+    for (int i = 0; i < len; i++) {
+        _LSEEK(i, SEEK_SET);
+        _WRITE("x", 1);
+        if (fdatasync(fd) < 0) {
+            perror("datasync_test: fdatasync");
+            goto out_fail;
+        }
+    }
+    if (sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER) < 0) {
+        perror("datasync_test: sync_file_range");
+        goto out_fail;
+    }
+    if ((sync_file_range(fd, 0, 0, ~0) != -1) || (errno != EINVAL)) {
+        printf("datasync_test: sync_file_range with invalid flags did not fail with EINVAL\n");
+        goto out_fail;
+    }
+    if ((sync_file_range(fd, -1, 0, SYNC_FILE_RANGE_WRITE) != -1) || (errno != EINVAL)) {
+        printf("datasync_test: sync_file_range with negative offset did not fail with EINVAL\n");
+        goto out_fail;
+    }
+    _LSEEK(0, SEEK_SET);
+    _READ(buf, BUFLEN);
+    if (rv != len) {
+        printf("datasync_test: read %d bytes, expected %ld\n", rv, len);
+        goto out_fail;
+    }
+    for (int i = 0; i < len; i++) {
+        if (buf[i] != 'x') {
+            printf("datasync_test: mismatch at offset %d, read '%c'\n", i, buf[i]);
+            goto out_fail;
+        }
+    }
+    close(fd);
+    if (unlink("datasync_file") < 0) {
+        perror("datasync_test: unlink");
+        exit(EXIT_FAILURE);
+    }
+    return;
+  out_fail:
+    close(fd);
+    exit(EXIT_FAILURE);
+}
+
 #define BULK_WRITE_BUFLEN (64 << 10)
 
 static void print_op_stats(const char *op, struct timespec *start, struct timespec *end,
@@ -767,6 +827,7 @@ int main(int argc, char **argv)
         append_write_test();
         truncate_test(argv[0]);
         write_exec_test(argv[0]);
+        datasync_test();
         fs_stress_test();
     }
 
@@ -0,0 +1,116 @@
+#include <runtime.h>
+#include <stdlib.h>
+
+#define LZ4_TEST_MAX_LEN    (64 * KB)
+#define LZ4_TEST_BOUND(n)   ((n) + (n) / 255 + 16)
+
+#define test_assert(expr)   do { \
+    if (!(expr)) { \
+        msg_err("%s -- failed at %s:%d\n", #expr, __FILE__, __LINE__); \
+        exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+static u8 src[LZ4_TEST_MAX_LEN];
+static u8 comp[LZ4_TEST_BOUND(LZ4_TEST_MAX_LEN)];
+static u8 out[LZ4_TEST_MAX_LEN];
+static u8 workspace[LZ4_COMPRESS_WORKSPACE];
+
+/* returns the compressed length */
+static bytes test_roundtrip(bytes len)
+{
+    bytes clen = lz4_compress(comp, sizeof(comp), src, len, workspace);
+    test_assert(clen > 0);
+    test_assert(clen <= LZ4_TEST_BOUND(len));
+    runtime_memset(out, 0xa5, sizeof(out));
+    test_assert(lz4_decompress(out, sizeof(out), comp, clen) == len);
+    test_assert(runtime_memcmp(src, out, len) == 0);
+    return clen;
+}
+
+static void fill_random(bytes len)
+{
+    for (bytes i = 0; i < len; i += sizeof(u64)) {
+        u64 r = random_u64();
+        runtime_memcpy(src + i, &r, MIN(sizeof(r), len - i));
+    }
+}
+
+static void test_short(void)
+{
+    for (bytes len = 0; len <= 32; len++) {
+        runtime_memset(src, 'a', len);
+        test_roundtrip(len);
+        fill_random(len);
+        test_roundtrip(len);
+    }
+}
+
+static void test_zeros(void)
+{
+    zero(src, LZ4_TEST_MAX_LEN);
+    test_assert(test_roundtrip(LZ4_TEST_MAX_LEN) < LZ4_TEST_MAX_LEN / 200);
+}
+
+static void test_text(void)
+{
+    const char *words[] = {"unikernel ", "page cache ", "extent ", "cluster ", "tfs\n"};
+    bytes len = 0;
+    for (int i = 0; len < LZ4_TEST_MAX_LEN; i++) {
+        const char *w = words[(i * 7 + i / 3) % (sizeof(words) / sizeof(words[0]))];
+        bytes n = MIN(runtime_strlen(w), LZ4_TEST_MAX_LEN - len);
+        runtime_memcpy(src + len, w, n);
+        len += n;
+    }
+    test_assert(test_roundtrip(LZ4_TEST_MAX_LEN) < LZ4_TEST_MAX_LEN / 4);
+}
+
+/* matches that overlap their own output, with offsets shorter than the match */
+static void test_overlap(void)
+{
+    for (int period = 1; period <= 9; period++) {
+        for (bytes i = 0; i < 4096; i++)
+            src[i] = i % period;
+        test_roundtrip(4096);
+    }
+}
+
+static void test_incompressible(void)
+{
+    fill_random(LZ4_TEST_MAX_LEN);
+    test_roundtrip(LZ4_TEST_MAX_LEN);
+
+    /* does not fit in fewer bytes than the input */
+    test_assert(lz4_compress(comp, LZ4_TEST_MAX_LEN - 512, src, LZ4_TEST_MAX_LEN,
+                             workspace) == 0);
+}
+
+static void test_malformed(void)
+{
+    zero(src, 4096);
+    bytes clen = lz4_compress(comp, sizeof(comp), src, 4096, workspace);
+    test_assert(clen > 0);
+
+    /* output buffer too small */
+    test_assert(lz4_decompress(out, 4095, comp, clen) == -1);
+
+    /* truncated input */
+    for (bytes len = 1; len < clen; len++)
+        test_assert(lz4_decompress(out, sizeof(out), comp, len) != 4096);
+
+    /* offset pointing before the start of the output */
+    u8 bad[] = {0x10, 'x', 0x02, 0x00};
+    test_assert(lz4_decompress(out, sizeof(out), bad, sizeof(bad)) == -1);
+}
+
+int main(int argc, char *argv[])
+{
+    init_process_runtime();
+    test_short();
+    test_zeros();
+    test_text();
+    test_overlap();
+    test_incompressible();
+    test_malformed();
+    return 0;
+}
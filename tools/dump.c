@@ -14,6 +14,10 @@
 #include <log.h>
 
 #define DUMP_OPT_TREE  (1U << 0)
+#define DUMP_OPT_STATS (1U << 1)
+#define DUMP_OPT_FRAG  (1U << 2)
+
+#define FRAG_WORST_FILES    10
 
 #define TERM_COLOR_BLUE     94
 #define TERM_COLOR_CYAN     96
@@ -28,10 +32,16 @@ closure_function(2, 3, void, bread,
     u64 length = range_span(blocks) << SECTOR_OFFSET;
     while (total < length) {
         xfer = pread(bound(d), dest + total, length - total, offset + total);
-        if (xfer < 0 && errno != EINTR) {
+        if (xfer < 0) {
+            if (errno == EINTR)
+                continue;
             apply(c, timm("read-error", "%s", strerror(errno)));
             return;
         }
+        if (xfer == 0) {
+            apply(c, timm("read-error", "read past end of image"));
+            return;
+        }
         total += xfer;
     }
     apply(c, STATUS_OK);
@@ -128,6 +138,147 @@ static void dump_fsentry(int indent, symbol name, tuple t)
         print_colored(indent, TERM_COLOR_WHITE, name, true);
 }
 
+struct frag_extent {
+    u64 file_offset;
+    u64 start_block;
+};
+
+struct frag_file {
+    buffer path;
+    u64 extents;
+    u64 breaks;     /* physical discontinuities between consecutive extents */
+};
+
+typedef struct frag_stats {
+    heap h;
+    u64 files;
+    u64 extents;
+    u64 fragmented;
+    struct frag_file worst[FRAG_WORST_FILES];
+    struct frag_extent *ex;
+    u64 ex_count;
+    u64 ex_size;
+} *frag_stats;
+
+closure_function(1, 2, boolean, frag_each_extent,
+                 frag_stats, fst,
+                 value, k, value, v)
+{
+    frag_stats fst = bound(fst);
+    u64 file_offset, start_block;
+    assert(is_symbol(k));
+    if (!is_tuple(v) || !parse_int(alloca_wrap(symbol_string(k)), 10, &file_offset) ||
+        !get_u64(v, sym(offset), &start_block))
+        return true;
+    if (fst->ex_count == fst->ex_size) {
+        fst->ex_size = fst->ex_size ? 2 * fst->ex_size : 64;
+        fst->ex = realloc(fst->ex, fst->ex_size * sizeof(*fst->ex));
+        if (!fst->ex) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    fst->ex[fst->ex_count].file_offset = file_offset;
+    fst->ex[fst->ex_count].start_block = start_block;
+    fst->ex_count++;
+    return true;
+}
+
+static int frag_extent_compare(const void *a, const void *b)
+{
+    const struct frag_extent *x = a, *y = b;
+    return x->file_offset < y->file_offset ? -1 : x->file_offset > y->file_offset;
+}
+
+static void frag_file(frag_stats fst, tuple extents, buffer path)
+{
+    fst->ex_count = 0;
+    iterate(extents, stack_closure(frag_each_extent, fst));
+    fst->files++;
+    fst->extents += fst->ex_count;
+    qsort(fst->ex, fst->ex_count, sizeof(*fst->ex), frag_extent_compare);
+    u64 breaks = 0;
+    for (u64 i = 1; i < fst->ex_count; i++) {
+        struct frag_extent *prev = &fst->ex[i - 1], *cur = &fst->ex[i];
+        if (prev->start_block + (cur->file_offset - prev->file_offset) != cur->start_block)
+            breaks++;
+    }
+    if (breaks == 0)
+        return;
+    fst->fragmented++;
+    if (fst->worst[FRAG_WORST_FILES - 1].path &&
+        (fst->worst[FRAG_WORST_FILES - 1].breaks < breaks))
+        deallocate_buffer(fst->worst[FRAG_WORST_FILES - 1].path);
+    int i = FRAG_WORST_FILES;
+    while ((i > 0) && (!fst->worst[i - 1].path || (fst->worst[i - 1].breaks < breaks))) {
+        if (i < FRAG_WORST_FILES)
+            fst->worst[i] = fst->worst[i - 1];
+        i--;
+    }
+    if (i < FRAG_WORST_FILES) {
+        fst->worst[i].path = path;
+        fst->worst[i].extents = fst->ex_count;
+        fst->worst[i].breaks = breaks;
+    }
+}
+
+static void frag_walk(frag_stats fst, tuple t, buffer path);
+
+closure_function(2, 2, boolean, frag_walk_each,
+                 frag_stats, fst, buffer, path,
+                 value, k, value, v)
+{
+    assert(is_symbol(k));
+    if (k == sym_this(".") || k == sym_this("..") || !is_tuple(v))
+        return true;
+    frag_stats fst = bound(fst);
+    buffer path = aprintf(fst->h, "%b/%b", bound(path), symbol_string(k));
+    frag_walk(fst, (tuple)v, path);
+    /* paths of the most fragmented files are kept for the report */
+    for (int i = 0; i < FRAG_WORST_FILES; i++) {
+        if (fst->worst[i].path == path)
+            return true;
+    }
+    deallocate_buffer(path);
+    return true;
+}
+
+static void frag_walk(frag_stats fst, tuple t, buffer path)
+{
+    tuple c = children(t);
+    if (c) {
+        iterate(c, stack_closure(frag_walk_each, fst, path));
+        return;
+    }
+    tuple extents = get_tuple(t, sym(extents));
+    if (extents)
+        frag_file(fst, extents, path);
+}
+
+/* Report how many extents files are split into and how many of those are not
+   physically contiguous on disk. */
+static void dump_fragmentation(heap h, tuple root)
+{
+    struct frag_stats fst;
+    zero(&fst, sizeof(fst));
+    fst.h = h;
+    buffer path = aprintf(h, "");
+    frag_walk(&fst, root, path);
+    deallocate_buffer(path);
+    rprintf("files: %ld\nextents: %ld\n", fst.files, fst.extents);
+    if (fst.files) {
+        u64 avg = fst.extents * 100 / fst.files;
+        rprintf("extents per file: %ld.%02ld\n", avg / 100, avg % 100);
+    }
+    rprintf("fragmented files: %ld\n", fst.fragmented);
+    for (int i = 0; i < FRAG_WORST_FILES && fst.worst[i].path; i++)
+        rprintf("  %b: %ld extents, %ld discontiguous\n", fst.worst[i].path,
+                fst.worst[i].extents, fst.worst[i].breaks);
+    for (int i = 0; i < FRAG_WORST_FILES && fst.worst[i].path; i++)
+        deallocate_buffer(fst.worst[i].path);
+    free(fst.ex);
+}
+
 closure_function(3, 2, void, fsc,
                  heap, h, buffer, b, unsigned int, options,
                  filesystem, fs, status, s)
@@ -160,6 +311,16 @@ closure_function(3, 2, void, fsc,
     if (options & DUMP_OPT_TREE)
         dump_fsentry(0, sym_this("/"), root);
 
+    if (options & DUMP_OPT_STATS) {
+        tfs_mount_stats ms = filesystem_get_mount_stats(fs);
+        rprintf("log extensions: %ld\nlog bytes: %ld\nlog entries: %ld\n"
+                "log read time: %T\nmount time: %T\n", ms->log_extensions,
+                ms->log_bytes, ms->log_entries, ms->read_time, ms->total_time);
+    }
+
+    if (options & DUMP_OPT_FRAG)
+        dump_fragmentation(h, root);
+
     closure_finish();
 }
 
@@ -235,6 +396,8 @@ static void usage(const char *prog)
             "<fs image> into <target dir>\n");
     fprintf(stderr, "  -t\t\t\tDisplay filesystem from <fs image> as a tree\n");
     fprintf(stderr, "  -l\t\t\tDisplay contents of crash log\n");
+    fprintf(stderr, "  -s\t\t\tDisplay statistics of the metadata log read\n");
+    fprintf(stderr, "  -f\t\t\tDisplay file fragmentation report\n");
     exit(EXIT_FAILURE);
 }
 
@@ -245,7 +408,7 @@ int main(int argc, char **argv)
     unsigned int options = 0;
     boolean print_klog = false;
 
-    while ((c = getopt(argc, argv, "d:tl")) != EOF) {
+    while ((c = getopt(argc, argv, "d:tlsf")) != EOF) {
         switch (c) {
         case 'd':
             target_dir = alloca_wrap_buffer(optarg, runtime_strlen(optarg));
@@ -256,6 +419,12 @@ int main(int argc, char **argv)
         case 'l':
             print_klog = true;
             break;
+        case 's':
+            options |= DUMP_OPT_STATS;
+            break;
+        case 'f':
+            options |= DUMP_OPT_FRAG;
+            break;
         default:
             usage(argv[0]);
         }
@@ -325,8 +325,18 @@ closure_function(0, 2, void, mkfs_write_handler,
     }
 }
 
-closure_function(4, 2, void, fsc,
-                 heap, h, descriptor, out, tuple, root, const char *, target_root,
+closure_function(0, 1, void, mkfs_write_clusters_handler,
+                 status, s)
+{
+    if (!is_ok(s)) {
+        rprintf("file write failed with %v\n", s);
+        exit(1);
+    }
+    closure_finish();
+}
+
+closure_function(5, 2, void, fsc,
+                 heap, h, descriptor, out, tuple, root, const char *, target_root, u64, write_flags,
                  filesystem, fs, status, s)
 {
     tuple root = bound(root);
@@ -357,8 +367,12 @@ closure_function(4, 2, void, fsc,
         if (contents) {
             if (buffer_length(contents) > 0) {
                 fsfile fsf = allocate_fsfile(fs, f);
-                filesystem_write_linear(fsf, buffer_ref(contents, 0), irangel(0, buffer_length(contents)),
-                                        ignore_io_status);
+                if (bound(write_flags))
+                    filesystem_write_clusters(fsf, buffer_ref(contents, 0), buffer_length(contents),
+                                              bound(write_flags), closure(h, mkfs_write_clusters_handler));
+                else
+                    filesystem_write_linear(fsf, buffer_ref(contents, 0), irangel(0, buffer_length(contents)),
+                                            ignore_io_status);
                 deallocate_buffer(contents);
             } else {
                 if (!off)
@@ -523,7 +537,11 @@ static void usage(const char *program_name)
            "-s image-size	- specify minimum image file size; can be expressed"
            " in bytes, KB (with k or K suffix), MB (with m or M suffix), and GB"
            " (with g or G suffix)\n"
-           "-e              - create empty filesystem\n",
+           "-e              - create empty filesystem\n"
+           "-d              - store identical clusters of file data in the root filesystem"
+           " only once\n"
+           "-z              - compress the contents of files in the root filesystem"
+           " (compressed files are read-only)\n",
            p, p);
 }
 
@@ -565,12 +583,19 @@ int main(int argc, char **argv)
     long long img_size = 0;
     boolean empty_fs = false;
     const char *uefi_loader = NULL;
+    u64 write_flags = 0;
 
-    while ((c = getopt(argc, argv, "eb:k:l:r:s:u:")) != EOF) {
+    while ((c = getopt(argc, argv, "deb:k:l:r:s:u:z")) != EOF) {
         switch (c) {
         case 'e':
             empty_fs = true;
             break;
+        case 'd':
+            write_flags |= TFS_WRITE_DEDUP;
+            break;
+        case 'z':
+            write_flags |= TFS_WRITE_COMPRESS;
+            break;
         case 'b':
             bootimg_path = optarg;
             break;
@@ -707,7 +732,7 @@ int main(int argc, char **argv)
             create_filesystem(h, SECTOR_SIZE, BOOTFS_SIZE, 0 /* no read */,
                               closure(h, bwrite, out, offset),
                               0 /* no flush */,
-                              "", closure(h, fsc, h, out, boot, target_root));
+                              "", closure(h, fsc, h, out, boot, target_root, 0));
             offset += BOOTFS_SIZE;
 
             /* Remove tuple from root, so it doesn't end up in the root FS. */
@@ -724,7 +749,7 @@ int main(int argc, char **argv)
                       closure(h, bwrite, out, offset),
                       0, /* no flush */
                       label,
-                      closure(h, fsc, h, out, root, target_root));
+                      closure(h, fsc, h, out, root, target_root, write_flags));
 
     off_t current_size = lseek(out, 0, SEEK_END);
     if (current_size < 0) {